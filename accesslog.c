@@ -0,0 +1,380 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a structured access log: one record per request, queued in a ring
+ * buffer shared by all motsognir processes and written out in batches.
+ *
+ * Every request is served by its own process, which formats its record once
+ * the request is over and pushes it into a ring buffer mapped with
+ * MAP_SHARED. The ring is a bounded multi-producer queue (after Dmitry
+ * Vyukov's design): every slot carries a sequence number telling whether it
+ * is free for a given lap, or holds a published record. Producers claim
+ * slots with a compare-and-swap on the head counter, so no process ever
+ * waits on another one, and a full ring drops records (and counts them)
+ * instead of blocking requests.
+ *
+ * The only consumer is the process that accepts connections: it drains the
+ * ring in batches (a single write() for a file, or one syslog() call per
+ * record), so request processes never format syslog messages nor wait on
+ * syslogd or on the disk.
+ */
+
+#include <fcntl.h>       /* open() */
+#include <stdint.h>
+#include <stdio.h>       /* snprintf() */
+#include <stdlib.h>      /* calloc(), free() */
+#include <string.h>      /* memcpy(), strcmp() */
+#include <syslog.h>
+#include <time.h>        /* clock_gettime(), gmtime_r() */
+#include <unistd.h>      /* write(), getpid() */
+#include <sys/mman.h>    /* mmap() */
+#include <sys/types.h>
+
+#include "accesslog.h"   /* include self for control */
+
+#define ACCESSLOG_SLOTS 1024  /* must be a power of 2 */
+#define ACCESSLOG_RECLEN 504  /* slots are 512 bytes */
+#define ACCESSLOG_STUCK 2     /* seconds after which a slot claimed but never published is given up */
+#define STATUS_ERROR 5        /* index of "error" in statusnames */
+
+struct logslot {
+  volatile uint32_t seq;  /* pos: free for the producer of pos, pos + 1: holds the record of pos */
+  uint32_t len;
+  char rec[ACCESSLOG_RECLEN];
+};
+
+struct loghdr {
+  volatile uint32_t head;      /* position of the next slot to be claimed */
+  volatile uint32_t dropped;   /* records dropped because the ring was full */
+  volatile uint32_t requests;  /* successful requests seen, for sampling */
+  uint32_t reserved[13];       /* pads the header to 64 bytes */
+};
+
+struct accesslog_t {
+  struct loghdr *hdr;
+  struct logslot *slots;
+  int fd;            /* the log file, or -1 for syslog */
+  int sampling;
+  /* fields below are used only by the consumer */
+  uint32_t tail;     /* position of the next record to be written out */
+  time_t lastflush;
+  uint32_t stucktail;
+  time_t stucksince;  /* 0 if the ring is not stuck */
+};
+
+/* the request served by the current process */
+static struct {
+  struct accesslog_t *log;
+  struct accesslog_t *slowlog;
+  long slowus;       /* threshold of the slow log */
+  pid_t pid;         /* 0 once the record is complete */
+  struct timespec start;
+  long phases[ACCESSLOG_PHASES];  /* in us since the start, -1 if not reached */
+  char client[64];
+  char selector[384];
+  char type;
+  const char *status;
+  long bytes;
+} cur;
+
+static const char *phasenames[ACCESSLOG_PHASES] = {"selector", "parsed", "evasion", "resolved", "firstbyte", "lastbyte"};
+
+/* statuses set with accesslog_setstatus(), numbered by accesslog_getstatusid() */
+static const char *statusnames[] = {"ok", "partial", "aborted", "badrange", "badrequest", "error", "forbidden", "http", "notfound", NULL};
+
+
+static time_t monotonicsecs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec);
+}
+
+
+struct accesslog_t *accesslog_open(const char *target, int sampling) {
+  struct accesslog_t *obj;
+  size_t maplen = sizeof(struct loghdr) + ACCESSLOG_SLOTS * sizeof(struct logslot);
+  void *map;
+  uint32_t x;
+  obj = calloc(1, sizeof(struct accesslog_t));
+  if (obj == NULL) return(NULL);
+  obj->fd = -1;
+  if (strcmp(target, "syslog") != 0) {
+    obj->fd = open(target, O_WRONLY | O_APPEND | O_CREAT, 0640);
+    if (obj->fd < 0) {
+      free(obj);
+      return(NULL);
+    }
+    fcntl(obj->fd, F_SETFD, FD_CLOEXEC); /* not for server-side apps */
+  }
+  map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+  if (map == MAP_FAILED) {
+    if (obj->fd >= 0) close(obj->fd);
+    free(obj);
+    return(NULL);
+  }
+  memset(map, 0, maplen);
+  obj->hdr = map;
+  obj->slots = (struct logslot *)((char *)map + sizeof(struct loghdr));
+  for (x = 0; x < ACCESSLOG_SLOTS; x++) obj->slots[x].seq = x;
+  obj->sampling = (sampling < 1) ? 1 : sampling;
+  obj->lastflush = monotonicsecs();
+  return(obj);
+}
+
+
+/* pushes a record into the ring. returns 0 on success, non-zero if the ring
+ * is full */
+static int push(struct accesslog_t *obj, const char *rec, int len) {
+  struct logslot *slot;
+  uint32_t pos;
+  int32_t diff;
+  for (;;) {
+    pos = obj->hdr->head;
+    slot = &(obj->slots[pos & (ACCESSLOG_SLOTS - 1)]);
+    diff = (int32_t)(slot->seq - pos);
+    if (diff == 0) {
+      if (__sync_bool_compare_and_swap(&(obj->hdr->head), pos, pos + 1)) break;
+    } else if (diff < 0) { /* the slot still holds the record of the previous lap */
+      __sync_fetch_and_add(&(obj->hdr->dropped), 1);
+      return(-1);
+    }
+    /* otherwise another process claimed this position first: try again */
+  }
+  memcpy(slot->rec, rec, len);
+  slot->len = len;
+  __sync_synchronize();
+  /* publish the record (this fails only if the consumer gave up waiting) */
+  __sync_bool_compare_and_swap(&(slot->seq), pos, pos + 1);
+  return(0);
+}
+
+
+/* writes a record out, through a batch buffer for files */
+static void emit(struct accesslog_t *obj, char *batch, int *batchlen, int batchsize, const char *rec, int len) {
+  if (obj->fd < 0) {
+    syslog(LOG_NOTICE, "%.*s", len, rec);
+    return;
+  }
+  if (*batchlen + len + 1 > batchsize) {
+    if (write(obj->fd, batch, *batchlen) < 0) syslog(LOG_WARNING, "WARNING: failed to write the access log");
+    *batchlen = 0;
+  }
+  memcpy(batch + *batchlen, rec, len);
+  batch[*batchlen + len] = '\n';
+  *batchlen += len + 1;
+}
+
+
+void accesslog_flush(struct accesslog_t *obj) {
+  char batch[64 * 1024];
+  char rec[64];
+  int batchlen = 0, ready = 0;
+  uint32_t t, dropped;
+  time_t now;
+  if (obj == NULL) return;
+  now = monotonicsecs();
+  /* wait for a full batch, but not more than a second */
+  for (t = obj->tail; (ready < ACCESSLOG_BATCH) && (obj->slots[t & (ACCESSLOG_SLOTS - 1)].seq == t + 1); t++) ready++;
+  if ((ready < ACCESSLOG_BATCH) && (now - obj->lastflush < 1)) return;
+  obj->lastflush = now;
+  dropped = obj->hdr->dropped;
+  if ((obj->hdr->head == obj->tail) && (dropped == 0)) return;
+
+  for (;;) {
+    struct logslot *slot = &(obj->slots[obj->tail & (ACCESSLOG_SLOTS - 1)]);
+    uint32_t seq = slot->seq;
+    if (seq == obj->tail + 1) { /* published */
+      __sync_synchronize();
+      emit(obj, batch, &batchlen, sizeof(batch), slot->rec, (slot->len > ACCESSLOG_RECLEN) ? ACCESSLOG_RECLEN : slot->len);
+      __sync_synchronize();
+      slot->seq = obj->tail + ACCESSLOG_SLOTS; /* free for the next lap */
+      obj->tail++;
+      obj->stucksince = 0;
+      continue;
+    }
+    if ((seq != obj->tail) || (obj->hdr->head == obj->tail)) break; /* nothing more */
+    /* the slot is claimed but its record is not published yet. a process
+     * that got killed at the wrong moment would block the ring forever, so
+     * such slots are given up after a while */
+    if ((obj->stucksince == 0) || (obj->stucktail != obj->tail)) {
+      obj->stucktail = obj->tail;
+      obj->stucksince = now + 1; /* never 0 */
+      break;
+    }
+    if (now + 1 - obj->stucksince < ACCESSLOG_STUCK) break;
+    if (__sync_bool_compare_and_swap(&(slot->seq), obj->tail, obj->tail + ACCESSLOG_SLOTS)) {
+      __sync_fetch_and_add(&(obj->hdr->dropped), 1);
+      obj->tail++;
+      obj->stucksince = 0;
+    }
+  }
+
+  dropped = obj->hdr->dropped;
+  if (dropped != 0) {
+    __sync_fetch_and_sub(&(obj->hdr->dropped), dropped);
+    emit(obj, batch, &batchlen, sizeof(batch), rec, snprintf(rec, sizeof(rec), "accesslog: %lu records dropped", (unsigned long)dropped));
+  }
+  if ((batchlen > 0) && (write(obj->fd, batch, batchlen) < 0)) syslog(LOG_WARNING, "WARNING: failed to write the access log");
+}
+
+
+/* returns the time elapsed since the start of the request, in us */
+static long elapsed(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return((now.tv_sec - cur.start.tv_sec) * 1000000L + (now.tv_nsec - cur.start.tv_nsec) / 1000);
+}
+
+
+void accesslog_begin(struct accesslog_t *obj, struct accesslog_t *slowlog, long slowms, const char *client, const struct timespec *start) {
+  int x;
+  /* the request is tracked even with no log at all, for the scoreboard */
+  cur.log = obj;
+  cur.slowlog = slowlog;
+  cur.slowus = slowms * 1000;
+  cur.pid = getpid();
+  if (start != NULL) {
+    cur.start = *start;
+  } else {
+    clock_gettime(CLOCK_MONOTONIC, &(cur.start));
+  }
+  for (x = 0; x < ACCESSLOG_PHASES; x++) cur.phases[x] = -1;
+  snprintf(cur.client, sizeof(cur.client), "%s", client);
+  cur.selector[0] = 0;
+  cur.type = '-';
+  cur.status = "ok";
+  cur.bytes = 0;
+}
+
+
+void accesslog_setselector(const char *selector) {
+  if ((cur.log == NULL) && (cur.slowlog == NULL)) return;
+  snprintf(cur.selector, sizeof(cur.selector), "%s", selector);
+}
+
+
+void accesslog_settype(char type) {
+  cur.type = type;
+}
+
+
+void accesslog_setstatus(const char *status) {
+  cur.status = status;
+}
+
+
+char accesslog_gettype(void) {
+  return(cur.type);
+}
+
+
+const char *accesslog_getstatus(void) {
+  return(cur.status);
+}
+
+
+int accesslog_getstatusid(void) {
+  int x;
+  for (x = 0; statusnames[x] != NULL; x++) {
+    if ((cur.status != NULL) && (strcmp(cur.status, statusnames[x]) == 0)) return(x);
+  }
+  return(STATUS_ERROR); /* unknown status */
+}
+
+
+void accesslog_setstatusid(int id) {
+  if ((id < 0) || (id >= (int)(sizeof(statusnames) / sizeof(statusnames[0])) - 1)) id = STATUS_ERROR;
+  cur.status = statusnames[id];
+}
+
+
+void accesslog_phase(int phase) {
+  if ((cur.pid == 0) || (phase < 0) || (phase >= ACCESSLOG_PHASES) || (cur.phases[phase] >= 0)) return;
+  cur.phases[phase] = elapsed();
+}
+
+
+void accesslog_addbytes(long bytes) {
+  if ((bytes <= 0) || (cur.pid == 0)) return;
+  cur.bytes += bytes;
+  cur.phases[ACCESSLOG_LASTBYTE] = elapsed();
+  if (cur.phases[ACCESSLOG_FIRSTBYTE] < 0) cur.phases[ACCESSLOG_FIRSTBYTE] = cur.phases[ACCESSLOG_LASTBYTE];
+}
+
+
+long accesslog_getbytes(void) {
+  return(cur.bytes);
+}
+
+
+const char *accesslog_phasename(int phase) {
+  if ((phase < 0) || (phase >= ACCESSLOG_PHASES)) return("?");
+  return(phasenames[phase]);
+}
+
+
+long accesslog_getphase(int phase) {
+  if ((phase < 0) || (phase >= ACCESSLOG_PHASES)) return(-1);
+  return(cur.phases[phase]);
+}
+
+
+int accesslog_failed(void) {
+  if (cur.status == NULL) return(0);
+  return((strcmp(cur.status, "ok") != 0) && (strcmp(cur.status, "partial") != 0));
+}
+
+
+/* formats the record of the current request, with the breakdown of its
+ * phases if withphases is non-zero. returns its length */
+static int formatrecord(char *rec, int recsize, long duration, int withphases) {
+  static const char *hexdigits = "0123456789ABCDEF";
+  char timestamp[32];
+  struct tm tm;
+  time_t t;
+  int len, x;
+  t = time(NULL);
+  gmtime_r(&t, &tm);
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+  len = snprintf(rec, recsize, "%s client=%s type=%c status=%s bytes=%ld ms=%ld.%03ld", timestamp, cur.client, cur.type, cur.status, cur.bytes, duration / 1000, duration % 1000);
+  if (withphases != 0) { /* ms since the connection was accepted, for every phase reached */
+    for (x = 0; (x < ACCESSLOG_PHASES) && (len < recsize - 64); x++) {
+      if (cur.phases[x] < 0) continue;
+      len += snprintf(rec + len, recsize - len, " %s=%ld.%03ld", phasenames[x], cur.phases[x] / 1000, cur.phases[x] % 1000);
+    }
+  }
+  len += snprintf(rec + len, recsize - len, " selector=\"");
+  /* the selector is quoted, with control chars, quotes and backslashes
+   * escaped as \xHH, and cut if it does not fit */
+  for (x = 0; (cur.selector[x] != 0) && (len < recsize - 6); x++) {
+    unsigned char c = cur.selector[x];
+    if ((c < 0x20) || (c == 0x7F) || (c == '"') || (c == '\\')) {
+      rec[len++] = '\\';
+      rec[len++] = 'x';
+      rec[len++] = hexdigits[c >> 4];
+      rec[len++] = hexdigits[c & 15];
+    } else {
+      rec[len++] = c;
+    }
+  }
+  rec[len++] = '"';
+  return(len);
+}
+
+
+void accesslog_end(void) {
+  char rec[ACCESSLOG_RECLEN];
+  long duration;
+  if ((cur.pid == 0) || (cur.pid != getpid())) return;
+  cur.pid = 0; /* queue the record only once */
+  duration = elapsed();
+  /* requests that took too long go to the slow log, with all details */
+  if ((cur.slowlog != NULL) && (duration >= cur.slowus)) push(cur.slowlog, rec, formatrecord(rec, sizeof(rec), duration, 1));
+  if (cur.log == NULL) return;
+  /* only a sample of successful requests is logged, if so configured */
+  if ((cur.log->sampling > 1) && (accesslog_failed() == 0)) {
+    if (__sync_fetch_and_add(&(cur.log->hdr->requests), 1) % cur.log->sampling != 0) return;
+  }
+  push(cur.log, rec, formatrecord(rec, sizeof(rec), duration, 0));
+}
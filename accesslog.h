@@ -0,0 +1,99 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a structured access log: one record per request, queued in a ring
+ * buffer shared by all motsognir processes and written out in batches
+ */
+
+#ifndef accesslog_h_sentinel
+#define accesslog_h_sentinel
+
+#include <time.h>
+
+struct accesslog_t;
+
+/* creates the ring buffer shared with all the processes forked afterwards.
+ * target is either a file (opened in append mode) or "syslog". only one
+ * successful request ("ok" or "partial" status) out of every 'sampling' is
+ * logged, failed requests are always logged. returns NULL on error */
+struct accesslog_t *accesslog_open(const char *target, int sampling);
+
+/* writes out the records queued so far, in a single batch. this is meant to
+ * be called regularly by the process that accepts connections (and only by
+ * it), at least every second: records are written once ACCESSLOG_BATCH of
+ * them are ready, or once the oldest one waits for a second */
+void accesslog_flush(struct accesslog_t *obj);
+
+#define ACCESSLOG_BATCH 64
+
+/* phases of a request, timed since the connection was accepted */
+#define ACCESSLOG_SELECTOR  0  /* selector received */
+#define ACCESSLOG_PARSED    1  /* selector parsed and validated */
+#define ACCESSLOG_EVASION   2  /* evasion check done */
+#define ACCESSLOG_RESOLVED  3  /* resource resolved, about to be served */
+#define ACCESSLOG_FIRSTBYTE 4  /* first byte sent (set by accesslog_addbytes()) */
+#define ACCESSLOG_LASTBYTE  5  /* last byte sent (set by accesslog_addbytes()) */
+#define ACCESSLOG_PHASES    6
+
+/* the functions below describe the request served by the current process */
+
+/* starts the record of the current request, and its timer. obj and slowlog
+ * may be NULL (the request is then tracked for the scoreboard only).
+ * requests that take slowms or more go to the slow log, with the breakdown
+ * of their phases. phases are timed since start, the CLOCK_MONOTONIC time
+ * the connection was accepted, or since now if start is NULL */
+void accesslog_begin(struct accesslog_t *obj, struct accesslog_t *slowlog, long slowms, const char *client, const struct timespec *start);
+
+/* sets the selector of the current request */
+void accesslog_setselector(const char *selector);
+
+/* sets the gopher type of the answer ('-' if unknown or dynamic, the default) */
+void accesslog_settype(char type);
+
+/* sets the status of the current request ("ok" by default). status must be
+ * a static string */
+void accesslog_setstatus(const char *status);
+
+/* returns the gopher type of the current request */
+char accesslog_gettype(void);
+
+/* returns the status of the current request */
+const char *accesslog_getstatus(void);
+
+/* returns the status of the current request as a number, for another
+ * process to set it with accesslog_setstatusid() (statuses are static
+ * strings, whose addresses mean nothing to other programs) */
+int accesslog_getstatusid(void);
+
+/* sets the status of the current request from a number returned by
+ * accesslog_getstatusid() */
+void accesslog_setstatusid(int id);
+
+/* marks the time a phase is reached (only the first call counts) */
+void accesslog_phase(int phase);
+
+/* accounts bytes sent to the client */
+void accesslog_addbytes(long bytes);
+
+/* returns the amount of bytes sent to the client so far */
+long accesslog_getbytes(void);
+
+/* returns the time a phase was reached, in us since the connection was
+ * accepted, or -1 if it was not reached */
+long accesslog_getphase(int phase);
+
+/* returns the name of a phase */
+const char *accesslog_phasename(int phase);
+
+/* returns non-zero if the status of the current request is a failure (not
+ * "ok" nor "partial") */
+int accesslog_failed(void);
+
+/* completes the record and queues it. only the first call, made by the
+ * process that called accesslog_begin(), does anything, so this can be set
+ * up with atexit(). a process may serve several requests by calling
+ * accesslog_begin() again afterwards */
+void accesslog_end(void);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a per-request memory arena, and a pool of I/O buffers.
+ *
+ * The arena is a bump allocator over a list of chunks: allocations made
+ * while serving a request (paths, gophermap lines...) cost a pointer
+ * increment, and are all released at once when the request is over.
+ *
+ * I/O buffers (used to stream files and menus to sockets) are of a fixed,
+ * moderate size: bigger buffers barely reduce the amount of system calls,
+ * while every process would pay for them. They are made smaller still if the
+ * socket's send buffer is smaller, as anything beyond would only wait in user
+ * space while the kernel drains the socket. Released buffers are kept in a small
+ * pool, so a request that streams several things in a row (gophermap lines,
+ * then a directory listing, then another file...) keeps reusing the same
+ * memory instead of touching fresh pages every time.
+ */
+
+#include <stdlib.h>      /* malloc(), free() */
+#include <string.h>      /* memcpy(), strlen() */
+#include <sys/socket.h>  /* getsockopt() */
+#include <sys/types.h>
+
+#include "arena.h"       /* include self for control */
+
+#define ARENA_CHUNK (16 * 1024)  /* default chunk size, bigger allocations get a chunk of their own */
+#define ARENA_ALIGN 16
+
+#define IOBUF_MIN (16 * 1024)
+#define IOBUF_DEFAULT (64 * 1024)
+#define IOBUF_POOLMAX 4  /* buffers kept for reuse, any more are freed */
+
+struct arenachunk {
+  struct arenachunk *next;
+  size_t size;
+  size_t used;
+  /* data follows, ARENA_ALIGN-aligned */
+};
+
+struct arena_t {
+  struct arenachunk *chunks;  /* the current chunk is the first of the list */
+  struct arenachunk *first;   /* the chunk allocated with the arena, kept on reset */
+};
+
+static size_t iobufsize = IOBUF_DEFAULT;
+static void *iobufpool[IOBUF_POOLMAX];
+static int iobufpoolcount = 0;
+
+
+#define CHUNKHDR ((sizeof(struct arenachunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static struct arenachunk *newchunk(size_t size) {
+  struct arenachunk *chunk;
+  chunk = malloc(CHUNKHDR + size);
+  if (chunk == NULL) return(NULL);
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  return(chunk);
+}
+
+
+struct arena_t *arena_new(void) {
+  struct arena_t *obj;
+  obj = malloc(sizeof(struct arena_t));
+  if (obj == NULL) return(NULL);
+  obj->chunks = newchunk(ARENA_CHUNK);
+  if (obj->chunks == NULL) {
+    free(obj);
+    return(NULL);
+  }
+  obj->first = obj->chunks;
+  return(obj);
+}
+
+
+void *arena_alloc(struct arena_t *obj, size_t len) {
+  struct arenachunk *chunk = obj->chunks;
+  void *res;
+  len = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (chunk->size - chunk->used < len) {
+    if (len > ARENA_CHUNK / 4) { /* big allocation: give it its own chunk, behind the current one */
+      chunk = newchunk(len);
+      if (chunk == NULL) return(NULL);
+      chunk->next = obj->chunks->next;
+      obj->chunks->next = chunk;
+      chunk->used = len;
+      return((char *)chunk + CHUNKHDR);
+    }
+    chunk = newchunk(ARENA_CHUNK);
+    if (chunk == NULL) return(NULL);
+    chunk->next = obj->chunks;
+    obj->chunks = chunk;
+  }
+  res = (char *)chunk + CHUNKHDR + chunk->used;
+  chunk->used += len;
+  return(res);
+}
+
+
+char *arena_strndup(struct arena_t *obj, const char *s, size_t len) {
+  char *res;
+  res = arena_alloc(obj, len + 1);
+  if (res == NULL) return(NULL);
+  memcpy(res, s, len);
+  res[len] = 0;
+  return(res);
+}
+
+
+char *arena_strdup(struct arena_t *obj, const char *s) {
+  return(arena_strndup(obj, s, strlen(s)));
+}
+
+
+void arena_reset(struct arena_t *obj) {
+  struct arenachunk *chunk, *next;
+  for (chunk = obj->chunks; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    if (chunk != obj->first) free(chunk);
+  }
+  obj->first->next = NULL;
+  obj->first->used = 0;
+  obj->chunks = obj->first;
+}
+
+
+void arena_free(struct arena_t *obj) {
+  struct arenachunk *chunk, *next;
+  if (obj == NULL) return;
+  for (chunk = obj->chunks; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+  free(obj);
+}
+
+
+void iobuf_init(int sock) {
+  int sndbuf = 0;
+  socklen_t optlen = sizeof(sndbuf);
+  if ((getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) != 0) || (sndbuf <= 0)) return;
+  iobufsize = IOBUF_DEFAULT;
+  if ((size_t)sndbuf < iobufsize) iobufsize = sndbuf;
+  if (iobufsize < IOBUF_MIN) iobufsize = IOBUF_MIN;
+}
+
+
+size_t iobuf_size(void) {
+  return(iobufsize);
+}
+
+
+void *iobuf_get(void) {
+  if (iobufpoolcount > 0) return(iobufpool[--iobufpoolcount]);
+  return(malloc(iobufsize));
+}
+
+
+void iobuf_put(void *buff) {
+  if (buff == NULL) return;
+  if (iobufpoolcount == IOBUF_POOLMAX) {
+    free(buff);
+    return;
+  }
+  iobufpool[iobufpoolcount++] = buff;
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a per-request memory arena, and a pool of I/O buffers
+ */
+
+#ifndef arena_h_sentinel
+#define arena_h_sentinel
+
+#include <stddef.h>
+
+struct arena_t;
+
+/* creates a new, empty arena. returns NULL on out of memory */
+struct arena_t *arena_new(void);
+
+/* allocates len bytes from the arena (aligned for any type). there is no
+ * way to free a single allocation: everything goes away at once with
+ * arena_reset() or arena_free(). returns NULL on out of memory */
+void *arena_alloc(struct arena_t *obj, size_t len);
+
+/* duplicates a string into the arena. returns NULL on out of memory */
+char *arena_strdup(struct arena_t *obj, const char *s);
+
+/* duplicates the first len bytes of s into the arena, and NUL-terminates them */
+char *arena_strndup(struct arena_t *obj, const char *s, size_t len);
+
+/* releases all allocations at once. the arena keeps its first chunk, so it
+ * can be reused without any call to malloc() for small workloads */
+void arena_reset(struct arena_t *obj);
+
+/* frees the arena and everything allocated from it */
+void arena_free(struct arena_t *obj);
+
+/* shrinks pooled I/O buffers to the send buffer of a socket if it is small
+ * (within sane limits). must be called before any iobuf_get() */
+void iobuf_init(int sock);
+
+/* returns the size of pooled I/O buffers */
+size_t iobuf_size(void);
+
+/* returns an I/O buffer of iobuf_size() bytes, taken from the pool if any is
+ * available. returns NULL on out of memory */
+void *iobuf_get(void);
+
+/* gives back a buffer to the pool */
+void iobuf_put(void *buff);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the transcoding of UTF-8 text into legacy 8-bit charsets.
+ *
+ * Every supported charset is described by the Unicode code points of its
+ * upper half (bytes 0x80-0xFF), the lower half being plain ASCII. From that,
+ * a reverse table is built once: it is split in pages of 256 code points, and
+ * only the pages that contain at least one character of the charset are
+ * allocated, so turning a code point into a byte costs two lookups. This is
+ * far cheaper than setting up iconv for each line, and text can be converted
+ * in place, as it streams.
+ */
+
+#include <stdlib.h>      /* calloc() */
+#include <strings.h>     /* strcasecmp() */
+
+#include "charset.h"     /* include self for control */
+
+#define CHARSETS 3
+
+/* code points of bytes 0x80-0xFF in CP437 */
+static const unsigned short cp437[128] = {
+  0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7, 0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+  0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9, 0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+  0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA, 0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+  0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556, 0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+  0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F, 0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+  0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B, 0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+  0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4, 0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+  0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248, 0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0
+};
+
+static const struct {
+  const char *name;
+  const char *alias1;
+  const char *alias2;
+} charsets[CHARSETS] = {
+  {"UTF-8", "UTF8", NULL},
+  {"ISO-8859-1", "LATIN1", "LATIN-1"},
+  {"CP437", "IBM437", "437"}
+};
+
+/* reverse tables: pages of 256 code points, NULL for pages that have no
+ * character in the charset. a zero entry means "not in the charset" */
+static unsigned char *revtables[CHARSETS][256];
+static int revtablesready[CHARSETS];
+
+
+static int buildtables(int charset) {
+  unsigned long cp;
+  int x;
+  if (revtablesready[charset] != 0) return(0);
+  for (x = 0; x < 128; x++) {
+    cp = (charset == CHARSET_CP437) ? cp437[x] : (unsigned long)(0x80 + x);
+    if (revtables[charset][cp >> 8] == NULL) {
+      revtables[charset][cp >> 8] = calloc(256, 1);
+      if (revtables[charset][cp >> 8] == NULL) return(-1);
+    }
+    revtables[charset][cp >> 8][cp & 0xff] = 0x80 + x;
+  }
+  revtablesready[charset] = 1;
+  return(0);
+}
+
+
+/* decodes the UTF-8 sequence at s (of which avail bytes are available) into
+ * cp. returns the length of the sequence, 0 if it is cut by the end of the
+ * buffer, or -1 if it is not valid UTF-8 (overlong forms and surrogates are
+ * rejected) */
+static int decode(const unsigned char *s, long avail, unsigned long *cp) {
+  unsigned char min = 0x80, max = 0xBF;
+  int len, x;
+  if ((s[0] >= 0xC2) && (s[0] <= 0xDF)) {
+    len = 2;
+    *cp = s[0] & 0x1F;
+  } else if ((s[0] >= 0xE0) && (s[0] <= 0xEF)) {
+    len = 3;
+    *cp = s[0] & 0x0F;
+    if (s[0] == 0xE0) min = 0xA0;
+    if (s[0] == 0xED) max = 0x9F;
+  } else if ((s[0] >= 0xF0) && (s[0] <= 0xF4)) {
+    len = 4;
+    *cp = s[0] & 0x07;
+    if (s[0] == 0xF0) min = 0x90;
+    if (s[0] == 0xF4) max = 0x8F;
+  } else {
+    return(-1);
+  }
+  for (x = 1; x < len; x++) {
+    if (x >= avail) return(0);
+    if ((s[x] < min) || (s[x] > max)) return(-1);
+    *cp = (*cp << 6) | (s[x] & 0x3F);
+    min = 0x80;
+    max = 0xBF;
+  }
+  return(len);
+}
+
+
+int charset_id(const char *name) {
+  int x;
+  for (x = 0; x < CHARSETS; x++) {
+    if ((strcasecmp(name, charsets[x].name) == 0) || (strcasecmp(name, charsets[x].alias1) == 0) || ((charsets[x].alias2 != NULL) && (strcasecmp(name, charsets[x].alias2) == 0))) {
+      if ((x != CHARSET_UTF8) && (buildtables(x) != 0)) return(-1);
+      return(x);
+    }
+  }
+  return(-1);
+}
+
+
+const char *charset_name(int charset) {
+  if ((charset < 0) || (charset >= CHARSETS)) return("UTF-8");
+  return(charsets[charset].name);
+}
+
+
+long charset_fromutf8(int charset, char *buff, long len, long *consumed) {
+  unsigned char *s = (unsigned char *)buff;
+  unsigned char *page;
+  unsigned long cp;
+  long in = 0, out;
+  int seqlen;
+
+  if ((charset <= CHARSET_UTF8) || (charset >= CHARSETS) || (buildtables(charset) != 0)) {
+    if (consumed != NULL) *consumed = len;
+    return(len);
+  }
+
+  /* ASCII is left untouched, so there is nothing to do until the first
+   * non-ASCII byte */
+  while ((in < len) && (s[in] < 0x80)) in++;
+  out = in;
+
+  while (in < len) {
+    if (s[in] < 0x80) {
+      s[out++] = s[in++];
+      continue;
+    }
+    seqlen = decode(s + in, len - in, &cp);
+    if (seqlen == 0) {
+      if (consumed != NULL) break; /* the rest comes with the next block */
+      seqlen = -1;
+    }
+    if (seqlen < 0) { /* not UTF-8 - keep the byte as it is */
+      s[out++] = s[in++];
+      continue;
+    }
+    in += seqlen;
+    page = (cp < 0x10000) ? revtables[charset][cp >> 8] : NULL;
+    if ((page != NULL) && (page[cp & 0xff] != 0)) {
+      s[out++] = page[cp & 0xff];
+    } else {
+      s[out++] = '?';
+    }
+  }
+  if (consumed != NULL) *consumed = in;
+  return(out);
+}
+
+
+void charset_strfromutf8(int charset, char *s) {
+  long len;
+  if (charset == CHARSET_UTF8) return;
+  for (len = 0; s[len] != 0; len++);
+  s[charset_fromutf8(charset, s, len, NULL)] = 0;
+}
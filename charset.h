@@ -0,0 +1,38 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the transcoding of UTF-8 text into legacy 8-bit charsets, for
+ * gopher clients that do not speak UTF-8
+ */
+
+#ifndef charset_h_sentinel
+#define charset_h_sentinel
+
+#define CHARSET_UTF8   0  /* no conversion */
+#define CHARSET_LATIN1 1  /* ISO-8859-1 */
+#define CHARSET_CP437  2  /* the IBM PC charset */
+
+/* returns the charset matching name (like "UTF-8", "ISO-8859-1" or "CP437",
+ * case-insensitive), or -1 if it is not supported. the conversion tables of
+ * the charset are built on first use: calling this before forking makes
+ * them shared by all processes */
+int charset_id(const char *name);
+
+/* returns the canonical name of a charset */
+const char *charset_name(int charset);
+
+/* converts len bytes of UTF-8 text in buff to charset, in place (the output
+ * is never longer than the input), and returns the length of the result.
+ * characters that have no equivalent in charset become '?', while bytes that
+ * are not valid UTF-8 are kept as they are (so text that is already in the
+ * target charset goes through unharmed). if consumed is not NULL, a sequence
+ * cut by the end of buff is left out, and *consumed is set to the amount of
+ * input bytes converted (the rest shall be converted along with the data
+ * that follows). otherwise the whole buffer is converted. */
+long charset_fromutf8(int charset, char *buff, long len, long *consumed);
+
+/* converts a NUL-terminated UTF-8 string to charset, in place */
+void charset_strfromutf8(int charset, char *s);
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * Test & benchmark application for charset transcoding.
+ *
+ * Checks conversions from UTF-8 against known answers and against iconv,
+ * makes sure that text converted block by block (with sequences cut at any
+ * place) is identical to text converted at once, then compares the speed of
+ * the lookup tables with iconv set up once per line.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "charset.h"
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+struct convtest {
+  int charset;
+  const char *in;
+  const char *out;
+};
+
+static struct convtest convtests[] = {
+  {CHARSET_LATIN1, "plain ascii", "plain ascii"},
+  {CHARSET_LATIN1, "Caf\xc3\xa9 cr\xc3\xa8me", "Caf\xe9 cr\xe8me"},
+  {CHARSET_CP437, "Caf\xc3\xa9 cr\xc3\xa8me", "Caf\x82 cr\x8a" "me"},
+  {CHARSET_CP437, "\xe2\x95\x94\xe2\x95\x90\xe2\x95\x97", "\xc9\xcd\xbb"},
+  {CHARSET_LATIN1, "10\xe2\x82\xac", "10?"},                 /* no euro sign in Latin-1 */
+  {CHARSET_CP437, "\xf0\x9f\x98\x80!", "?!"},                /* emoji */
+  {CHARSET_LATIN1, "d\xe9j\xe0 latin-1", "d\xe9j\xe0 latin-1"}, /* not UTF-8: kept as-is */
+  {CHARSET_LATIN1, "\xc0\xaf", "\xc0\xaf"},                  /* overlong form */
+  {CHARSET_LATIN1, "\xed\xa0\x80", "\xed\xa0\x80"},          /* surrogate */
+  {CHARSET_LATIN1, "cut \xc3", "cut \xc3"},                  /* sequence cut by the end of the string */
+  {CHARSET_UTF8, "Caf\xc3\xa9", "Caf\xc3\xa9"},
+  {0, NULL, NULL}
+};
+
+
+/* generates len bytes of text mixing ASCII, 2, 3 and 4 bytes sequences and
+ * a few invalid bytes */
+static void gentext(char *buff, long len) {
+  static const char *pieces[] = {"a", "e", " ", "\n", "\xc3\xa9", "\xc3\xa0", "\xc3\xa7", "\xe2\x95\x90", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xe9", "\xc3"};
+  long x = 0;
+  int n;
+  while (x < len) {
+    const char *p = pieces[rand() % 12];
+    n = strlen(p);
+    if (n > len - x) n = len - x;
+    memcpy(buff + x, p, n);
+    x += n;
+  }
+}
+
+
+/* converts buff block by block, the way the text streamer does it, into
+ * out. returns the length of the result */
+static long convblocks(int charset, const char *buff, long len, char *out) {
+  char block[64];
+  long pos = 0, outlen = 0, carry = 0, n, used = 0, res;
+  while ((pos < len) || (carry > 0)) {
+    n = 1 + rand() % (sizeof(block) - 4);
+    if (n > len - pos) n = len - pos;
+    memcpy(block + carry, buff + pos, n);
+    pos += n;
+    if (n == 0) { /* end of input with a cut sequence */
+      res = charset_fromutf8(charset, block, carry, NULL);
+      carry = 0;
+    } else {
+      n += carry;
+      res = charset_fromutf8(charset, block, n, &used);
+      carry = n - used;
+    }
+    memcpy(out + outlen, block, res);
+    outlen += res;
+    memmove(block, block + used, carry);
+  }
+  return(outlen);
+}
+
+
+/* converts text line by line with iconv, set up anew for each line (the
+ * naive way), into out. returns the length of the result */
+static long iconvlines(const char *charset, char *text, long len, char *out) {
+  char *in = text, *eol, *ip, *op;
+  size_t il, ol;
+  long outlen = 0;
+  iconv_t cd;
+  while (in < text + len) {
+    eol = memchr(in, '\n', text + len - in);
+    eol = (eol == NULL) ? text + len : eol + 1;
+    cd = iconv_open(charset, "UTF-8");
+    if (cd == (iconv_t)-1) return(-1);
+    ip = in;
+    il = eol - in;
+    op = out + outlen;
+    ol = il;
+    while (il > 0) {
+      if (iconv(cd, &ip, &il, &op, &ol) == (size_t)-1) { /* unconvertible: skip a byte */
+        *op++ = '?';
+        ol--;
+        ip++;
+        il--;
+      }
+    }
+    iconv_close(cd);
+    outlen = op - out;
+    in = eol;
+  }
+  return(outlen);
+}
+
+
+int main(int argc, char **argv) {
+  static const char *names[] = {"UTF-8", "ISO-8859-1", "CP437"};
+  char buff[64], utf8[8], *ip, *op;
+  char *text, *out1, *out2;
+  int x, c, iterations = 20, errors = 0;
+  long len, textlen = 4 * 1024 * 1024, len1, len2;
+  size_t il, ol;
+  double t0, t_tables, t_iconv;
+  iconv_t cd;
+
+  if (argc > 1) iterations = atoi(argv[1]);
+  if (iterations < 1) {
+    puts("charsettest is a simple tool to test and benchmark motsognir's charset transcoding.");
+    puts("usage: charsettest [iterations]");
+    return(1);
+  }
+
+  puts("check charset names...");
+  for (c = 0; c < 3; c++) {
+    if ((charset_id(names[c]) != c) || (strcmp(charset_name(c), names[c]) != 0)) {
+      printf("  FAILED: charset '%s'\n", names[c]);
+      errors++;
+    }
+  }
+  if ((charset_id("latin1") != CHARSET_LATIN1) || (charset_id("ibm437") != CHARSET_CP437) || (charset_id("EBCDIC") != -1)) {
+    puts("  FAILED: charset aliases");
+    errors++;
+  }
+
+  puts("check known conversions...");
+  for (x = 0; convtests[x].in != NULL; x++) {
+    strcpy(buff, convtests[x].in);
+    charset_strfromutf8(convtests[x].charset, buff);
+    if (strcmp(buff, convtests[x].out) != 0) {
+      printf("  FAILED: test #%d\n", x);
+      errors++;
+    }
+  }
+
+  puts("check all characters of 8-bit charsets against iconv...");
+  for (c = CHARSET_LATIN1; c <= CHARSET_CP437; c++) {
+    cd = iconv_open("UTF-8", names[c]);
+    if (cd == (iconv_t)-1) {
+      printf("  skipped: iconv does not support %s\n", names[c]);
+      continue;
+    }
+    for (x = 0x80; x < 0x100; x++) {
+      buff[0] = x;
+      ip = buff;
+      il = 1;
+      op = utf8;
+      ol = sizeof(utf8) - 1;
+      if (iconv(cd, &ip, &il, &op, &ol) == (size_t)-1) continue; /* iconv does not know this one */
+      *op = 0;
+      charset_strfromutf8(c, utf8);
+      if ((unsigned char)utf8[0] != x) {
+        printf("  FAILED: %s byte 0x%02X does not convert back\n", names[c], x);
+        errors++;
+      }
+    }
+    iconv_close(cd);
+  }
+
+  puts("check block by block conversions...");
+  text = malloc(textlen);
+  out1 = malloc(textlen);
+  out2 = malloc(textlen);
+  if ((text == NULL) || (out1 == NULL) || (out2 == NULL)) {
+    puts("out of memory");
+    return(1);
+  }
+  for (c = CHARSET_LATIN1; c <= CHARSET_CP437; c++) {
+    for (x = 0; x < 200; x++) {
+      len = 1 + rand() % 4096;
+      gentext(text, len);
+      memcpy(out1, text, len);
+      len1 = charset_fromutf8(c, out1, len, NULL);
+      len2 = convblocks(c, text, len, out2);
+      if ((len1 != len2) || (memcmp(out1, out2, len1) != 0)) {
+        printf("  FAILED: %s, text #%d\n", names[c], x);
+        errors++;
+        break;
+      }
+    }
+  }
+
+  if (errors != 0) {
+    printf("%d errors found!\n", errors);
+    return(1);
+  }
+
+  /* some French-like text, that all charsets can represent */
+  for (len = 0; len < textlen; len++) {
+    static const char *words[] = {"le ", "caf\xc3\xa9 ", "tr\xc3\xa8s ", "fran\xc3\xa7" "ais ", "gopher ", "\xc3\xa0 ", "\n"};
+    const char *w = words[rand() % 7];
+    if (len + (long)strlen(w) > textlen) break;
+    memcpy(text + len, w, strlen(w));
+    len += strlen(w) - 1;
+  }
+  textlen = len;
+  for (c = CHARSET_LATIN1; c <= CHARSET_CP437; c++) {
+    printf("benchmark %d x conversion of %ld KiB of text to %s...\n", iterations, textlen / 1024, names[c]);
+    t0 = now();
+    for (x = 0; x < iterations; x++) {
+      memcpy(out1, text, textlen);
+      len1 = charset_fromutf8(c, out1, textlen, NULL);
+    }
+    t_tables = now() - t0;
+    t0 = now();
+    for (x = 0; x < iterations; x++) {
+      len2 = iconvlines(names[c], text, textlen, out2);
+      if (len2 < 0) break;
+    }
+    t_iconv = now() - t0;
+    printf("  tables:         %8.1f MiB/s\n", (double)iterations * textlen / t_tables / 1048576.0);
+    if (len2 < 0) {
+      printf("  iconv per line: not supported\n");
+      continue;
+    }
+    printf("  iconv per line: %8.1f MiB/s\n", (double)iterations * textlen / t_iconv / 1048576.0);
+    printf("  speedup: %.1fx\n", t_iconv / t_tables);
+    if ((len1 != len2) || (memcmp(out1, out2, len1) != 0)) {
+      puts("  FAILED: outputs differ");
+      errors++;
+    }
+  }
+
+  free(text);
+  free(out1);
+  free(out2);
+  if (errors != 0) {
+    printf("%d errors found!\n", errors);
+    return(1);
+  }
+  return(0);
+}
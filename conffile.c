@@ -0,0 +1,92 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the tokenizer of the configuration file. It is kept apart from
+ * motsognir.c so it can be tested (see vhosttest)
+ */
+
+#include <ctype.h>     /* isspace() */
+#include <stdio.h>
+#include <stdlib.h>    /* realloc() */
+#include <string.h>
+#include <syslog.h>
+
+#include "conffile.h"  /* include self for control */
+
+
+/* Trims any whitespaces before and after a string. */
+static void trimstr(char *s) {
+  size_t len = strlen(s);
+  char *nws = s;
+  /* trim trailing whitespace */
+  while (len && isspace((unsigned char)s[len-1])) len--;
+  /* trim leading whitespace */
+  if (len != 0) {
+    while (isspace((unsigned char)*nws)) nws++;
+    if ((nws - s) != 0) {
+      len -= (nws - s);
+      memmove(s, nws, len);
+    }
+  }
+  s[len] = '\0';
+}
+
+
+int conffile_next(FILE *fd, char *token, int tokenlen, char *value, int valuelen) {
+  int bytebuff, tokenpos = 0, valuepos;
+
+  for (;;) {
+    bytebuff = getc(fd);
+    if (bytebuff < 0) return(CONFFILE_EOF);
+    if (bytebuff == '\n') { /* a line without any '=': maybe a section */
+      token[tokenpos] = 0;
+      trimstr(token);
+      tokenpos = 0;
+      if (token[0] == '[') return(CONFFILE_SECTION);
+      continue;
+    }
+    if (bytebuff != '=') {
+      if ((tokenpos + 1) < tokenlen) token[tokenpos++] = bytebuff;
+      continue;
+    }
+    token[tokenpos] = 0;
+    trimstr(token);
+    tokenpos = 0;
+    /* read the value, up to the end of the line or to a comment */
+    valuepos = 0;
+    for (;;) {
+      bytebuff = getc(fd);
+      if ((bytebuff < 0) || (bytebuff == '\n') || (bytebuff == '#')) break;
+      if ((bytebuff != '\r') && ((valuepos + 1) < valuelen)) value[valuepos++] = bytebuff;
+    }
+    value[valuepos] = 0;
+    trimstr(value);
+    if (bytebuff == '#') { /* skip the comment */
+      do {
+        bytebuff = getc(fd);
+      } while ((bytebuff >= 0) && (bytebuff != '\n'));
+    }
+    /* ignore commented out directives, and directives with an empty value */
+    if ((token[0] == 0) || (token[0] == '#') || (value[0] == 0)) continue;
+    return(CONFFILE_DIRECTIVE);
+  }
+}
+
+
+char **conffile_explodelist(char *s, const char *delims) {
+  char **res = NULL;
+  int rescount = 0;
+  char *p;
+
+  for (p = strtok(s, delims); p != NULL; p = strtok(NULL, delims)) {
+    res = realloc(res, (rescount + 2) * sizeof(char *)); /* always allocate one place more, so I can put the NULL list terminator there later */
+    if (res == NULL) {
+      syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+      return(res);
+    }
+    res[rescount++] = strdup(p);
+  }
+  if (res != NULL) res[rescount] = NULL;
+  return(res);
+}
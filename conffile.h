@@ -0,0 +1,30 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the tokenizer of the configuration file
+ */
+
+#ifndef conffile_h_sentinel
+#define conffile_h_sentinel
+
+#include <stdio.h>
+
+#define CONFFILE_EOF       0
+#define CONFFILE_DIRECTIVE 1  /* a 'token=value' line */
+#define CONFFILE_SECTION   2  /* a '[section]' line */
+
+/* reads the next directive or section header of a configuration file. the
+ * token (or the section header, brackets included) is written to token, and
+ * the value of a directive to value, both trimmed. comments, commented out
+ * directives ('#Token=value') and directives without a value are skipped.
+ * returns CONFFILE_DIRECTIVE, CONFFILE_SECTION, or CONFFILE_EOF at the end
+ * of the file. */
+int conffile_next(FILE *fd, char *token, int tokenlen, char *value, int valuelen);
+
+/* explodes a list of items separated by any of the delims chars into a
+ * malloc()ed, NULL-terminated array of strings. returns NULL if the list is
+ * empty, or on out of memory */
+char **conffile_explodelist(char *s, const char *delims);
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides pre-computed directory listings (index files).
+ *
+ * An index file holds the sorted listing of a single directory, with gopher
+ * types already resolved and names already percent-encoded, so a menu can be
+ * sent without listing, sorting nor stat()ing anything. It is valid as long
+ * as the directory's inode and mtime match the ones recorded in its header.
+ * If the index is built for an output charset other than UTF-8, names are
+ * stored converted to that charset as well, so they are converted only once
+ * per change of the directory.
+ *
+ * File layout (host byte order, it is a local cache):
+ *   header:  char magic[8], u32 count, u32 charset, i64 dirmtime,
+ *            i64 dirmtime_nsec, u64 dirinode
+ *   offsets: u32 offset[count] (from the start of the file)
+ *   records: u8 type, u8 isdir, u16 namelen, u16 encnamelen, u16 altnamelen,
+ *            u64 size, i64 mtime, name + NUL, encname + NUL, and if charset
+ *            is not UTF-8, altname + NUL (the name in that charset)
+ *   trailer: char endmagic[8]
+ *
+ * Index files are not trusted. Opening one only checks its header and its
+ * trailer (so a truncated file is ignored, as if out of date), and each entry
+ * is checked against the size of the file when it is read, so opening an
+ * index does not depend on its amount of entries.
+ */
+
+#include <errno.h>
+#include <fcntl.h>       /* open(), fstatat() */
+#include <stdint.h>
+#include <stdio.h>       /* rename(), snprintf() */
+#include <stdlib.h>      /* malloc(), realloc(), free() */
+#include <string.h>      /* memcpy(), memcmp(), strlen(), strrchr() */
+#include <unistd.h>      /* close(), write(), unlink(), getpid() */
+#include <sys/mman.h>    /* mmap() */
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "charset.h"
+#include "dirlist.h"
+#include "dirindex.h"    /* include self for control */
+
+#define DIRINDEX_MAGIC "MOTSIDX2"
+#define DIRINDEX_ENDMAGIC "MOTSEND2"
+#define HEADERLEN 40
+#define RECORDLEN 24
+
+struct dirindex_t {
+  const unsigned char *map;
+  size_t maplen;
+  size_t datalen;  /* maplen, minus the trailer */
+  long count;
+  int charset;
+};
+
+struct buff {
+  unsigned char *data;
+  size_t len;
+  size_t alloc;
+};
+
+
+static int buff_append(struct buff *b, const void *data, size_t len) {
+  if (b->len + len > b->alloc) {
+    unsigned char *newdata;
+    size_t newalloc = b->alloc * 2 + len + 4096;
+    newdata = realloc(b->data, newalloc);
+    if (newdata == NULL) return(-1);
+    b->data = newdata;
+    b->alloc = newalloc;
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+  return(0);
+}
+
+
+/* percent-encodes src into dst (at least 3 * strlen(src) + 1 bytes long),
+ * leaving a-z, A-Z, 0-9 and '-', '/', '_', '.', '~' as-is */
+static void encodename(const char *src, char *dst) {
+  const char *hexchar = "0123456789ABCDEF";
+  for (; *src != 0; src++) {
+    unsigned char c = *src;
+    if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) || (c == '-') || (c == '/') || (c == '_') || (c == '.') || (c == '~')) {
+      *dst++ = c;
+    } else {
+      *dst++ = '%';
+      *dst++ = hexchar[c >> 4];
+      *dst++ = hexchar[c & 15];
+    }
+  }
+  *dst = 0;
+}
+
+
+int dirindex_build(const char *dirpath, const struct stat *dirst, const char *indexfile, const struct extmap_t *extmap, int charset) {
+  struct dirlist_t *dirlist;
+  struct buff b = {NULL, 0, 0};
+  char tmpfile[4096];
+  char *encname = NULL, *altname = NULL;
+  int dirfd = -1, fd = -1, err = 0;
+  long count, x;
+  uint32_t u32;
+  int64_t i64;
+  uint64_t u64;
+
+  dirlist = dirlist_load(dirpath, dirlist_menufilter);
+  if (dirlist == NULL) return(-1);
+  count = dirlist_count(dirlist);
+
+  /* header and offsets table */
+  u32 = count;
+  if (buff_append(&b, DIRINDEX_MAGIC, 8) != 0) goto OOM;
+  if (buff_append(&b, &u32, 4) != 0) goto OOM;
+  u32 = charset;
+  if (buff_append(&b, &u32, 4) != 0) goto OOM;
+  i64 = dirst->st_mtime;
+  if (buff_append(&b, &i64, 8) != 0) goto OOM;
+  i64 = dirst->st_mtim.tv_nsec;
+  if (buff_append(&b, &i64, 8) != 0) goto OOM;
+  u64 = dirst->st_ino;
+  if (buff_append(&b, &u64, 8) != 0) goto OOM;
+  for (x = 0; x < count; x++) {
+    if (buff_append(&b, &u32, 4) != 0) goto OOM;
+  }
+
+  /* records */
+  dirfd = open(dirpath, O_RDONLY | O_DIRECTORY);
+  if (dirfd < 0) goto FAIL;
+  for (x = 0; x < count; x++) {
+    unsigned char rec[RECORDLEN];
+    const char *name = dirlist_name(dirlist, x);
+    uint16_t namelen = strlen(name), enclen, altlen = 0;
+    struct stat st;
+    memset(rec, 0, sizeof(rec));
+    /* remember the offset of the record */
+    u32 = b.len;
+    memcpy(b.data + HEADERLEN + x * 4, &u32, 4);
+    /* gather attributes */
+    if (dirlist_isdir(dirlist, x) != 0) {
+      rec[0] = '1';
+      rec[1] = 1;
+    } else {
+      const char *ext = strrchr(name, '.');
+      rec[0] = extmap_lookup(extmap, (ext != NULL) ? ext + 1 : "");
+    }
+    if (fstatat(dirfd, name, &st, 0) == 0) {
+      u64 = st.st_size;
+      i64 = st.st_mtime;
+      memcpy(rec + 8, &u64, 8);
+      memcpy(rec + 16, &i64, 8);
+    }
+    free(encname);
+    encname = malloc(namelen * 3 + 1);
+    if (encname == NULL) goto OOM;
+    encodename(name, encname);
+    enclen = strlen(encname);
+    if (charset != CHARSET_UTF8) {
+      free(altname);
+      altname = malloc(namelen + 1);
+      if (altname == NULL) goto OOM;
+      memcpy(altname, name, namelen + 1);
+      charset_strfromutf8(charset, altname);
+      altlen = strlen(altname);
+    }
+    memcpy(rec + 2, &namelen, 2);
+    memcpy(rec + 4, &enclen, 2);
+    memcpy(rec + 6, &altlen, 2);
+    if (buff_append(&b, rec, RECORDLEN) != 0) goto OOM;
+    if (buff_append(&b, name, namelen + 1) != 0) goto OOM;
+    if (buff_append(&b, encname, enclen + 1) != 0) goto OOM;
+    if ((altname != NULL) && (buff_append(&b, altname, altlen + 1) != 0)) goto OOM;
+  }
+
+  if (buff_append(&b, DIRINDEX_ENDMAGIC, 8) != 0) goto OOM;
+
+  /* write the index to a temporary file first, then move it in place */
+  snprintf(tmpfile, sizeof(tmpfile), "%s.%ld.tmp", indexfile, (long)getpid());
+  fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) goto FAIL;
+  if (write(fd, b.data, b.len) != (ssize_t)b.len) {
+    err = errno;
+    close(fd);
+    unlink(tmpfile);
+    goto FAIL;
+  }
+  close(fd);
+  if (rename(tmpfile, indexfile) != 0) {
+    err = errno;
+    unlink(tmpfile);
+    goto FAIL;
+  }
+  close(dirfd);
+  free(encname);
+  free(altname);
+  free(b.data);
+  dirlist_free(dirlist);
+  return(0);
+
+  OOM:
+  errno = ENOMEM;
+  FAIL:
+  if (err == 0) err = errno;
+  if (dirfd >= 0) close(dirfd);
+  free(encname);
+  free(altname);
+  free(b.data);
+  dirlist_free(dirlist);
+  errno = err;
+  return(-1);
+}
+
+
+/* returns non-zero if a string of len bytes (plus its NUL terminator) fits
+ * in the index at offset pos */
+static int stringfits(const struct dirindex_t *obj, uint64_t pos, uint16_t len) {
+  if (pos + len + 1 > obj->datalen) return(0);
+  return(obj->map[pos + len] == 0);
+}
+
+
+/* reads entry n of an index into e. returns 0 on success, -1 if the entry
+ * does not fit in the file (before its trailer) */
+static int readentry(const struct dirindex_t *obj, long n, struct dirindex_entry *e) {
+  uint32_t offset;
+  uint16_t namelen, enclen, altlen;
+  uint64_t size, pos;
+  int64_t mtime;
+  const unsigned char *rec;
+  if ((n < 0) || (n >= obj->count)) return(-1);
+  memcpy(&offset, obj->map + HEADERLEN + n * 4, 4);
+  /* the record lies after the offsets table, and within the file */
+  if ((offset < HEADERLEN + (uint64_t)obj->count * 4) || ((uint64_t)offset + RECORDLEN > obj->datalen)) return(-1);
+  rec = obj->map + offset;
+  memcpy(&namelen, rec + 2, 2);
+  memcpy(&enclen, rec + 4, 2);
+  memcpy(&altlen, rec + 6, 2);
+  pos = (uint64_t)offset + RECORDLEN;
+  if (stringfits(obj, pos, namelen) == 0) return(-1);
+  pos += namelen + 1;
+  if (stringfits(obj, pos, enclen) == 0) return(-1);
+  if ((obj->charset != CHARSET_UTF8) && (stringfits(obj, pos + enclen + 1, altlen) == 0)) return(-1);
+  memcpy(&size, rec + 8, 8);
+  memcpy(&mtime, rec + 16, 8);
+  e->type = rec[0];
+  e->isdir = rec[1];
+  e->size = size;
+  e->mtime = mtime;
+  e->name = (const char *)rec + RECORDLEN;
+  e->encname = e->name + namelen + 1;
+  e->altname = (obj->charset != CHARSET_UTF8) ? e->encname + enclen + 1 : NULL;
+  return(0);
+}
+
+
+struct dirindex_t *dirindex_open(const char *indexfile, const struct stat *dirst) {
+  struct dirindex_t *obj;
+  struct stat st;
+  int fd;
+  uint32_t u32, charset;
+  int64_t mtime, mtimensec;
+  uint64_t ino;
+  void *map;
+
+  fd = open(indexfile, O_RDONLY);
+  if (fd < 0) return(NULL);
+  if ((fstat(fd, &st) != 0) || (st.st_size < HEADERLEN + 8)) {
+    close(fd);
+    return(NULL);
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return(NULL);
+
+  /* validate the header against the directory */
+  memcpy(&u32, (unsigned char *)map + 8, 4);
+  memcpy(&charset, (unsigned char *)map + 12, 4);
+  memcpy(&mtime, (unsigned char *)map + 16, 8);
+  memcpy(&mtimensec, (unsigned char *)map + 24, 8);
+  memcpy(&ino, (unsigned char *)map + 32, 8);
+  if ((memcmp(map, DIRINDEX_MAGIC, 8) != 0) || (memcmp((unsigned char *)map + st.st_size - 8, DIRINDEX_ENDMAGIC, 8) != 0)
+   || (HEADERLEN + (uint64_t)u32 * 4 + 8 > (uint64_t)st.st_size)
+   || ((charset != CHARSET_UTF8) && (charset != CHARSET_LATIN1) && (charset != CHARSET_CP437))
+   || (mtime != dirst->st_mtime) || (mtimensec != dirst->st_mtim.tv_nsec) || (ino != (uint64_t)dirst->st_ino)) {
+    munmap(map, st.st_size);
+    return(NULL);
+  }
+
+  obj = malloc(sizeof(struct dirindex_t));
+  if (obj == NULL) {
+    munmap(map, st.st_size);
+    return(NULL);
+  }
+  obj->map = map;
+  obj->maplen = st.st_size;
+  obj->datalen = st.st_size - 8;
+  obj->count = u32;
+  obj->charset = charset;
+  return(obj);
+}
+
+
+long dirindex_count(const struct dirindex_t *obj) {
+  return(obj->count);
+}
+
+
+int dirindex_charset(const struct dirindex_t *obj) {
+  return(obj->charset);
+}
+
+
+int dirindex_get(const struct dirindex_t *obj, long n, struct dirindex_entry *e) {
+  return(readentry(obj, n, e));
+}
+
+
+void dirindex_close(struct dirindex_t *obj) {
+  if (obj == NULL) return;
+  munmap((void *)obj->map, obj->maplen);
+  free(obj);
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides pre-computed directory listings (index files)
+ */
+
+#ifndef dirindex_h_sentinel
+#define dirindex_h_sentinel
+
+#include <sys/stat.h>
+#include <time.h>
+
+#include "extmap.h"
+
+/* name of index files, within the index tree */
+#define DIRINDEX_FILENAME ".motsognir-index"
+
+struct dirindex_t;
+
+struct dirindex_entry {
+  const char *name;
+  const char *encname;  /* percent-encoded name */
+  const char *altname;  /* name in the charset of the index (NULL if UTF-8) */
+  char type;            /* gopher type */
+  int isdir;
+  unsigned long size;
+  time_t mtime;
+};
+
+/* lists directory dirpath (whose attributes are dirst) and writes its index
+ * to indexfile. types of files are resolved through extmap, and names are
+ * stored converted to charset as well (see charset.h). returns 0 on success,
+ * non-zero otherwise (with errno set) */
+int dirindex_build(const char *dirpath, const struct stat *dirst, const char *indexfile, const struct extmap_t *extmap, int charset);
+
+/* maps an index file in memory. returns NULL if the index does not exist, has
+ * an invalid header or trailer, or is out of date with regard to the directory
+ * described by dirst. entries are not checked here, but by dirindex_get() */
+struct dirindex_t *dirindex_open(const char *indexfile, const struct stat *dirst);
+
+/* returns the amount of entries in an index */
+long dirindex_count(const struct dirindex_t *obj);
+
+/* returns the charset the index was built for (see charset.h) */
+int dirindex_charset(const struct dirindex_t *obj);
+
+/* fills e with the details of entry n. returns 0 on success, -1 if n is out
+ * of range or its entry is invalid */
+int dirindex_get(const struct dirindex_t *obj, long n, struct dirindex_entry *e);
+
+/* unmaps an index file */
+void dirindex_close(struct dirindex_t *obj);
+
+#endif
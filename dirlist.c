@@ -0,0 +1,227 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a fast loader for sorted directory listings.
+ *
+ * scandir() allocates one dirent per entry and calls strcasecmp() on every
+ * comparison, which does not scale well to directories with hundreds of
+ * thousands of entries. Here, entries are read with large getdents64() calls
+ * (on Linux, readdir() elsewhere), names are stored one after another in a
+ * single block of memory along with a lower-cased sort key, and the first
+ * bytes of every key are packed into an integer so most comparisons never
+ * need to touch the strings at all. Entries of unknown type (filesystems that
+ * do not fill d_type) are resolved with fstatat() once the directory has been
+ * read entirely.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>       /* open(), fstatat() */
+#include <stdlib.h>      /* malloc(), realloc(), qsort(), free() */
+#include <string.h>      /* strcmp(), strlen(), memcpy() */
+#include <unistd.h>      /* close() */
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/syscall.h> /* SYS_getdents64 */
+#endif
+
+#include "dirlist.h"     /* include self for control */
+
+#define DIRLIST_GETDENTSBUFF (256 * 1024)
+
+#define TYPE_FILE    0
+#define TYPE_DIR     1
+#define TYPE_UNKNOWN 2
+
+struct dirlist_entry {
+  unsigned long prefix; /* first bytes of the sort key, as a big-endian integer */
+  const char *key;      /* lower-cased name */
+  const char *name;
+  long nameoffset;      /* position of name in the names block (during load) */
+  int type;
+};
+
+struct dirlist_t {
+  struct dirlist_entry *entries;
+  int count;
+  int entriesalloc;
+  char *names;
+  long nameslen;
+  long namesalloc;
+};
+
+
+/* appends an entry to the list. returns 0 on success, non-zero on out of memory */
+static int addentry(struct dirlist_t *obj, const char *name, int type) {
+  long len = strlen(name) + 1, x;
+  char *key;
+  if (obj->count == obj->entriesalloc) {
+    struct dirlist_entry *newentries;
+    int newalloc = obj->entriesalloc * 2 + 64;
+    newentries = realloc(obj->entries, newalloc * sizeof(struct dirlist_entry));
+    if (newentries == NULL) return(-1);
+    obj->entries = newentries;
+    obj->entriesalloc = newalloc;
+  }
+  if (obj->nameslen + len * 2 > obj->namesalloc) {
+    char *newnames;
+    long newalloc = obj->namesalloc * 2 + len * 2 + 4096;
+    newnames = realloc(obj->names, newalloc);
+    if (newnames == NULL) return(-1);
+    obj->names = newnames;
+    obj->namesalloc = newalloc;
+  }
+  /* store the name, followed by its lower-cased version */
+  memcpy(obj->names + obj->nameslen, name, len);
+  key = obj->names + obj->nameslen + len;
+  for (x = 0; x < len; x++) {
+    if ((name[x] >= 'A') && (name[x] <= 'Z')) {
+      key[x] = name[x] + ('a' - 'A');
+    } else {
+      key[x] = name[x];
+    }
+  }
+  obj->entries[obj->count].nameoffset = obj->nameslen;
+  obj->entries[obj->count].type = type;
+  obj->count += 1;
+  obj->nameslen += len * 2;
+  return(0);
+}
+
+
+/* reads all entries of the directory behind dirfd. returns 0 on success */
+#ifdef SYS_getdents64
+static int readentries(struct dirlist_t *obj, int dirfd, int (*filter)(const char *name)) {
+  char *buff;
+  long len, pos;
+  buff = malloc(DIRLIST_GETDENTSBUFF);
+  if (buff == NULL) return(-1);
+  for (;;) {
+    len = syscall(SYS_getdents64, dirfd, buff, DIRLIST_GETDENTSBUFF);
+    if (len <= 0) break;
+    /* linux_dirent64 layout: u64 d_ino, s64 d_off, u16 d_reclen, u8 d_type, char d_name[] */
+    for (pos = 0; pos < len;) {
+      unsigned short reclen;
+      unsigned char dtype = buff[pos + 18];
+      const char *name = buff + pos + 19;
+      memcpy(&reclen, buff + pos + 16, sizeof(reclen));
+      pos += reclen;
+      if ((filter != NULL) && (filter(name) == 0)) continue;
+      if (addentry(obj, name, (dtype == DT_DIR) ? TYPE_DIR : ((dtype == DT_UNKNOWN) ? TYPE_UNKNOWN : TYPE_FILE)) != 0) {
+        free(buff);
+        return(-1);
+      }
+    }
+  }
+  free(buff);
+  return((len < 0) ? -1 : 0);
+}
+#else
+static int readentries(struct dirlist_t *obj, int dirfd, int (*filter)(const char *name)) {
+  DIR *dir;
+  struct dirent *ent;
+  int res = 0;
+  dir = fdopendir(dup(dirfd));
+  if (dir == NULL) return(-1);
+  while ((ent = readdir(dir)) != NULL) {
+    if ((filter != NULL) && (filter(ent->d_name) == 0)) continue;
+    res = addentry(obj, ent->d_name, (ent->d_type == DT_DIR) ? TYPE_DIR : ((ent->d_type == DT_UNKNOWN) ? TYPE_UNKNOWN : TYPE_FILE));
+    if (res != 0) break;
+  }
+  closedir(dir);
+  return(res);
+}
+#endif
+
+
+/* sorting backend: directories first, then by case-insensitive name */
+static int entrycmp(const void *a, const void *b) {
+  const struct dirlist_entry *ea = a, *eb = b;
+  int res;
+  if (ea->type != eb->type) return((ea->type == TYPE_DIR) ? -1 : 1);
+  if (ea->prefix != eb->prefix) return((ea->prefix < eb->prefix) ? -1 : 1);
+  res = strcmp(ea->key, eb->key);
+  if (res != 0) return(res);
+  return(strcmp(ea->name, eb->name));
+}
+
+
+struct dirlist_t *dirlist_load(const char *path, int (*filter)(const char *name)) {
+  struct dirlist_t *obj;
+  int dirfd, x, err;
+  unsigned int i;
+
+  dirfd = open(path, O_RDONLY | O_DIRECTORY);
+  if (dirfd < 0) return(NULL);
+  obj = calloc(1, sizeof(struct dirlist_t));
+  if (obj == NULL) {
+    close(dirfd);
+    errno = ENOMEM;
+    return(NULL);
+  }
+  if (readentries(obj, dirfd, filter) != 0) {
+    err = errno;
+    close(dirfd);
+    dirlist_free(obj);
+    errno = err;
+    return(NULL);
+  }
+
+  /* names are at their final place now, compute pointers and sort prefixes */
+  for (x = 0; x < obj->count; x++) {
+    struct dirlist_entry *e = &(obj->entries[x]);
+    const unsigned char *k;
+    e->name = obj->names + e->nameoffset;
+    e->key = e->name + strlen(e->name) + 1;
+    e->prefix = 0;
+    k = (const unsigned char *)e->key;
+    for (i = 0; i < sizeof(e->prefix); i++) {
+      e->prefix <<= 8;
+      if (*k != 0) e->prefix |= *(k++);
+    }
+    /* filesystems that do not fill d_type need a stat() */
+    if (e->type == TYPE_UNKNOWN) {
+      struct stat st;
+      e->type = TYPE_FILE;
+      if ((fstatat(dirfd, e->name, &st, AT_SYMLINK_NOFOLLOW) == 0) && S_ISDIR(st.st_mode)) e->type = TYPE_DIR;
+    }
+  }
+  close(dirfd);
+
+  qsort(obj->entries, obj->count, sizeof(struct dirlist_entry), entrycmp);
+  return(obj);
+}
+
+
+int dirlist_menufilter(const char *name) {
+  if (name[0] == '.') return(0); /* skip any entry starting with '.' (these are either hidden files or system stuff like '.' or '..') */
+  if (strcmp(name, "gophermap") == 0) return(0);     /* skip gophermap entries (txt) */
+  if (strcmp(name, "gophermap.cgi") == 0) return(0); /* skip gophermap entries (cgi) */
+  if (strcmp(name, "gophermap.php") == 0) return(0); /* skip gophermap entries (php) */
+  return(1);
+}
+
+
+int dirlist_count(const struct dirlist_t *obj) {
+  return(obj->count);
+}
+
+
+const char *dirlist_name(const struct dirlist_t *obj, int n) {
+  return(obj->entries[n].name);
+}
+
+
+int dirlist_isdir(const struct dirlist_t *obj, int n) {
+  return(obj->entries[n].type == TYPE_DIR);
+}
+
+
+void dirlist_free(struct dirlist_t *obj) {
+  if (obj == NULL) return;
+  free(obj->entries);
+  free(obj->names);
+  free(obj);
+}
@@ -0,0 +1,34 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a fast loader for sorted directory listings
+ */
+
+#ifndef dirlist_h_sentinel
+#define dirlist_h_sentinel
+
+struct dirlist_t;
+
+/* loads the content of a directory and sorts it (directories first, then by
+ * case-insensitive name). entries for which filter() returns zero are left
+ * out (filter may be NULL). returns NULL on error, with errno set */
+struct dirlist_t *dirlist_load(const char *path, int (*filter)(const char *name));
+
+/* the filter used for gopher menus: leaves out hidden entries (including '.'
+ * and '..') and gophermaps */
+int dirlist_menufilter(const char *name);
+
+/* returns the amount of entries in a directory listing */
+int dirlist_count(const struct dirlist_t *obj);
+
+/* returns the name of entry n */
+const char *dirlist_name(const struct dirlist_t *obj, int n);
+
+/* returns non-zero if entry n is a directory */
+int dirlist_isdir(const struct dirlist_t *obj, int n);
+
+/* frees the memory allocated to a directory listing */
+void dirlist_free(struct dirlist_t *obj);
+
+#endif
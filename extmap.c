@@ -5,35 +5,46 @@
  * Provides a simple db-like system for storing and mapping file extensions
  */
 
+#include <stdint.h>  /* uint64_t */
 #include <stdio.h>   /* FILE */
-#include <stdlib.h>  /* malloc(), calloc(), free() */
-#include <string.h>  /* strcmp() */
+#include <stdlib.h>  /* malloc(), calloc(), qsort(), free() */
+#include <string.h>  /* memcpy(), memset() */
 
 #include "extmap.h"  /* include self for control */
 
-struct extmap_node {
-  struct extmap_node *next;
+#define MAXEXTLEN 15  /* longer extensions are never mapped */
+
+/* a slot of the hash table: the extension, lower-cased and NUL-padded, is
+ * stored inline so a lookup only has to compare two words */
+struct extmap_slot {
+  uint64_t key[2];
+  char type;        /* 0 if the slot is empty */
+};
+
+/* an extension as read from the mapping file, before compilation */
+struct extmap_item {
+  uint64_t key[2];
   char type;
-  char extension[1]; /* this MUST be at the end - struct is made bigger to accomodate longer extensions */
+  long order;       /* position in the file, later definitions win */
 };
 
+/* the map is a perfect hash table (hash and displace): every extension is
+ * first hashed to a bucket, whose displacement value selects a second hash
+ * function that sends all extensions of the bucket to distinct slots. */
 struct extmap_t {
-  struct extmap_node *maplist[1024];  /* mapping on two first letters fits in 10 bits */
+  struct extmap_slot *slots;
+  uint32_t *displacements;  /* one per bucket */
+  unsigned long slotmask;
+  unsigned long bucketmask;
   char fallback;
 };
 
-/* copy src string to dst, forcing lower case at the same time */
-static void copystringlcase(char *dst, const char *src) {
-  int x;
-  for (x = 0; src[x] != 0; x++) {
-    if ((src[x] >= 'A') && (src[x] <= 'Z')) {
-      dst[x] = ('a' - 'A') + src[x];
-    } else {
-      dst[x] = src[x];
-    }
-  }
-  dst[x] = 0;
-}
+/* the item list built while reading a mapping file */
+struct extmap_list {
+  struct extmap_item *items;
+  long count;
+  long alloc;
+};
 
 /* right trim string and return new length */
 static int rtrimgetlen(char *s) {
@@ -64,36 +75,160 @@ static int getlinefromfile(FILE *fd, char *linebuff, int maxlen) {
   return(eofflag);
 }
 
-/* provides a 10-bit mapping id of the extension / the extension MUST be fed
- * in lower case format! */
-static int ext2map(char *extension) {
-  int res;
-  /* map only if two first chars are both in range a-z */
-  if ((extension[0] >= 'a') && (extension[0] <= 'z') && (extension[1] >= 'a') && (extension[1] <= 'z')) {
-    res = extension[0] - 'a';
-    res <<= 5;
-    res |= extension[1] - 'a';
-    res += 1; /* plus 1, because id 0 is reserved for unmappable filetypes */
-  } else { /* this is an unmappable extension -> goes to id 0 */
-    res = 0;
+/* packs an extension into a lower-cased, NUL-padded key. returns -1 if the
+ * extension is too long to be mapped */
+static int makekey(uint64_t *key, const char *extension) {
+  unsigned char buff[16];
+  int x;
+  memset(buff, 0, sizeof(buff));
+  for (x = 0; extension[x] != 0; x++) {
+    if (x == MAXEXTLEN) return(-1);
+    buff[x] = extension[x];
+    if ((buff[x] >= 'A') && (buff[x] <= 'Z')) buff[x] += 'a' - 'A';
   }
-  return(res);
+  memcpy(key, buff, 16);
+  return(0);
 }
 
-/* adds an extension to an extmap db */
-static void additem(struct extmap_t *obj, char *ext, char type) {
-  int hashmap;
-  struct extmap_node *newnode;
-  newnode = calloc(1, sizeof(struct extmap_node) + strlen(ext));
-  if (newnode == NULL) return;
-  /* populate the new node with data */
-  copystringlcase(newnode->extension, ext);
-  newnode->type = type;
-  /* compute extension's hash map value looking at its lower case version */
-  hashmap = ext2map(newnode->extension);
-  /* attach the new node to the proper list */
-  newnode->next = obj->maplist[hashmap];
-  obj->maplist[hashmap] = newnode;
+/* hashes a key, the seed selecting one hash function out of a family */
+static uint64_t hashkey(const uint64_t *key, uint64_t seed) {
+  uint64_t h;
+  h = (key[0] ^ seed) * UINT64_C(0x9E3779B97F4A7C15);
+  h ^= h >> 32;
+  h = (h ^ key[1]) * UINT64_C(0xC2B2AE3D27D4EB4F);
+  h ^= h >> 29;
+  h *= UINT64_C(0x165667B19E3779F9);
+  h ^= h >> 32;
+  return(h);
+}
+
+/* adds an extension to the list of items to be compiled */
+static void additem(struct extmap_list *list, const char *ext, char type) {
+  struct extmap_item *item;
+  if (type == 0) return;  /* a zero type marks empty slots */
+  if (list->count == list->alloc) {
+    struct extmap_item *newitems;
+    long newalloc = list->alloc * 2 + 64;
+    newitems = realloc(list->items, newalloc * sizeof(struct extmap_item));
+    if (newitems == NULL) return;
+    list->items = newitems;
+    list->alloc = newalloc;
+  }
+  item = &(list->items[list->count]);
+  if (makekey(item->key, ext) != 0) return;  /* could never match anyway */
+  item->type = type;
+  item->order = list->count;
+  list->count++;
+}
+
+/* sorts items by extension, and for a given extension by decreasing order */
+static int itemcmp(const void *a, const void *b) {
+  const struct extmap_item *ia = a, *ib = b;
+  if (ia->key[0] != ib->key[0]) return((ia->key[0] < ib->key[0]) ? -1 : 1);
+  if (ia->key[1] != ib->key[1]) return((ia->key[1] < ib->key[1]) ? -1 : 1);
+  return((ia->order > ib->order) ? -1 : 1);
+}
+
+/* tries to place all items in a table of slotmask + 1 slots. returns 0 on
+ * success, -1 if some bucket could not be placed (the caller then retries
+ * with a bigger table) */
+static int placeitems(struct extmap_t *obj, const struct extmap_item *items, long count, long *bucketorder, long *bucketstart, long *placed) {
+  unsigned long bucketcount = obj->bucketmask + 1, b, slot;
+  long x, y, *byhash;
+  uint32_t d;
+
+  /* group items by bucket (counting sort) */
+  byhash = malloc(count * sizeof(long));
+  if (byhash == NULL) return(-1);
+  memset(bucketstart, 0, (bucketcount + 1) * sizeof(long));
+  for (x = 0; x < count; x++) bucketstart[(hashkey(items[x].key, 0) & obj->bucketmask) + 1]++;
+  for (b = 0; b < bucketcount; b++) bucketstart[b + 1] += bucketstart[b];
+  for (b = 0; b < bucketcount; b++) bucketorder[b] = bucketstart[b];
+  for (x = 0; x < count; x++) byhash[bucketorder[hashkey(items[x].key, 0) & obj->bucketmask]++] = x;
+
+  /* place the biggest buckets first, while the table is still mostly empty
+   * (counting sort on bucket sizes, placed holding the count of every size) */
+  memset(placed, 0, (count + 1) * sizeof(long));
+  for (b = 0; b < bucketcount; b++) placed[bucketstart[b + 1] - bucketstart[b]]++;
+  for (x = count, y = 0; x >= 0; x--) {
+    long n = placed[x];
+    placed[x] = y;
+    y += n;
+  }
+  for (b = 0; b < bucketcount; b++) bucketorder[placed[bucketstart[b + 1] - bucketstart[b]]++] = b;
+
+  memset(obj->slots, 0, (obj->slotmask + 1) * sizeof(struct extmap_slot));
+  for (b = 0; b < bucketcount; b++) {
+    long bucket = bucketorder[b], first = bucketstart[bucket], last = bucketstart[bucket + 1];
+    if (first == last) break;  /* all remaining buckets are empty */
+    for (d = 1; d != 0; d++) {
+      /* look for a displacement that sends every item of the bucket to a free slot */
+      for (x = first; x < last; x++) {
+        slot = hashkey(items[byhash[x]].key, d) & obj->slotmask;
+        if (obj->slots[slot].type != 0) break;
+        obj->slots[slot].type = 1;  /* taken, at least temporarily */
+        placed[x - first] = slot;
+      }
+      if (x == last) break;
+      for (y = first; y < x; y++) obj->slots[placed[y - first]].type = 0;
+      if (d == 65536) break;  /* give up, the table is too crowded */
+    }
+    if (x != last) {
+      free(byhash);
+      return(-1);
+    }
+    obj->displacements[bucket] = d;
+    for (x = first; x < last; x++) {
+      struct extmap_slot *s = &(obj->slots[placed[x - first]]);
+      s->key[0] = items[byhash[x]].key[0];
+      s->key[1] = items[byhash[x]].key[1];
+      s->type = items[byhash[x]].type;
+    }
+  }
+  free(byhash);
+  return(0);
+}
+
+/* compiles a list of items into a perfect hash table */
+static int compile(struct extmap_t *obj, struct extmap_list *list) {
+  long x, y, *bucketorder, *bucketstart, *placed;
+  unsigned long slotcount, bucketcount;
+  int res = -1;
+
+  /* drop duplicates, keeping the last definition of every extension */
+  qsort(list->items, list->count, sizeof(struct extmap_item), itemcmp);
+  for (x = 0, y = 0; x < list->count; x++) {
+    if ((y > 0) && (list->items[x].key[0] == list->items[y - 1].key[0]) && (list->items[x].key[1] == list->items[y - 1].key[1])) continue;
+    list->items[y++] = list->items[x];
+  }
+  list->count = y;
+
+  /* about two items per bucket, and a table at most half full */
+  for (bucketcount = 1; bucketcount * 2 < (unsigned long)list->count; bucketcount *= 2);
+  for (slotcount = 16; slotcount < (unsigned long)list->count * 2; slotcount *= 2);
+  bucketorder = malloc(bucketcount * sizeof(long));
+  bucketstart = malloc((bucketcount + 1) * sizeof(long));
+  placed = malloc((list->count + 1) * sizeof(long));
+  obj->displacements = calloc(bucketcount, sizeof(uint32_t));
+  obj->bucketmask = bucketcount - 1;
+  if ((bucketorder == NULL) || (bucketstart == NULL) || (placed == NULL) || (obj->displacements == NULL)) goto DONE;
+  for (;;) {
+    obj->slots = malloc(slotcount * sizeof(struct extmap_slot));
+    if (obj->slots == NULL) goto DONE;
+    obj->slotmask = slotcount - 1;
+    if (placeitems(obj, list->items, list->count, bucketorder, bucketstart, placed) == 0) break;
+    free(obj->slots);
+    obj->slots = NULL;
+    if (slotcount > (unsigned long)list->count * 64) goto DONE; /* should never happen */
+    slotcount *= 2;
+  }
+  res = 0;
+
+  DONE:
+  free(bucketorder);
+  free(bucketstart);
+  free(placed);
+  return(res);
 }
 
 /* loads a extension->filetype mapping file, or loads a default map if file is NULL */
@@ -102,109 +237,100 @@ struct extmap_t *extmap_load(const char *file) {
   FILE *fd;
   int eofflag;
   char linebuff[64];
+  struct extmap_list list;
   struct extmap_t *res;
   res = calloc(1, sizeof(struct extmap_t));
   if (res == NULL) return(NULL);
+  memset(&list, 0, sizeof(list));
   /* set default fallback type */
   res->fallback = '9';
   /* load a default map if file is NULL */
   if (file == NULL) {
-    additem(res, "aac", 's');
-    additem(res, "aiff", 's');
-    additem(res, "bas", '0');
-    additem(res, "bmp", 'I');
-    additem(res, "c", '0');
-    additem(res, "cpp", '0');
-    additem(res, "css", '0');
-    additem(res, "eps", 'I');
-    additem(res, "flac", 's');
-    additem(res, "gif", 'g');
-    additem(res, "htm", 'h');
-    additem(res, "html", 'h');
-    additem(res, "ico", 'I');
-    additem(res, "jpeg", 'I');
-    additem(res, "jpg", 'I');
-    additem(res, "mp2", 's');
-    additem(res, "mp3", 's');
-    additem(res, "mpc", 's');
-    additem(res, "mid", 's');
-    additem(res, "ogg", 's');
-    additem(res, "pas", '0');
-    additem(res, "pcx", 'I');
-    additem(res, "pdf", 'P');
-    additem(res, "png", 'I');
-    additem(res, "tif", 'I');
-    additem(res, "tiff", 'I');
-    additem(res, "txt", '0');
-    additem(res, "svg", 'I');
-    additem(res, "wav", 's');
-    additem(res, "wma", 's');
-    return(res);
+    additem(&list, "aac", 's');
+    additem(&list, "aiff", 's');
+    additem(&list, "bas", '0');
+    additem(&list, "bmp", 'I');
+    additem(&list, "c", '0');
+    additem(&list, "cpp", '0');
+    additem(&list, "css", '0');
+    additem(&list, "eps", 'I');
+    additem(&list, "flac", 's');
+    additem(&list, "gif", 'g');
+    additem(&list, "htm", 'h');
+    additem(&list, "html", 'h');
+    additem(&list, "ico", 'I');
+    additem(&list, "jpeg", 'I');
+    additem(&list, "jpg", 'I');
+    additem(&list, "mp2", 's');
+    additem(&list, "mp3", 's');
+    additem(&list, "mpc", 's');
+    additem(&list, "mid", 's');
+    additem(&list, "ogg", 's');
+    additem(&list, "pas", '0');
+    additem(&list, "pcx", 'I');
+    additem(&list, "pdf", 'P');
+    additem(&list, "png", 'I');
+    additem(&list, "tif", 'I');
+    additem(&list, "tiff", 'I');
+    additem(&list, "txt", '0');
+    additem(&list, "svg", 'I');
+    additem(&list, "wav", 's');
+    additem(&list, "wma", 's');
+  } else {
+    /* a real file has been provided -> load it */
+    fd = fopen(file, "rb");
+    if (fd == NULL) {
+      free(res);
+      return(NULL);
+    }
+    /* load types (read line by line, and parse) */
+    for (;;) {
+      eofflag = getlinefromfile(fd, linebuff, 63);
+      /* compute string length, and right trim */
+      slen = rtrimgetlen(linebuff);
+      /* skip lines shorter than 2 chars */
+      if (slen < 2) {
+        if (eofflag != 0) break;
+        continue;
+      }
+      /* skip comments and lines starting with a space */
+      if ((linebuff[0] == '#') || (linebuff[0] == ' ')) continue;
+      /* check that the line is ending with a colon ':' followed by filetype */
+      if (linebuff[slen - 2] != ':') continue;
+      /* separate string and add new type */
+      linebuff[slen - 2] = 0;
+      additem(&list, linebuff, linebuff[slen - 1]);
+    }
+    fclose(fd);
   }
-  /* a real file has been provided -> load it */
-  fd = fopen(file, "rb");
-  if (fd == NULL) {
-    free(res);
+  /* turn the list into the final hash table */
+  if (compile(res, &list) != 0) {
+    free(list.items);
+    extmap_free(res);
     return(NULL);
   }
-  /* load types (read line by line, and parse) */
-  for (;;) {
-    eofflag = getlinefromfile(fd, linebuff, 63);
-    /* compute string length, and right trim */
-    slen = rtrimgetlen(linebuff);
-    /* skip lines shorter than 2 chars */
-    if (slen < 2) {
-      if (eofflag != 0) break;
-      continue;
-    }
-    /* skip comments and lines starting with a space */
-    if ((linebuff[0] == '#') || (linebuff[0] == ' ')) continue;
-    /* check that the line is ending with a colon ':' followed by filetype */
-    if (linebuff[slen - 2] != ':') continue;
-    /* separate string and add new type */
-    linebuff[slen - 2] = 0;
-    additem(res, linebuff, linebuff[slen - 1]);
-  }
-  fclose(fd);
+  free(list.items);
   return(res);
 }
 
 /* frees the memory allocated to an extmap */
 void extmap_free(struct extmap_t *obj) {
-  int x;
-  struct extmap_node *lnode, *previousnode;
-  /* iterate through all mappings, and free linked lists */
-  for (x = 0; x < 676; x++) {
-    lnode = obj->maplist[x];
-    while (lnode != NULL) {
-      previousnode = lnode;
-      lnode = lnode->next;
-      free(previousnode);
-    }
-  }
-  /* finally, free the container itself */
+  free(obj->slots);
+  free(obj->displacements);
   free(obj);
 }
 
 /* performs a lookup of an extension in our mapping system, and return the gopher type char */
 char extmap_lookup(const struct extmap_t *obj, const char *extension) {
-  char lowext[16];
-  struct extmap_node *rootnode;
-
-  /* if the extension is longer than 15 chars, do not map */
-  if (strlen(extension) > 15) return(obj->fallback);
+  const struct extmap_slot *slot;
+  uint64_t key[2];
 
-  /* convert the extension to lower case */
-  copystringlcase(lowext, extension);
+  /* extensions longer than 15 chars are never mapped */
+  if (makekey(key, extension) != 0) return(obj->fallback);
 
-  /* select the proper linked list, by mapping the extension */
-  rootnode = obj->maplist[ext2map(lowext)];
-
-  /* iterate through the list to match an extension */
-  while (rootnode != NULL) {
-    if (strcmp(rootnode->extension, lowext) == 0) return(rootnode->type);
-    rootnode = rootnode->next;
-  }
+  /* two hashes, and a single slot to check */
+  slot = &(obj->slots[hashkey(key, obj->displacements[hashkey(key, 0) & obj->bucketmask]) & obj->slotmask]);
+  if ((slot->type != 0) && (slot->key[0] == key[0]) && (slot->key[1] == key[1])) return(slot->type);
 
   /* if nothing matched, return the default type */
   return(obj->fallback);
@@ -1,22 +1,284 @@
 /*
- * Test application for extmap.
+ * Test & benchmark application for extmap.
+ *
+ * Either performs lookups of the extensions given on the command line, or
+ * benchmarks the perfect hash table against the legacy engine (linked lists
+ * hashed on the two first letters) on the default map and on big generated
+ * maps, checking on the way that both engines always agree.
  *
  * This file is part of the Motsognir gopher server.
- * Copyright (C) 2014 Mateusz Viste
+ * Copyright (C) 2014-2019 Mateusz Viste
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "extmap.h"
-#include <stdio.h>
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+/*** the legacy engine (as motsognir used it up to v1.0.11) ***/
+
+struct legacy_node {
+  struct legacy_node *next;
+  char type;
+  char extension[1];
+};
+
+struct legacy_t {
+  struct legacy_node *maplist[1024];
+  char fallback;
+};
+
+static void legacy_lcase(char *dst, const char *src) {
+  int x;
+  for (x = 0; src[x] != 0; x++) dst[x] = ((src[x] >= 'A') && (src[x] <= 'Z')) ? src[x] + ('a' - 'A') : src[x];
+  dst[x] = 0;
+}
+
+static int legacy_ext2map(const char *extension) {
+  if ((extension[0] >= 'a') && (extension[0] <= 'z') && (extension[1] >= 'a') && (extension[1] <= 'z')) {
+    return((((extension[0] - 'a') << 5) | (extension[1] - 'a')) + 1);
+  }
+  return(0);
+}
+
+static void legacy_additem(struct legacy_t *obj, const char *ext, char type) {
+  struct legacy_node *newnode;
+  int hashmap;
+  newnode = calloc(1, sizeof(struct legacy_node) + strlen(ext));
+  if (newnode == NULL) return;
+  legacy_lcase(newnode->extension, ext);
+  newnode->type = type;
+  hashmap = legacy_ext2map(newnode->extension);
+  newnode->next = obj->maplist[hashmap];
+  obj->maplist[hashmap] = newnode;
+}
+
+/* loads either the default map (if file is NULL) or a map file, with the
+ * same parsing rules as extmap_load() */
+static struct legacy_t *legacy_load(const char *file) {
+  static const char *defmap[] = {"aac:s", "aiff:s", "bas:0", "bmp:I", "c:0", "cpp:0", "css:0", "eps:I", "flac:s", "gif:g", "htm:h", "html:h", "ico:I", "jpeg:I", "jpg:I", "mp2:s", "mp3:s", "mpc:s", "mid:s", "ogg:s", "pas:0", "pcx:I", "pdf:P", "png:I", "tif:I", "tiff:I", "txt:0", "svg:I", "wav:s", "wma:s", NULL};
+  struct legacy_t *res;
+  char linebuff[128];
+  FILE *fd;
+  int x, slen;
+  res = calloc(1, sizeof(struct legacy_t));
+  if (res == NULL) return(NULL);
+  res->fallback = '9';
+  if (file == NULL) {
+    for (x = 0; defmap[x] != NULL; x++) {
+      snprintf(linebuff, sizeof(linebuff), "%s", defmap[x]);
+      linebuff[strlen(linebuff) - 2] = 0;
+      legacy_additem(res, linebuff, defmap[x][strlen(defmap[x]) - 1]);
+    }
+    return(res);
+  }
+  fd = fopen(file, "rb");
+  if (fd == NULL) {
+    free(res);
+    return(NULL);
+  }
+  while (fgets(linebuff, sizeof(linebuff), fd) != NULL) {
+    linebuff[strcspn(linebuff, "\r\n")] = 0;
+    slen = strlen(linebuff);
+    if (slen < 2) continue;
+    if ((linebuff[0] == '#') || (linebuff[0] == ' ') || (linebuff[slen - 2] != ':')) continue;
+    linebuff[slen - 2] = 0;
+    legacy_additem(res, linebuff, linebuff[slen - 1]);
+  }
+  fclose(fd);
+  return(res);
+}
+
+static void legacy_free(struct legacy_t *obj) {
+  struct legacy_node *lnode, *next;
+  int x;
+  for (x = 0; x < 1024; x++) {
+    for (lnode = obj->maplist[x]; lnode != NULL; lnode = next) {
+      next = lnode->next;
+      free(lnode);
+    }
+  }
+  free(obj);
+}
+
+static char legacy_lookup(const struct legacy_t *obj, const char *extension) {
+  char lowext[16];
+  struct legacy_node *node;
+  if (strlen(extension) > 15) return(obj->fallback);
+  legacy_lcase(lowext, extension);
+  for (node = obj->maplist[legacy_ext2map(lowext)]; node != NULL; node = node->next) {
+    if (strcmp(node->extension, lowext) == 0) return(node->type);
+  }
+  return(obj->fallback);
+}
+
+
+/*** benchmark ***/
+
+/* a random extension of 1..maxlen chars, mostly letters, some digits and symbols */
+static void randext(char *s, int maxlen) {
+  static const char *charset = "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz0123456789_-+";
+  int len = 1 + rand() % maxlen, x;
+  for (x = 0; x < len; x++) s[x] = charset[rand() % 65];
+  s[len] = 0;
+}
+
+/* writes a map of count random extensions (with some duplicates) to file */
+static int genmap(const char *file, long count) {
+  static const char *types = "0gIs9Phc";
+  char ext[32];
+  FILE *fd;
+  long x;
+  fd = fopen(file, "wb");
+  if (fd == NULL) return(-1);
+  fputs("# generated by extmaptest\n", fd);
+  for (x = 0; x < count; x++) {
+    randext(ext, (x % 100 == 99) ? 20 : 8);
+    fprintf(fd, "%s:%c\n", ext, types[rand() % 8]);
+  }
+  fclose(fd);
+  return(0);
+}
+
+/* builds a set of queries: half of them are extensions found in the map
+ * file (with random case), the other half are random */
+static char (*genqueries(const char *file, long count))[24] {
+  char (*queries)[24];
+  char **known = NULL, linebuff[128];
+  long knowncount = 0, x;
+  FILE *fd;
+  int i;
+  queries = malloc(count * sizeof(*queries));
+  if (queries == NULL) return(NULL);
+  if (file != NULL) {
+    fd = fopen(file, "rb");
+    if (fd != NULL) {
+      while (fgets(linebuff, sizeof(linebuff), fd) != NULL) {
+        char *colon = strrchr(linebuff, ':');
+        if ((linebuff[0] == '#') || (colon == NULL)) continue;
+        *colon = 0;
+        known = realloc(known, (knowncount + 1) * sizeof(char *));
+        known[knowncount++] = strdup(linebuff);
+      }
+      fclose(fd);
+    }
+  } else {
+    static const char *defmap[] = {"aac", "gif", "html", "JPG", "c", "Txt", "pdf", "wma", "TIFF", "mp3"};
+    for (x = 0; x < 10; x++) {
+      known = realloc(known, (knowncount + 1) * sizeof(char *));
+      known[knowncount++] = strdup(defmap[x]);
+    }
+  }
+  for (x = 0; x < count; x++) {
+    if ((x & 1) && (knowncount > 0)) {
+      snprintf(queries[x], sizeof(queries[x]), "%s", known[rand() % knowncount]);
+      for (i = 0; queries[x][i] != 0; i++) {
+        if ((rand() % 4 == 0) && (queries[x][i] >= 'a') && (queries[x][i] <= 'z')) queries[x][i] -= 'a' - 'A';
+      }
+    } else {
+      randext(queries[x], 20);
+    }
+  }
+  for (x = 0; x < knowncount; x++) free(known[x]);
+  free(known);
+  return(queries);
+}
+
+/* checks both engines on a map and compares their speed. returns 0 if they agree */
+static int bench(const char *title, const char *file, long lookups, long legacylookups) {
+  struct extmap_t *extmap;
+  struct legacy_t *legacy;
+  char (*queries)[24];
+  long x, querycount = 65536, mismatches = 0;
+  double t, t_phash, t_legacy;
+  volatile char sink = 0;
+
+  t = now();
+  extmap = extmap_load(file);
+  t = now() - t;
+  legacy = legacy_load(file);
+  queries = genqueries(file, querycount);
+  if ((extmap == NULL) || (legacy == NULL) || (queries == NULL)) {
+    printf("%s: failed to load the map\n", title);
+    return(1);
+  }
+
+  for (x = 0; (x < querycount) && (x < legacylookups); x++) {
+    if (extmap_lookup(extmap, queries[x]) != legacy_lookup(legacy, queries[x])) {
+      if (mismatches++ < 5) printf("  MISMATCH on '%s': %c vs %c\n", queries[x], extmap_lookup(extmap, queries[x]), legacy_lookup(legacy, queries[x]));
+    }
+  }
+
+  t_phash = now();
+  for (x = 0; x < lookups; x++) sink ^= extmap_lookup(extmap, queries[x & (querycount - 1)]);
+  t_phash = now() - t_phash;
+  t_legacy = now();
+  for (x = 0; x < legacylookups; x++) sink ^= legacy_lookup(legacy, queries[x & (querycount - 1)]);
+  t_legacy = (now() - t_legacy) * lookups / legacylookups;
+
+  printf("%-14s %9.1f ms %12.1f M/s %12.1f M/s %8.1fx%s\n", title, t * 1000, lookups / t_phash / 1000000, lookups / t_legacy / 1000000, t_legacy / t_phash, (mismatches != 0) ? "  MISMATCH!" : "");
+  extmap_free(extmap);
+  legacy_free(legacy);
+  free(queries);
+  return(mismatches != 0);
+}
 
 
 int main(int argc, char **argv) {
   struct extmap_t *extmap;
-  int extnum;
+  int extnum, res = 0;
+
+  /* benchmark mode */
+  if ((argc >= 2) && (strcmp(argv[1], "-b") == 0)) {
+    static const long sizes[] = {100, 1000, 10000, 100000, 1000000, 0};
+    char tmpfile[] = "/tmp/extmaptest-XXXXXX";
+    char title[32];
+    long lookups = 2000000;
+    int fd, x;
+    if (argc >= 3) lookups = atol(argv[2]);
+    if (lookups < 1) lookups = 1;
+    fd = mkstemp(tmpfile);
+    if (fd < 0) {
+      puts("failed to create a temporary file");
+      return(1);
+    }
+    close(fd);
+    srand(1);
+    printf("benchmark of %ld lookups per map (half hits, half misses)\n", lookups);
+    printf("%-14s %12s %16s %16s %9s\n", "map", "load time", "perfect hash", "legacy", "speedup");
+    res |= bench("default", NULL, lookups, lookups);
+    for (x = 0; sizes[x] != 0; x++) {
+      snprintf(title, sizeof(title), "%ld exts", sizes[x]);
+      if (genmap(tmpfile, sizes[x]) != 0) {
+        res = 1;
+        break;
+      }
+      /* the legacy engine scans long lists on big maps, so it is given
+       * fewer lookups there (its time is scaled accordingly) */
+      res |= bench(title, tmpfile, lookups, (sizes[x] > 1000) ? lookups * 1000 / sizes[x] + 1 : lookups);
+    }
+    unlink(tmpfile);
+    return(res);
+  }
 
   if (argc < 3) {
-    puts("extmaptest is a simple tool to test motsognir's extmap engine.");
+    puts("extmaptest is a simple tool to test and benchmark motsognir's extmap engine.");
     puts("usage: extmaptest file.conf ext1 [ext2] ... [extN]");
+    puts("       extmaptest -b [lookups]");
+    puts("");
+    puts("an empty file.conf (\"\") loads the default map");
     return(1);
   }
 
@@ -0,0 +1,340 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides Gopher+ support: parsing of Gopher+ requests, and attribute blocks
+ * (+INFO, +ADMIN, +VIEWS and +ABSTRACT) of items and whole directories.
+ *
+ * A directory attributes request ('$') describes every item of a menu, hence
+ * needs the type, size and date of every entry of the directory. Names and
+ * types come from the pre-computed listing of the directory (see dirindex.c),
+ * which is built on the spot if it is missing or out of date, so the
+ * directory is neither listed nor sorted. Sizes and dates are not taken from
+ * the listing, as files may be rewritten without their directory changing:
+ * each entry is fstatat()ed when its attributes are asked for. Abstracts are
+ * looked up in the '.abstract' subdirectory, which is listed once: only the
+ * entries that have an abstract cost an extra open().
+ */
+
+#include <ctype.h>       /* isupper() */
+#include <errno.h>
+#include <fcntl.h>       /* open(), fstatat() */
+#include <stdio.h>       /* snprintf() */
+#include <stdlib.h>      /* malloc(), calloc(), free() */
+#include <string.h>
+#include <unistd.h>      /* read(), close() */
+#include <sys/stat.h>    /* stat(), mkdir() */
+
+#include "dirindex.h"
+#include "dirlist.h"
+#include "http.h"        /* http_contenttype() */
+#include "gopherplus.h"  /* include self for control */
+
+struct gopherplus_entry {
+  const char *name;
+  char type;
+  char isdir;
+  char hasabstract;
+};
+
+struct gopherplus_dir {
+  char *dirpath;
+  int dirfd;                   /* entries are fstatat()ed from there */
+  struct dirindex_t *idx;      /* the index entries come from, if any */
+  struct dirlist_t *dirlist;   /* the listing entries come from otherwise */
+  struct gopherplus_entry *entries;
+  long count;
+  long *hash;                  /* entry numbers (+1, 0 being a free slot), by name */
+  long hashsize;
+  char abstract[GOPHERPLUS_MAXABSTRACT + 1];
+};
+
+
+int gopherplus_parse(char *selector, char *attrs, int attrssize) {
+  char *field, *p;
+  char kind;
+
+  attrs[0] = 0;
+  field = strrchr(selector, '\t');
+  if (field == NULL) return(0);
+  kind = field[1];
+  p = field + 2;
+  switch (kind) {
+    case '+': /* '+' alone, or followed by a view ('+text/plain') */
+      if ((*p != 0) && (strchr(p, '/') == NULL)) return(0);
+      break;
+    case '!':
+    case '$': /* optionally followed by attribute names ('+INFO+ABSTRACT') */
+      if ((*p != 0) && (*p != '+')) return(0);
+      for (; *p != 0; p++) {
+        if ((*p != '+') && (!isupper((unsigned char)*p))) return(0);
+      }
+      if ((int)strlen(field + 2) >= attrssize) return(0);
+      strcpy(attrs, field + 2);
+      break;
+    default:
+      return(0);
+  }
+  *field = 0;
+  return(kind);
+}
+
+
+/* returns non-zero if attribute block name is wanted, according to attrs */
+static int wanted(const char *attrs, const char *name) {
+  const char *p;
+  int len = strlen(name);
+  if (attrs[0] == 0) return(1);
+  for (p = strstr(attrs, name); p != NULL; p = strstr(p + 1, name)) {
+    if ((p[len] == 0) || (p[len] == '+')) return(1);
+  }
+  return(0);
+}
+
+
+/* formats a size the way Gopher+ views do ('<12k>') */
+static void formatsize(char *buff, int buffsize, unsigned long size) {
+  if (size < 1024) {
+    snprintf(buff, buffsize, "<%lub>", size);
+  } else if (size < 10ul * 1024 * 1024) {
+    snprintf(buff, buffsize, "<%luk>", (size + 512) / 1024);
+  } else {
+    snprintf(buff, buffsize, "<%luM>", (size + 512 * 1024) / (1024 * 1024));
+  }
+}
+
+
+void gopherplus_block(const struct gopherplus_item *item, const char *admin, const char *attrs, gopherplus_emit_t emit, void *ctx) {
+  char line[2048], sizestr[32], date[64], stamp[16];
+  const char *p, *ext, *contenttype;
+  struct tm tm;
+  int len;
+
+  snprintf(line, sizeof(line), "+INFO: %c%s\t%s\t%s\t%ld%s", item->type, item->name, item->selector, item->host, item->port, (item->plus != 0) ? "\t+" : "");
+  emit(ctx, line);
+  if (item->hasattrs == 0) return;
+
+  if (wanted(attrs, "ADMIN")) {
+    localtime_r(&(item->mtime), &tm);
+    strftime(date, sizeof(date), "%a %b %d %H:%M:%S %Y", &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d%H%M%S", &tm);
+    emit(ctx, "+ADMIN:");
+    snprintf(line, sizeof(line), " Admin: %s", admin);
+    emit(ctx, line);
+    snprintf(line, sizeof(line), " Mod-Date: %s <%s>", date, stamp);
+    emit(ctx, line);
+  }
+
+  if (wanted(attrs, "VIEWS")) {
+    contenttype = item->contenttype;
+    if (contenttype == NULL) {
+      if ((item->isdir != 0) || (item->type == '1')) {
+        contenttype = "application/gopher-menu";
+      } else {
+        ext = strrchr(item->name, '.');
+        contenttype = http_contenttype((ext != NULL) ? ext + 1 : NULL, item->type);
+      }
+    }
+    emit(ctx, "+VIEWS:");
+    if (item->isdir != 0) { /* the size of a menu is not known in advance */
+      snprintf(line, sizeof(line), " %s:", contenttype);
+    } else {
+      formatsize(sizestr, sizeof(sizestr), item->size);
+      snprintf(line, sizeof(line), " %s: %s", contenttype, sizestr);
+    }
+    emit(ctx, line);
+  }
+
+  if ((item->abstract != NULL) && (wanted(attrs, "ABSTRACT"))) {
+    emit(ctx, "+ABSTRACT:");
+    /* every line of the block starts with a space */
+    for (p = item->abstract; *p != 0;) {
+      line[0] = ' ';
+      for (len = 1; (*p != 0) && (*p != '\n'); p++) {
+        if ((*p == '\r') || (len >= (int)sizeof(line) - 1)) continue;
+        line[len++] = ((unsigned char)*p < 32) ? ' ' : *p;
+      }
+      line[len] = 0;
+      emit(ctx, line);
+      if (*p == '\n') p++;
+    }
+  }
+}
+
+
+int gopherplus_readabstract(const char *dirpath, const char *name, char *buff, int buffsize) {
+  char path[4096];
+  int fd, len = 0, n;
+  snprintf(path, sizeof(path), "%s/%s/%s", dirpath, GOPHERPLUS_ABSTRACTDIR, name);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return(-1);
+  while (len < buffsize - 1) {
+    n = read(fd, buff + len, buffsize - 1 - len);
+    if ((n < 0) && (errno == EINTR)) continue;
+    if (n <= 0) break;
+    len += n;
+  }
+  close(fd);
+  /* no trailing newlines */
+  while ((len > 0) && ((buff[len - 1] == '\n') || (buff[len - 1] == '\r'))) len--;
+  buff[len] = 0;
+  return(len);
+}
+
+
+/* hashes a name (FNV-1a) */
+static unsigned long hashname(const char *s) {
+  unsigned long h = 2166136261ul;
+  for (; *s != 0; s++) h = (h ^ (unsigned char)*s) * 16777619ul;
+  return(h);
+}
+
+
+/* returns the number of entry name, or -1 if there is none */
+static long findentry(const struct gopherplus_dir *dir, const char *name) {
+  long slot, n;
+  for (slot = hashname(name) & (dir->hashsize - 1); (n = dir->hash[slot]) != 0; slot = (slot + 1) & (dir->hashsize - 1)) {
+    if (strcmp(dir->entries[n - 1].name, name) == 0) return(n - 1);
+  }
+  return(-1);
+}
+
+
+/* opens the index of dirpath, (re)building it first if needed */
+static struct dirindex_t *openindex(const char *dirpath, const struct stat *dirst, const char *indexfile, const struct extmap_t *extmap, int charset) {
+  struct dirindex_t *idx;
+  char indexdir[4096];
+  char *p;
+  idx = dirindex_open(indexfile, dirst);
+  if (idx != NULL) return(idx);
+  /* the directory of the index may not exist yet (a new directory) */
+  snprintf(indexdir, sizeof(indexdir), "%s", indexfile);
+  p = strrchr(indexdir, '/');
+  if (p != NULL) {
+    *p = 0;
+    mkdir(indexdir, 0755);
+  }
+  if (dirindex_build(dirpath, dirst, indexfile, extmap, charset) != 0) return(NULL);
+  return(dirindex_open(indexfile, dirst));
+}
+
+
+/* lists dirpath and types its entries, the way dirindex_build() does */
+static int listdir(struct gopherplus_dir *dir, const struct extmap_t *extmap) {
+  const char *ext;
+  long x;
+  dir->dirlist = dirlist_load(dir->dirpath, dirlist_menufilter);
+  if (dir->dirlist == NULL) return(-1);
+  dir->count = dirlist_count(dir->dirlist);
+  dir->entries = calloc(dir->count + 1, sizeof(struct gopherplus_entry));
+  if (dir->entries == NULL) return(-1);
+  for (x = 0; x < dir->count; x++) {
+    struct gopherplus_entry *e = &(dir->entries[x]);
+    e->name = dirlist_name(dir->dirlist, x);
+    e->isdir = (dirlist_isdir(dir->dirlist, x) != 0);
+    if (e->isdir != 0) {
+      e->type = '1';
+    } else {
+      ext = strrchr(e->name, '.');
+      e->type = extmap_lookup(extmap, (ext != NULL) ? ext + 1 : "");
+    }
+  }
+  return(0);
+}
+
+
+struct gopherplus_dir *gopherplus_opendir(const char *dirpath, const char *indexfile, const struct extmap_t *extmap, int charset) {
+  struct gopherplus_dir *dir;
+  struct dirlist_t *abstracts;
+  char path[4096];
+  struct stat st;
+  long x, slot;
+
+  if (stat(dirpath, &st) != 0) return(NULL);
+  dir = calloc(1, sizeof(struct gopherplus_dir));
+  if (dir == NULL) return(NULL);
+  dir->dirfd = open(dirpath, O_RDONLY | O_DIRECTORY);
+  dir->dirpath = strdup(dirpath);
+  if ((dir->dirfd < 0) || (dir->dirpath == NULL)) goto FAIL;
+
+  if (indexfile != NULL) dir->idx = openindex(dirpath, &st, indexfile, extmap, charset);
+  if (dir->idx != NULL) {
+    dir->count = dirindex_count(dir->idx);
+    dir->entries = calloc(dir->count + 1, sizeof(struct gopherplus_entry));
+    if (dir->entries == NULL) goto FAIL;
+    for (x = 0; x < dir->count; x++) {
+      struct dirindex_entry e;
+      if (dirindex_get(dir->idx, x, &e) != 0) break;
+      dir->entries[x].name = e.name;
+      dir->entries[x].type = e.type;
+      dir->entries[x].isdir = (e.isdir != 0);
+    }
+    if (x < dir->count) { /* a failing index is ignored */
+      dirindex_close(dir->idx);
+      dir->idx = NULL;
+      free(dir->entries);
+      dir->entries = NULL;
+    }
+  }
+  if ((dir->idx == NULL) && (listdir(dir, extmap) != 0)) goto FAIL;
+
+  /* hash entries by name (the table is at most half full) */
+  for (dir->hashsize = 16; dir->hashsize < dir->count * 2; dir->hashsize *= 2);
+  dir->hash = calloc(dir->hashsize, sizeof(long));
+  if (dir->hash == NULL) goto FAIL;
+  for (x = 0; x < dir->count; x++) {
+    for (slot = hashname(dir->entries[x].name) & (dir->hashsize - 1); dir->hash[slot] != 0; slot = (slot + 1) & (dir->hashsize - 1));
+    dir->hash[slot] = x + 1;
+  }
+
+  /* flag entries that have an abstract */
+  snprintf(path, sizeof(path), "%s/%s", dirpath, GOPHERPLUS_ABSTRACTDIR);
+  abstracts = dirlist_load(path, dirlist_menufilter);
+  if (abstracts != NULL) {
+    for (x = 0; x < dirlist_count(abstracts); x++) {
+      slot = findentry(dir, dirlist_name(abstracts, x));
+      if (slot >= 0) dir->entries[slot].hasabstract = 1;
+    }
+    dirlist_free(abstracts);
+  }
+  return(dir);
+
+  FAIL:
+  gopherplus_closedir(dir);
+  return(NULL);
+}
+
+
+int gopherplus_isindexed(const struct gopherplus_dir *dir) {
+  return(dir->idx != NULL);
+}
+
+
+int gopherplus_getattrs(struct gopherplus_dir *dir, const char *name, struct gopherplus_item *item) {
+  const struct gopherplus_entry *e;
+  struct stat st;
+  long n;
+  n = findentry(dir, name);
+  if ((n < 0) || (fstatat(dir->dirfd, name, &st, 0) != 0)) return(-1);
+  e = &(dir->entries[n]);
+  item->type = e->type;
+  item->hasattrs = 1;
+  item->isdir = e->isdir;
+  item->size = st.st_size;
+  item->mtime = st.st_mtime;
+  item->abstract = NULL;
+  if ((e->hasabstract != 0) && (gopherplus_readabstract(dir->dirpath, name, dir->abstract, sizeof(dir->abstract)) >= 0)) item->abstract = dir->abstract;
+  return(0);
+}
+
+
+void gopherplus_closedir(struct gopherplus_dir *dir) {
+  if (dir == NULL) return;
+  if (dir->dirfd >= 0) close(dir->dirfd);
+  free(dir->hash);
+  free(dir->entries);
+  if (dir->dirlist != NULL) dirlist_free(dir->dirlist);
+  dirindex_close(dir->idx);
+  free(dir->dirpath);
+  free(dir);
+}
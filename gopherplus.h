@@ -0,0 +1,77 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides Gopher+ support: parsing of Gopher+ requests, and attribute blocks
+ * (+INFO, +ADMIN, +VIEWS and +ABSTRACT) of items and whole directories
+ */
+
+#ifndef gopherplus_h_sentinel
+#define gopherplus_h_sentinel
+
+#include <time.h>
+
+#include "extmap.h"
+
+/* abstracts of entries are read from the '.abstract' subdirectory of their
+ * directory, in a file named like the entry itself */
+#define GOPHERPLUS_ABSTRACTDIR ".abstract"
+#define GOPHERPLUS_MAXABSTRACT 4096  /* abstracts longer than this are truncated */
+
+struct gopherplus_item {
+  char type;
+  const char *name;
+  const char *selector;     /* as sent in menus (percent-encoded) */
+  const char *host;
+  long port;
+  int plus;                 /* non-zero if the item is served by a Gopher+ server */
+  int hasattrs;             /* non-zero if the fields below are set */
+  int isdir;
+  unsigned long size;
+  time_t mtime;
+  const char *contenttype;  /* NULL to derive it from the name and type */
+  const char *abstract;     /* NULL if none */
+};
+
+struct gopherplus_dir;
+
+/* called with every line of a block, without any CRLF terminator */
+typedef void (*gopherplus_emit_t)(void *ctx, const char *line);
+
+/* detects a Gopher+ request: a selector whose last tab-separated field is
+ * '+' (optionally followed by a view), '!' (item attributes) or '$'
+ * (directory attributes), the latter two being optionally followed by the
+ * names of the attributes wanted ('!+ABSTRACT'). the field is cut off the
+ * selector, and the attribute names are copied to attrs (empty if all are
+ * wanted). returns the kind of request ('+', '!' or '$'), or 0 if the
+ * selector is not a Gopher+ one */
+int gopherplus_parse(char *selector, char *attrs, int attrssize);
+
+/* emits the attribute block of an item. +INFO is always present, other
+ * blocks only if item->hasattrs is set and attrs is empty or names them */
+void gopherplus_block(const struct gopherplus_item *item, const char *admin, const char *attrs, gopherplus_emit_t emit, void *ctx);
+
+/* reads the abstract of entry name in directory dirpath into buff. returns
+ * its length, or -1 if the entry has no abstract */
+int gopherplus_readabstract(const char *dirpath, const char *name, char *buff, int buffsize);
+
+/* loads the names and types of all the entries of directory dirpath. they
+ * come from the directory's index (as built by motsognir-index) if indexfile
+ * is not NULL: a missing or out of date index is built first, and if that
+ * fails (read-only index tree...), the directory is listed directly. indexes
+ * are built for the output charset (see charset.h) */
+struct gopherplus_dir *gopherplus_opendir(const char *dirpath, const char *indexfile, const struct extmap_t *extmap, int charset);
+
+/* returns non-zero if the attributes were loaded from an index */
+int gopherplus_isindexed(const struct gopherplus_dir *dir);
+
+/* fills the type, size, date and abstract of entry name in item (and sets
+ * item->hasattrs). the size and date are the current ones of the entry, not
+ * the ones its index was built with. the abstract stays valid until the next
+ * call. returns -1 if the directory has no such entry */
+int gopherplus_getattrs(struct gopherplus_dir *dir, const char *name, struct gopherplus_item *item);
+
+/* frees a directory loaded with gopherplus_opendir() */
+void gopherplus_closedir(struct gopherplus_dir *dir);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * Test & benchmark application for Gopher+ attributes.
+ *
+ * Checks the parsing of Gopher+ requests and the formatting of attribute
+ * blocks, then fills a temporary directory with files (some of them having an
+ * abstract) and compares the attributes loaded through the directory's index
+ * against the ones obtained by listing the directory, both for correctness and
+ * for speed. Also checks that a file rewritten after the index was built gets
+ * its new size.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>   /* mkdir() */
+
+#include "charset.h"
+#include "gopherplus.h"
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+struct parsetest {
+  const char *selector;
+  int kind;
+  const char *rest;   /* selector, once the Gopher+ field is cut off */
+  const char *attrs;
+};
+
+static struct parsetest parsetests[] = {
+  {"/docs/a.txt", 0, "/docs/a.txt", ""},
+  {"/docs/a.txt\t+", '+', "/docs/a.txt", ""},
+  {"/docs/a.txt\t+text/plain", '+', "/docs/a.txt", ""},
+  {"/docs/a.txt\t!", '!', "/docs/a.txt", ""},
+  {"/docs/a.txt\t!+ABSTRACT+VIEWS", '!', "/docs/a.txt", "+ABSTRACT+VIEWS"},
+  {"\t$", '$', "", ""},
+  {"/docs\t$+INFO", '$', "/docs", "+INFO"},
+  {"/search\tsome words\t+", '+', "/search\tsome words", ""},
+  {"/search\t+words", 0, "/search\t+words", ""},
+  {"/search\t!wow", 0, "/search\t!wow", ""},
+  {"/search\t$5", 0, "/search\t$5", ""},
+  {NULL, 0, NULL, NULL}
+};
+
+
+/* appends lines to a buffer, with a LF after each */
+static void emit(void *ctx, const char *line) {
+  strcat((char *)ctx, line);
+  strcat((char *)ctx, "\n");
+}
+
+
+/* fills the attributes of all entries of a directory into items, and returns
+ * the time it took */
+static double loadall(const char *dirpath, const char *indexfile, const struct extmap_t *extmap, int count, struct gopherplus_item *items, char **abstracts) {
+  struct gopherplus_dir *dir;
+  char name[64];
+  double t0 = now();
+  int x;
+  dir = gopherplus_opendir(dirpath, indexfile, extmap, CHARSET_UTF8);
+  if (dir == NULL) return(-1);
+  for (x = 0; x < count; x++) {
+    sprintf(name, "file%05d.txt", x);
+    memset(&(items[x]), 0, sizeof(struct gopherplus_item));
+    if (gopherplus_getattrs(dir, name, &(items[x])) != 0) {
+      gopherplus_closedir(dir);
+      return(-1);
+    }
+    if ((abstracts != NULL) && (items[x].abstract != NULL)) abstracts[x] = strdup(items[x].abstract);
+  }
+  if ((indexfile != NULL) && (gopherplus_isindexed(dir) == 0)) {
+    gopherplus_closedir(dir);
+    return(-1);
+  }
+  gopherplus_closedir(dir);
+  return(now() - t0);
+}
+
+
+int main(int argc, char **argv) {
+  struct gopherplus_item item, *items1, *items2;
+  struct extmap_t *extmap;
+  char **abstracts;
+  char sel[256], attrs[64], buff[4096], dirpath[256], indexfile[300], path[512];
+  int x, kind, count = 5000, iterations = 20, errors = 0;
+  double t, t_index = 0, t_list = 0;
+  FILE *fd;
+
+  if (argc > 1) count = atoi(argv[1]);
+  if (argc > 2) iterations = atoi(argv[2]);
+  if ((count < 1) || (iterations < 1)) {
+    puts("gopherplustest is a simple tool to test and benchmark motsognir's Gopher+ attributes.");
+    puts("usage: gopherplustest [files] [iterations]");
+    return(1);
+  }
+
+  puts("check the parsing of Gopher+ requests...");
+  for (x = 0; parsetests[x].selector != NULL; x++) {
+    strcpy(sel, parsetests[x].selector);
+    kind = gopherplus_parse(sel, attrs, sizeof(attrs));
+    if ((kind != parsetests[x].kind) || (strcmp(sel, parsetests[x].rest) != 0) || (strcmp(attrs, parsetests[x].attrs) != 0)) {
+      printf("  FAILED: test #%d (kind=%d selector='%s' attrs='%s')\n", x, kind, sel, attrs);
+      errors++;
+    }
+  }
+
+  puts("check attribute blocks...");
+  memset(&item, 0, sizeof(item));
+  item.type = '0';
+  item.name = "Notes";
+  item.selector = "/notes.txt";
+  item.host = "example.org";
+  item.port = 70;
+  item.plus = 1;
+  item.hasattrs = 1;
+  item.size = 12345;
+  item.abstract = "First line\r\nSecond line";
+  buff[0] = 0;
+  gopherplus_block(&item, "Jane <jane@example.org>", "+VIEWS+ABSTRACT", emit, buff);
+  if (strcmp(buff, "+INFO: 0Notes\t/notes.txt\texample.org\t70\t+\n+VIEWS:\n text/plain: <12k>\n+ABSTRACT:\n First line\n Second line\n") != 0) {
+    printf("  FAILED: unexpected block:\n%s", buff);
+    errors++;
+  }
+  item.hasattrs = 0;
+  item.plus = 0;
+  buff[0] = 0;
+  gopherplus_block(&item, "Jane", "", emit, buff);
+  if (strcmp(buff, "+INFO: 0Notes\t/notes.txt\texample.org\t70\n") != 0) {
+    printf("  FAILED: unexpected block:\n%s", buff);
+    errors++;
+  }
+
+  printf("create %d files...\n", count);
+  snprintf(dirpath, sizeof(dirpath), "/tmp/gopherplustest.%ld", (long)getpid());
+  snprintf(path, sizeof(path), "%s/.abstract", dirpath);
+  if ((mkdir(dirpath, 0755) != 0) || (mkdir(path, 0755) != 0)) {
+    printf("failed to create directory '%s'\n", dirpath);
+    return(1);
+  }
+  snprintf(indexfile, sizeof(indexfile), "%s.index", dirpath); /* out of the directory, or writing it would make it out of date */
+  for (x = 0; x < count; x++) {
+    snprintf(path, sizeof(path), "%s/file%05d.txt", dirpath, x);
+    fd = fopen(path, "wb");
+    if (fd == NULL) break;
+    fprintf(fd, "%*s", x % 3000, "");
+    fclose(fd);
+    if (x % 10 != 0) continue;
+    snprintf(path, sizeof(path), "%s/.abstract/file%05d.txt", dirpath, x);
+    fd = fopen(path, "wb");
+    if (fd == NULL) break;
+    fprintf(fd, "Abstract of file #%d\n", x);
+    fclose(fd);
+  }
+
+  puts("check that the index and the directory agree...");
+  items1 = calloc(count, sizeof(struct gopherplus_item));
+  items2 = calloc(count, sizeof(struct gopherplus_item));
+  abstracts = calloc(count, sizeof(char *));
+  extmap = extmap_load(NULL);
+  if ((items1 == NULL) || (items2 == NULL) || (abstracts == NULL) || (extmap == NULL)) {
+    puts("out of memory");
+    return(1);
+  }
+  if ((loadall(dirpath, NULL, extmap, count, items1, abstracts) < 0) || (loadall(dirpath, indexfile, extmap, count, items2, NULL) < 0)) {
+    puts("  FAILED: could not load attributes");
+    errors++;
+  } else {
+    for (x = 0; x < count; x++) {
+      if ((items1[x].type != items2[x].type) || (items1[x].size != items2[x].size) || (items1[x].mtime != items2[x].mtime) || (items2[x].size != (unsigned long)(x % 3000))) {
+        printf("  FAILED: attributes of file #%d differ\n", x);
+        errors++;
+        break;
+      }
+      if ((abstracts[x] != NULL) != (x % 10 == 0)) {
+        printf("  FAILED: abstract of file #%d\n", x);
+        errors++;
+        break;
+      }
+    }
+  }
+
+  puts("check the attributes of a file rewritten after indexing...");
+  snprintf(path, sizeof(path), "%s/file%05d.txt", dirpath, 1);
+  fd = fopen(path, "r+b"); /* same inode, so the directory does not change */
+  if (fd != NULL) {
+    fprintf(fd, "%*s", 5000, "");
+    fclose(fd);
+  }
+  if ((fd == NULL) || (loadall(dirpath, indexfile, extmap, count, items2, NULL) < 0) || (items2[1].size != 5000)) {
+    printf("  FAILED: size of the rewritten file is %lu instead of 5000\n", items2[1].size);
+    errors++;
+  }
+
+  if (errors == 0) {
+    printf("benchmark %d x attributes of a %d files directory...\n", iterations, count);
+    for (x = 0; x < iterations; x++) {
+      t = loadall(dirpath, indexfile, extmap, count, items2, NULL);
+      if (t >= 0) t_index += t;
+      t = loadall(dirpath, NULL, extmap, count, items2, NULL);
+      if (t >= 0) t_list += t;
+    }
+    printf("  index:   %8.2f ms per directory\n", t_index * 1000.0 / iterations);
+    printf("  listing: %8.2f ms per directory\n", t_list * 1000.0 / iterations);
+    printf("  speedup: %.1fx\n", t_list / t_index);
+  }
+
+  /* clean up */
+  for (x = 0; x < count; x++) {
+    snprintf(path, sizeof(path), "%s/file%05d.txt", dirpath, x);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/.abstract/file%05d.txt", dirpath, x);
+    unlink(path);
+    free(abstracts[x]);
+  }
+  snprintf(path, sizeof(path), "%s/.abstract", dirpath);
+  rmdir(path);
+  unlink(indexfile);
+  rmdir(dirpath);
+  free(abstracts);
+  free(items1);
+  free(items2);
+  extmap_free(extmap);
+
+  if (errors != 0) {
+    printf("%d errors found!\n", errors);
+    return(1);
+  }
+  return(0);
+}
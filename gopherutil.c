@@ -0,0 +1,259 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the small string helpers that run on every request, or on every
+ * menu line: selector encoding, gophermap lines parsing and building, path
+ * resolution, file extensions and the selector security check. These are
+ * kept apart from motsognir.c so they can be benchmarked (see gopherutiltest)
+ */
+
+#include <stdio.h>       /* snprintf() */
+#include <stdlib.h>      /* atol() */
+#include <string.h>
+#include <strings.h>     /* strcasecmp() */
+#include <syslog.h>
+
+#include "selcheck.h"    /* selcheck_scan() */
+#include "gopherutil.h"  /* include self for control */
+
+
+/* tests whether 'string' starts with 'start'. Returns 0 if not, non-zero
+ * otherwise. */
+int stringstartswith(const char *string, const char *start) {
+  while (*start != 0) {
+    if (*string != *start) return(0);
+    start += 1;
+    string += 1;
+  }
+  return(1);
+}
+
+
+/* tests whether 'string' ends with 'end'. Returns 0 if not, non-zero
+ * otherwise. */
+int stringendswith(const char *string, const char *end) {
+  int endlen = strlen(end);
+  int stringlen = strlen(string);
+  if (stringlen < endlen) return(0);
+  if (endlen == 0) return(1);
+  string += (stringlen - endlen);
+  if (strcmp(string, end) == 0) return(1);
+  return(0);
+}
+
+
+/* collapses all sequences of ch chars in string into a single ch, in place */
+void RemoveDoubleChar(char *string, char ch) {
+  char *start = string, *dst = string;
+  for (; *string != 0; string++) {
+    if ((*string == ch) && (dst > start) && (dst[-1] == ch)) continue;
+    *dst++ = *string;
+  }
+  *dst = 0;
+}
+
+
+/* glues relpath to curdir, and simplifies the result ('//' and '/../') */
+void computerelativepath(char *result, int result_maxlen, const char *curdir, const char *relpath) {
+  char *tempptr, *lastslash;
+  int x;
+  /* first glue both paths together */
+  snprintf(result, result_maxlen, "%s/%s", curdir, relpath);
+
+  /* make sure we have no // doublons */
+  RemoveDoubleChar(result, '/');
+
+  /* simplify all /../ */
+  for (;;) {
+    tempptr = strstr(result, "/../");
+    if (tempptr == NULL) break;
+    /* find out where is the last / before our point */
+    if (tempptr == result) {
+      lastslash = result;
+    } else {
+      for (lastslash = tempptr - 1; lastslash > result; lastslash--) if (*lastslash == '/') break;
+    }
+    /* move the right part of URL to the left */
+    for (x = 0;; x++) {
+      lastslash[x] = tempptr[x + 3];
+      if (lastslash[x] == 0) break;
+    }
+  }
+
+  /* if the result ends with a '/..', we need to simplify this as well */
+  x = strlen(result);
+  if (x < 3) return;
+
+  x -= 3;
+  if ((result[x] == '/') && (result[x + 1] == '.') && (result[x + 2] == '.')) {
+    if (x == 0) {
+      result[1] = 0;
+      return;
+    }
+    result[x] = 0;
+    for (x--; x >= 0; x--) {
+      if (result[x] == '/') {
+        result[x + 1] = 0;
+        break;
+      }
+    }
+  }
+}
+
+
+/* builds a gophermap line, replacing elements by default values if needed
+ * (selfhost and selfport being the server's own), and resolving relative
+ * paths */
+void buildgophermapline(char *linebuff, int linebuff_len, char itemtype, const char *desc, const char *selector, const char *server, long port, const char *curdirectory, const char *selfhost, long selfport) {
+  const char *itemserver = server;
+  char itemselector[1024];
+  long itemport = port;
+
+  /* check values, and put default ones if some are missing */
+  if ((server[0] == 0) && (itemport == 0)) { /* if both are missing then */
+    itemserver = selfhost;                   /* point to self using cfg  */
+    itemport = selfport;                     /* parameters               */
+  } else if (itemport == 0) {
+    if (strcasecmp(itemserver, selfhost) == 0) {
+      itemport = selfport;           /* use cfg port if 'server' looks like */
+    } else {                         /* me, otherwise default to the usual  */
+      itemport = 70;                 /* port 70 value                       */
+    }
+  } else if (server[0] == 0) {           /* only server missing - set to   */
+    itemserver = selfhost;               /* self and keep the port that is */
+  }                                      /* explicitely set in the map     */
+
+  /* if we are dealing with relative path on the local server, resolve it first */
+  if ((itemtype != 'i') && (selector[0] != '/') && (selector[0] != 0) && (strcasecmp(itemserver, selfhost) == 0) && (stringstartswith(selector, "URL:") == 0)) {
+    computerelativepath(itemselector, sizeof(itemselector), curdirectory, selector);
+  } else {
+    snprintf(itemselector, sizeof(itemselector), "%s", selector);
+  }
+
+  snprintf(linebuff, linebuff_len, "%c%s\t%s\t%s\t%ld", itemtype, desc, itemselector, itemserver, itemport);
+}
+
+
+/* Encode a string to percent encoding */
+void percencode(const char *src, char *dst, int dstmaxlen) {
+  int x, encodingrequired, dstlen = 0;
+  const char *hexchar = "0123456789ABCDEF";
+  for (x = 0; src[x] != 0; x++) {
+    encodingrequired = 0;
+    for (;;) { /* not a 'real' loop, just an easy way to break out */
+      if ((src[x] >= 'a') && (src[x] <= 'z')) break; /* do not encode a..z */
+      if ((src[x] >= 'A') && (src[x] <= 'Z')) break; /* do not encode A..Z */
+      if ((src[x] >= '0') && (src[x] <= '9')) break; /* do not encode 0..9 */
+      if ((src[x] == '-') || (src[x] == '/') || (src[x] == '_') || (src[x] == '.') || (src[x] == '~')) break; /* do not encode some chars */
+      /* since I am here, I need to encode the stuff I got */
+      encodingrequired = 1;
+      break;
+    }
+    if (dstlen + 4 >= dstmaxlen) {
+      syslog(LOG_WARNING, "WARNING: reached percent encoding length limit - aborting");
+      break; /* stop the work if we reached our limit */
+    }
+    if (encodingrequired == 0) { /* if no encoding is needed, just put the char as-is */
+      dst[dstlen++] = src[x];
+    } else { /* otherwise I need to encode the char */
+      dst[dstlen++] = '%';
+      dst[dstlen++] = hexchar[(unsigned)(src[x] & 0xF0) >> 4];
+      dst[dstlen++] = hexchar[(unsigned)(src[x] & 0x0F)];
+    }
+  }
+  /* terminate the dst string with a NULL terminator */
+  dst[dstlen] = 0;
+}
+
+
+/* Returns a pointer to the extension part of a filename (or to an empty
+ * string if the filename has no extension) */
+const char *getfileextension(const char *filename) {
+  const char *ext = NULL;
+  int x;
+  /* find the LAST occurence of the '.' char in the name */
+  for (x = 0; filename[x] != 0; x++) {
+    if (filename[x] == '.') ext = filename + x + 1;
+  }
+  if (ext != NULL) return(ext);
+  /* if no dot present in the filename, return an empty string using the filename's NULL terminator */
+  return(filename + x);
+}
+
+
+/* cuts a gophermap line into chunks and fills values. returns 0 on success, non-zero on error. */
+int explodegophermapline(const char *linebuff, char *itemtype, char *itemdesc, char *itemselector, char *itemserver, long *itemport) {
+  int x;
+  char tmpstring[16];
+  /* first make sure to clear out all variables */
+  *itemtype = 0;
+  itemdesc[0] = 0;
+  itemselector[0] = 0;
+  itemserver[0] = 0;
+  *itemport = 0;
+  /* if the line is empty, stop right now */
+  if (*linebuff == 0) {
+    *itemtype = 'i';
+    return(0);
+  }
+  /* read the itemtype */
+  *itemtype = *linebuff;
+  linebuff += 1;
+  /* read the item's description */
+  for (x = 0;;) {
+    if (x == 1023) return(-1);
+    if (*linebuff == '\t') break;
+    if (*linebuff == 0) return(0);
+    itemdesc[x] = *linebuff;
+    itemdesc[++x] = 0;
+    linebuff += 1;
+  }
+  linebuff += 1;
+  /* read the item's selector */
+  for (x = 0;;) {
+    if (x == 1023) return(-1);
+    if (*linebuff == '\t') break;
+    if (*linebuff == 0) return(0);
+    itemselector[x] = *linebuff;
+    itemselector[++x] = 0;
+    linebuff += 1;
+  }
+  linebuff += 1;
+  /* read the item's server */
+  for (x = 0;;) {
+    if (x == 63) return(-1);
+    if (*linebuff == '\t') break;
+    if (*linebuff == 0) return(0);
+    itemserver[x] = *linebuff;
+    itemserver[++x] = 0;
+    linebuff += 1;
+  }
+  linebuff += 1;
+  /* read the item's port */
+  for (x = 0;;) {
+    if (x == 8) return(-1);
+    if (*linebuff == '\t') break;
+    if (*linebuff == 0) break;
+    tmpstring[x] = *linebuff;
+    tmpstring[++x] = 0;
+    linebuff += 1;
+  }
+  *itemport = atol(tmpstring);
+  if ((*itemport < 1) || (*itemport > 65535)) *itemport = 0;
+  return(0);
+}
+
+
+/* performs various security checks on a gopher request. Returns NULL if all is ok, or a pointer to an error string otherwise. */
+const char *gophersecuritycheck(const char *GophRequest) {
+  int res;
+  /* all checks are performed in a single pass - then the most relevant problem is reported */
+  res = selcheck_scan(GophRequest);
+  if (res == 0) return(NULL); /* Alles klar, proceed! */
+  if (res & SELCHECK_TOOLONG) return("The gopher request is longer than 512 bytes. RFC 1436 states that the selector shouldn't be longer than 256 bytes.");
+  if (res & SELCHECK_DOUBLETAB) return("Client's request contains two TAB characters, one after the other. It shouldn't ever happen.");
+  if (res & SELCHECK_TRAILINGTAB) return("Client's request ends by a TAB character. There's no situation where that should happen.");
+  if (res & SELCHECK_CTRLCHAR) return("A control char (ASCII 1..31) has been found in the request. There's no reason for such char to be present there.");
+  return("Detected an invalid UTF-8 sequence.");
+}
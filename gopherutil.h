@@ -0,0 +1,46 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the small string helpers that run on every request, or on every
+ * menu line
+ */
+
+#ifndef gopherutil_h_sentinel
+#define gopherutil_h_sentinel
+
+/* tests whether 'string' starts with 'start'. Returns 0 if not, non-zero
+ * otherwise. */
+int stringstartswith(const char *string, const char *start);
+
+/* tests whether 'string' ends with 'end'. Returns 0 if not, non-zero
+ * otherwise. */
+int stringendswith(const char *string, const char *end);
+
+/* collapses all sequences of ch chars in string into a single ch, in place */
+void RemoveDoubleChar(char *string, char ch);
+
+/* glues relpath to curdir, and simplifies the result ('//' and '/../') */
+void computerelativepath(char *result, int result_maxlen, const char *curdir, const char *relpath);
+
+/* builds a gophermap line, replacing elements by default values if needed
+ * (selfhost and selfport being the server's own), and resolving relative
+ * paths */
+void buildgophermapline(char *linebuff, int linebuff_len, char itemtype, const char *desc, const char *selector, const char *server, long port, const char *curdirectory, const char *selfhost, long selfport);
+
+/* Encode a string to percent encoding */
+void percencode(const char *src, char *dst, int dstmaxlen);
+
+/* Returns a pointer to the extension part of a filename (or to an empty
+ * string if the filename has no extension) */
+const char *getfileextension(const char *filename);
+
+/* cuts a gophermap line into chunks and fills values (itemdesc and
+ * itemselector must be 1024 bytes long, itemserver 64 bytes). returns 0 on
+ * success, non-zero on error. */
+int explodegophermapline(const char *linebuff, char *itemtype, char *itemdesc, char *itemselector, char *itemserver, long *itemport);
+
+/* performs various security checks on a gopher request. Returns NULL if all is ok, or a pointer to an error string otherwise. */
+const char *gophersecuritycheck(const char *GophRequest);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Test & benchmark application for the request hot-path helpers.
+ *
+ * Checks the string helpers of gopherutil.c (and the selector parser and
+ * extension map they work with) against known answers, then measures how
+ * long every one of them takes per call, in ns, on typical inputs and on
+ * adversarial ones (long selectors, runs of slashes, heavy percent-encoding,
+ * deep relative paths...).
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "extmap.h"
+#include "gopherutil.h"
+#include "selparse.h"
+
+static struct extmap_t *extmap;
+static volatile long checksum; /* keeps the compiler from optimizing calls away */
+static char input[8192];       /* adversarial inputs are built there */
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+static void run_percencode(const char *s) {
+  static char out[16384];
+  percencode(s, out, sizeof(out));
+  checksum += out[0];
+}
+
+
+static void run_selparse(const char *s) {
+  static char sel[8192], pathbuff[8192 + 2];
+  struct selparse_t res;
+  strcpy(sel, s);
+  checksum += selparse(&res, sel, pathbuff, 0);
+}
+
+
+static void run_explodegophermapline(const char *s) {
+  char itemtype, itemdesc[1024], itemselector[1024], itemserver[64];
+  long itemport;
+  checksum += explodegophermapline(s, &itemtype, itemdesc, itemselector, itemserver, &itemport);
+}
+
+
+static void run_buildgophermapline(const char *s) {
+  char linebuff[1024];
+  buildgophermapline(linebuff, sizeof(linebuff), '0', "A document", s, "", 0, "/phlog/2019/", "gopher.example.org", 70);
+  checksum += linebuff[1];
+}
+
+
+static void run_computerelativepath(const char *s) {
+  char result[8192];
+  computerelativepath(result, sizeof(result), "/a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p/q/r/s/t/", s);
+  checksum += result[0];
+}
+
+
+static void run_removedoublechar(const char *s) {
+  static char buff[8192];
+  strcpy(buff, s);
+  RemoveDoubleChar(buff, '/');
+  checksum += buff[0];
+}
+
+
+static void run_gophersecuritycheck(const char *s) {
+  checksum += (gophersecuritycheck(s) == NULL);
+}
+
+
+static void run_getfileextension(const char *s) {
+  checksum += getfileextension(s)[0];
+}
+
+
+static void run_extmap_lookup(const char *s) {
+  checksum += extmap_lookup(extmap, getfileextension(s));
+}
+
+
+/* runs fn(s) for at least mintime seconds, and prints the time per call */
+static void bench(const char *name, const char *desc, void (*fn)(const char *), const char *s, double mintime) {
+  long iterations, i;
+  double t0, elapsed = 0;
+  for (iterations = 64;; iterations *= 2) {
+    t0 = now();
+    for (i = 0; i < iterations; i++) fn(s);
+    elapsed = now() - t0;
+    if (elapsed >= mintime) break;
+  }
+  printf("  %-22s %-36s %10.1f ns/op\n", name, desc, elapsed * 1e9 / iterations);
+}
+
+
+/* builds an adversarial input out of n copies of a pattern, followed by an
+ * optional suffix */
+static const char *repeat(const char *pattern, int n, const char *suffix) {
+  int x, len = 0, plen = strlen(pattern);
+  for (x = 0; (x < n) && (len + plen < (int)sizeof(input) - 64); x++) {
+    memcpy(input + len, pattern, plen);
+    len += plen;
+  }
+  strcpy(input + len, suffix);
+  return(input);
+}
+
+
+static int check(const char *what, const char *result, const char *expected) {
+  if ((result != NULL) && (expected != NULL) && (strcmp(result, expected) == 0)) return(0);
+  if ((result == NULL) && (expected == NULL)) return(0);
+  printf("FAILED: %s returned '%s' instead of '%s'\n", what, (result != NULL) ? result : "(null)", (expected != NULL) ? expected : "(null)");
+  return(1);
+}
+
+
+/* checks the helpers against known answers. returns the amount of failures */
+static int runchecks(void) {
+  char buff[1024], itemtype, itemdesc[1024], itemselector[1024], itemserver[64];
+  long itemport;
+  int errors = 0;
+
+  percencode("/my docs/f\xc3\xa9te.txt", buff, sizeof(buff));
+  errors += check("percencode()", buff, "/my%20docs/f%C3%A9te.txt");
+
+  strcpy(buff, "//a///b//c/");
+  RemoveDoubleChar(buff, '/');
+  errors += check("RemoveDoubleChar()", buff, "/a/b/c/");
+  strcpy(buff, "//a///b/");
+  RemoveDoubleChar(buff, '/');
+  errors += check("RemoveDoubleChar()", buff, "/a/b/");
+  strcpy(buff, "//");
+  RemoveDoubleChar(buff, '/');
+  errors += check("RemoveDoubleChar()", buff, "/");
+
+  computerelativepath(buff, sizeof(buff), "/a/b/c/", "../d/./e.txt");
+  errors += check("computerelativepath()", buff, "/a/b/d/./e.txt");
+  computerelativepath(buff, sizeof(buff), "/a/b/", "../..");
+  errors += check("computerelativepath()", buff, "/");
+
+  if ((explodegophermapline("1Docs\tdocs/\tgopher.example.org\t7070", &itemtype, itemdesc, itemselector, itemserver, &itemport) != 0) || (itemtype != '1') || (itemport != 7070)) {
+    printf("FAILED: explodegophermapline() on a full line\n");
+    errors++;
+  }
+  errors += check("explodegophermapline()", itemdesc, "Docs");
+  errors += check("explodegophermapline()", itemselector, "docs/");
+  errors += check("explodegophermapline()", itemserver, "gopher.example.org");
+  if (explodegophermapline(repeat("x", 2000, ""), &itemtype, itemdesc, itemselector, itemserver, &itemport) == 0) {
+    printf("FAILED: explodegophermapline() accepted an overlong description\n");
+    errors++;
+  }
+
+  buildgophermapline(buff, sizeof(buff), '0', "Readme", "../readme.txt", "", 0, "/phlog/2019/", "gopher.example.org", 70);
+  errors += check("buildgophermapline()", buff, "0Readme\t/phlog/readme.txt\tgopher.example.org\t70");
+  buildgophermapline(buff, sizeof(buff), 'h', "Web", "URL:http://example.org/", "gopher.example.org", 0, "/", "gopher.example.org", 7070);
+  errors += check("buildgophermapline()", buff, "hWeb\tURL:http://example.org/\tgopher.example.org\t7070");
+  buildgophermapline(buff, sizeof(buff), '1', "Elsewhere", "/", "other.example.org", 0, "/", "gopher.example.org", 7070);
+  errors += check("buildgophermapline()", buff, "1Elsewhere\t/\tother.example.org\t70");
+
+  errors += check("getfileextension()", getfileextension("/archive/motsognir-1.0.11.tar.gz"), "gz");
+  errors += check("getfileextension()", getfileextension("/archive/README"), "");
+
+  errors += check("gophersecuritycheck()", gophersecuritycheck("/phlog/f\xc3\xa9te.txt"), NULL);
+  if (gophersecuritycheck("/a\x01b") == NULL) errors += check("gophersecuritycheck()", NULL, "an error");
+  if (gophersecuritycheck("/bad\xc0\xaf") == NULL) errors += check("gophersecuritycheck()", NULL, "an error");
+
+  if (extmap_lookup(extmap, "txt") != '0') {
+    printf("FAILED: extmap_lookup() does not map txt files to type 0\n");
+    errors++;
+  }
+  return(errors);
+}
+
+
+int main(int argc, char **argv) {
+  static const char *typicalselector = "/phlog/2019/f%C3%A9te+de+la+musique.txt";
+  double mintime = 0.2;
+
+  if (argc > 1) mintime = atof(argv[1]);
+  if ((argc > 2) || (mintime <= 0)) {
+    puts("gopherutiltest is a simple tool to test and benchmark motsognir's request hot-path helpers.");
+    puts("usage: gopherutiltest [seconds_per_benchmark]");
+    return(1);
+  }
+
+  extmap = extmap_load(NULL);
+  if (extmap == NULL) {
+    puts("failed to load the default extension map");
+    return(1);
+  }
+
+  puts("check helpers against known answers...");
+  if (runchecks() != 0) return(1);
+
+  puts("benchmark...");
+  bench("percencode", "typical path", run_percencode, "/phlog/2019/fete de la musique.txt", mintime);
+  bench("percencode", "1000 UTF-8 chars", run_percencode, repeat("\xc3\xa9", 1000, ""), mintime);
+  bench("selparse (percdecode)", "typical selector", run_selparse, typicalselector, mintime);
+  bench("selparse (percdecode)", "1000 percent-encoded chars", run_selparse, repeat("%2F", 1000, ""), mintime);
+  bench("selparse (percdecode)", "4000 slashes", run_selparse, repeat("/", 4000, "file.txt"), mintime);
+  bench("explodegophermapline", "typical line", run_explodegophermapline, "0About this server\t/about.txt\tgopher.example.org\t70", mintime);
+  bench("explodegophermapline", "1000-chars description", run_explodegophermapline, repeat("x", 1000, "\t/about.txt\tgopher.example.org\t70"), mintime);
+  bench("buildgophermapline", "absolute selector", run_buildgophermapline, "/phlog/2019/readme.txt", mintime);
+  bench("buildgophermapline", "relative selector", run_buildgophermapline, "../2018/./readme.txt", mintime);
+  bench("computerelativepath", "typical path", run_computerelativepath, "../../docs/readme.txt", mintime);
+  bench("computerelativepath", "200 parent dirs", run_computerelativepath, repeat("../", 200, "readme.txt"), mintime);
+  bench("RemoveDoubleChar", "typical path", run_removedoublechar, "/software//mirror/linux//debian/pool", mintime);
+  bench("RemoveDoubleChar", "4000 slashes", run_removedoublechar, repeat("/", 4000, ""), mintime);
+  bench("gophersecuritycheck", "typical selector", run_gophersecuritycheck, "/phlog/2019/f\xc3\xa9te de la musique.txt", mintime);
+  bench("gophersecuritycheck", "500 UTF-8 bytes", run_gophersecuritycheck, repeat("\xe2\x82\xac", 166, ""), mintime);
+  bench("gophersecuritycheck", "4000 bytes (too long)", run_gophersecuritycheck, repeat("a", 4000, ""), mintime);
+  bench("getfileextension", "typical file name", run_getfileextension, "/archive/motsognir-1.0.11.tar.gz", mintime);
+  bench("getfileextension", "4000 dots", run_getfileextension, repeat(".", 4000, "txt"), mintime);
+  bench("extmap_lookup", "known extension", run_extmap_lookup, "/docs/readme.txt", mintime);
+  bench("extmap_lookup", "unknown extension", run_extmap_lookup, "/docs/archive.unknownext", mintime);
+
+  extmap_free(extmap);
+  return(0);
+}
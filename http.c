@@ -0,0 +1,520 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the building blocks of the HTTP gateway: parsing of HTTP/1.x
+ * requests, HTTP dates and content types, and rendering of gopher menus as
+ * HTML pages.
+ *
+ * Nothing here touches sockets: the gateway itself (reading requests,
+ * sending answers, running the gopher pipeline) lives in motsognir.c.
+ */
+
+#include <ctype.h>       /* isdigit(), isxdigit() */
+#include <stdio.h>       /* snprintf(), sscanf() */
+#include <stdlib.h>      /* realloc(), strtol() */
+#include <string.h>
+#include <strings.h>     /* strcasecmp(), strncasecmp() */
+#include <time.h>        /* gmtime_r(), timegm() */
+
+#include "http.h"        /* include self for control */
+
+static const char *daynames[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char *monthnames[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+
+/* returns the amount of empty lines (CRLF or LF) at the start of buff:
+ * clients may send some between pipelined requests */
+static int skipemptylines(const char *buff, int len) {
+  int x = 0;
+  while (x < len) {
+    if (buff[x] == '\n') {
+      x++;
+    } else if ((buff[x] == '\r') && (x + 1 < len) && (buff[x + 1] == '\n')) {
+      x += 2;
+    } else {
+      break;
+    }
+  }
+  return(x);
+}
+
+
+int http_headlen(const char *buff, int len) {
+  int x;
+  for (x = skipemptylines(buff, len); x < len; x++) {
+    if (buff[x] != '\n') continue;
+    if ((x + 1 < len) && (buff[x + 1] == '\n')) return(x + 2);
+    if ((x + 2 < len) && (buff[x + 1] == '\r') && (buff[x + 2] == '\n')) return(x + 3);
+  }
+  return(0);
+}
+
+
+/* returns non-zero if the comma-separated list of tokens s contains token */
+static int hastoken(const char *s, const char *token) {
+  int tlen = strlen(token);
+  while (*s != 0) {
+    while ((*s == ' ') || (*s == '\t') || (*s == ',')) s++;
+    if ((strncasecmp(s, token, tlen) == 0) && ((s[tlen] == 0) || (s[tlen] == ',') || (s[tlen] == ' ') || (s[tlen] == '\t'))) return(1);
+    while ((*s != 0) && (*s != ',')) s++;
+  }
+  return(0);
+}
+
+
+int http_parserequest(struct http_request *req, const char *head, int headlen) {
+  char line[4096 + 64];
+  int pos, linelen, x, connclose = 0, connkeepalive = 0, gothost = 0;
+  char *target, *version, *value;
+
+  memset(req, 0, sizeof(struct http_request));
+  pos = skipemptylines(head, headlen);
+
+  while (pos < headlen) {
+    /* fetch the next line, without its CRLF */
+    for (x = pos; (x < headlen) && (head[x] != '\n'); x++);
+    linelen = x - pos;
+    if ((linelen > 0) && (head[pos + linelen - 1] == '\r')) linelen--;
+    if (linelen >= (int)sizeof(line)) {
+      /* an overlong request line means an overlong target */
+      return((req->method[0] == 0) ? 414 : 431);
+    }
+    memcpy(line, head + pos, linelen);
+    line[linelen] = 0;
+    pos = x + 1;
+
+    if (req->method[0] == 0) { /* request line: METHOD SP TARGET SP HTTP/x.y */
+      target = strchr(line, ' ');
+      if ((target == NULL) || (target == line) || (target - line >= (int)sizeof(req->method))) return(400);
+      *target++ = 0;
+      version = strchr(target, ' ');
+      if (version == NULL) return(400);
+      *version++ = 0;
+      for (x = 0; line[x] != 0; x++) {
+        if ((line[x] < 'A') || (line[x] > 'Z')) return(400);
+      }
+      strcpy(req->method, line);
+      if (strlen(target) >= sizeof(req->target)) return(414);
+      if ((target[0] == 0) || (strchr(target, ' ') != NULL)) return(400);
+      strcpy(req->target, target);
+      if ((strncmp(version, "HTTP/", 5) != 0) || (!isdigit(version[5])) || (version[6] != '.') || (!isdigit(version[7])) || (version[8] != 0)) return(400);
+      if (version[5] != '1') return(505);
+      req->version = (version[7] == '0') ? 10 : 11;
+      continue;
+    }
+
+    if (linelen == 0) break; /* end of the head */
+
+    /* a header - folded headers are obsolete, and refused */
+    if ((line[0] == ' ') || (line[0] == '\t')) return(400);
+    value = strchr(line, ':');
+    if ((value == NULL) || (value == line)) return(400);
+    *value++ = 0;
+    while ((*value == ' ') || (*value == '\t')) value++;
+    for (x = strlen(value); (x > 0) && ((value[x - 1] == ' ') || (value[x - 1] == '\t')); x--) value[x - 1] = 0;
+
+    if (strcasecmp(line, "Host") == 0) {
+      gothost = 1;
+    } else if (strcasecmp(line, "Connection") == 0) {
+      if (hastoken(value, "close")) connclose = 1;
+      if (hastoken(value, "keep-alive")) connkeepalive = 1;
+    } else if (strcasecmp(line, "Content-Length") == 0) {
+      char *end;
+      if (!isdigit(value[0])) return(400);
+      req->contentlength = strtol(value, &end, 10);
+      if ((*end != 0) || (req->contentlength < 0)) return(400);
+    } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+      return(501); /* request bodies are of no use to the gateway */
+    } else if (strcasecmp(line, "If-Modified-Since") == 0) {
+      req->ifmodifiedsince = http_parsedate(value);
+    }
+  }
+
+  if (req->method[0] == 0) return(400);
+  if ((req->version == 11) && (gothost == 0)) return(400);
+  if (req->version == 11) {
+    req->keepalive = !connclose;
+  } else {
+    req->keepalive = (connkeepalive && !connclose);
+  }
+  return(0);
+}
+
+
+static int hexval(char c) {
+  if ((c >= '0') && (c <= '9')) return(c - '0');
+  if ((c >= 'a') && (c <= 'f')) return(c - 'a' + 10);
+  return(c - 'A' + 10);
+}
+
+
+int http_toselector(char *sel, int selsize, const char *target) {
+  const char *query;
+  int len, x;
+
+  /* absolute-form targets (as sent to proxies) are reduced to their path */
+  if ((strncasecmp(target, "http://", 7) == 0) || (strncasecmp(target, "https://", 8) == 0)) {
+    target = strchr(strstr(target, "://") + 3, '/');
+    if (target == NULL) target = "/";
+  }
+
+  query = strchr(target, '?');
+  if ((query == NULL) || (strncmp(query + 1, "search=", 7) != 0) || (strchr(query + 1, '&') != NULL)) {
+    if ((int)strlen(target) >= selsize) return(-1);
+    strcpy(sel, target);
+    return(0);
+  }
+
+  /* a search form: the query becomes the search part of the selector, form
+   * decoded ('+' being a space) */
+  len = query - target;
+  if (len + 2 > selsize) return(-1);
+  memcpy(sel, target, len);
+  sel[len++] = '\t';
+  for (x = 8; query[x] != 0; x++) {
+    char c = query[x];
+    if (c == '+') {
+      c = ' ';
+    } else if ((c == '%') && isxdigit(query[x + 1]) && isxdigit(query[x + 2])) {
+      c = (char)((hexval(query[x + 1]) << 4) | hexval(query[x + 2]));
+      x += 2;
+    }
+    if ((unsigned char)c < 32) c = ' '; /* no control chars in selectors */
+    if (len + 1 >= selsize) return(-1);
+    sel[len++] = c;
+  }
+  sel[len] = 0;
+  return(0);
+}
+
+
+void http_date(char *buff, time_t t) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  snprintf(buff, 30, "%s, %02d %s %04d %02d:%02d:%02d GMT", daynames[tm.tm_wday % 7], tm.tm_mday % 100, monthnames[tm.tm_mon % 12], (tm.tm_year + 1900) % 10000, tm.tm_hour % 100, tm.tm_min % 100, tm.tm_sec % 100);
+}
+
+
+time_t http_parsedate(const char *s) {
+  char day[4], month[4];
+  struct tm tm;
+  int x;
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(s, "%3s, %2d %3s %4d %2d:%2d:%2d GMT", day, &tm.tm_mday, month, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 7) return(0);
+  if (strchr(s, ',') != s + 3) return(0);
+  for (x = 0; x < 12; x++) {
+    if (strcmp(month, monthnames[x]) == 0) break;
+  }
+  if ((x == 12) || (tm.tm_year < 1970) || (tm.tm_mday < 1) || (tm.tm_mday > 31) || (tm.tm_hour > 23) || (tm.tm_min > 59) || (tm.tm_sec > 60)) return(0);
+  tm.tm_mon = x;
+  tm.tm_year -= 1900;
+  return(timegm(&tm));
+}
+
+
+const char *http_contenttype(const char *ext, char gophertype) {
+  static const char *types[] = {
+    "txt", "text/plain", "htm", "text/html", "html", "text/html",
+    "css", "text/css", "xml", "text/xml", "json", "application/json",
+    "png", "image/png", "jpg", "image/jpeg", "jpeg", "image/jpeg",
+    "gif", "image/gif", "webp", "image/webp", "svg", "image/svg+xml",
+    "ico", "image/x-icon", "bmp", "image/bmp", "pdf", "application/pdf",
+    "mp3", "audio/mpeg", "ogg", "audio/ogg", "flac", "audio/flac",
+    "wav", "audio/wav", "mp4", "video/mp4", "webm", "video/webm",
+    "zip", "application/zip", "gz", "application/gzip",
+    "epub", "application/epub+zip", NULL};
+  int x;
+  for (x = 0; (ext != NULL) && (types[x] != NULL); x += 2) {
+    if (strcasecmp(ext, types[x]) == 0) return(types[x + 1]);
+  }
+  switch (gophertype) {
+    case '0':
+    case '2':
+      return("text/plain");
+    case 'h':
+      return("text/html");
+    case 'g':
+      return("image/gif");
+    case 'P':
+      return("application/pdf");
+    default:
+      return("application/octet-stream");
+  }
+}
+
+
+const char *http_reason(int status) {
+  switch (status) {
+    case 200: return("OK");
+    case 304: return("Not Modified");
+    case 400: return("Bad Request");
+    case 403: return("Forbidden");
+    case 404: return("Not Found");
+    case 405: return("Method Not Allowed");
+    case 414: return("URI Too Long");
+    case 431: return("Request Header Fields Too Large");
+    case 500: return("Internal Server Error");
+    case 501: return("Not Implemented");
+    case 502: return("Bad Gateway");
+    case 503: return("Service Unavailable");
+    case 505: return("HTTP Version Not Supported");
+    default: return("Unknown");
+  }
+}
+
+
+int http_statusof(const char *status) {
+  if ((strcmp(status, "ok") == 0) || (strcmp(status, "partial") == 0)) return(200);
+  if (strcmp(status, "notfound") == 0) return(404);
+  if (strcmp(status, "forbidden") == 0) return(403);
+  if ((strcmp(status, "badrequest") == 0) || (strcmp(status, "badrange") == 0) || (strcmp(status, "http") == 0)) return(400);
+  return(500);
+}
+
+
+int http_append(struct http_buff *b, const void *data, long len, long maxsize) {
+  if (b->len + len > maxsize) return(-1);
+  if (b->len + len > b->size) {
+    long newsize = (b->size < 4096) ? 4096 : b->size;
+    char *newdata;
+    while (newsize < b->len + len) newsize *= 2;
+    if (newsize > maxsize) newsize = maxsize;
+    newdata = realloc(b->data, newsize);
+    if (newdata == NULL) return(-1);
+    b->data = newdata;
+    b->size = newsize;
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+  return(0);
+}
+
+
+/* returns the length of the line at the start of data (without its CRLF),
+ * and sets *next to the offset of the next line */
+static long linelength(const char *data, long len, long *next) {
+  long x;
+  for (x = 0; (x < len) && (data[x] != '\n'); x++);
+  *next = (x < len) ? x + 1 : x;
+  if ((x > 0) && (data[x - 1] == '\r')) x--;
+  return(x);
+}
+
+
+int http_lookslikemenu(const char *data, long len) {
+  long pos = 0, next, linelen, x;
+  int tabs, lines = 0;
+  while (pos < len) {
+    linelen = linelength(data + pos, len - pos, &next);
+    if ((linelen == 1) && (data[pos] == '.')) break; /* end of menu */
+    /* every line must have at least 3 tabs, and a numeric port */
+    for (x = 0, tabs = 0; x < linelen; x++) {
+      if (data[pos + x] != '\t') continue;
+      tabs++;
+      if ((tabs == 3) && ((x + 1 >= linelen) || (!isdigit(data[pos + x + 1])))) return(0);
+    }
+    if (tabs < 3) return(0);
+    lines++;
+    pos += next;
+  }
+  return(lines > 0);
+}
+
+
+long http_untext(char *data, long len) {
+  long pos = 0, out = 0, next, linelen;
+  while (pos < len) {
+    linelen = linelength(data + pos, len - pos, &next);
+    if ((linelen == 1) && (data[pos] == '.') && (pos + next >= len)) break; /* terminator */
+    if ((linelen >= 2) && (data[pos] == '.') && (data[pos + 1] == '.')) {
+      pos++; /* escaped dot */
+      next--;
+    }
+    memmove(data + out, data + pos, next);
+    out += next;
+    pos += next;
+  }
+  return(out);
+}
+
+
+static int appendstr(struct http_buff *out, const char *s, long maxsize) {
+  return(http_append(out, s, strlen(s), maxsize));
+}
+
+
+/* appends a string, HTML-escaped */
+static int appendescaped(struct http_buff *out, const char *s, long maxsize) {
+  for (; *s != 0; s++) {
+    int res;
+    switch (*s) {
+      case '&': res = appendstr(out, "&amp;", maxsize); break;
+      case '<': res = appendstr(out, "&lt;", maxsize); break;
+      case '>': res = appendstr(out, "&gt;", maxsize); break;
+      case '"': res = appendstr(out, "&quot;", maxsize); break;
+      default: res = http_append(out, s, 1, maxsize); break;
+    }
+    if (res != 0) return(-1);
+  }
+  return(0);
+}
+
+
+/* appends an URL (in an HTML attribute): chars that are not allowed in URLs
+ * are percent-encoded */
+static int appendurl(struct http_buff *out, const char *s, long maxsize) {
+  char hex[4];
+  for (; *s != 0; s++) {
+    int res;
+    unsigned char c = (unsigned char)*s;
+    if ((c <= 32) || (c >= 127) || (c == '"') || (c == '<') || (c == '>') || (c == '\'') || (c == '`') || (c == '#')) {
+      snprintf(hex, sizeof(hex), "%%%02X", c);
+      res = appendstr(out, hex, maxsize);
+    } else if (c == '&') {
+      res = appendstr(out, "&amp;", maxsize);
+    } else {
+      res = http_append(out, s, 1, maxsize);
+    }
+    if (res != 0) return(-1);
+  }
+  return(0);
+}
+
+
+/* returns the label shown before menu items, after their gopher type */
+static const char *typelabel(char type) {
+  switch (type) {
+    case 'i': return("      ");
+    case '0': return("[TXT] ");
+    case '1': return("[DIR] ");
+    case '3': return("[ERR] ");
+    case '7': return("[ASK] ");
+    case '8':
+    case 'T': return("[TEL] ");
+    case 'g':
+    case 'I':
+    case 'p': return("[IMG] ");
+    case 's': return("[SND] ");
+    case ';': return("[VID] ");
+    case 'h': return("[WWW] ");
+    case 'd':
+    case 'P': return("[DOC] ");
+    default: return("[BIN] ");
+  }
+}
+
+
+/* URL schemes that "hURL:" items may link to. anything else (javascript:,
+ * data:, ...) could run in the visitor's browser, so it is shown as text */
+static const char *urlschemes[] = {"http", "https", "gopher", "gophers", "ftp", "ftps", "mailto", "news", "nntp", "irc", "ircs", "telnet", "ssh", "finger", NULL};
+
+
+/* returns 1 if url starts with a scheme of urlschemes, 0 otherwise */
+static int urlschemeallowed(const char *url) {
+  int x, len;
+  for (len = 0; isalnum((unsigned char)url[len]) || (url[len] == '+') || (url[len] == '-') || (url[len] == '.'); len++);
+  if ((len == 0) || (url[len] != ':')) return(0);
+  for (x = 0; urlschemes[x] != NULL; x++) {
+    if (((int)strlen(urlschemes[x]) == len) && (strncasecmp(url, urlschemes[x], len) == 0)) return(1);
+  }
+  return(0);
+}
+
+
+/* renders a single menu line */
+static int menuline(struct http_buff *out, char *line, const char *selfhost, long selfport, long maxsize) {
+  char type, *desc, *sel = "", *host = "", *portstr = "0";
+  char port[16];
+  int local, res = 0;
+
+  type = line[0];
+  desc = line + 1;
+  if ((line[0] == 0) || (strchr(line, '\t') == NULL)) { /* not a menu item, show it as text */
+    type = 'i';
+    desc = line;
+  } else {
+    sel = strchr(desc, '\t');
+    *sel++ = 0;
+    host = strchr(sel, '\t');
+    if (host != NULL) {
+      *host++ = 0;
+      portstr = strchr(host, '\t');
+      if (portstr != NULL) {
+        char *plus;
+        *portstr++ = 0;
+        plus = strchr(portstr, '\t'); /* gopher+ flag */
+        if (plus != NULL) *plus = 0;
+      } else {
+        portstr = "0";
+      }
+    } else {
+      host = "";
+    }
+  }
+  snprintf(port, sizeof(port), "%ld", atol(portstr));
+  local = ((selfhost != NULL) && (strcasecmp(host, selfhost) == 0) && (atol(portstr) == selfport));
+
+  res |= appendstr(out, typelabel(type), maxsize);
+  if ((type == 'i') || (type == '3') || ((type == 'h') && (strncmp(sel, "URL:", 4) == 0) && (urlschemeallowed(sel + 4) == 0))) {
+    res |= appendescaped(out, desc, maxsize);
+    res |= appendstr(out, "\n", maxsize);
+    return(res);
+  }
+
+  res |= appendstr(out, "<a href=\"", maxsize);
+  if ((type == 'h') && (strncmp(sel, "URL:", 4) == 0)) {
+    res |= appendurl(out, sel + 4, maxsize);
+  } else if ((type == '8') || (type == 'T')) {
+    res |= appendstr(out, "telnet://", maxsize);
+    res |= appendurl(out, host, maxsize);
+    res |= appendstr(out, ":", maxsize);
+    res |= appendstr(out, port, maxsize);
+  } else if (local) {
+    if (sel[0] != '/') res |= appendstr(out, "/", maxsize);
+    res |= appendurl(out, sel, maxsize);
+  } else {
+    res |= appendstr(out, "gopher://", maxsize);
+    res |= appendurl(out, host, maxsize);
+    res |= appendstr(out, ":", maxsize);
+    res |= appendstr(out, port, maxsize);
+    res |= appendstr(out, "/", maxsize);
+    res |= http_append(out, &type, 1, maxsize);
+    res |= appendurl(out, sel, maxsize);
+  }
+  res |= appendstr(out, "\">", maxsize);
+  res |= appendescaped(out, desc, maxsize);
+  res |= appendstr(out, "</a>", maxsize);
+
+  /* local search items get a form */
+  if ((type == '7') && local) {
+    res |= appendstr(out, " <form style=\"display:inline\" method=\"get\" action=\"", maxsize);
+    if (sel[0] != '/') res |= appendstr(out, "/", maxsize);
+    res |= appendurl(out, sel, maxsize);
+    res |= appendstr(out, "\"><input name=\"search\" size=\"30\"> <input type=\"submit\" value=\"Search\"></form>", maxsize);
+  }
+  res |= appendstr(out, "\n", maxsize);
+  return(res);
+}
+
+
+int http_menutohtml(struct http_buff *out, const char *menu, long len, const char *title, const char *selfhost, long selfport, long maxsize) {
+  char line[4096];
+  long pos = 0, next, linelen;
+  int res = 0;
+
+  res |= appendstr(out, "<!DOCTYPE html>\n<html>\n<head>\n<meta name=\"viewport\" content=\"width=device-width\">\n<title>", maxsize);
+  res |= appendescaped(out, title, maxsize);
+  res |= appendstr(out, "</title>\n</head>\n<body>\n<pre>\n", maxsize);
+  while ((pos < len) && (res == 0)) {
+    linelen = linelength(menu + pos, len - pos, &next);
+    if ((linelen == 1) && (menu[pos] == '.')) break; /* end of menu */
+    if (linelen >= (long)sizeof(line)) linelen = sizeof(line) - 1;
+    memcpy(line, menu + pos, linelen);
+    line[linelen] = 0;
+    res |= menuline(out, line, selfhost, selfport, maxsize);
+    pos += next;
+  }
+  res |= appendstr(out, "</pre>\n</body>\n</html>\n", maxsize);
+  return((res != 0) ? -1 : 0);
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the building blocks of the HTTP gateway: parsing of HTTP/1.x
+ * requests, HTTP dates and content types, and rendering of gopher menus as
+ * HTML pages
+ */
+
+#ifndef http_h_sentinel
+#define http_h_sentinel
+
+#include <time.h>
+
+#define HTTP_MAXHEAD 16384  /* max size of a request head (request line and headers) */
+
+struct http_request {
+  char method[16];
+  char target[4096];     /* request target, as sent (path and query) */
+  int version;           /* 10 for HTTP/1.0, 11 for HTTP/1.1 */
+  int keepalive;         /* non-zero if the client wishes to keep the connection open */
+  long contentlength;    /* length of the request body (0 if none) */
+  time_t ifmodifiedsince; /* 0 if none */
+};
+
+/* a growable buffer */
+struct http_buff {
+  char *data;
+  long len;
+  long size;
+};
+
+/* returns the length of the request head at the start of buff (up to, and
+ * including, the empty line that ends it), or 0 if the head is incomplete */
+int http_headlen(const char *buff, int len);
+
+/* parses a request head (as found by http_headlen()). returns 0 on success,
+ * or the HTTP status code to answer with otherwise */
+int http_parserequest(struct http_request *req, const char *head, int headlen);
+
+/* translates a request target into a gopher selector: the target is kept
+ * as is (the path of a selector is percent-encoded, like the one of an URL),
+ * except for a 'search=' query, sent by the search forms of HTML menus,
+ * which becomes the search part of the selector. returns -1 if the selector
+ * does not fit in selsize bytes */
+int http_toselector(char *sel, int selsize, const char *target);
+
+/* formats t as an HTTP date ("Sun, 06 Nov 1994 08:49:37 GMT") into buff,
+ * which must be at least 30 bytes long */
+void http_date(char *buff, time_t t);
+
+/* parses an HTTP date, returns 0 if it is not valid */
+time_t http_parsedate(const char *s);
+
+/* returns the content type of a file, after its extension, or its gopher
+ * type if the extension is unknown */
+const char *http_contenttype(const char *ext, char gophertype);
+
+/* returns the reason phrase of an HTTP status code */
+const char *http_reason(int status);
+
+/* returns the HTTP status that matches the status of a request, as set with
+ * accesslog_setstatus() */
+int http_statusof(const char *status);
+
+/* appends len bytes to a buffer. returns -1 if out of memory, or if the
+ * buffer would grow beyond maxsize bytes */
+int http_append(struct http_buff *b, const void *data, long len, long maxsize);
+
+/* returns non-zero if the data looks like a gopher menu: lines made of a
+ * type, a description, a selector, a host and a port, separated by tabs */
+int http_lookslikemenu(const char *data, long len);
+
+/* strips the terminating '.' line of a gopher text document, and the dots
+ * escaping lines that start with a dot. returns the new length */
+long http_untext(char *data, long len);
+
+/* renders a gopher menu as an HTML page, appended to out. items that point
+ * to selfhost:selfport are linked to through the gateway itself, others
+ * through gopher:// URLs. returns -1 if out of memory */
+int http_menutohtml(struct http_buff *out, const char *menu, long len, const char *title, const char *selfhost, long selfport, long maxsize);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * Test & benchmark application for the HTTP gateway.
+ *
+ * Checks the request parser, the translation of request targets into
+ * selectors and the HTTP date functions against known answers, then measures
+ * how fast gopher menus are rendered as HTML.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http.h"
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+struct reqtest {
+  const char *head;
+  int status;     /* expected result of http_parserequest() */
+  int keepalive;  /* expected keep-alive flag (if status is 0) */
+};
+
+static struct reqtest reqtests[] = {
+  {"GET / HTTP/1.1\r\nHost: example.org\r\n\r\n", 0, 1},
+  {"GET / HTTP/1.1\r\nHost: example.org\r\nConnection: close\r\n\r\n", 0, 0},
+  {"GET / HTTP/1.0\r\n\r\n", 0, 0},
+  {"GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", 0, 1},
+  {"HEAD /docs/a.txt HTTP/1.1\r\nHost: x\r\nConnection: keep-alive, TE\r\n\r\n", 0, 1},
+  {"\r\nGET / HTTP/1.1\r\nHost: x\r\n\r\n", 0, 1},
+  {"GET / HTTP/1.1\r\n\r\n", 400, 0},
+  {"GET /\r\n\r\n", 400, 0},
+  {"GET / HTTP/2.0\r\nHost: x\r\n\r\n", 505, 0},
+  {"GET / HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n", 501, 0},
+  {"GET / HTTP/1.1\r\nHost: x\r\nContent-Length: abc\r\n\r\n", 400, 0},
+  {NULL, 0, 0}
+};
+
+struct seltest {
+  const char *target;
+  const char *selector;
+};
+
+static struct seltest seltests[] = {
+  {"/", "/"},
+  {"/docs/a%20b.txt", "/docs/a%20b.txt"},
+  {"/search?search=hello+world", "/search\thello world"},
+  {"/search?search=caf%C3%A9%26co", "/search\tcaf\xc3\xa9&co"},
+  {"/cgi/app.cgi?x=1", "/cgi/app.cgi?x=1"},
+  {"http://example.org/docs", "/docs"},
+  {"http://example.org", "/"},
+  {NULL, NULL}
+};
+
+struct urltest {
+  const char *item;
+  int linked;     /* 1 if the item must be rendered as a link */
+};
+
+static struct urltest urltests[] = {
+  {"hWeb site\tURL:http://example.org/\texample.org\t70\r\n", 1},
+  {"hWeb site\tURL:HTTPS://example.org/\texample.org\t70\r\n", 1},
+  {"hMail me\tURL:mailto:me@example.org\texample.org\t70\r\n", 1},
+  {"hClick me\tURL:javascript:alert(1)\texample.org\t70\r\n", 0},
+  {"hClick me\tURL:JavaScript:alert(1)\texample.org\t70\r\n", 0},
+  {"hClick me\tURL: javascript:alert(1)\texample.org\t70\r\n", 0},
+  {"hClick me\tURL:data:text/html,<script>\texample.org\t70\r\n", 0},
+  {"hClick me\tURL:vbscript:x\texample.org\t70\r\n", 0},
+  {"hNo scheme\tURL://example.org/\texample.org\t70\r\n", 0},
+  {NULL, 0}
+};
+
+
+/* generates a gopher menu of n items, mixing local and remote ones */
+static char *genmenu(int n, long *len) {
+  char *menu, *ptr;
+  int i;
+  menu = malloc((size_t)n * 128 + 4);
+  if (menu == NULL) return(NULL);
+  ptr = menu;
+  for (i = 0; i < n; i++) {
+    switch (i % 4) {
+      case 0:
+        ptr += sprintf(ptr, "1Directory #%d\t/dir%d/\tlocalhost\t70\r\n", i, i);
+        break;
+      case 1:
+        ptr += sprintf(ptr, "0Some <text> & file #%d\t/dir/file%d.txt\tlocalhost\t70\r\n", i, i);
+        break;
+      case 2:
+        ptr += sprintf(ptr, "iAn information line\t\terror.host\t1\r\n");
+        break;
+      default:
+        ptr += sprintf(ptr, "1Elsewhere #%d\t/x y/%d\tgopher.example.org\t70\r\n", i, i);
+        break;
+    }
+  }
+  ptr += sprintf(ptr, ".\r\n");
+  *len = ptr - menu;
+  return(menu);
+}
+
+
+int main(int argc, char **argv) {
+  struct http_request req;
+  struct http_buff out;
+  char sel[1024], date[32];
+  char *menu;
+  long menulen;
+  int x, r, iterations = 2000, errors = 0;
+  double t0, t;
+  time_t ts;
+
+  if (argc > 1) iterations = atoi(argv[1]);
+  if (iterations < 1) {
+    puts("httptest is a simple tool to test and benchmark motsognir's HTTP gateway.");
+    puts("usage: httptest [iterations]");
+    return(1);
+  }
+
+  puts("check the request parser...");
+  for (x = 0; reqtests[x].head != NULL; x++) {
+    int headlen = http_headlen(reqtests[x].head, strlen(reqtests[x].head));
+    r = http_parserequest(&req, reqtests[x].head, headlen);
+    if ((headlen != (int)strlen(reqtests[x].head)) || (r != reqtests[x].status) || ((r == 0) && ((req.keepalive != 0) != reqtests[x].keepalive))) {
+      printf("  FAILED: test #%d (headlen=%d status=%d keepalive=%d)\n", x, headlen, r, req.keepalive);
+      errors++;
+    }
+  }
+  if (http_headlen("GET / HTTP/1.1\r\nHost: x\r\n", 25) != 0) {
+    puts("  FAILED: incomplete head reported as complete");
+    errors++;
+  }
+
+  puts("check the translation of targets into selectors...");
+  for (x = 0; seltests[x].target != NULL; x++) {
+    if ((http_toselector(sel, sizeof(sel), seltests[x].target) != 0) || (strcmp(sel, seltests[x].selector) != 0)) {
+      printf("  FAILED: '%s' -> '%s' (expected '%s')\n", seltests[x].target, sel, seltests[x].selector);
+      errors++;
+    }
+  }
+
+  puts("check HTTP dates...");
+  http_date(date, 784111777);
+  if (strcmp(date, "Sun, 06 Nov 1994 08:49:37 GMT") != 0) {
+    printf("  FAILED: http_date() -> '%s'\n", date);
+    errors++;
+  }
+  for (ts = 0; ts < 2000000000; ts += 86399 * 37) {
+    http_date(date, ts);
+    if (http_parsedate(date) != ts) {
+      printf("  FAILED: '%s' does not parse back to %ld\n", date, (long)ts);
+      errors++;
+      break;
+    }
+  }
+  if (http_parsedate("Sunday, 06-Nov-94 08:49:37 GMT") != 0) {
+    puts("  FAILED: obsolete date format accepted");
+    errors++;
+  }
+
+  puts("check links of URL: items...");
+  for (x = 0; urltests[x].item != NULL; x++) {
+    memset(&out, 0, sizeof(out));
+    if ((http_menutohtml(&out, urltests[x].item, strlen(urltests[x].item), "/", "localhost", 70, 65536) != 0) || (http_append(&out, "", 1, 65536) != 0) || ((strstr(out.data, "<a href=") != NULL) != urltests[x].linked)) {
+      printf("  FAILED: '%s' %s\n", urltests[x].item, urltests[x].linked ? "not linked" : "linked");
+      errors++;
+    }
+    free(out.data);
+  }
+
+  if (errors != 0) {
+    printf("%d errors found!\n", errors);
+    return(1);
+  }
+
+  menu = genmenu(200, &menulen);
+  if (menu == NULL) {
+    puts("out of memory");
+    return(1);
+  }
+  memset(&out, 0, sizeof(out));
+  printf("benchmark %d x rendering of a %d items menu (%ld bytes)...\n", iterations, 200, menulen);
+  t0 = now();
+  for (x = 0; x < iterations; x++) {
+    out.len = 0;
+    if (http_menutohtml(&out, menu, menulen, "/", "localhost", 70, 16 * 1024 * 1024) != 0) {
+      puts("  FAILED: rendering failed");
+      return(1);
+    }
+  }
+  t = now() - t0;
+  printf("  %.0f menus/s, %.1f MiB/s of HTML (%ld bytes per page)\n", iterations / t, (double)iterations * out.len / t / 1048576.0, out.len);
+
+  free(out.data);
+  free(menu);
+  return(0);
+}
@@ -0,0 +1,658 @@
+/*
+ * Load benchmark for motsognir: measures end-to-end throughput and tail
+ * latency of the server.
+ *
+ * Builds a synthetic gopher root in a temporary directory (a directory to
+ * list, a text file, a binary file and a CGI script), starts a motsognir
+ * server on loopback to serve it, and drives a mix of menu, text, binary,
+ * CGI and missing-file requests against it, either at a fixed concurrency
+ * (closed loop) or at a fixed arrival rate (open loop). In the latter case
+ * latencies are measured from the time requests were due, so a server that
+ * falls behind is not hidden by the load generator waiting for it.
+ *
+ * Slow readers may be added: clients that download a large file at a
+ * throttled rate, holding a serving process for the whole time, as real
+ * clients on slow links do. The file is much larger than socket buffers
+ * (loopback ones are several MiB big), so the server does have to wait.
+ *
+ * Reports requests/s, latency percentiles, bytes/s, and the CPU time and
+ * memory used by the server. CPU time comes from the server's scoreboard
+ * (through its status socket), memory from /proc (Linux only).
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define MAXCONNS 4096
+#define MENUFILES 200              /* entries of the listed directory */
+#define TEXTSIZE (64 * 1024)       /* size of the text file */
+#define BINSIZE (1024 * 1024)      /* size of the binary file */
+#define LARGESIZE (8 * 1024 * 1024) /* size of the file for slow readers */
+#define SLOWCHUNK 4096             /* slow readers read that much at once */
+
+/* classes of requests */
+#define MENU    0
+#define TEXT    1
+#define BINARY  2
+#define CGI     3
+#define MISSING 4
+#define SLOW    5  /* slow readers */
+#define CLASSES 6
+
+static const char *classnames[CLASSES] = {"menu", "text", "binary", "cgi", "missing", "slow"};
+
+/* connection states */
+#define FREE       0
+#define CONNECTING 1
+#define SENDING    2
+#define READING    3
+
+struct conn {
+  int fd;
+  int state;
+  int cls;
+  double due;       /* time the request was due (or started) */
+  double nextread;  /* slow readers only: time of the next read */
+  long bytes;
+  char sel[64];
+  int sellen;
+  int selsent;
+};
+
+struct stats {
+  unsigned int *lat;  /* latencies, in us */
+  long count;
+  long size;
+  long errors;
+  double bytes;
+};
+
+struct server {
+  char root[64];
+  char conf[96];
+  char statussock[96];
+  long pid;
+  int port;
+  /* memory, sampled during the run */
+  long peakprocs;
+  long peaktotalrss;  /* in KiB, all server processes */
+  long peakprocrss;   /* in KiB, the biggest process */
+  long masterrss;
+};
+
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+
+static void addsample(struct stats *st, double seconds) {
+  if (st->count == st->size) {
+    unsigned int *newlat;
+    st->size = (st->size == 0) ? 4096 : st->size * 2;
+    newlat = realloc(st->lat, st->size * sizeof(unsigned int));
+    if (newlat == NULL) {
+      st->size = st->count;
+      return;
+    }
+    st->lat = newlat;
+  }
+  st->lat[st->count++] = (unsigned int)(seconds * 1e6);
+}
+
+
+static int cmpuint(const void *a, const void *b) {
+  unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+  if (x < y) return(-1);
+  return(x > y);
+}
+
+
+/* returns the q-quantile of sorted samples, in ms */
+static double quantile(const struct stats *st, double q) {
+  long idx;
+  if (st->count == 0) return(0);
+  idx = (long)(q * st->count);
+  if (idx >= st->count) idx = st->count - 1;
+  return(st->lat[idx] / 1000.0);
+}
+
+
+static int writefile(const char *dir, const char *name, const char *data, long len, int mode) {
+  char path[512];
+  int fd;
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  if (fd < 0) return(-1);
+  if (write(fd, data, len) != len) {
+    close(fd);
+    return(-1);
+  }
+  return(close(fd));
+}
+
+
+/* creates the synthetic gopher root, and the server's configuration */
+static int buildroot(struct server *srv) {
+  char path[256], *buff;
+  long x, len;
+
+  strcpy(srv->root, "/tmp/motsognir-bench.XXXXXX");
+  if (mkdtemp(srv->root) == NULL) return(-1);
+  chmod(srv->root, 0755);
+  buff = malloc(BINSIZE);
+  if (buff == NULL) return(-1);
+
+  /* a directory to list */
+  snprintf(path, sizeof(path), "%s/menu", srv->root);
+  if (mkdir(path, 0755) != 0) return(-1);
+  for (x = 0; x < MENUFILES; x++) {
+    char name[64];
+    snprintf(name, sizeof(name), "document-%03ld.txt", x);
+    if (writefile(path, name, "hello\n", 6, 0644) != 0) return(-1);
+  }
+
+  /* a text file, made of lines of various lengths */
+  for (len = 0, x = 0; len < TEXTSIZE - 80; x++) {
+    len += sprintf(buff + len, "line %ld: %.*s\n", x, (int)(x % 64), "the quick brown fox jumps over the lazy dog, again and again...");
+  }
+  if (writefile(srv->root, "text.txt", buff, len, 0644) != 0) return(-1);
+
+  /* a binary file */
+  for (x = 0; x < BINSIZE; x++) buff[x] = (char)(rand() & 0xff);
+  if (writefile(srv->root, "binary.bin", buff, BINSIZE, 0644) != 0) return(-1);
+  free(buff);
+
+  /* a large (sparse) file for slow readers */
+  snprintf(path, sizeof(path), "%s/large.bin", srv->root);
+  if ((writefile(srv->root, "large.bin", "", 0, 0644) != 0) || (truncate(path, LARGESIZE) != 0)) return(-1);
+
+  /* a CGI script */
+  strcpy(path, "#!/bin/sh\necho \"iHello from a script\tfake\tfake\t0\"\n");
+  if (writefile(srv->root, "script.cgi", path, strlen(path), 0755) != 0) return(-1);
+
+  /* the configuration of the server */
+  snprintf(srv->conf, sizeof(srv->conf), "%s/motsognir.conf", srv->root);
+  snprintf(srv->statussock, sizeof(srv->statussock), "%s/status.sock", srv->root);
+  len = snprintf(path, sizeof(path), "GopherRoot=%s/\nGopherHostname=127.0.0.1\nGopherPort=%d\nbind=::FFFF:127.0.0.1\nGopherCgiSupport=1\nStatusSocket=%s\n", srv->root, srv->port, srv->statussock);
+  return(writefile(srv->root, "motsognir.conf", path, len, 0644));
+}
+
+
+/* removes the synthetic gopher root */
+static void removeroot(const char *dir) {
+  char path[512];
+  struct dirent *ent;
+  DIR *d = opendir(dir);
+  if (d == NULL) return;
+  while ((ent = readdir(d)) != NULL) {
+    struct stat st;
+    if ((strcmp(ent->d_name, ".") == 0) || (strcmp(ent->d_name, "..") == 0)) continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+    if ((lstat(path, &st) == 0) && (S_ISDIR(st.st_mode))) {
+      removeroot(path);
+    } else {
+      unlink(path);
+    }
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+
+/* returns a free TCP port on loopback, or -1 */
+static int freeport(void) {
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  int sock, port = -1;
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0) return(-1);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) && (getsockname(sock, (struct sockaddr *)&addr, &addrlen) == 0)) port = ntohs(addr.sin_port);
+  close(sock);
+  return(port);
+}
+
+
+/* reads the process id, parent and session of a process from /proc. returns
+ * the amount of resident memory (in KiB), or -1 on error */
+static long readprocstat(long pid, long *ppid, long *session) {
+  char path[64], buff[1024], *p;
+  long rss = -1;
+  int fd, len;
+  snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return(-1);
+  len = read(fd, buff, sizeof(buff) - 1);
+  close(fd);
+  if (len <= 0) return(-1);
+  buff[len] = 0;
+  p = strrchr(buff, ')');  /* the process name may contain anything */
+  if (p == NULL) return(-1);
+  /* fields after the name: state ppid pgrp session ... rss is the 22nd */
+  if (sscanf(p + 2, "%*c %ld %*d %ld %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %*u %*u %ld", ppid, session, &rss) != 3) return(-1);
+  return(rss * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+
+/* returns the CPU time (user + system) used by a process, in seconds */
+static double readproccpu(long pid) {
+  char path[64], buff[1024], *p;
+  unsigned long utime, stime;
+  int fd, len;
+  snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return(0);
+  len = read(fd, buff, sizeof(buff) - 1);
+  close(fd);
+  if (len <= 0) return(0);
+  buff[len] = 0;
+  p = strrchr(buff, ')');
+  if ((p == NULL) || (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)) return(0);
+  return((double)(utime + stime) / sysconf(_SC_CLK_TCK));
+}
+
+
+/* finds the pid of the daemonized server: the session leader that runs
+ * with our configuration file */
+static long findserver(const struct server *srv) {
+  struct dirent *ent;
+  DIR *dir;
+  long res = -1;
+  dir = opendir("/proc");
+  if (dir == NULL) return(-1);
+  while ((ent = readdir(dir)) != NULL) {
+    char path[64], cmdline[512];
+    long pid = atol(ent->d_name), ppid, session;
+    int fd, len, x;
+    if ((pid <= 0) || (readprocstat(pid, &ppid, &session) < 0) || (session != pid)) continue;
+    snprintf(path, sizeof(path), "/proc/%ld/cmdline", pid);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) continue;
+    len = read(fd, cmdline, sizeof(cmdline) - 1);
+    close(fd);
+    if (len <= 0) continue;
+    cmdline[len] = 0;
+    for (x = 0; x < len; x += strlen(cmdline + x) + 1) {
+      if (strcmp(cmdline + x, srv->conf) == 0) res = pid;
+    }
+    if (res > 0) break;
+  }
+  closedir(dir);
+  return(res);
+}
+
+
+/* samples the memory used by all processes of the server */
+static void samplememory(struct server *srv) {
+  struct dirent *ent;
+  DIR *dir;
+  long procs = 0, total = 0;
+  dir = opendir("/proc");
+  if (dir == NULL) return;
+  while ((ent = readdir(dir)) != NULL) {
+    long pid = atol(ent->d_name), ppid, session, rss;
+    if (pid <= 0) continue;
+    rss = readprocstat(pid, &ppid, &session);
+    if ((rss < 0) || (session != srv->pid)) continue;
+    procs++;
+    total += rss;
+    if (pid == srv->pid) srv->masterrss = rss;
+    if (rss > srv->peakprocrss) srv->peakprocrss = rss;
+  }
+  closedir(dir);
+  if (procs > srv->peakprocs) srv->peakprocs = procs;
+  if (total > srv->peaktotalrss) srv->peaktotalrss = total;
+}
+
+
+/* reads a counter from the server's status socket (see StatusSocket) */
+static double readstatus(const struct server *srv, const char *key) {
+  static char buff[32768];
+  struct sockaddr_un addr;
+  int sock, len = 0, res;
+  size_t keylen = strlen(key);
+  char *p;
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) return(0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, srv->statussock, sizeof(addr.sun_path) - 1);
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(sock);
+    return(0);
+  }
+  while ((len < (int)sizeof(buff) - 1) && ((res = recv(sock, buff + len, sizeof(buff) - 1 - len, 0)) > 0)) len += res;
+  close(sock);
+  buff[len] = 0;
+  for (p = buff; p != NULL; p = strchr(p, '\n')) {
+    if (*p == '\n') p++;
+    if ((strncmp(p, key, keylen) == 0) && (p[keylen] == '=')) return(atof(p + keylen + 1));
+  }
+  return(0);
+}
+
+
+/* starts the server, and waits until it accepts connections */
+static int startserver(struct server *srv, const char *binary) {
+  struct sockaddr_in addr;
+  pid_t pid;
+  int x, status;
+  pid = fork();
+  if (pid < 0) return(-1);
+  if (pid == 0) {
+    execl(binary, binary, "--config", srv->conf, (char *)NULL);
+    _exit(127);
+  }
+  if ((waitpid(pid, &status, 0) != pid) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != 0)) return(-1);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(srv->port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (x = 0; x < 100; x++) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int res = connect(sock, (struct sockaddr *)&addr, sizeof(addr));
+    close(sock);
+    if (res == 0) break;
+    usleep(50000);
+  }
+  srv->pid = findserver(srv);
+  return((srv->pid > 0) ? 0 : -1);
+}
+
+
+/* picks the class of the next request, as per the mix */
+static int pickclass(const int *mix, int mixtotal) {
+  int r = rand() % mixtotal, x;
+  for (x = 0; x < SLOW; x++) {
+    if (r < mix[x]) return(x);
+    r -= mix[x];
+  }
+  return(MENU);
+}
+
+
+/* opens a connection for a request of the given class */
+static int startconn(struct conn *c, int cls, double due, int port) {
+  struct sockaddr_in addr;
+  static long missingcount;
+  c->cls = cls;
+  c->due = due;
+  c->nextread = 0;
+  c->bytes = 0;
+  c->selsent = 0;
+  switch (cls) {
+    case MENU:    strcpy(c->sel, "/menu/"); break;
+    case TEXT:    strcpy(c->sel, "/text.txt"); break;
+    case CGI:     strcpy(c->sel, "/script.cgi"); break;
+    case MISSING: sprintf(c->sel, "/missing-%ld.txt", missingcount++); break;
+    case SLOW:    strcpy(c->sel, "/large.bin"); break;
+    default:      strcpy(c->sel, "/binary.bin"); break;
+  }
+  strcat(c->sel, "\r\n");
+  c->sellen = strlen(c->sel);
+  c->fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (c->fd < 0) return(-1);
+  fcntl(c->fd, F_SETFL, O_NONBLOCK);
+  if (cls == SLOW) { /* a small receive window, so the server gets to wait */
+    int rcvbuf = SLOWCHUNK * 4;
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) && (errno != EINPROGRESS)) {
+    close(c->fd);
+    return(-1);
+  }
+  c->state = CONNECTING;
+  return(0);
+}
+
+
+/* closes a connection, and accounts its request. failed is set when the
+ * request did not complete */
+static void endconn(struct conn *c, struct stats *st, int failed, double t) {
+  close(c->fd);
+  c->state = FREE;
+  st[c->cls].bytes += c->bytes;
+  if ((failed != 0) || (c->bytes == 0)) {
+    st[c->cls].errors++;
+  } else {
+    addsample(&st[c->cls], t - c->due);
+  }
+}
+
+
+/* moves a connection forward, as per the poll() events it got */
+static void serveconn(struct conn *c, short revents, struct stats *st, double t, double slowdelay) {
+  static char buff[65536];
+  long res;
+  if (c->state == CONNECTING) {
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    if (revents == 0) return;
+    if ((getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0) || (err != 0)) {
+      endconn(c, st, 1, t);
+      return;
+    }
+    c->state = SENDING;
+  }
+  if (c->state == SENDING) {
+    res = send(c->fd, c->sel + c->selsent, c->sellen - c->selsent, MSG_NOSIGNAL);
+    if (res < 0) {
+      if ((errno != EAGAIN) && (errno != EINTR)) endconn(c, st, 1, t);
+      return;
+    }
+    c->selsent += res;
+    if (c->selsent == c->sellen) c->state = READING;
+    return;
+  }
+  if ((revents & (POLLIN | POLLHUP | POLLERR)) == 0) return;
+  res = recv(c->fd, buff, (c->cls == SLOW) ? SLOWCHUNK : sizeof(buff), 0);
+  if (res < 0) {
+    if ((errno != EAGAIN) && (errno != EINTR)) endconn(c, st, 1, t);
+    return;
+  }
+  if (res == 0) {
+    endconn(c, st, 0, t);
+    return;
+  }
+  c->bytes += res;
+  if (c->cls == SLOW) c->nextread = t + slowdelay;
+}
+
+
+static void printstats(const char *name, struct stats *st, double duration) {
+  if ((st->count == 0) && (st->errors == 0) && (st->bytes == 0)) return; /* slow readers may not complete */
+  qsort(st->lat, st->count, sizeof(unsigned int), cmpuint);
+  printf("  %-8s %8ld %9.1f %6ld %9.3f %9.3f %9.3f %9.3f %9.2f\n", name, st->count, st->count / duration, st->errors,
+         quantile(st, 0.50), quantile(st, 0.99), quantile(st, 0.999), quantile(st, 1.0), st->bytes / duration / 1048576.0);
+}
+
+
+static void help(void) {
+  puts("loadbench starts a motsognir server on loopback against a synthetic gopher root, and measures its throughput and latency (Linux only).");
+  puts("");
+  puts("usage: loadbench [-c concurrency] [-r rate] [-d seconds] [-m mix] [-s slowreaders] [-b bytes/s] [-x server]");
+  puts("");
+  puts("  -c concurrency  requests in flight (closed loop), or at most (open loop) (default: 16)");
+  puts("  -r rate         requests started per second (open loop), 0 for closed loop (default: 0)");
+  puts("  -d seconds      duration of the run (default: 10)");
+  puts("  -m mix          weights of the requests, in this order: menu,text,binary,cgi,missing (default: 30,30,20,10,10)");
+  puts("  -s slowreaders  amount of clients downloading a 8 MiB file slowly (default: 0)");
+  puts("  -b bytes/s      download rate of slow readers (default: 65536)");
+  puts("  -x server       motsognir binary to benchmark (default: ./motsognir)");
+}
+
+
+int main(int argc, char **argv) {
+  static struct conn conns[MAXCONNS];
+  static struct pollfd pfd[MAXCONNS];
+  static int pfdconn[MAXCONNS];
+  struct stats st[CLASSES], all;
+  struct server srv;
+  const char *binary = "./motsognir";
+  int mix[SLOW] = {30, 30, 20, 10, 10};
+  int concurrency = 16, slowreaders = 0, mixtotal = 0, x, y;
+  double duration = 10, rate = 0, slowrate = 65536, slowdelay;
+  double t, tstart, tend, nextarrival, nextsample, cpustart, cpuend, mastercpu;
+
+  for (x = 1; x < argc; x++) {
+    if ((strcmp(argv[x], "-c") == 0) && (x + 1 < argc)) {
+      concurrency = atoi(argv[++x]);
+    } else if ((strcmp(argv[x], "-r") == 0) && (x + 1 < argc)) {
+      rate = atof(argv[++x]);
+    } else if ((strcmp(argv[x], "-d") == 0) && (x + 1 < argc)) {
+      duration = atof(argv[++x]);
+    } else if ((strcmp(argv[x], "-m") == 0) && (x + 1 < argc)) {
+      if (sscanf(argv[++x], "%d,%d,%d,%d,%d", &mix[0], &mix[1], &mix[2], &mix[3], &mix[4]) != 5) break;
+    } else if ((strcmp(argv[x], "-s") == 0) && (x + 1 < argc)) {
+      slowreaders = atoi(argv[++x]);
+    } else if ((strcmp(argv[x], "-b") == 0) && (x + 1 < argc)) {
+      slowrate = atof(argv[++x]);
+    } else if ((strcmp(argv[x], "-x") == 0) && (x + 1 < argc)) {
+      binary = argv[++x];
+    } else {
+      break;
+    }
+  }
+  for (y = 0; y < SLOW; y++) {
+    if (mix[y] < 0) x = -1;
+    mixtotal += mix[y];
+  }
+  if ((x != argc) || (concurrency < 1) || (slowreaders < 0) || (concurrency + slowreaders > MAXCONNS) || (rate < 0) || (duration <= 0) || (slowrate <= 0) || (mixtotal <= 0)) {
+    help();
+    return(1);
+  }
+  slowdelay = SLOWCHUNK / slowrate;
+  signal(SIGPIPE, SIG_IGN);
+  srand(1);
+
+  /* set up the server */
+  memset(&srv, 0, sizeof(srv));
+  srv.port = freeport();
+  if ((srv.port < 0) || (buildroot(&srv) != 0)) {
+    printf("failed to build the gopher root in %s: %s\n", srv.root, strerror(errno));
+    return(1);
+  }
+  if (startserver(&srv, binary) != 0) {
+    printf("failed to start the server '%s'\n", binary);
+    removeroot(srv.root);
+    return(1);
+  }
+  printf("server pid %ld on port %d, gopher root %s\n", srv.pid, srv.port, srv.root);
+  printf("%s, %d slow readers at %.0f bytes/s, mix menu=%d text=%d binary=%d cgi=%d missing=%d, %.0fs\n", (rate > 0) ? "open loop" : "closed loop", slowreaders, slowrate, mix[0], mix[1], mix[2], mix[3], mix[4], duration);
+  if (rate > 0) {
+    printf("%.0f requests/s, at most %d in flight\n", rate, concurrency);
+  } else {
+    printf("%d requests in flight\n", concurrency);
+  }
+
+  memset(st, 0, sizeof(st));
+  for (x = 0; x < MAXCONNS; x++) conns[x].state = FREE;
+  cpustart = readstatus(&srv, "cpu.user") + readstatus(&srv, "cpu.system");
+  mastercpu = readproccpu(srv.pid);
+  tstart = now();
+  tend = tstart + duration;
+  nextarrival = tstart;
+  nextsample = tstart;
+
+  for (t = tstart; t < tend; t = now()) {
+    int nfds = 0, timeout;
+    double wakeup = tend;
+
+    /* start requests: slow readers first (slots after the regular ones),
+     * then regular requests, as soon as slots free up (closed loop) or as
+     * per the arrival rate (open loop) */
+    for (x = concurrency; x < concurrency + slowreaders; x++) {
+      if ((conns[x].state == FREE) && (startconn(&conns[x], SLOW, t, srv.port) != 0)) st[SLOW].errors++;
+    }
+    for (x = 0; x < concurrency; x++) {
+      int cls;
+      if ((conns[x].state != FREE) || ((rate > 0) && (nextarrival > t))) continue;
+      cls = pickclass(mix, mixtotal);
+      if (startconn(&conns[x], cls, (rate > 0) ? nextarrival : t, srv.port) != 0) st[cls].errors++;
+      if (rate > 0) nextarrival += 1.0 / rate;
+    }
+    if ((rate > 0) && (nextarrival < wakeup)) wakeup = nextarrival;
+
+    /* memory is sampled ten times per second */
+    if (t >= nextsample) {
+      samplememory(&srv);
+      nextsample = t + 0.1;
+    }
+    if (nextsample < wakeup) wakeup = nextsample;
+
+    /* wait for something to do */
+    for (x = 0; x < concurrency + slowreaders; x++) {
+      if (conns[x].state == FREE) continue;
+      if ((conns[x].state == READING) && (conns[x].cls == SLOW) && (conns[x].nextread > t)) { /* not yet */
+        if (conns[x].nextread < wakeup) wakeup = conns[x].nextread;
+        continue;
+      }
+      pfd[nfds].fd = conns[x].fd;
+      pfd[nfds].events = (conns[x].state == READING) ? POLLIN : POLLOUT;
+      pfd[nfds].revents = 0;
+      pfdconn[nfds++] = x;
+    }
+    timeout = (int)((wakeup - t) * 1000) + 1;
+    if (timeout < 0) timeout = 0;
+    if (poll(pfd, nfds, timeout) < 0) continue;
+    t = now();
+    for (x = 0; x < nfds; x++) {
+      if (pfd[x].revents != 0) serveconn(&conns[pfdconn[x]], pfd[x].revents, st, t, slowdelay);
+    }
+  }
+  duration = now() - tstart;
+
+  /* requests still in flight are not accounted, except for the bytes that
+   * slow readers got so far */
+  for (x = 0; x < concurrency + slowreaders; x++) {
+    if (conns[x].state == FREE) continue;
+    if (conns[x].cls == SLOW) st[SLOW].bytes += conns[x].bytes;
+    close(conns[x].fd);
+  }
+  usleep(200000); /* let serving processes notice, and update the scoreboard */
+  cpuend = readstatus(&srv, "cpu.user") + readstatus(&srv, "cpu.system");
+  mastercpu = readproccpu(srv.pid) - mastercpu;
+  kill(srv.pid, SIGTERM);
+  removeroot(srv.root);
+
+  /* report */
+  memset(&all, 0, sizeof(all));
+  for (x = 0; x < SLOW; x++) {
+    for (y = 0; y < st[x].count; y++) addsample(&all, st[x].lat[y] / 1e6);
+    all.errors += st[x].errors;
+    all.bytes += st[x].bytes;
+  }
+  printf("\n  %-8s %8s %9s %6s %9s %9s %9s %9s %9s\n", "class", "requests", "req/s", "errors", "p50 ms", "p99 ms", "p999 ms", "max ms", "MiB/s");
+  for (x = 0; x < CLASSES; x++) printstats(classnames[x], &st[x], duration);
+  printstats("all", &all, duration); /* slow readers excluded */
+  printf("\nserver CPU: %.2fs for requests, %.2fs for the master process (%.0f%% of one core)\n", (cpuend - cpustart) / 1e6, mastercpu, ((cpuend - cpustart) / 1e6 + mastercpu) * 100 / duration);
+  printf("server memory: %ld processes at most, %ld KiB RSS for all of them at most, %ld KiB for the biggest one, %ld KiB for the master process\n", srv.peakprocs, srv.peaktotalrss, srv.peakprocrss, srv.masterrss);
+  return(0);
+}
@@ -0,0 +1,268 @@
+/*
+ * motsognir-index - builds pre-computed directory listings for Motsognir.
+ *
+ * Walks a gopher root and writes one index file per directory into a
+ * separate index tree (the one pointed by the DirIndexPath directive). Motsognir
+ * then sends these listings as-is, without having to list, sort and stat()
+ * the directories on every request. Directories that did not change since
+ * their last indexing are not listed again, only their subdirectories are
+ * checked, so running the tool periodically is cheap.
+ *
+ * It also builds the full-text search index used by the SearchSelector
+ * directive, which is updated incrementally as well.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "charset.h"
+#include "dirindex.h"
+#include "extmap.h"
+#include "search.h"
+
+#define MAXTHREADS 64
+
+struct job {
+  struct job *next;
+  char relpath[1];  /* this MUST be at the end - struct is made bigger to accomodate the path */
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct job *jobs;
+  int busy;         /* workers currently processing a job */
+  const char *root;
+  const char *indexroot;
+  const struct extmap_t *extmap;
+  int charset;
+  int force;
+  long indexed;
+  long uptodate;
+  long errors;
+} g;
+
+
+/* queues a directory (relative to the root, with a trailing '/') */
+static void pushjob(const char *relpath, const char *name) {
+  struct job *job;
+  size_t len = strlen(relpath) + strlen(name) + 2;
+  job = malloc(sizeof(struct job) + len);
+  if (job == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  snprintf(job->relpath, len, "%s%s%s", relpath, name, (name[0] != 0) ? "/" : "");
+  pthread_mutex_lock(&g.lock);
+  job->next = g.jobs;
+  g.jobs = job;
+  pthread_cond_signal(&g.cond);
+  pthread_mutex_unlock(&g.lock);
+}
+
+
+/* creates a directory and all its parents, if they do not exist yet */
+static int mkdirs(const char *path) {
+  char buff[4096];
+  size_t x;
+  snprintf(buff, sizeof(buff), "%s", path);
+  for (x = 1; buff[x] != 0; x++) {
+    if (buff[x] != '/') continue;
+    buff[x] = 0;
+    if ((mkdir(buff, 0755) != 0) && (errno != EEXIST)) return(-1);
+    buff[x] = '/';
+  }
+  if ((mkdir(buff, 0755) != 0) && (errno != EEXIST)) return(-1);
+  return(0);
+}
+
+
+/* indexes a single directory (if needed) and queues its subdirectories */
+static void processdir(const char *relpath) {
+  char dirpath[4096], indexdir[4096], indexfile[4096 + sizeof(DIRINDEX_FILENAME)];
+  struct dirindex_t *idx;
+  struct dirindex_entry e;
+  struct stat st;
+  long x;
+
+  snprintf(dirpath, sizeof(dirpath), "%s%s", g.root, relpath);
+  snprintf(indexdir, sizeof(indexdir), "%s%s", g.indexroot, relpath);
+  snprintf(indexfile, sizeof(indexfile), "%s%s", indexdir, DIRINDEX_FILENAME);
+  if (stat(dirpath, &st) != 0) {
+    fprintf(stderr, "%s: %s\n", dirpath, strerror(errno));
+    pthread_mutex_lock(&g.lock);
+    g.errors++;
+    pthread_mutex_unlock(&g.lock);
+    return;
+  }
+
+  /* is the existing index still valid? */
+  idx = NULL;
+  if (g.force == 0) idx = dirindex_open(indexfile, &st);
+  if ((idx != NULL) && (dirindex_charset(idx) != g.charset)) { /* built for another charset */
+    dirindex_close(idx);
+    idx = NULL;
+  }
+  if (idx != NULL) {
+    pthread_mutex_lock(&g.lock);
+    g.uptodate++;
+    pthread_mutex_unlock(&g.lock);
+  } else {
+    if ((mkdirs(indexdir) != 0) || (dirindex_build(dirpath, &st, indexfile, g.extmap, g.charset) != 0)) {
+      fprintf(stderr, "%s: %s\n", dirpath, strerror(errno));
+      pthread_mutex_lock(&g.lock);
+      g.errors++;
+      pthread_mutex_unlock(&g.lock);
+      return;
+    }
+    pthread_mutex_lock(&g.lock);
+    g.indexed++;
+    pthread_mutex_unlock(&g.lock);
+    idx = dirindex_open(indexfile, &st);
+    if (idx == NULL) return; /* the directory changed in the meantime - it will be indexed on next run */
+  }
+
+  /* subdirectories must be checked in any case */
+  for (x = 0; x < dirindex_count(idx); x++) {
+    if (dirindex_get(idx, x, &e) != 0) continue;
+    if (e.isdir != 0) pushjob(relpath, e.name);
+  }
+  dirindex_close(idx);
+}
+
+
+static void *worker(void *arg) {
+  struct job *job;
+  (void)arg;
+  for (;;) {
+    pthread_mutex_lock(&g.lock);
+    while ((g.jobs == NULL) && (g.busy > 0)) pthread_cond_wait(&g.cond, &g.lock);
+    if (g.jobs == NULL) { /* nothing left to do, and nobody could produce more */
+      pthread_cond_broadcast(&g.cond);
+      pthread_mutex_unlock(&g.lock);
+      return(NULL);
+    }
+    job = g.jobs;
+    g.jobs = job->next;
+    g.busy++;
+    pthread_mutex_unlock(&g.lock);
+
+    processdir(job->relpath);
+    free(job);
+
+    pthread_mutex_lock(&g.lock);
+    g.busy--;
+    if ((g.busy == 0) && (g.jobs == NULL)) pthread_cond_broadcast(&g.cond);
+    pthread_mutex_unlock(&g.lock);
+  }
+}
+
+
+static void help(void) {
+  puts("motsognir-index builds pre-computed directory listings for the Motsognir gopher server.");
+  puts("");
+  puts("usage: motsognir-index [-j threads] [-e extmapfile] [-c charset] [-f] [-s searchindex] gopherroot [indexroot]");
+  puts("");
+  puts("At least one of indexroot (directory listings) or -s (search index) is required.");
+  puts("");
+  puts("  -j threads     amount of directories indexed in parallel (default: 4)");
+  puts("  -e extmapfile  extension mapping file (same as the ExtMapFile directive)");
+  puts("  -c charset     output charset of listings (same as the OutputCharset directive)");
+  puts("  -f             re-index all directories, even those that did not change");
+  puts("  -s searchindex build the full-text search index (same as the SearchIndex directive)");
+}
+
+
+int main(int argc, char **argv) {
+  pthread_t threads[MAXTHREADS];
+  char root[4096], indexroot[4096];
+  const char *extmapfile = NULL, *searchindex = NULL;
+  struct extmap_t *extmap;
+  int threadscount = 4, x, i;
+
+  memset(&g, 0, sizeof(g));
+  for (x = 1; x < argc; x++) {
+    if ((strcmp(argv[x], "-j") == 0) && (x + 1 < argc)) {
+      threadscount = atoi(argv[++x]);
+    } else if ((strcmp(argv[x], "-e") == 0) && (x + 1 < argc)) {
+      extmapfile = argv[++x];
+    } else if ((strcmp(argv[x], "-c") == 0) && (x + 1 < argc)) {
+      g.charset = charset_id(argv[++x]);
+      if (g.charset < 0) {
+        fprintf(stderr, "unsupported charset: %s\n", argv[x]);
+        return(1);
+      }
+    } else if ((strcmp(argv[x], "-s") == 0) && (x + 1 < argc)) {
+      searchindex = argv[++x];
+    } else if (strcmp(argv[x], "-f") == 0) {
+      g.force = 1;
+    } else {
+      break;
+    }
+  }
+  if ((x + 2 != argc) && ((x + 1 != argc) || (searchindex == NULL))) {
+    help();
+    return(1);
+  }
+  if ((threadscount < 1) || (threadscount > MAXTHREADS)) {
+    help();
+    return(1);
+  }
+  /* directories are processed by their path relative to the root, starting
+   * with a '/' (just like selectors), so the roots are kept without any
+   * trailing '/' */
+  snprintf(root, sizeof(root), "%s", argv[x]);
+  snprintf(indexroot, sizeof(indexroot), "%s", (x + 1 < argc) ? argv[x + 1] : "");
+  while ((root[0] != 0) && (root[strlen(root) - 1] == '/')) root[strlen(root) - 1] = 0;
+  while ((indexroot[0] != 0) && (indexroot[strlen(indexroot) - 1] == '/')) indexroot[strlen(indexroot) - 1] = 0;
+  g.root = root;
+  g.indexroot = indexroot;
+
+  extmap = extmap_load(extmapfile);
+  if (extmap == NULL) {
+    fprintf(stderr, "failed to load the extension mapping\n");
+    return(1);
+  }
+  g.extmap = extmap;
+
+  if (searchindex != NULL) {
+    struct search_stats stats;
+    if (g.force != 0) unlink(searchindex);
+    if (search_build(root, searchindex, extmap, &stats) != 0) {
+      fprintf(stderr, "%s: failed to build the search index\n", searchindex);
+      g.errors++;
+    } else {
+      printf("search index: %ld documents from %ld files (%ld unchanged), %ld terms\n", stats.docs, stats.sources, stats.reused, stats.terms);
+    }
+    if (argc == x + 1) {
+      extmap_free(extmap);
+      return((g.errors != 0) ? 2 : 0);
+    }
+  }
+
+  pthread_mutex_init(&g.lock, NULL);
+  pthread_cond_init(&g.cond, NULL);
+  pushjob("/", "");
+
+  for (i = 0; i < threadscount; i++) {
+    if (pthread_create(&threads[i], NULL, worker, NULL) != 0) break;
+  }
+  if (i == 0) {
+    fprintf(stderr, "failed to start any thread\n");
+    return(1);
+  }
+  while (i-- > 0) pthread_join(threads[i], NULL);
+
+  printf("%ld directories indexed, %ld up to date, %ld errors\n", g.indexed, g.uptodate, g.errors);
+  extmap_free(extmap);
+  return((g.errors != 0) ? 2 : 0);
+}
@@ -0,0 +1,580 @@
+/*
+ * motsognir-replay - replays the requests of a log file against a server.
+ *
+ * Extracts the requests recorded in a log file, either the Query='...'
+ * messages that motsognir sends to syslog in verbose mode, or the records of
+ * its access log (AccessLog directive, in a file or in syslog), and sends
+ * them again to a server: at their original pace, N times faster, or as fast
+ * as possible. Latencies are measured from the time requests are due, so a
+ * server that cannot keep up shows it.
+ *
+ * Results are reported per class of selector (menus, text files, binary
+ * files, scripts and searches, guessed from the selector alone), and may be
+ * saved as a baseline, that later runs are compared against.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define MAXCONNS 4096
+
+/* classes of selectors */
+#define MENU    0
+#define TEXT    1
+#define BINARY  2
+#define SCRIPT  3
+#define SEARCH  4
+#define ALL     5  /* all of the above */
+#define CLASSES 6
+
+static const char *classnames[CLASSES] = {"menu", "text", "binary", "script", "search", "all"};
+
+/* metrics saved into baselines, latencies being in ms */
+#define METRICS 6
+static const char *metricnames[METRICS] = {"requests", "errors", "p50", "p90", "p99", "p999"};
+
+struct rec {
+  double t;     /* start time, in seconds (since an arbitrary origin) */
+  double stamp; /* time as logged */
+  int coarse;   /* the stamp has a resolution of one second only */
+  int cls;
+  char *sel;
+};
+
+struct conn {
+  int fd;       /* -1 if free */
+  int cls;
+  double due;
+  long bytes;
+  char *sel;    /* selector followed by CRLF */
+  int sellen;
+  int selsent;
+  int connected;
+};
+
+struct stats {
+  unsigned int *lat;  /* latencies, in us */
+  long count;
+  long size;
+  long errors;
+  double bytes;
+};
+
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+
+/* returns the amount of days between 1970-01-01 and the given date */
+static long daysfromcivil(int y, int m, int d) {
+  long era;
+  int yoe, doy;
+  y -= (m <= 2);
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  return(era * 146097 + (long)yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468);
+}
+
+
+/* parses an ISO 8601 timestamp (2019-02-19T10:20:30[.123456][Z|+01:00]).
+ * the time zone is ignored. sets coarse if the timestamp has no fractional
+ * part. returns 0 on success */
+static int parseiso(const char *s, double *t, int *coarse) {
+  int y, mo, d, h, mi, sec, n = 0;
+  if ((sscanf(s, "%4d-%2d-%2dT%2d:%2d:%2d%n", &y, &mo, &d, &h, &mi, &sec, &n) != 6) || (n != 19)) return(-1);
+  *t = (double)daysfromcivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + sec;
+  *coarse = 1;
+  if (s[19] == '.') {
+    double frac = 0.1;
+    for (s += 20; (*s >= '0') && (*s <= '9'); s++, frac /= 10) *t += (*s - '0') * frac;
+    *coarse = 0;
+  }
+  return(0);
+}
+
+
+/* parses a BSD syslog timestamp (Feb 19 10:20:30). the year is unknown, so
+ * the result is relative to the start of the year */
+static int parsebsd(const char *s, double *t) {
+  static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  const char *m;
+  int d, h, mi, sec;
+  if (strlen(s) < 15) return(-1);
+  for (m = months; *m != 0; m += 3) {
+    if (strncmp(s, m, 3) == 0) break;
+  }
+  if ((*m == 0) || (sscanf(s + 3, "%d %d:%d:%d", &d, &h, &mi, &sec) != 4)) return(-1);
+  *t = (double)daysfromcivil(2000, (m - months) / 3 + 1, d) * 86400 + h * 3600 + mi * 60 + sec;
+  return(0);
+}
+
+
+/* guesses the class of a selector */
+static int classify(const char *sel) {
+  static const char *textexts[] = {"txt", "text", "md", "log", "csv", "asc", "nfo", NULL};
+  const char *ext = NULL, *p;
+  int x;
+  if (strchr(sel, '\t') != NULL) return(SEARCH);
+  if (strchr(sel, '?') != NULL) return(SCRIPT);
+  for (p = sel; *p != 0; p++) {
+    if (*p == '/') ext = NULL;
+    if (*p == '.') ext = p + 1;
+  }
+  if ((ext == NULL) || (*ext == 0)) return(MENU);
+  if ((strcasecmp(ext, "cgi") == 0) || (strcasecmp(ext, "php") == 0)) return(SCRIPT);
+  for (x = 0; textexts[x] != NULL; x++) {
+    if (strcasecmp(ext, textexts[x]) == 0) return(TEXT);
+  }
+  return(BINARY);
+}
+
+
+static int hexval(char c) {
+  if ((c >= '0') && (c <= '9')) return(c - '0');
+  if ((c >= 'A') && (c <= 'F')) return(c - 'A' + 10);
+  if ((c >= 'a') && (c <= 'f')) return(c - 'a' + 10);
+  return(-1);
+}
+
+
+/* extracts a request out of a log line. returns 0 on success */
+static int parseline(char *line, struct rec *r) {
+  char *p, *end, *dst, *sel;
+  r->t = 0;
+  p = strstr(line, "Z client=");
+  if ((p != NULL) && (p - line >= 19) && ((end = strstr(p, " selector=\"")) != NULL)) {
+    /* an access log record: its timestamp is the time the request ended */
+    char *ms = strstr(p, " ms=");
+    if (parseiso(p - 19, &(r->stamp), &(r->coarse)) != 0) return(-1);
+    if ((ms != NULL) && (ms < end)) r->t = -atof(ms + 4) / 1000;
+    /* the selector is quoted, with \xHH escapes */
+    sel = p = end + 11;
+    end = strrchr(p, '"');
+    if (end == NULL) return(-1);
+    for (dst = p; p < end; p++) {
+      if ((p[0] == '\\') && (p[1] == 'x') && (hexval(p[2]) >= 0) && (hexval(p[3]) >= 0)) {
+        *dst++ = (char)(hexval(p[2]) * 16 + hexval(p[3]));
+        p += 3;
+      } else {
+        *dst++ = *p;
+      }
+    }
+    *dst = 0;
+  } else if ((p = strstr(line, "Query='")) != NULL) {
+    /* a Query='...' syslog message: the line starts with the timestamp,
+     * possibly preceded by a <priority> tag */
+    char *ts = line;
+    if ((*ts == '<') && (strchr(ts, '>') != NULL)) ts = strchr(ts, '>') + 1;
+    if (parseiso(ts, &(r->stamp), &(r->coarse)) != 0) {
+      if (parsebsd(ts, &(r->stamp)) != 0) return(-1);
+      r->coarse = 1;
+    }
+    sel = p = p + 7;
+    end = strrchr(p, '\'');
+    if (end == NULL) return(-1);
+    /* syslog daemons escape control chars as #ooo (octal) */
+    for (dst = p; p < end; p++) {
+      if ((p[0] == '#') && (p[1] == '0') && (p[2] >= '0') && (p[2] <= '3') && (p[3] >= '0') && (p[3] <= '7')) {
+        *dst++ = (char)((p[2] - '0') * 8 + (p[3] - '0'));
+        p += 3;
+      } else {
+        *dst++ = *p;
+      }
+    }
+    *dst = 0;
+  } else {
+    return(-1);
+  }
+  r->sel = strdup(sel);
+  if (r->sel == NULL) return(-1);
+  r->cls = classify(r->sel);
+  return(0);
+}
+
+
+static int cmprec(const void *a, const void *b) {
+  const struct rec *x = a, *y = b;
+  if (x->t < y->t) return(-1);
+  return(x->t > y->t);
+}
+
+
+/* loads all requests of a log file. returns their amount, or -1 on error */
+static long loadlog(const char *file, struct rec **recs) {
+  static char line[16384];
+  FILE *fd;
+  long count = 0, size = 0, x, y, i;
+  fd = (strcmp(file, "-") == 0) ? stdin : fopen(file, "rb");
+  if (fd == NULL) return(-1);
+  *recs = NULL;
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    struct rec r;
+    line[strcspn(line, "\r\n")] = 0;
+    if (parseline(line, &r) != 0) continue;
+    if (count == size) {
+      struct rec *newrecs;
+      size = (size == 0) ? 1024 : size * 2;
+      newrecs = realloc(*recs, size * sizeof(struct rec));
+      if (newrecs == NULL) break;
+      *recs = newrecs;
+    }
+    (*recs)[count++] = r;
+  }
+  if (fd != stdin) fclose(fd);
+  /* requests logged within the same second are spread over that second,
+   * so they do not all start at once */
+  for (x = 0; x < count; x = y) {
+    y = x + 1;
+    if ((*recs)[x].coarse != 0) {
+      while ((y < count) && ((*recs)[y].coarse != 0) && ((*recs)[y].stamp == (*recs)[x].stamp)) y++;
+    }
+    for (i = x; i < y; i++) (*recs)[i].t += (*recs)[i].stamp + (double)(i - x) / (y - x);
+  }
+  qsort(*recs, count, sizeof(struct rec), cmprec);
+  return(count);
+}
+
+
+static void addsample(struct stats *st, double seconds) {
+  if (st->count == st->size) {
+    unsigned int *newlat;
+    st->size = (st->size == 0) ? 4096 : st->size * 2;
+    newlat = realloc(st->lat, st->size * sizeof(unsigned int));
+    if (newlat == NULL) {
+      st->size = st->count;
+      return;
+    }
+    st->lat = newlat;
+  }
+  st->lat[st->count++] = (unsigned int)(seconds * 1e6);
+}
+
+
+static int cmpuint(const void *a, const void *b) {
+  unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+  if (x < y) return(-1);
+  return(x > y);
+}
+
+
+/* returns the q-quantile of sorted samples, in ms */
+static double quantile(const struct stats *st, double q) {
+  long idx;
+  if (st->count == 0) return(0);
+  idx = (long)(q * st->count);
+  if (idx >= st->count) idx = st->count - 1;
+  return(st->lat[idx] / 1000.0);
+}
+
+
+/* computes the metrics saved into baselines */
+static void getmetrics(const struct stats *st, double *m) {
+  m[0] = st->count;
+  m[1] = st->errors;
+  m[2] = quantile(st, 0.50);
+  m[3] = quantile(st, 0.90);
+  m[4] = quantile(st, 0.99);
+  m[5] = quantile(st, 0.999);
+}
+
+
+/* loads a baseline file (class.metric=value lines). returns 0 on success */
+static int loadbaseline(const char *file, double baseline[CLASSES][METRICS]) {
+  char line[256];
+  FILE *fd;
+  int x, y;
+  fd = fopen(file, "rb");
+  if (fd == NULL) return(-1);
+  for (x = 0; x < CLASSES; x++) for (y = 0; y < METRICS; y++) baseline[x][y] = -1;
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    char *dot = strchr(line, '.'), *eq = strchr(line, '=');
+    if ((dot == NULL) || (eq == NULL) || (eq < dot)) continue;
+    for (x = 0; x < CLASSES; x++) {
+      if ((strlen(classnames[x]) != (size_t)(dot - line)) || (strncmp(line, classnames[x], dot - line) != 0)) continue;
+      for (y = 0; y < METRICS; y++) {
+        if ((strlen(metricnames[y]) == (size_t)(eq - dot - 1)) && (strncmp(dot + 1, metricnames[y], eq - dot - 1) == 0)) baseline[x][y] = atof(eq + 1);
+      }
+    }
+  }
+  fclose(fd);
+  return(0);
+}
+
+
+static int savebaseline(const char *file, struct stats *st) {
+  FILE *fd;
+  double m[METRICS];
+  int x, y;
+  fd = fopen(file, "wb");
+  if (fd == NULL) return(-1);
+  for (x = 0; x < CLASSES; x++) {
+    getmetrics(&st[x], m);
+    for (y = 0; y < METRICS; y++) fprintf(fd, "%s.%s=%.3f\n", classnames[x], metricnames[y], m[y]);
+  }
+  return(fclose(fd));
+}
+
+
+/* opens a connection for a request. returns 0 on success */
+static int startconn(struct conn *c, const struct rec *r, double due, const struct addrinfo *addr) {
+  c->cls = r->cls;
+  c->due = due;
+  c->bytes = 0;
+  c->selsent = 0;
+  c->connected = 0;
+  c->sellen = strlen(r->sel) + 2;
+  c->sel = malloc(c->sellen + 1);
+  if (c->sel == NULL) return(-1);
+  sprintf(c->sel, "%s\r\n", r->sel);
+  c->fd = socket(addr->ai_family, SOCK_STREAM, 0);
+  if (c->fd < 0) {
+    free(c->sel);
+    return(-1);
+  }
+  fcntl(c->fd, F_SETFL, O_NONBLOCK);
+  if ((connect(c->fd, addr->ai_addr, addr->ai_addrlen) != 0) && (errno != EINPROGRESS)) {
+    close(c->fd);
+    c->fd = -1;
+    free(c->sel);
+    return(-1);
+  }
+  return(0);
+}
+
+
+/* closes a connection, and accounts its request */
+static void endconn(struct conn *c, struct stats *st, int failed, double t) {
+  close(c->fd);
+  c->fd = -1;
+  free(c->sel);
+  st[c->cls].bytes += c->bytes;
+  if ((failed != 0) || (c->bytes == 0)) {
+    st[c->cls].errors++;
+  } else {
+    addsample(&st[c->cls], t - c->due);
+  }
+}
+
+
+/* moves a connection forward, as per the poll() events it got */
+static void serveconn(struct conn *c, short revents, struct stats *st, double t) {
+  static char buff[65536];
+  long res;
+  if (c->connected == 0) {
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    if ((getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0) || (err != 0)) {
+      endconn(c, st, 1, t);
+      return;
+    }
+    c->connected = 1;
+  }
+  if (c->selsent < c->sellen) {
+    res = send(c->fd, c->sel + c->selsent, c->sellen - c->selsent, MSG_NOSIGNAL);
+    if (res < 0) {
+      if ((errno != EAGAIN) && (errno != EINTR)) endconn(c, st, 1, t);
+      return;
+    }
+    c->selsent += res;
+    return;
+  }
+  if ((revents & (POLLIN | POLLHUP | POLLERR)) == 0) return;
+  res = recv(c->fd, buff, sizeof(buff), 0);
+  if (res < 0) {
+    if ((errno != EAGAIN) && (errno != EINTR)) endconn(c, st, 1, t);
+    return;
+  }
+  if (res == 0) {
+    endconn(c, st, 0, t);
+    return;
+  }
+  c->bytes += res;
+}
+
+
+static void help(void) {
+  puts("motsognir-replay replays the requests found in a motsognir log against a server, and reports latencies per class of selector.");
+  puts("");
+  puts("usage: motsognir-replay [options] logfile");
+  puts("");
+  puts("  logfile        syslog file with Query='...' messages (logged in Verbose mode), or access log (AccessLog), '-' for stdin");
+  puts("  -h host        server to send requests to (default: 127.0.0.1)");
+  puts("  -p port        port of the server (default: 70)");
+  puts("  -s speed       1 replays requests at their original pace, 2 twice as fast... 0 as fast as possible (default: 1)");
+  puts("  -c concurrency requests in flight at most (default: 16)");
+  puts("  -t timeout     seconds after which a request is considered failed (default: 30)");
+  puts("  -o file        save the results as a baseline");
+  puts("  -b file        compare the results against a baseline");
+  puts("");
+  puts("Note that an access log logs only part of successful requests if AccessLogSampling is set.");
+}
+
+
+int main(int argc, char **argv) {
+  static struct conn conns[MAXCONNS];
+  static struct pollfd pfd[MAXCONNS];
+  static int pfdconn[MAXCONNS];
+  static struct stats st[CLASSES];
+  static double baseline[CLASSES][METRICS];
+  struct addrinfo hints, *addr;
+  struct rec *recs;
+  const char *host = "127.0.0.1", *port = "70", *logfile, *savefile = NULL, *basefile = NULL;
+  double speed = 1, timeout = 30, t, tstart, duration, m[METRICS];
+  long count, next = 0, x, y;
+  int concurrency = 16, inflight = 0;
+
+  for (x = 1; x < argc; x++) {
+    if ((strcmp(argv[x], "-h") == 0) && (x + 1 < argc)) {
+      host = argv[++x];
+    } else if ((strcmp(argv[x], "-p") == 0) && (x + 1 < argc)) {
+      port = argv[++x];
+    } else if ((strcmp(argv[x], "-s") == 0) && (x + 1 < argc)) {
+      speed = atof(argv[++x]);
+    } else if ((strcmp(argv[x], "-c") == 0) && (x + 1 < argc)) {
+      concurrency = atoi(argv[++x]);
+    } else if ((strcmp(argv[x], "-t") == 0) && (x + 1 < argc)) {
+      timeout = atof(argv[++x]);
+    } else if ((strcmp(argv[x], "-o") == 0) && (x + 1 < argc)) {
+      savefile = argv[++x];
+    } else if ((strcmp(argv[x], "-b") == 0) && (x + 1 < argc)) {
+      basefile = argv[++x];
+    } else {
+      break;
+    }
+  }
+  if ((x + 1 != argc) || (speed < 0) || (timeout <= 0) || (concurrency < 1) || (concurrency > MAXCONNS)) {
+    help();
+    return(1);
+  }
+  logfile = argv[x];
+  signal(SIGPIPE, SIG_IGN);
+
+  if ((basefile != NULL) && (loadbaseline(basefile, baseline) != 0)) {
+    printf("failed to load the baseline '%s': %s\n", basefile, strerror(errno));
+    return(1);
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &addr) != 0) {
+    printf("failed to resolve '%s'\n", host);
+    return(1);
+  }
+  count = loadlog(logfile, &recs);
+  if (count < 0) {
+    printf("failed to read '%s': %s\n", logfile, strerror(errno));
+    return(1);
+  }
+  if (count == 0) {
+    printf("no requests found in '%s'\n", logfile);
+    return(1);
+  }
+  printf("replaying %ld requests spanning %.1fs ", count, recs[count - 1].t - recs[0].t);
+  if (speed > 0) {
+    printf("at %gx speed, %d in flight at most\n", speed, concurrency);
+  } else {
+    printf("as fast as possible, %d in flight\n", concurrency);
+  }
+  fflush(stdout);
+
+  for (x = 0; x < concurrency; x++) conns[x].fd = -1;
+  tstart = now();
+  for (t = tstart; (next < count) || (inflight > 0); t = now()) {
+    int nfds = 0, polltimeout = 100;
+
+    /* start the requests that are due, as long as slots are free */
+    for (x = 0; (x < concurrency) && (next < count); x++) {
+      double due = (speed > 0) ? tstart + (recs[next].t - recs[0].t) / speed : t;
+      if (conns[x].fd >= 0) continue;
+      if (due > t) {
+        if ((due - t) * 1000 < polltimeout) polltimeout = (int)((due - t) * 1000) + 1;
+        break;
+      }
+      if (startconn(&conns[x], &recs[next], due, addr) != 0) {
+        st[recs[next].cls].errors++;
+      } else {
+        inflight++;
+      }
+      next++;
+    }
+
+    for (x = 0; x < concurrency; x++) {
+      if (conns[x].fd < 0) continue;
+      if (t - conns[x].due > timeout) { /* took too long */
+        endconn(&conns[x], st, 1, t);
+        inflight--;
+        continue;
+      }
+      pfd[nfds].fd = conns[x].fd;
+      pfd[nfds].events = (conns[x].selsent < conns[x].sellen) ? POLLOUT : POLLIN;
+      pfd[nfds].revents = 0;
+      pfdconn[nfds++] = x;
+    }
+    if (poll(pfd, nfds, polltimeout) < 0) continue;
+    t = now();
+    for (x = 0; x < nfds; x++) {
+      if (pfd[x].revents == 0) continue;
+      serveconn(&conns[pfdconn[x]], pfd[x].revents, st, t);
+      if (conns[pfdconn[x]].fd < 0) inflight--;
+    }
+  }
+  duration = now() - tstart;
+  freeaddrinfo(addr);
+
+  /* report */
+  for (x = 0; x < ALL; x++) {
+    for (y = 0; y < st[x].count; y++) addsample(&st[ALL], st[x].lat[y] / 1e6);
+    st[ALL].errors += st[x].errors;
+    st[ALL].bytes += st[x].bytes;
+  }
+  printf("done in %.1fs (%.1f requests/s)\n\n", duration, count / duration);
+  printf("  %-8s %8s %6s %9s %9s %9s %9s %9s %9s\n", "class", "requests", "errors", "p50 ms", "p90 ms", "p99 ms", "p999 ms", "max ms", "MiB");
+  for (x = 0; x < CLASSES; x++) {
+    if ((st[x].count == 0) && (st[x].errors == 0)) continue;
+    qsort(st[x].lat, st[x].count, sizeof(unsigned int), cmpuint);
+    printf("  %-8s %8ld %6ld %9.3f %9.3f %9.3f %9.3f %9.3f %9.2f\n", classnames[x], st[x].count, st[x].errors,
+           quantile(&st[x], 0.50), quantile(&st[x], 0.90), quantile(&st[x], 0.99), quantile(&st[x], 0.999), quantile(&st[x], 1.0), st[x].bytes / 1048576.0);
+  }
+
+  if (basefile != NULL) {
+    printf("\ncompared to %s (latency changes, in %%):\n\n", basefile);
+    printf("  %-8s %8s %6s %9s %9s %9s %9s\n", "class", "requests", "errors", "p50", "p90", "p99", "p999");
+    for (x = 0; x < CLASSES; x++) {
+      if (((st[x].count == 0) && (st[x].errors == 0)) || (baseline[x][0] < 0)) continue;
+      getmetrics(&st[x], m);
+      printf("  %-8s %+8.0f %+6.0f", classnames[x], m[0] - baseline[x][0], m[1] - baseline[x][1]);
+      for (y = 2; y < METRICS; y++) {
+        if (baseline[x][y] > 0) {
+          printf(" %+8.1f%%", (m[y] - baseline[x][y]) * 100 / baseline[x][y]);
+        } else {
+          printf(" %9s", "-");
+        }
+      }
+      printf("\n");
+    }
+  }
+
+  if ((savefile != NULL) && (savebaseline(savefile, st) != 0)) {
+    printf("failed to save the baseline to '%s': %s\n", savefile, strerror(errno));
+    return(1);
+  }
+  return((st[ALL].errors == 0) ? 0 : 2);
+}
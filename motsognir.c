@@ -24,10 +24,11 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <grp.h>
 #include <limits.h>  /* required by FreeBSD to define PATH_MAX */
 #include <pwd.h>
-#include <regex.h>   /* regcomp(), regexec()... */
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,14 +39,38 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>  /* required by FreeBSD to define in6addr_any */
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>    /* mmap() */
+#include <sys/resource.h> /* setrlimit() */
 #include <sys/uio.h>     /* writev() */
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>    /* sockaddr_un */
 #include <sys/wait.h>  /* WEXITSTATUS */
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
-#include "binary.h"
+#include "accesslog.h"
+#include "arena.h"
+#include "charset.h"
+#include "conffile.h"
+#include "dirindex.h"
+#include "dirlist.h"
 #include "extmap.h"
+#include "gopherplus.h"
+#include "gopherutil.h"
+#include "http.h"
+#include "router.h"
+#include "scoreboard.h"
+#include "search.h"
+#include "selcheck.h"
+#include "selparse.h"
+#include "sniff.h"
+#include "tls.h"
+#include "txtstream.h"
+#include "vhost.h"
 
 /* Constants */
 #define pVer "1.0.11"
@@ -60,6 +85,20 @@
 #endif
 
 
+/* maximum values for CgiConcurrency rules (concurrency and wait queue) */
+#define CGISLOTS_MAX 64
+
+/* a CgiConcurrency rule, along with its slots in shared memory. A slot holds
+ * the pid of the process that owns it, or 0 if it is free. */
+struct cgiconcurrency {
+  char *glob;
+  int maxrunning;
+  int maxwaiting;
+  int queuetimeout;
+  pid_t *running; /* CGISLOTS_MAX slots in shared memory */
+  pid_t *waiting; /* CGISLOTS_MAX slots in shared memory */
+};
+
 struct MotsognirConfig {
   char *gopherroot;
   char *userdir;
@@ -76,9 +115,25 @@ struct MotsognirConfig {
   int cgisupport;
   int phpsupport;
   int subgophermaps;
+  int subgophermapsmaxparallel;
+  int subgophermapstimeout;
+  int cgitimeout;
+  int cgimaxcputime;
+  int cgimaxmemory;
+  int cgimaxfilesize;
+  long cgimaxoutput;
+  struct cgiconcurrency *cgiconcurrency;
+  int cgiconcurrencycount;
   int paranoidmode;
+  int dirlistpagesize;
+  char *dirindexpath;
+  char *gopherplusadmin;
+  char *searchselector;
+  char *searchindex;
+  int searchmaxresults;
   char *plugin;
-  regex_t *pluginfilter;
+  char *pluginfilter;
+  struct router_t *router;
   char *runasuser;
   uid_t runasuser_uid;
   gid_t runasuser_gid;
@@ -89,6 +144,30 @@ struct MotsognirConfig {
   int disableipv6;
   char *extmapfile;
   struct extmap_t *extmap;
+  int rangerequests;
+  int contentsniffing;
+  int outputcharset;     /* CHARSET_UTF8 (no conversion), CHARSET_LATIN1... */
+  int outputcharsettext; /* non-zero if text files are converted as well */
+  char *sniffcachefile;
+  struct sniffcache_t *sniffcache;
+  char *accesslogtarget;
+  int accesslogsampling;
+  struct accesslog_t *accesslog;
+  char *slowlogtarget;
+  long slowlogthreshold;
+  struct accesslog_t *slowlog;
+  struct scoreboard_t *scoreboard;
+  char *statusselector;
+  char **statusallow;
+  char *statussocket;
+  int httpgateway;
+  int httpkeepalive;
+  int tlsport;
+  char *tlscertificate;
+  char *tlskey;
+  struct tls_t *tls;
+  struct vhost *vhosts;
+  int vhostscount;
   char securldelim;
 };
 
@@ -104,24 +183,20 @@ static void sanitizeenv(void) {
 }
 
 
-/* return the directory part of a path - must be FREEed */
-static char *getdirpart(const char *s) {
+/* return the directory part of a path, allocated from the request's arena */
+static char *getdirpart(struct arena_t *arena, const char *s) {
   int lastslash = -1, i;
-  char *res;
   if (s == NULL) return(NULL);
   /* find the last occurence of '/' */
   for (i = 0; s[i] != 0; i++) {
     if (s[i] == '/') lastslash = i;
   }
   /* if no slash, then return "." */
-  if (lastslash < 0) return(strdup("."));
+  if (lastslash < 0) return(arena_strdup(arena, "."));
   /* if it's '/' already, return same thing */
-  if (lastslash == 0) return(strdup("/"));
+  if (lastslash == 0) return(arena_strdup(arena, "/"));
   /* copy the directory part of the string */
-  res = calloc(1, lastslash + 1);
-  if (res == NULL) return(NULL);
-  memcpy(res, s, lastslash);
-  return(res);
+  return(arena_strndup(arena, s, lastslash));
 }
 
 
@@ -143,7 +218,7 @@ static char *readfiletomem(const char *file) {
         fseek(fp, 0L, SEEK_SET);
         /* read the entire file into memory */
         newLen = fread(source, sizeof(char), bufsize, fp);
-        source[++newLen] = '\0'; /* string terminator, just to be safe */
+        source[newLen] = '\0'; /* string terminator, just to be safe */
       }
     }
     fclose(fp);
@@ -183,55 +258,89 @@ static void sendline(int sock, char *dataline) {
   iov[0].iov_len = strlen(dataline);
   iov[1].iov_base = "\r\n";
   iov[1].iov_len = 2;
-  writev(sock, iov, 2);
+  accesslog_addbytes(writev(sock, iov, 2));
 }
 
 
-static char *skip_whitespace(char *s) {
-  while (*s == ' ' || (unsigned char)(*s - 9) <= (13 - 9)) s++;
-  return (char *) s;
+/* a buffer used to batch many lines into few send() calls */
+struct sendbuff {
+  int sock;
+  int len;
+  int size;
+  char *buff;  /* an I/O buffer from the pool, NULL if out of memory */
+};
+
+
+static void sendbuff_init(struct sendbuff *sb, int sock) {
+  sb->sock = sock;
+  sb->len = 0;
+  sb->size = iobuf_size();
+  sb->buff = iobuf_get();
+  if (sb->buff == NULL) sb->size = 0; /* lines will be sent one by one */
 }
 
 
-/* Trims any whitespaces before and after a string. */
-static void trimstr(char *s) {
-  size_t len = strlen(s);
-  /* trim trailing whitespace */
-  while (len && isspace(s[len-1])) len--;
-  /* trim leading whitespace */
-  if (len != 0) {
-    char *nws = skip_whitespace(s);
-    if ((nws - s) != 0) {
-      len -= (nws - s);
-      memmove(s, nws, len);
+static void sendbuff_flush(struct sendbuff *sb) {
+  int pos = 0, res;
+  while (pos < sb->len) {
+    res = send(sb->sock, sb->buff + pos, sb->len - pos, 0);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      break;
     }
+    pos += res;
   }
-  s[len] = '\0';
+  accesslog_addbytes(pos);
+  sb->len = 0;
 }
 
 
-/* tests whether 'string' starts with 'start'. Returns 0 if not, non-zero
- * otherwise. */
-static int stringstartswith(const char *string, const char *start) {
-  while (*start != 0) {
-    if (*string != *start) return(0);
-    start += 1;
-    string += 1;
+/* appends a line (and its CRLF terminator) to the buffer, flushing it first if needed */
+static void sendbuff_line(struct sendbuff *sb, const char *line) {
+  int len = strlen(line);
+  if (sb->len + len + 2 > sb->size) sendbuff_flush(sb);
+  if (len + 2 > sb->size) { /* too long to be buffered at all */
+    sendline(sb->sock, (char *)line);
+    return;
   }
-  return(1);
+  memcpy(sb->buff + sb->len, line, len);
+  sb->buff[sb->len + len] = '\r';
+  sb->buff[sb->len + len + 1] = '\n';
+  sb->len += len + 2;
 }
 
 
-/* tests whether 'string' ends with 'end'. Returns 0 if not, non-zero
- * otherwise. */
-static int stringendswith(const char *string, const char *end) {
-  int endlen = strlen(end);
-  int stringlen = strlen(string);
-  if (stringlen < endlen) return(0);
-  if (endlen == 0) return(1);
-  string += (stringlen - endlen);
-  if (strcmp(string, end) == 0) return(1);
-  return(0);
+/* appends len bytes of data to the buffer, flushing it as often as needed.
+ * data is sent at once if there is no buffer */
+static void sendbuff_write(struct sendbuff *sb, const char *data, int len) {
+  int n;
+  while (len > 0) {
+    if (sb->len == sb->size) sendbuff_flush(sb);
+    if (sb->size == 0) { /* no buffer at all */
+      n = send(sb->sock, data, len, 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        return;
+      }
+      accesslog_addbytes(n);
+    } else {
+      n = sb->size - sb->len;
+      if (n > len) n = len;
+      memcpy(sb->buff + sb->len, data, n);
+      sb->len += n;
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+
+/* flushes the buffer and gives it back to the pool */
+static void sendbuff_close(struct sendbuff *sb) {
+  sendbuff_flush(sb);
+  iobuf_put(sb->buff);
+  sb->buff = NULL;
+  sb->size = 0;
 }
 
 
@@ -258,222 +367,6 @@ static void lshiftstring(char *str, int n) {
 }
 
 
-static void RemoveDoubleChar(char *string, char ch) {
-  char chstr[3] = {0, 0, 0};
-  char *occur;
-  chstr[0] = ch;
-  chstr[1] = ch;
-  for (;;) {
-    occur = strstr(string, chstr);
-    if (occur == NULL) break; /* we're done */
-    while (*occur != 0) {
-      *occur = occur[1];
-      occur += 1;
-    }
-  }
-}
-
-
-static void computerelativepath(char *result, int result_maxlen, const char *curdir, const char *relpath) {
-  char *tempptr, *lastslash;
-  int x;
-  /* first glue both paths together */
-  snprintf(result, result_maxlen, "%s/%s", curdir, relpath);
-
-  /* make sure we have no // doublons */
-  RemoveDoubleChar(result, '/');
-
-  /* simplify all /../ */
-  for (;;) {
-    tempptr = strstr(result, "/../");
-    if (tempptr == NULL) break;
-    /* find out where is the last / before our point */
-    if (tempptr == result) {
-      lastslash = result;
-    } else {
-      for (lastslash = tempptr - 1; lastslash > result; lastslash--) if (*lastslash == '/') break;
-    }
-    /* move the right part of URL to the left */
-    for (x = 0;; x++) {
-      lastslash[x] = tempptr[x + 3];
-      if (lastslash[x] == 0) break;
-    }
-  }
-
-  /* if the result ends with a '/..', we need to simplify this as well */
-  x = strlen(result);
-  if (x < 3) return;
-
-  x -= 3;
-  if ((result[x] == '/') && (result[x + 1] == '.') && (result[x + 2] == '.')) {
-    if (x == 0) {
-      result[1] = 0;
-      return;
-    }
-    result[x] = 0;
-    for (x--; x >= 0; x--) {
-      if (result[x] == '/') {
-        result[x + 1] = 0;
-        break;
-      }
-    }
-  }
-}
-
-
-/* builds a gophermap line, replacing elements by default values if needed, and resolving relative paths */
-static void buildgophermapline(char *linebuff, int linebuff_len, char itemtype, const char *desc, const char *selector, const char *server, long port, const char *curdirectory, const struct MotsognirConfig *config) {
-  const char *itemserver = server;
-  char itemselector[1024];
-  long itemport = port;
-
-  /* check values, and put default ones if some are missing */
-  if ((server[0] == 0) && (itemport == 0)) { /* if both are missing then */
-    itemserver = config->gopherhostname;     /* point to self using cfg  */
-    itemport = config->gopherport;           /* parameters               */
-  } else if (itemport == 0) {
-    if (strcasecmp(itemserver, config->gopherhostname) == 0) {
-      itemport = config->gopherport; /* use cfg port if 'server' looks like */
-    } else {                         /* me, otherwise default to the usual  */
-      itemport = 70;                 /* port 70 value                       */
-    }
-  } else if (server[0] == 0) {           /* only server missing - set to   */
-    itemserver = config->gopherhostname; /* self and keep the port that is */
-  }                                      /* explicitely set in the map     */
-
-  /* if we are dealing with relative path on the local server, resolve it first */
-  if ((itemtype != 'i') && (selector[0] != '/') && (selector[0] != 0) && (strcasecmp(itemserver, config->gopherhostname) == 0) && (stringstartswith(selector, "URL:") == 0)) {
-    computerelativepath(itemselector, sizeof(itemselector), curdirectory, selector);
-  } else {
-    snprintf(itemselector, sizeof(itemselector), "%s", selector);
-  }
-
-  snprintf(linebuff, linebuff_len, "%c%s\t%s\t%s\t%ld", itemtype, desc, itemselector, itemserver, itemport);
-}
-
-
-/* Encode a string to percent encoding */
-static void percencode(const char *src, char *dst, int dstmaxlen) {
-  int x, encodingrequired, dstlen = 0;
-  const char *hexchar = "0123456789ABCDEF";
-  for (x = 0; src[x] != 0; x++) {
-    encodingrequired = 0;
-    for (;;) { /* not a 'real' loop, just an easy way to break out */
-      if ((src[x] >= 'a') && (src[x] <= 'z')) break; /* do not encode a..z */
-      if ((src[x] >= 'A') && (src[x] <= 'Z')) break; /* do not encode A..Z */
-      if ((src[x] >= '0') && (src[x] <= '9')) break; /* do not encode 0..9 */
-      if ((src[x] == '-') || (src[x] == '/') || (src[x] == '_') || (src[x] == '.') || (src[x] == '~')) break; /* do not encode some chars */
-      /* since I am here, I need to encode the stuff I got */
-      encodingrequired = 1;
-      break;
-    }
-    if (dstlen + 4 >= dstmaxlen) {
-      syslog(LOG_WARNING, "WARNING: reached percent encoding length limit - aborting");
-      break; /* stop the work if we reached our limit */
-    }
-    if (encodingrequired == 0) { /* if no encoding is needed, just put the char as-is */
-      dst[dstlen++] = src[x];
-    } else { /* otherwise I need to encode the char */
-      dst[dstlen++] = '%';
-      dst[dstlen++] = hexchar[(unsigned)(src[x] & 0xF0) >> 4];
-      dst[dstlen++] = hexchar[(unsigned)(src[x] & 0x0F)];
-    }
-  }
-  /* terminate the dst string with a NULL terminator */
-  dst[dstlen] = 0;
-}
-
-
-/* Decodes a single hex character (0..F) and returns its value. Returns -1 if
- * the character is invalid. */
-static int hex2int(char ch) {
-  switch (ch) {
-    case '0':
-      return(0);
-    case '1':
-      return(1);
-    case '2':
-      return(2);
-    case '3':
-      return(3);
-    case '4':
-      return(4);
-    case '5':
-      return(5);
-    case '6':
-      return(6);
-    case '7':
-      return(7);
-    case '8':
-      return(8);
-    case '9':
-      return(9);
-    case 'A':
-    case 'a':
-      return(10);
-    case 'B':
-    case 'b':
-      return(11);
-    case 'C':
-    case 'c':
-      return(12);
-    case 'D':
-    case 'd':
-      return(13);
-    case 'E':
-    case 'e':
-      return(14);
-    case 'F':
-    case 'f':
-      return(15);
-    default:
-      return(-1);
-  }
-}
-
-
-/* decodes a string from percent encoding to a 'normal' string, in-place. returns 0 on success, non-zero if decoding fails. */
-static int percdecode(char *string) {
-  int x, y, firstnibble, secondnibble;
-  y = 0;
-  for (x = 0; string[x] != 0; x++) {
-    /* if different than %, write it as-is (or as a space, if we got a +), and continue */
-    if (string[x] != '%') {
-      if (string[x] == '+') {
-        string[y++] = ' ';
-      } else {
-        string[y++] = string[x];
-      }
-      continue;
-    }
-    /* since we are here, we are dealing with a percent-encoded thing - first make sure we are not in a dangerous position */
-    if ((string[x + 1] == 0) || (string[x + 2] == 0)) {
-      string[x] = 0;
-      syslog(LOG_WARNING, "ERROR: detected invalid percent encoding");
-      return(-1);
-    }
-    /* detect NULL chars, these shall never be decoded */
-    if ((string[x + 1] == '0') && (string[x + 2] == '0')) {
-      string[x] = 0;
-      syslog(LOG_WARNING, "ERROR: detected a dangerous percent encoding (%%00)");
-      return(-1);
-    }
-    /* decode anything else */
-    firstnibble = hex2int(string[++x]);
-    secondnibble = hex2int(string[++x]);
-    if ((firstnibble < 0) || (secondnibble < 0)) {
-      string[x - 2] = 0;
-      syslog(LOG_WARNING, "ERROR: detected an invalid percent encoding");
-      return(-1);
-    }
-    string[y++] = (firstnibble << 4) | secondnibble;
-  }
-  /* terminate the result */
-  string[y] = 0;
-  return(0);
-}
-
-
 static void printcapstxt(int sock, const struct MotsognirConfig *config, const char *version) {
   char linebuff[1024];
   sendline(sock, "CAPS");                 /* These four characters must be at the beginning to identify the file as successfully fetched. */
@@ -508,10 +401,17 @@ static void printcapstxt(int sock, const struct MotsognirConfig *config, const c
     snprintf(linebuff, sizeof(linebuff), "ServerGeolocationString=%s", config->capsservergeolocationstring);
     sendline(sock, linebuff);
   }
-  if (config->capsserverdefaultencoding != NULL) {
+  if (config->outputcharset != CHARSET_UTF8) { /* menus are sent in the output charset */
+    snprintf(linebuff, sizeof(linebuff), "ServerDefaultEncoding=%s", charset_name(config->outputcharset));
+    sendline(sock, linebuff);
+  } else if (config->capsserverdefaultencoding != NULL) {
     snprintf(linebuff, sizeof(linebuff), "ServerDefaultEncoding=%s", config->capsserverdefaultencoding);
     sendline(sock, linebuff);
   }
+  if (config->rangerequests != 0) {
+    sendline(sock, "ServerByteRanges=TRUE");            /* Binary files can be fetched partially, by appending */
+    sendline(sock, "ServerByteRangesSyntax=?range=OFFSET-END"); /* a range to their selector (END being optional). */
+  }
 }
 
 
@@ -571,39 +471,6 @@ static void sendbackhttperror(int sock, const struct MotsognirConfig *config) {
 }
 
 
-static void sendbackgopherplushack(int sock, const struct MotsognirConfig *config) {
-  char txtline[1024];
-  syslog(LOG_INFO, "GOPHER+ request detected - a gopher+ fake redirector is returned");
-  sendline(sock, "+-1");
-  snprintf(txtline, sizeof(txtline), "+INFO: 1Main menu (non-gopher+)\t\t%s\t%d", config->gopherhostname, config->gopherport);
-  sendline(sock, txtline);
-  sendline(sock, "+VIEWS:");
-  sendline(sock, " application/gopher+-menu: <512b>");
-  sendline(sock, "+ABSTRACT:");
-  sendline(sock, " This gopher supports standard gopher access only.");
-  sendline(sock, ".");
-}
-
-
-/* explode a list of directories separated by ':' into a malloc()ed, NULL-terminated array of strings */
-static char **explode_dirlist(char *s) {
-  char **res = NULL;
-  int rescount = 0;
-  char *p;
-
-  for (p = strtok(s, ":"); p != NULL; p = strtok(NULL, ":")) {
-    res = realloc(res, rescount * sizeof(char *) + 2); /* always allocate one place more, so I can put the NULL list terminator there later */
-    if (res == NULL) {
-      syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
-      return(res);
-    }
-    res[rescount++] = strdup(p);
-  }
-  if (res != NULL) res[rescount] = NULL;
-  return(res);
-}
-
-
 /* checks if a file exists. returns zero if the file does not exit, non-zero otherwise. */
 static int fexist(const char *filename) {
   FILE *fd;
@@ -617,13 +484,169 @@ static int fexist(const char *filename) {
 }
 
 
+/* parses a 'PluginRoute=handler pattern' value and appends it to the plugin
+ * routing table. returns 0 on success, non-zero otherwise. */
+static int addpluginroute(struct MotsognirConfig *config, char *value) {
+  char *pattern;
+  /* the handler is separated from the pattern by the first whitespace */
+  for (pattern = value; (*pattern != 0) && (*pattern != ' ') && (*pattern != '\t'); pattern++);
+  if (*pattern != 0) *(pattern++) = 0;
+  while ((*pattern == ' ') || (*pattern == '\t')) pattern++;
+  if (config->router == NULL) config->router = router_new();
+  if (config->router == NULL) {
+    syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+    return(-1);
+  }
+  if (router_add(config->router, pattern, value) != 0) {
+    syslog(LOG_ERR, "ERROR: Invalid PluginRoute regex for '%s': %s", value, pattern);
+    return(-1);
+  }
+  return(0);
+}
+
+
+/* parses a 'CgiConcurrency=glob maxrunning [maxwaiting [queuetimeout]]' value
+ * and appends it to the list of rules. returns 0 on success, non-zero
+ * otherwise. */
+static int addcgiconcurrency(struct MotsognirConfig *config, char *value) {
+  struct cgiconcurrency *newlist, *rule;
+  char *glob = strtok(value, " \t");
+  char *maxrunning = strtok(NULL, " \t");
+  char *maxwaiting = strtok(NULL, " \t");
+  char *queuetimeout = strtok(NULL, " \t");
+  if ((glob == NULL) || (maxrunning == NULL)) {
+    syslog(LOG_ERR, "ERROR: Invalid CgiConcurrency directive. The expected format is 'glob maxrunning [maxwaiting [queuetimeout]]'");
+    return(-1);
+  }
+  newlist = realloc(config->cgiconcurrency, (config->cgiconcurrencycount + 1) * sizeof(struct cgiconcurrency));
+  if (newlist == NULL) {
+    syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+    return(-1);
+  }
+  config->cgiconcurrency = newlist;
+  rule = &(newlist[config->cgiconcurrencycount]);
+  memset(rule, 0, sizeof(*rule));
+  rule->glob = strdup(glob);
+  rule->maxrunning = atoi(maxrunning);
+  rule->maxwaiting = 0;
+  rule->queuetimeout = 10;
+  if (maxwaiting != NULL) rule->maxwaiting = atoi(maxwaiting);
+  if (queuetimeout != NULL) rule->queuetimeout = atoi(queuetimeout);
+  if ((rule->maxrunning < 1) || (rule->maxrunning > CGISLOTS_MAX) || (rule->maxwaiting < 0) || (rule->maxwaiting > CGISLOTS_MAX) || (rule->queuetimeout < 0)) {
+    syslog(LOG_ERR, "ERROR: Invalid CgiConcurrency limits for '%s' (concurrency and queue length must be in the range 1..%d)", glob, CGISLOTS_MAX);
+    free(rule->glob);
+    return(-1);
+  }
+  config->cgiconcurrencycount += 1;
+  return(0);
+}
+
+
+/* allocates the slot table shared by all motsognir processes for
+ * CgiConcurrency rules. returns 0 on success, non-zero otherwise. */
+static int allocatecgislots(struct MotsognirConfig *config) {
+  pid_t *shm;
+  int x;
+  if (config->cgiconcurrencycount == 0) return(0);
+  shm = mmap(NULL, config->cgiconcurrencycount * CGISLOTS_MAX * 2 * sizeof(pid_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+  if (shm == MAP_FAILED) {
+    syslog(LOG_ERR, "ERROR: failed to allocate shared memory for CgiConcurrency rules (%s)", strerror(errno));
+    return(-1);
+  }
+  memset(shm, 0, config->cgiconcurrencycount * CGISLOTS_MAX * 2 * sizeof(pid_t));
+  for (x = 0; x < config->cgiconcurrencycount; x++) {
+    config->cgiconcurrency[x].running = shm + (x * 2 * CGISLOTS_MAX);
+    config->cgiconcurrency[x].waiting = shm + (x * 2 * CGISLOTS_MAX) + CGISLOTS_MAX;
+  }
+  return(0);
+}
+
+
+/* validates [vhost] sections, and fills the settings they inherit from the
+ * main configuration. must be called once the main configuration is loaded.
+ * returns 0 on success, non-zero otherwise. */
+static int resolvevhosts(struct MotsognirConfig *config) {
+  struct vhost *vh;
+  int x, y;
+  for (x = 0; x < config->vhostscount; x++) {
+    vh = &(config->vhosts[x]);
+    if (vh->port == 0) vh->port = config->gopherport;
+    if ((vh->port < 1) || (vh->port > 65535) || (vh->port == config->tlsport)) {
+      syslog(LOG_ERR, "ERROR: Invalid GopherPort in [vhost] section #%d (%d)", x + 1, vh->port);
+      return(-1);
+    }
+    /* local addresses are compared as strings: normalize them */
+    if (vhost_normalizebind(vh) != 0) {
+      syslog(LOG_ERR, "ERROR: Invalid Bind address in [vhost] section #%d (%s)", x + 1, vh->bind);
+      return(-1);
+    }
+    for (y = 0; y < x; y++) {
+      if ((config->vhosts[y].port == vh->port) && (((vh->bind == NULL) && (config->vhosts[y].bind == NULL)) || ((vh->bind != NULL) && (config->vhosts[y].bind != NULL) && (strcmp(vh->bind, config->vhosts[y].bind) == 0)))) {
+        syslog(LOG_ERR, "ERROR: [vhost] sections #%d and #%d have the same address and port", y + 1, x + 1);
+        return(-1);
+      }
+    }
+    if ((vh->userdir != NULL) && ((vh->userdir[0] != '/') || (strstr(vh->userdir, "%s") == NULL))) {
+      syslog(LOG_ERR, "ERROR: The UserDir of [vhost] section #%d is invalid. It shall be an absolute path (start by '/') and contain the '%%s' placeholder.", x + 1);
+      return(-1);
+    }
+    /* indexes describe a specific gopher root: they are inherited only by
+     * vhosts that serve the same root */
+    if (vh->gopherroot == NULL) {
+      vh->gopherroot = config->gopherroot;
+      if (vh->dirindexpath == NULL) vh->dirindexpath = config->dirindexpath;
+      if (vh->searchindex == NULL) vh->searchindex = config->searchindex;
+    }
+    if (vh->gopherhostname == NULL) vh->gopherhostname = config->gopherhostname;
+    if (vh->outputcharsetname == NULL) {
+      vh->outputcharset = config->outputcharset;
+    } else {
+      vh->outputcharset = charset_id(vh->outputcharsetname);
+      if (vh->outputcharset < 0) {
+        syslog(LOG_ERR, "ERROR: Unsupported OutputCharset in [vhost] section #%d (%s)", x + 1, vh->outputcharsetname);
+        return(-1);
+      }
+    }
+    if (vh->pubdirlist == NULL) vh->pubdirlist = config->pubdirlist;
+    if (vh->userdir == NULL) vh->userdir = config->userdir;
+    if (vh->extmapfile == NULL) {
+      vh->extmap = config->extmap;
+    } else {
+      vh->extmap = extmap_load(vh->extmapfile);
+      if (vh->extmap == NULL) {
+        syslog(LOG_ERR, "ERROR: failed to load the extension mapping file '%s'", vh->extmapfile);
+        return(-1);
+      }
+    }
+  }
+  return(0);
+}
+
+
+/* switches config to the vhost that matches the local address and port of a
+ * connection, if any */
+static void selectvhost(struct MotsognirConfig *config, const char *localaddr, int localport) {
+  struct vhost *vh = vhost_select(config->vhosts, config->vhostscount, localaddr, localport);
+  if (vh == NULL) return;
+  syslog(LOG_INFO, "serving vhost '%s' (%s:%d)", (vh->gopherhostname != NULL) ? vh->gopherhostname : localaddr, (vh->bind != NULL) ? vh->bind : "*", vh->port);
+  config->gopherport = vh->port;
+  config->gopherhostname = vh->gopherhostname;
+  config->gopherroot = vh->gopherroot;
+  config->pubdirlist = vh->pubdirlist;
+  config->userdir = vh->userdir;
+  config->extmap = vh->extmap;
+  config->dirindexpath = vh->dirindexpath;
+  config->searchindex = vh->searchindex;
+  config->outputcharset = vh->outputcharset;
+  if (config->searchindex == NULL) config->searchselector = NULL; /* no search index, no search */
+}
+
+
 static int loadconfig(struct MotsognirConfig *config, const char *configfile) {
   FILE *fd;
   char tokenbuff[64], valuebuff[1024];
-  int tokenbuffpos = 0;
-  int valuebuffpos = 0;
-  int bytebuff;
-  int state = 0; /* 0=reading token, 1=reading value, 2=reading comment */
+  int x;
+  int vhost = -1; /* the [vhost] section being read, if any */
   struct passwd *pw;
 
   /* zero out the config structure, just in case */
@@ -645,8 +668,23 @@ static int loadconfig(struct MotsognirConfig *config, const char *configfile) {
   config->cgisupport = 0;
   config->phpsupport = 0;
   config->subgophermaps = 0;
+  config->subgophermapsmaxparallel = 4;
+  config->subgophermapstimeout = 30;
+  config->cgitimeout = 0;
+  config->cgimaxcputime = 0;
+  config->cgimaxmemory = 0;
+  config->cgimaxfilesize = 0;
+  config->cgimaxoutput = 0;
   config->paranoidmode = 0;
+  config->dirlistpagesize = 0;
+  config->dirindexpath = NULL;
+  config->gopherplusadmin = NULL;
+  config->searchselector = NULL;
+  config->searchindex = NULL;
+  config->searchmaxresults = 50;
   config->plugin = NULL;
+  config->pluginfilter = NULL;
+  config->router = NULL;
   config->runasuser = NULL;
   config->runasuser_uid = 0;
   config->runasuser_gid = 0;
@@ -655,6 +693,26 @@ static int loadconfig(struct MotsognirConfig *config, const char *configfile) {
   config->httperrfile = NULL;
   config->bind = NULL;
   config->extmapfile = NULL;
+  config->rangerequests = 0;
+  config->contentsniffing = 0;
+  config->outputcharset = CHARSET_UTF8;
+  config->outputcharsettext = 0;
+  config->sniffcachefile = NULL;
+  config->accesslogtarget = NULL;
+  config->accesslogsampling = 1;
+  config->slowlogtarget = NULL;
+  config->slowlogthreshold = 1000;
+  config->statusselector = NULL;
+  config->statusallow = NULL;
+  config->statussocket = NULL;
+  config->httpgateway = 0;
+  config->httpkeepalive = 15;
+  config->tlsport = 0;
+  config->tlscertificate = NULL;
+  config->tlskey = NULL;
+  config->tls = NULL;
+  config->vhosts = NULL;
+  config->vhostscount = 0;
   config->extmap = NULL;
   config->securldelim = 0;
 
@@ -665,101 +723,156 @@ static int loadconfig(struct MotsognirConfig *config, const char *configfile) {
   }
 
   for (;;) {
-    bytebuff = getc(fd);
-    if (state == 0) {  /* if reading token... */
-      if (bytebuff < 0) break;
-      if (bytebuff == '=') {
-        tokenbuff[tokenbuffpos] = 0;
-        trimstr(tokenbuff);
-        tokenbuffpos = 0;
-        state = 1;
-      } else if (bytebuff == '\n') {
-        tokenbuff[tokenbuffpos] = 0;
-        trimstr(tokenbuff);
-        tokenbuffpos = 0;
-        state = 0;
-      } else {
-        if ((tokenbuffpos + 1) < (long)sizeof(tokenbuff)) tokenbuff[tokenbuffpos++] = bytebuff;
+    x = conffile_next(fd, tokenbuff, sizeof(tokenbuff), valuebuff, sizeof(valuebuff));
+    if (x == CONFFILE_EOF) break;
+    if (x == CONFFILE_SECTION) {
+      /* a section header: directives that follow it belong to a vhost */
+      if (strcasecmp(tokenbuff, "[vhost]") != 0) {
+        syslog(LOG_ERR, "ERROR: Unknown section '%s' found in the configuration file", tokenbuff);
+        fclose(fd);
+        return(-1);
       }
-    } else if (state == 1) { /* if reading value... */
-      if ((bytebuff == '\n') || (bytebuff == '\n') || (bytebuff < 0) || (bytebuff == '#')) {
-        state = 0;
-        if (bytebuff == '#') state = 2;
-        /* check token and assign value */
-        valuebuff[valuebuffpos] = 0;
-        trimstr(valuebuff);
-        if (valuebuff[0] == 0) tokenbuff[0] = 0; /* make sure to ignore any parameter with an empty value */
-        /* printf("Got conf: '%s' -> '%s'\n", tokenbuff, valuebuff); */
-        if (strcasecmp(tokenbuff, "verbose") == 0) {
-          config->verbosemode = atoi(valuebuff);
-        } else if (strcasecmp(tokenbuff, "bind") == 0) {
-          config->bind = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "disableipv6") == 0) {
-          config->disableipv6 = atoi(valuebuff);
-        } else if (strcasecmp(tokenbuff, "capssupport") == 0) {
-          config->capssupport = atoi(valuebuff);
-        } else if (strcasecmp(tokenbuff, "CapsServerArchitecture") == 0) {
-          config->capsserverarchitecture = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "CapsServerDescription") == 0) {
-          config->capsserverdescription = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "CapsServerGeolocationString") == 0) {
-          config->capsservergeolocationstring = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "CapsServerDefaultEncoding") == 0) {
-          config->capsserverdefaultencoding = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "DefaultGophermap") == 0) {
-          config->defaultgophermap = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "GopherRoot") == 0) {
-          config->gopherroot = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "RunAsUser") == 0) {
-          config->runasuser = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "GopherPort") == 0) {
-          config->gopherport = atoi(valuebuff);
-        } else if (strcasecmp(tokenbuff, "GopherHostname") == 0) {
-          config->gopherhostname = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "GopherCgiSupport") == 0) {
-          config->cgisupport = atoi(valuebuff);
-        } else if (strcasecmp(tokenbuff, "GopherPhpSupport") == 0) {
-          config->phpsupport = atoi(valuebuff);
-        } else if (strcasecmp(tokenbuff, "SubGophermaps") == 0) {
-          config->subgophermaps = atoi(valuebuff);
-        } else if (strcasecmp(tokenbuff, "paranoidmode") == 0) {
-          config->paranoidmode = atoi(valuebuff);
-        } else if (strcasecmp(tokenbuff, "plugin") == 0) {
-          config->plugin = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "pluginfilter") == 0) {
-          /* alloc and compile the regular expression */
-          config->pluginfilter = calloc(1, sizeof(regex_t));
-          if (config->pluginfilter == NULL) {
-            syslog(LOG_ERR, "ERROR: Out of memory while trying to allocate regex space!");
-          } else if (regcomp(config->pluginfilter, valuebuff, REG_EXTENDED | REG_NOSUB) != 0) {
-            syslog(LOG_ERR, "ERROR: Invalid PluginFilter regex!");
-            free(config->pluginfilter);
-            config->pluginfilter = NULL;
-          }
-        } else if (strcasecmp(tokenbuff, "chroot") == 0) {
-          config->chroot = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "userdir") == 0) {
-          config->userdir = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "pubdirlist") == 0) {
-          config->pubdirlist = explode_dirlist(valuebuff);
-        } else if (strcasecmp(tokenbuff, "httperrfile") == 0) {
-          config->httperrfile = readfiletomem(valuebuff);
-          if (config->httperrfile == NULL) syslog(LOG_WARNING, "WARNING: Failed to load custom http error file '%s'. Default content will be used instead.", valuebuff);
-        } else if (strcasecmp(tokenbuff, "ExtMapFile") == 0) {
-          config->extmapfile = strdup(valuebuff);
-        } else if (strcasecmp(tokenbuff, "SecUrlDelim") == 0) {
-          config->securldelim = atoi(valuebuff);
-        }
-        valuebuffpos = 0;
-      } else if (bytebuff != '\r') {
-        if ((valuebuffpos + 1) < (long)sizeof(valuebuff)) valuebuff[valuebuffpos++] = bytebuff;
+      vhost = vhost_add(&(config->vhosts), &(config->vhostscount));
+      if (vhost < 0) {
+        fclose(fd);
+        return(-1);
       }
-      if (bytebuff < 0) break;
-    } else { /* if reading comment... */
-      if (bytebuff < 0) break;
-      if (bytebuff == '\n') state = 0;
+      continue;
+    }
+    /* printf("Got conf: '%s' -> '%s'\n", tokenbuff, valuebuff); */
+    if (vhost >= 0) {
+      if (vhost_directive(&(config->vhosts[vhost]), tokenbuff, valuebuff) != 0) {
+        syslog(LOG_ERR, "ERROR: '%s' cannot be set in a [vhost] section", tokenbuff);
+        fclose(fd);
+        return(-1);
+      }
+    } else if (strcasecmp(tokenbuff, "verbose") == 0) {
+      config->verbosemode = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "bind") == 0) {
+      config->bind = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "disableipv6") == 0) {
+      config->disableipv6 = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "capssupport") == 0) {
+      config->capssupport = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "CapsServerArchitecture") == 0) {
+      config->capsserverarchitecture = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "CapsServerDescription") == 0) {
+      config->capsserverdescription = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "CapsServerGeolocationString") == 0) {
+      config->capsservergeolocationstring = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "CapsServerDefaultEncoding") == 0) {
+      config->capsserverdefaultencoding = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "DefaultGophermap") == 0) {
+      config->defaultgophermap = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "GopherRoot") == 0) {
+      config->gopherroot = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "RunAsUser") == 0) {
+      config->runasuser = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "GopherPort") == 0) {
+      config->gopherport = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "GopherHostname") == 0) {
+      config->gopherhostname = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "GopherCgiSupport") == 0) {
+      config->cgisupport = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "GopherPhpSupport") == 0) {
+      config->phpsupport = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SubGophermaps") == 0) {
+      config->subgophermaps = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "DirListPageSize") == 0) {
+      config->dirlistpagesize = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "DirIndexPath") == 0) {
+      config->dirindexpath = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "GopherPlusAdmin") == 0) {
+      config->gopherplusadmin = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SearchSelector") == 0) {
+      config->searchselector = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SearchIndex") == 0) {
+      config->searchindex = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SearchMaxResults") == 0) {
+      config->searchmaxresults = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SubGophermapsMaxParallel") == 0) {
+      config->subgophermapsmaxparallel = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SubGophermapsTimeout") == 0) {
+      config->subgophermapstimeout = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "CgiTimeout") == 0) {
+      config->cgitimeout = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "CgiMaxCpuTime") == 0) {
+      config->cgimaxcputime = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "CgiMaxMemory") == 0) {
+      config->cgimaxmemory = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "CgiMaxFileSize") == 0) {
+      config->cgimaxfilesize = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "CgiMaxOutput") == 0) {
+      config->cgimaxoutput = atol(valuebuff) * 1024 * 1024;
+    } else if (strcasecmp(tokenbuff, "paranoidmode") == 0) {
+      config->paranoidmode = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "plugin") == 0) {
+      config->plugin = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "pluginfilter") == 0) {
+      config->pluginfilter = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "pluginroute") == 0) {
+      if (addpluginroute(config, valuebuff) != 0) {
+        fclose(fd);
+        return(-1);
+      }
+    } else if (strcasecmp(tokenbuff, "CgiConcurrency") == 0) {
+      if (addcgiconcurrency(config, valuebuff) != 0) {
+        fclose(fd);
+        return(-1);
+      }
+    } else if (strcasecmp(tokenbuff, "chroot") == 0) {
+      config->chroot = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "userdir") == 0) {
+      config->userdir = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "pubdirlist") == 0) {
+      config->pubdirlist = conffile_explodelist(valuebuff, ":");
+    } else if (strcasecmp(tokenbuff, "httperrfile") == 0) {
+      config->httperrfile = readfiletomem(valuebuff);
+      if (config->httperrfile == NULL) syslog(LOG_WARNING, "WARNING: Failed to load custom http error file '%s'. Default content will be used instead.", valuebuff);
+    } else if (strcasecmp(tokenbuff, "ExtMapFile") == 0) {
+      config->extmapfile = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "RangeRequests") == 0) {
+      config->rangerequests = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "ContentSniffing") == 0) {
+      config->contentsniffing = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "OutputCharset") == 0) {
+      config->outputcharset = charset_id(valuebuff);
+      if (config->outputcharset < 0) {
+        syslog(LOG_ERR, "ERROR: Unsupported OutputCharset found in the configuration file (%s)", valuebuff);
+        fclose(fd);
+        return(-1);
+      }
+    } else if (strcasecmp(tokenbuff, "OutputCharsetText") == 0) {
+      config->outputcharsettext = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SniffCache") == 0) {
+      config->sniffcachefile = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "AccessLog") == 0) {
+      config->accesslogtarget = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "AccessLogSampling") == 0) {
+      config->accesslogsampling = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SlowLog") == 0) {
+      config->slowlogtarget = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SlowLogThreshold") == 0) {
+      config->slowlogthreshold = atol(valuebuff);
+    } else if (strcasecmp(tokenbuff, "StatusSelector") == 0) {
+      config->statusselector = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "StatusAllow") == 0) {
+      config->statusallow = conffile_explodelist(valuebuff, " ,");
+    } else if (strcasecmp(tokenbuff, "StatusSocket") == 0) {
+      config->statussocket = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "HttpGateway") == 0) {
+      config->httpgateway = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "HttpKeepAlive") == 0) {
+      config->httpkeepalive = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "TlsPort") == 0) {
+      config->tlsport = atoi(valuebuff);
+    } else if (strcasecmp(tokenbuff, "TlsCertificate") == 0) {
+      config->tlscertificate = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "TlsKey") == 0) {
+      config->tlskey = strdup(valuebuff);
+    } else if (strcasecmp(tokenbuff, "SecUrlDelim") == 0) {
+      config->securldelim = atoi(valuebuff);
     }
-
   }
   fclose(fd);
 
@@ -775,6 +888,66 @@ static int loadconfig(struct MotsognirConfig *config, const char *configfile) {
     return(-1);
   }
 
+  if (config->httpkeepalive < 0) {
+    syslog(LOG_ERR, "ERROR: Invalid HttpKeepAlive value found in the configuration file (%d)", config->httpkeepalive);
+    return(-1);
+  }
+
+  if ((config->tlsport < 0) || (config->tlsport > 65535) || (config->tlsport == config->gopherport)) {
+    syslog(LOG_ERR, "ERROR: Invalid TlsPort value found in the configuration file (%d)", config->tlsport);
+    return(-1);
+  }
+
+  if ((config->tlsport != 0) && ((config->tlscertificate == NULL) || (config->tlskey == NULL))) {
+    syslog(LOG_ERR, "ERROR: TlsPort requires both a TlsCertificate and a TlsKey");
+    return(-1);
+  }
+
+  if ((config->subgophermapsmaxparallel < 1) || (config->subgophermapsmaxparallel > 64)) {
+    syslog(LOG_ERR, "ERROR: Invalid SubGophermapsMaxParallel value found in the configuration file (%d)", config->subgophermapsmaxparallel);
+    return(-1);
+  }
+
+  if (config->dirlistpagesize < 0) {
+    syslog(LOG_ERR, "ERROR: Invalid DirListPageSize value found in the configuration file (%d)", config->dirlistpagesize);
+    return(-1);
+  }
+
+  if ((config->searchselector != NULL) && ((config->searchselector[0] != '/') || (config->searchindex == NULL))) {
+    syslog(LOG_ERR, "ERROR: SearchSelector must start with a '/', and requires a SearchIndex");
+    return(-1);
+  }
+
+  if ((config->statusselector != NULL) && (config->statusselector[0] != '/')) {
+    syslog(LOG_ERR, "ERROR: StatusSelector must start with a '/'");
+    return(-1);
+  }
+
+  if ((config->contentsniffing < 0) || (config->contentsniffing > 2)) {
+    syslog(LOG_ERR, "ERROR: Invalid ContentSniffing value found in the configuration file (%d)", config->contentsniffing);
+    return(-1);
+  }
+
+  if (config->accesslogsampling < 1) {
+    syslog(LOG_ERR, "ERROR: Invalid AccessLogSampling value found in the configuration file (%d)", config->accesslogsampling);
+    return(-1);
+  }
+
+  if (config->slowlogthreshold < 0) {
+    syslog(LOG_ERR, "ERROR: Invalid SlowLogThreshold value found in the configuration file (%ld)", config->slowlogthreshold);
+    return(-1);
+  }
+
+  if ((config->searchmaxresults < 1) || (config->searchmaxresults > 1000)) {
+    syslog(LOG_ERR, "ERROR: Invalid SearchMaxResults value found in the configuration file (%d)", config->searchmaxresults);
+    return(-1);
+  }
+
+  if ((config->cgitimeout < 0) || (config->cgimaxcputime < 0) || (config->cgimaxmemory < 0) || (config->cgimaxfilesize < 0) || (config->cgimaxoutput < 0)) {
+    syslog(LOG_ERR, "ERROR: CGI limits found in the configuration file cannot be negative");
+    return(-1);
+  }
+
   if (config->gopherroot[0] == 0) {
     syslog(LOG_ERR, "ERROR: Missing gopher root path in the configuration file. Please add a valid 'GopherRoot=' directive");
     return(-1);
@@ -792,6 +965,73 @@ static int loadconfig(struct MotsognirConfig *config, const char *configfile) {
     syslog(LOG_WARNING, "WARNING: Missing gopher hostname in the configuration file. The local IP address will be used instead. Please add a valid 'GopherHostname=' directive.");
   }
 
+  /* the legacy 'Plugin' directive is simply the last rule of the routing table */
+  if (config->plugin != NULL) {
+    if (config->router == NULL) config->router = router_new();
+    if (config->router == NULL) {
+      syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+      return(-1);
+    }
+    if ((config->pluginfilter != NULL) && (router_add(config->router, config->pluginfilter, config->plugin) != 0)) {
+      syslog(LOG_ERR, "ERROR: Invalid PluginFilter regex!");
+      free(config->pluginfilter);
+      config->pluginfilter = NULL;
+    }
+    if ((config->pluginfilter == NULL) && (router_add(config->router, "", config->plugin) != 0)) {
+      syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+      return(-1);
+    }
+  }
+
+  /* CgiConcurrency rules are enforced across all processes via shared memory */
+  if (allocatecgislots(config) != 0) return(-1);
+
+  /* content sniffing verdicts are shared by all processes as well */
+  if (config->contentsniffing != 0) {
+    config->sniffcache = sniffcache_open(config->sniffcachefile);
+    if (config->sniffcache == NULL) {
+      syslog(LOG_ERR, "ERROR: failed to open the sniffing cache '%s' (%s)", (config->sniffcachefile != NULL) ? config->sniffcachefile : "shm", strerror(errno));
+      return(-1);
+    }
+  }
+
+  /* so are server statistics */
+  config->scoreboard = scoreboard_open();
+  if (config->scoreboard == NULL) {
+    syslog(LOG_ERR, "ERROR: failed to allocate shared memory for the scoreboard (%s)", strerror(errno));
+    return(-1);
+  }
+  if (config->statusallow == NULL) { /* the status is restricted to localhost by default */
+    char localhost[] = "127.0.0.1 ::1";
+    config->statusallow = conffile_explodelist(localhost, " ");
+  }
+
+  /* access log records are queued by all processes into shared memory */
+  if ((config->accesslogtarget != NULL) && (config->accesslogtarget[0] != 0)) {
+    config->accesslog = accesslog_open(config->accesslogtarget, config->accesslogsampling);
+    if (config->accesslog == NULL) {
+      syslog(LOG_ERR, "ERROR: failed to open the access log '%s' (%s)", config->accesslogtarget, strerror(errno));
+      return(-1);
+    }
+  }
+
+  /* so are the records of slow requests, all of them */
+  if ((config->slowlogtarget != NULL) && (config->slowlogtarget[0] != 0)) {
+    config->slowlog = accesslog_open(config->slowlogtarget, 1);
+    if (config->slowlog == NULL) {
+      syslog(LOG_ERR, "ERROR: failed to open the slow log '%s' (%s)", config->slowlogtarget, strerror(errno));
+      return(-1);
+    }
+  }
+
+  /* the TLS context is set up once, here: the certificate and key are read
+   * before any chroot() or privileges drop, and session ticket keys are
+   * shared by all processes */
+  if (config->tlsport != 0) {
+    config->tls = tls_open(config->tlscertificate, config->tlskey);
+    if (config->tls == NULL) return(-1);
+  }
+
   /* load extension mappings (ext -> gopher type pairs) */
   config->extmap = extmap_load(config->extmapfile);
   if (config->extmap == NULL) {
@@ -799,6 +1039,9 @@ static int loadconfig(struct MotsognirConfig *config, const char *configfile) {
     return(-1);
   }
 
+  /* vhosts inherit whatever they do not set from the main configuration */
+  if (resolvevhosts(config) != 0) return(-1);
+
   /* if a 'RunAsUser' directive is present, resolve the username to a proper uid/gid (because later we might be unable to do it from within a chroot jail) */
   if (config->runasuser != NULL) {
     pw = getpwnam(config->runasuser);
@@ -817,59 +1060,6 @@ static int loadconfig(struct MotsognirConfig *config, const char *configfile) {
 }
 
 
-static char **explode_serverside_params_from_query(char *directorytolist, const struct MotsognirConfig *config) {
-  char *ptr, *tabposition = NULL, *queposition = NULL;
-  static char *res[2] = { NULL, NULL };
-  /* find out the positions of tabs and question marks */
-  for (ptr = directorytolist; *ptr != 0; ptr++) {
-    if ((*ptr == '?') && (queposition == NULL)) {
-      queposition = ptr;
-    }
-    if ((*ptr == config->securldelim) && (queposition == NULL)) {
-      queposition = ptr;
-    }
-    if ((*ptr == '\t') && (tabposition == NULL)) {
-      tabposition = ptr;
-      break;
-    }
-  }
-  /* if a tab was found, extract the search query */
-  if (tabposition != NULL) {
-    for (ptr = tabposition + 1; *ptr != 0; ptr++) {
-      if (*ptr == '\t') {
-        *ptr = 0;
-        break;
-      }
-    }
-    res[1] = strdup(tabposition + 1);
-    *tabposition = 0; /* set tabposition to zero, to end up the URL nicely */
-  }
-  /* if a question mark was found, extract the URL query */
-  if (queposition != NULL) {
-    res[0] = strdup(queposition + 1);
-    *queposition = 0; /* set queposition to zero, to end up the URL nicely */
-  }
-  /* Retrieve server-side parameters */
-  syslog(LOG_INFO, "Got following server-side parameters: %s | %s", res[0], res[1]);
-  return(res); /* return the array with params */
-}
-
-
-/* Returns a pointer to the extension part of a filename (or to an empty
- * string if the filename has no extension) */
-static const char *getfileextension(const char *filename) {
-  const char *ext = NULL;
-  int x;
-  /* find the LAST occurence of the '.' char in the name */
-  for (x = 0; filename[x] != 0; x++) {
-    if (filename[x] == '.') ext = filename + x + 1;
-  }
-  if (ext != NULL) return(ext);
-  /* if no dot present in the filename, return an empty string using the filename's NULL terminator */
-  return(filename + x);
-}
-
-
 /* Map the gopher type of a file, based on its extension */
 static char DetectGopherType(const char *filename, const struct extmap_t *extmap) {
   const char *ext = getfileextension(filename);
@@ -877,10 +1067,36 @@ static char DetectGopherType(const char *filename, const struct extmap_t *extmap
 }
 
 
+/* Map the gopher type of a file, looking at its content if ContentSniffing
+ * says so (only for files mapped to the binary type, or for all files).
+ * Verdicts are cached: if mayread is zero, only a cached verdict is used,
+ * and the extension-based type is returned when there is none. */
+static char DetectGopherTypeSniff(const char *filename, const struct MotsognirConfig *config, int mayread) {
+  char gophertype, sniffed;
+  struct stat st;
+  int fd;
+  gophertype = DetectGopherType(filename, config->extmap);
+  if ((config->contentsniffing == 0) || ((config->contentsniffing == 1) && (gophertype != '9'))) return(gophertype);
+  if ((stat(filename, &st) != 0) || (!S_ISREG(st.st_mode))) return(gophertype);
+  sniffed = sniffcache_get(config->sniffcache, &st);
+  if (sniffed != 0) return(sniffed);
+  if (mayread == 0) return(gophertype);
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) return(gophertype);
+  sniffed = sniff_fd(fd);
+  close(fd);
+  if (sniffed == 0) return(gophertype);
+  sniffcache_put(config->sniffcache, &st, sniffed);
+  syslog(LOG_INFO, "Content of '%s' sniffed as type '%c'", filename, sniffed);
+  return(sniffed);
+}
+
+
 /* Reads a single line from a file descriptor. Returns the length of the line
- * (can be zero). Returns -1 on error or EOF). */
+ * (can be zero), or n if the line was too long and got cut to n - 1 bytes.
+ * Returns -1 on error or EOF). */
 static int sockreadline(int sock, char *buf, int n, time_t *timeoutStartTime) {
-  int numRead, totRead = 0, gotatleastonebyte = 0;
+  int numRead, totRead = 0, gotatleastonebyte = 0, truncated = 0;
   char ch;
   struct timeval tv;
   /* set the socket to return after 1s, so we can check for real timeout every second */
@@ -914,6 +1130,8 @@ static int sockreadline(int sock, char *buf, int n, time_t *timeoutStartTime) {
       if (totRead < n - 1) {      /* Discard > (n - 1) bytes */
         totRead++;
         *buf++ = ch;
+      } else {
+        truncated = 1;
       }
     }
   }
@@ -925,6 +1143,7 @@ static int sockreadline(int sock, char *buf, int n, time_t *timeoutStartTime) {
   }
   /* terminate the buffer and return the result */
   *buf = 0;
+  if (truncated != 0) return(n);
   return(totRead);
 }
 
@@ -957,154 +1176,289 @@ static void exturlredirector(int sock, const char *directorytolist) {
 }
 
 
-/* sorting backend used by outputdircontent to sort the content of a directory */
-static int motsognir_dirsort(const struct dirent **a, const struct dirent **b) {
-  /* directories should always be listed first */
-  if (((*a)->d_type == DT_DIR) && ((*b)->d_type != DT_DIR)) return(-1);
-  if (((*a)->d_type != DT_DIR) && ((*b)->d_type == DT_DIR)) return(1);
-  /* no directory tie break found, sort them by name then */
-  return(strcasecmp((*a)->d_name, (*b)->d_name));
+/* computes the path of the index file of a directory (directorytolist must
+ * end with a '/'). returns -1 if the directory has no index */
+static int getdirindexfile(char *indexfile, int indexfile_len, const struct MotsognirConfig *config, const char *directorytolist) {
+  if (config->dirindexpath == NULL) return(-1);
+  /* indexes cover the gopher root only, not user directories */
+  if ((directorytolist[0] == '/') && (directorytolist[1] == '~') && (config->userdir != NULL)) return(-1);
+  snprintf(indexfile, indexfile_len, "%s%s%s", config->dirindexpath, directorytolist, DIRINDEX_FILENAME);
+  return(0);
+}
+
+
+/* opens the pre-computed listing of a directory, as built by motsognir-index.
+ * returns NULL if there is none, or if it is out of date. */
+static struct dirindex_t *opendirindex(const struct MotsognirConfig *config, const char *localfile, const char *directorytolist) {
+  char indexfile[4096 + sizeof(DIRINDEX_FILENAME)];
+  struct stat st;
+  if (getdirindexfile(indexfile, sizeof(indexfile), config, directorytolist) != 0) return(NULL);
+  if (stat(localfile, &st) != 0) return(NULL);
+  return(dirindex_open(indexfile, &st));
+}
+
+
+/* returns name as it should be displayed, that is converted to the output
+ * charset (into buff) if it is not UTF-8 */
+static const char *outputname(const struct MotsognirConfig *config, const char *name, char *buff, int buffsize) {
+  if (config->outputcharset == CHARSET_UTF8) return(name);
+  snprintf(buff, buffsize, "%s", name);
+  charset_strfromutf8(config->outputcharset, buff);
+  return(buff);
 }
 
 
 /* outputs a gophermap-compatible listing of the directory's content.
  * dirsonly controls whether to list directories only (if set to non-zero), or
- * directories and files. */
-static void outputdircontent(int sock, const struct MotsognirConfig *config, const char *localfile, char const *directorytolist, int dirsonly) {
-  char tempstring[2048];
-  DIR *dirptr;
-  int direntriescount;
-  int x;
-  int entriesdisplayed;
-  struct dirent **direntries;
-
-  /* load the content of the directory */
-  dirptr = opendir(localfile);
-  if (dirptr == NULL) {
-    syslog(LOG_WARNING, "ERROR: Could not access directory '%s' (%s)", localfile, strerror(errno));
-    sendline(sock, "3Error: could not access directory\tfake\tfake\t0");
-    return;
-  }
-
-  direntriescount = scandir(localfile, &direntries, NULL, motsognir_dirsort);
-  closedir(dirptr);
-  if (direntriescount < 0) {
-    syslog(LOG_WARNING, "ERROR: Failed to scan the directory '%s': %s", localfile, strerror(errno));
-    return;
+ * directories and files. if page is non-zero, only the given page of the
+ * listing is sent (DirListPageSize entries), followed by navigation links. */
+static void outputdircontent(int sock, const struct MotsognirConfig *config, const char *localfile, char const *directorytolist, int dirsonly, long page) {
+  char tempstring[4096];
+  char entryselector[1024];
+  char entryselector_encoded[1024];
+  char namebuff[1024];
+  struct dirlist_t *dirlist = NULL;
+  struct dirindex_t *dirindex;
+  struct sendbuff sb;
+  long direntriescount, x, firstentry = 0, lastentry, pagescount = 1;
+  int entriesdisplayed, altnames;
+
+  /* use the pre-computed listing if there is an up to date one, otherwise load the content of the directory */
+  dirindex = opendirindex(config, localfile, directorytolist);
+  if (dirindex != NULL) {
+    direntriescount = dirindex_count(dirindex);
+    syslog(LOG_INFO, "Found %ld items in the index of '%s'", direntriescount, localfile);
+  } else {
+    dirlist = dirlist_load(localfile, dirlist_menufilter);
+    if (dirlist == NULL) {
+      syslog(LOG_WARNING, "ERROR: Could not access directory '%s' (%s)", localfile, strerror(errno));
+      sendline(sock, "3Error: could not access directory\tfake\tfake\t0");
+      return;
+    }
+    direntriescount = dirlist_count(dirlist);
+    syslog(LOG_INFO, "Found %ld items in '%s'", direntriescount, localfile);
+  }
+
+  /* compute the slice of entries to display */
+  lastentry = direntriescount;
+  if ((page > 0) && (config->dirlistpagesize > 0)) {
+    pagescount = (direntriescount + config->dirlistpagesize - 1) / config->dirlistpagesize;
+    if (pagescount < 1) pagescount = 1;
+    if (page > pagescount) page = pagescount;
+    firstentry = (page - 1) * config->dirlistpagesize;
+    if (lastentry > firstentry + config->dirlistpagesize) lastentry = firstentry + config->dirlistpagesize;
+  } else {
+    page = 0;
   }
 
-  syslog(LOG_INFO, "Found %d items in '%s'", direntriescount, localfile);
-
   /* iterate on every entry */
+  sendbuff_init(&sb, sock);
   entriesdisplayed = 0;
-  for (x = 0; x < direntriescount; x++) {
-    char entrytype;
-    char entryselector[1024];
-    char entryselector_encoded[1024];
-    if (direntries[x]->d_name[0] == '.') continue; /* skip any entry starting with '.' (these are either hidden files or system stuff like '.' or '..') */
-    if (strcmp(direntries[x]->d_name, "gophermap") == 0) continue;     /* skip gophermap entries (txt) */
-    if (strcmp(direntries[x]->d_name, "gophermap.cgi") == 0) continue; /* skip gophermap entries (cgi) */
-    if (strcmp(direntries[x]->d_name, "gophermap.php") == 0) continue; /* skip gophermap entries (php) */
-    if (direntries[x]->d_type == DT_DIR) {
-      entrytype = '1';
-    } else {
-      if (dirsonly != 0) continue; /* skip files if dirsonly is set */
-      entrytype = DetectGopherType(direntries[x]->d_name, config->extmap);
+  if (dirindex != NULL) { /* index entries are already typed and encoded */
+    percencode(directorytolist, entryselector_encoded, sizeof(entryselector_encoded));
+    /* names are converted already if the index was built for the output charset */
+    altnames = ((config->outputcharset != CHARSET_UTF8) && (dirindex_charset(dirindex) == config->outputcharset));
+    for (x = firstentry; x < lastentry; x++) {
+      struct dirindex_entry e;
+      if (dirindex_get(dirindex, x, &e) != 0) continue;
+      if ((dirsonly != 0) && (e.isdir == 0)) continue; /* skip files if dirsonly is set */
+      /* the index holds extension-based types, apply cached sniffing verdicts like below */
+      if ((e.isdir == 0) && (config->contentsniffing != 0) && ((config->contentsniffing == 2) || (e.type == '9'))) {
+        snprintf(entryselector, sizeof(entryselector), "%s/%s", localfile, e.name);
+        e.type = DetectGopherTypeSniff(entryselector, config, 0);
+      }
+      entriesdisplayed += 1;
+      snprintf(tempstring, sizeof(tempstring), "%c%s\t%s%s\t%s\t%d", e.type, (altnames != 0) ? e.altname : outputname(config, e.name, namebuff, sizeof(namebuff)), entryselector_encoded, e.encname, config->gopherhostname, config->gopherport);
+      sendbuff_line(&sb, tempstring);
     }
-    entriesdisplayed += 1;
-    snprintf(entryselector, sizeof(entryselector), "%s%s", directorytolist, direntries[x]->d_name);
-    percencode(entryselector, entryselector_encoded, sizeof(entryselector_encoded));
-    snprintf(tempstring, sizeof(tempstring), "%c%s\t%s\t%s\t%d", entrytype, direntries[x]->d_name, entryselector_encoded, config->gopherhostname, config->gopherport);
-    sendline(sock, tempstring);
-    free(direntries[x]);
+    dirindex_close(dirindex);
+  } else {
+    for (x = firstentry; x < lastentry; x++) {
+      char entrytype;
+      const char *name = dirlist_name(dirlist, x);
+      if (dirlist_isdir(dirlist, x) != 0) {
+        entrytype = '1';
+      } else {
+        if (dirsonly != 0) continue; /* skip files if dirsonly is set */
+        if (config->contentsniffing != 0) { /* listings rely on cached verdicts only, they never read files */
+          snprintf(entryselector, sizeof(entryselector), "%s/%s", localfile, name);
+          entrytype = DetectGopherTypeSniff(entryselector, config, 0);
+        } else {
+          entrytype = DetectGopherType(name, config->extmap);
+        }
+      }
+      entriesdisplayed += 1;
+      snprintf(entryselector, sizeof(entryselector), "%s%s", directorytolist, name);
+      percencode(entryselector, entryselector_encoded, sizeof(entryselector_encoded));
+      snprintf(tempstring, sizeof(tempstring), "%c%s\t%s\t%s\t%d", entrytype, outputname(config, name, namebuff, sizeof(namebuff)), entryselector_encoded, config->gopherhostname, config->gopherport);
+      sendbuff_line(&sb, tempstring);
+    }
+    dirlist_free(dirlist);
   }
-  free(direntries);
 
   /* if no entries were displayed, write so */
-  if (entriesdisplayed == 0) sendline(sock, "iThis directory is empty.\tfake\tfake\t0");
+  if (entriesdisplayed == 0) sendbuff_line(&sb, "iThis directory is empty.\tfake\tfake\t0");
+
+  /* navigation links between pages */
+  if ((page > 0) && (pagescount > 1)) {
+    percencode(directorytolist, entryselector_encoded, sizeof(entryselector_encoded));
+    sendbuff_line(&sb, "i\tfake\tfake\t0");
+    snprintf(tempstring, sizeof(tempstring), "iPage %ld of %ld (%ld items)\tfake\tfake\t0", page, pagescount, direntriescount);
+    sendbuff_line(&sb, tempstring);
+    if (page > 1) {
+      snprintf(tempstring, sizeof(tempstring), "1Previous page\t%s?page=%ld\t%s\t%d", entryselector_encoded, page - 1, config->gopherhostname, config->gopherport);
+      sendbuff_line(&sb, tempstring);
+    }
+    if (page < pagescount) {
+      snprintf(tempstring, sizeof(tempstring), "1Next page\t%s?page=%ld\t%s\t%d", entryselector_encoded, page + 1, config->gopherhostname, config->gopherport);
+      sendbuff_line(&sb, tempstring);
+    }
+  }
+  sendbuff_close(&sb);
 }
 
 
-/* cuts a gophermap line into chunks and fills values. returns 0 on success, non-zero on error. */
-static int explodegophermapline(const char *linebuff, char *itemtype, char *itemdesc, char *itemselector, char *itemserver, long *itemport) {
+/* returns non-zero if the client is allowed to see the server status (its
+ * address starts with one of the StatusAllow prefixes) */
+static int statusallowed(const struct MotsognirConfig *config, const char *remoteclientaddr) {
   int x;
-  char tmpstring[16];
-  /* first make sure to clear out all variables */
-  *itemtype = 0;
-  itemdesc[0] = 0;
-  itemselector[0] = 0;
-  itemserver[0] = 0;
-  *itemport = 0;
-  /* if the line is empty, stop right now */
-  if (*linebuff == 0) {
-    *itemtype = 'i';
-    return(0);
+  for (x = 0; (config->statusallow != NULL) && (config->statusallow[x] != NULL); x++) {
+    if (stringstartswith(remoteclientaddr, config->statusallow[x]) != 0) return(1);
   }
-  /* read the itemtype */
-  *itemtype = *linebuff;
-  linebuff += 1;
-  /* read the item's description */
-  for (x = 0;;) {
-    if (x == 1023) return(-1);
-    if (*linebuff == '\t') break;
-    if (*linebuff == 0) return(0);
-    itemdesc[x] = *linebuff;
-    itemdesc[++x] = 0;
-    linebuff += 1;
-  }
-  linebuff += 1;
-  /* read the item's selector */
-  for (x = 0;;) {
-    if (x == 1023) return(-1);
-    if (*linebuff == '\t') break;
-    if (*linebuff == 0) return(0);
-    itemselector[x] = *linebuff;
-    itemselector[++x] = 0;
-    linebuff += 1;
-  }
-  linebuff += 1;
-  /* read the item's server */
-  for (x = 0;;) {
-    if (x == 63) return(-1);
-    if (*linebuff == '\t') break;
-    if (*linebuff == 0) return(0);
-    itemserver[x] = *linebuff;
-    itemserver[++x] = 0;
-    linebuff += 1;
-  }
-  linebuff += 1;
-  /* read the item's port */
-  for (x = 0;;) {
-    if (x == 8) return(-1);
-    if (*linebuff == '\t') break;
-    if (*linebuff == 0) break;
-    tmpstring[x] = *linebuff;
-    tmpstring[++x] = 0;
-    linebuff += 1;
-  }
-  *itemport = atol(tmpstring);
-  if ((*itemport < 1) || (*itemport > 65535)) *itemport = 0;
   return(0);
 }
 
 
-/* executes a CGI/PHP application with a set of env variables describing the
- * gopher environment. returns the amount of data returned by the CGI/PHP app */
-static long execCgi(int sock, const char *localfile, char **srvsideparams, const struct MotsognirConfig *config, const char *version, const char *scriptname, const char *remoteclientaddr, const char *launcher, int gophermapflag) {
-  char tmpstring[4096];
-  const char *cmd;
-  int res;
-  char *emptyarr[2] = { NULL, NULL };
-  long datacount = 0;
-  FILE *cgifd;
-  /* if srvsideparams is NULL, replace it temporarily by an empty array */
-  if (srvsideparams == NULL) srvsideparams = emptyarr;
-  if ((srvsideparams[0] != NULL) || (srvsideparams[1] != NULL)) {
-    syslog(LOG_INFO, "running server-side app '%s' with queries '%s' + '%s'", localfile, srvsideparams[0], srvsideparams[1]);
-  } else {
-    syslog(LOG_INFO, "running server-side app '%s'", localfile);
+/* returns the server status report in the given format, preceded by the
+ * version of the server, in a buffer allocated with malloc(), and sets len
+ * to its length. returns NULL on error */
+static char *statusreport(const struct MotsognirConfig *config, int format, const char *eol, int *len) {
+  char *buff;
+  int size, res, tries;
+  /* histograms may fill up while the report is written: start over with a
+   * bigger buffer then */
+  for (tries = 0; tries < 3; tries++) {
+    size = scoreboard_reportsize(config->scoreboard, format) + 256;
+    buff = malloc(size);
+    if (buff == NULL) {
+      syslog(LOG_WARNING, "WARNING: out of memory for the server status (%d bytes)", size);
+      return(NULL);
+    }
+    if (format == SCOREBOARD_KEYVALUE) {
+      *len = snprintf(buff, size, "version=%s%s", pVer, eol);
+    } else {
+      *len = snprintf(buff, size, "Motsognir v%s server status%s%s", pVer, eol, eol);
+    }
+    res = scoreboard_report(config->scoreboard, buff + *len, size - *len, format, eol);
+    if (res >= 0) {
+      *len += res;
+      return(buff);
+    }
+    free(buff);
   }
-  /* Set environment variables */
+  syslog(LOG_WARNING, "WARNING: the server status does not fit in its buffer");
+  return(NULL);
+}
+
+
+/* sends the server status as a text document: a report for humans, or
+ * key=value pairs if the 'auto' query is given (like '/server-status?auto') */
+static void outputstatus(int sock, const struct MotsognirConfig *config, const char *remoteclientaddr, const char *query) {
+  struct sendbuff sb;
+  char *report;
+  int len;
+  int keyvalue = ((query != NULL) && (strcmp(query, "auto") == 0));
+  if (statusallowed(config, remoteclientaddr) == 0) {
+    syslog(LOG_WARNING, "Server status denied to %s", remoteclientaddr);
+    accesslog_settype('3');
+    accesslog_setstatus("forbidden");
+    sendline(sock, "3Forbidden!\tfake\tfake\t0");
+    sendline(sock, ".");
+    return;
+  }
+  report = statusreport(config, keyvalue ? SCOREBOARD_KEYVALUE : SCOREBOARD_TEXTREPORT, "\r\n", &len);
+  if (report == NULL) {
+    accesslog_settype('3');
+    accesslog_setstatus("error");
+    sendline(sock, "3Server status unavailable\tfake\tfake\t0");
+    sendline(sock, ".");
+    return;
+  }
+  accesslog_settype('0');
+  sendbuff_init(&sb, sock);
+  sendbuff_write(&sb, report, len);
+  sendbuff_line(&sb, ".");
+  sendbuff_close(&sb);
+  free(report);
+}
+
+
+/* answers a search request with a menu of the best matching items. without
+ * any query, a search item is returned instead, for clients to query it. */
+static void outputsearch(int sock, const struct MotsognirConfig *config, const char *query) {
+  char tempstring[2048];
+  char selector_encoded[1024];
+  char curdirectory[1024];
+  char desc[1024];
+  struct search_result *results;
+  struct search_t *search;
+  struct sendbuff sb;
+  int count, x;
+
+  if ((query == NULL) || (query[0] == 0)) {
+    snprintf(tempstring, sizeof(tempstring), "7Search\t%s\t%s\t%d", config->searchselector, config->gopherhostname, config->gopherport);
+    sendline(sock, tempstring);
+    return;
+  }
+
+  search = search_open(config->searchindex);
+  if (search == NULL) {
+    syslog(LOG_WARNING, "ERROR: failed to open the search index '%s'", config->searchindex);
+    sendline(sock, "3Search is not available\tfake\tfake\t0");
+    return;
+  }
+  results = malloc(config->searchmaxresults * sizeof(struct search_result));
+  if (results == NULL) {
+    search_close(search);
+    sendline(sock, "3Internal error\tfake\tfake\t0");
+    return;
+  }
+  count = search_query(search, query, results, config->searchmaxresults);
+  syslog(LOG_INFO, "Search for '%s' returned %d results", query, count);
+
+  sendbuff_init(&sb, sock);
+  snprintf(curdirectory, sizeof(curdirectory), "%s", query);
+  for (x = 0; curdirectory[x] != 0; x++) { /* the query is echoed in a menu line - it must not contain any tab */
+    if ((unsigned char)curdirectory[x] < 32) curdirectory[x] = ' ';
+  }
+  snprintf(tempstring, sizeof(tempstring), "iSearch results for '%s': %d\tfake\tfake\t0", curdirectory, count);
+  sendbuff_line(&sb, tempstring);
+  sendbuff_line(&sb, "i\tfake\tfake\t0");
+  for (x = 0; x < count; x++) {
+    const struct search_result *r = &(results[x]);
+    const char *selector = r->selector;
+    /* text files are indexed under their local path, which has to be encoded */
+    if (strcmp(r->selector, r->source) == 0) {
+      percencode(r->selector, selector_encoded, sizeof(selector_encoded));
+      selector = selector_encoded;
+    }
+    /* relative selectors of gophermap items are resolved against the gophermap's directory */
+    snprintf(curdirectory, sizeof(curdirectory), "%s", r->source);
+    curdirectory[strrchr(curdirectory, '/') - curdirectory + 1] = 0;
+    buildgophermapline(tempstring, sizeof(tempstring), r->type, outputname(config, r->desc, desc, sizeof(desc)), selector, r->server, r->port, curdirectory, config->gopherhostname, config->gopherport);
+    sendbuff_line(&sb, tempstring);
+  }
+  if (count == 0) sendbuff_line(&sb, "iNothing found.\tfake\tfake\t0");
+  sendbuff_close(&sb);
+  free(results);
+  search_close(search);
+}
+
+
+/* sets the environment variables that describe the gopher environment to a
+ * CGI/PHP application (srvsideparams must not be NULL) */
+static void setcgienv(char **srvsideparams, const struct MotsognirConfig *config, const char *version, const char *scriptname, const char *remoteclientaddr) {
+  char tmpstring[64];
   setenv("SERVER_NAME", config->gopherhostname, 1);       /* The server's hostname, DNS alias, or IP address as it would appear in self-referencing URLs. */
   snprintf(tmpstring, sizeof(tmpstring), "%d", config->gopherport);
   setenv("SERVER_PORT", tmpstring, 1);                    /* The server's port, as it would appear in self-referencing URLs. */
@@ -1123,6 +1477,353 @@ static long execCgi(int sock, const char *localfile, char **srvsideparams, const
   if (srvsideparams[0] != 0) setenv("QUERY_STRING_URL", srvsideparams[0], 1);
   if (srvsideparams[1] != 0) setenv("QUERY_STRING_SEARCH", srvsideparams[1], 1);
   setenv("SCRIPT_NAME", scriptname, 1);
+}
+
+
+/* processes a single line of output of a dynamic gophermap, and sends the
+ * resulting gophermap line to the socket. returns 0 on success, non-zero if
+ * the line cannot be interpreted as a gophermap line. */
+static int senddynamicgophermapline(int sock, const char *line, const char *urldir, const struct MotsognirConfig *config) {
+  char linebuff[4096];
+  char itemtype;
+  char itemdesc[1024];
+  char itemselector[1024];
+  char itemserver[1024];
+  long itemport;
+  if (explodegophermapline(line, &itemtype, itemdesc, itemselector, itemserver, &itemport) != 0) return(-1);
+  /* build the result line and send it over the wire */
+  charset_strfromutf8(config->outputcharset, itemdesc);
+  buildgophermapline(linebuff, sizeof(linebuff), itemtype, itemdesc, itemselector, itemserver, itemport, urldir, config->gopherhostname, config->gopherport);
+  sendline(sock, linebuff);
+  return(0);
+}
+
+
+/* a running server-side app, along with its resource accounting */
+struct cgiproc {
+  const char *script;
+  pid_t pid;              /* also the id of the app's process group */
+  int fd;                 /* read end of the app's stdout */
+  time_t starttime;
+  long outputlen;         /* amount of bytes read from the app so far */
+  const char *killreason; /* name of the limit that made us kill the app */
+};
+
+
+/* starts a server-side app through /bin/sh, in a process group of its own,
+ * with its stdout connected to a pipe and with configured resource limits
+ * applied. returns 0 on success, non-zero otherwise. */
+static int spawncgi(struct cgiproc *proc, const char *cmd, const char *script, const struct MotsognirConfig *config) {
+  int pipefd[2];
+  char execcmd[4200];
+  /* 'exec' makes the shell replace itself by the app, so signals and exit
+   * codes reach us directly */
+  snprintf(execcmd, sizeof(execcmd), "exec %s", cmd);
+  memset(proc, 0, sizeof(*proc));
+  proc->script = script;
+  proc->fd = -1;
+  if (pipe(pipefd) != 0) return(-1);
+  proc->pid = fork();
+  if (proc->pid < 0) {
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return(-1);
+  }
+  if (proc->pid == 0) { /* I'm the child */
+    struct rlimit rl;
+    setpgid(0, 0);
+    /* the soft CPU limit sends a SIGXCPU, the hard one (1s later) kills */
+    if (config->cgimaxcputime > 0) {
+      rl.rlim_cur = config->cgimaxcputime;
+      rl.rlim_max = config->cgimaxcputime + 1;
+      setrlimit(RLIMIT_CPU, &rl);
+    }
+    if (config->cgimaxmemory > 0) {
+      rl.rlim_cur = (rlim_t)config->cgimaxmemory * 1024 * 1024;
+      rl.rlim_max = rl.rlim_cur;
+      setrlimit(RLIMIT_AS, &rl);
+    }
+    if (config->cgimaxfilesize > 0) {
+      rl.rlim_cur = (rlim_t)config->cgimaxfilesize * 1024 * 1024;
+      rl.rlim_max = rl.rlim_cur;
+      setrlimit(RLIMIT_FSIZE, &rl);
+    }
+    close(pipefd[0]);
+    if (pipefd[1] != STDOUT_FILENO) {
+      dup2(pipefd[1], STDOUT_FILENO);
+      close(pipefd[1]);
+    }
+    execl("/bin/sh", "sh", "-c", execcmd, (char *)NULL);
+    _exit(127);
+  }
+  /* the child sets its process group as well, but it might not have been
+   * scheduled yet: this way the group exists before anyone signals it (an
+   * error only means that the child did it already, or exec'ed) */
+  setpgid(proc->pid, proc->pid);
+  /* make sure that other server-side apps won't inherit the pipe */
+  fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+  close(pipefd[1]);
+  proc->fd = pipefd[0];
+  proc->starttime = time(NULL);
+  return(0);
+}
+
+
+/* kills a server-side app and all its children: first asks politely with a
+ * SIGTERM, then sends a SIGKILL if the app is still there 2s later */
+static void killcgi(struct cgiproc *proc, const char *reason) {
+  siginfo_t info;
+  int x;
+  if ((proc->pid <= 0) || (proc->killreason != NULL)) return;
+  proc->killreason = reason;
+  syslog(LOG_WARNING, "WARNING: server-side app '%s' killed after %lds (%s limit reached)", proc->script, (long)(time(NULL) - proc->starttime), reason);
+  kill(-(proc->pid), SIGTERM);
+  for (x = 0; x < 20; x++) {
+    /* WNOWAIT leaves the app as a zombie, so its process group id cannot be reused before the SIGKILL below */
+    memset(&info, 0, sizeof(info));
+    if ((waitid(P_PID, proc->pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0) && (info.si_pid != 0)) break;
+    usleep(100000);
+  }
+  kill(-(proc->pid), SIGKILL); /* whatever children the app might have left behind */
+}
+
+
+/* closes the output of a server-side app and collects its exit status */
+static void reapcgi(struct cgiproc *proc, const struct MotsognirConfig *config) {
+  int res;
+  if (proc->fd >= 0) close(proc->fd);
+  proc->fd = -1;
+  if (proc->pid <= 0) return;
+  if (waitpid(proc->pid, &res, 0) < 0) {
+    syslog(LOG_WARNING, "WARNING: call to server-side app '%s' failed (%s)", proc->script, strerror(errno));
+  } else if (proc->killreason != NULL) {
+    /* killed by us, this has been logged already */
+  } else if (WIFSIGNALED(res)) {
+    const char *resource = NULL;
+    if (WTERMSIG(res) == SIGXCPU) resource = "CPU time";
+    if ((WTERMSIG(res) == SIGKILL) && (config->cgimaxcputime > 0)) resource = "CPU time"; /* most likely the hard limit */
+    if (WTERMSIG(res) == SIGXFSZ) resource = "file size";
+    if (resource != NULL) {
+      syslog(LOG_WARNING, "WARNING: server-side app '%s' killed by signal %d (%s limit reached)", proc->script, WTERMSIG(res), resource);
+    } else {
+      syslog(LOG_WARNING, "WARNING: server-side app '%s' killed by signal %d", proc->script, WTERMSIG(res));
+    }
+  } else if (WEXITSTATUS(res) != 0) {
+    syslog(LOG_WARNING, "WARNING: server-side app '%s' terminated with a non-zero exit code (%d)", proc->script, WEXITSTATUS(res));
+  }
+  proc->pid = 0;
+}
+
+
+/* accounts for len bytes of output read from a server-side app, and kills
+ * the app if it went past the output limit. returns the amount of bytes that
+ * may be used (ie. len truncated to the output limit). */
+static long cgiaccountoutput(struct cgiproc *proc, long len, const struct MotsognirConfig *config) {
+  proc->outputlen += len;
+  if ((config->cgimaxoutput > 0) && (proc->outputlen > config->cgimaxoutput)) {
+    len -= proc->outputlen - config->cgimaxoutput;
+    proc->outputlen = config->cgimaxoutput;
+    killcgi(proc, "output size");
+  }
+  return(len);
+}
+
+
+/* waits for some output from a server-side app, enforcing the wall-clock
+ * deadline and the output limit. returns the amount of bytes read, 0 on EOF,
+ * or -1 if the app has been killed. */
+static long readcgi(struct cgiproc *proc, char *buff, long bufflen, const struct MotsognirConfig *config) {
+  struct pollfd pfd;
+  long len;
+  int res;
+  for (;;) {
+    if (proc->killreason != NULL) return(-1);
+    if ((config->cgitimeout > 0) && (time(NULL) - proc->starttime >= config->cgitimeout)) {
+      killcgi(proc, "wall-clock time");
+      return(-1);
+    }
+    /* wake up every second to check the deadline */
+    pfd.fd = proc->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    res = poll(&pfd, 1, 1000);
+    if (res == 0) continue;
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      syslog(LOG_WARNING, "ERROR: poll() failed while reading from server-side app '%s' (%s)", proc->script, strerror(errno));
+      killcgi(proc, "poll() failure");
+      return(-1);
+    }
+    len = read(proc->fd, buff, bufflen);
+    if (len < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN)) continue;
+      return(0);
+    }
+    if (len == 0) return(0);
+    len = cgiaccountoutput(proc, len, config);
+    if (len <= 0) return(-1);
+    return(len);
+  }
+}
+
+
+/* appends data from buff (starting at *pos) to line, until a LF is found.
+ * returns non-zero once a complete line has been assembled, zero if buff got
+ * exhausted before. CR chars are dropped and long lines truncated. */
+static int assembleline(const char *buff, size_t bufflen, size_t *pos, char *line, int *linelen, int linemax) {
+  while (*pos < bufflen) {
+    char ch = buff[(*pos)++];
+    if (ch == '\n') {
+      line[*linelen] = 0;
+      return(1);
+    }
+    if (ch == '\r') continue;
+    if (*linelen < linemax - 1) line[(*linelen)++] = ch;
+  }
+  line[*linelen] = 0;
+  return(0);
+}
+
+
+/* tries to take a free slot out of a slot list (free slots are 0, others
+ * hold the pid of their owner). Slots owned by processes that do not exist
+ * anymore (crashed or killed while holding a slot) are taken over. Returns
+ * the index of the slot that has been taken, or -1 if all are busy. */
+static int cgislot_take(pid_t *slots, int slotscount) {
+  pid_t mypid = getpid();
+  pid_t owner;
+  int x;
+  for (x = 0; x < slotscount; x++) {
+    owner = slots[x];
+    if ((owner != 0) && ((kill(owner, 0) == 0) || (errno != ESRCH))) continue;
+    if (__sync_bool_compare_and_swap(&(slots[x]), owner, mypid)) return(x);
+  }
+  return(-1);
+}
+
+
+/* returns the first CgiConcurrency rule that matches the script, or NULL */
+static struct cgiconcurrency *cgiconcurrency_find(const char *script, const struct MotsognirConfig *config) {
+  int x;
+  for (x = 0; x < config->cgiconcurrencycount; x++) {
+    if (fnmatch(config->cgiconcurrency[x].glob, script, 0) == 0) return(&(config->cgiconcurrency[x]));
+  }
+  return(NULL);
+}
+
+
+/* acquires a running slot for a script, if it matches any CgiConcurrency
+ * rule, possibly waiting in the rule's queue for a slot to become free.
+ * returns the slot's index, -1 if the script is not subject to any limit, or
+ * -2 if no slot could be obtained. */
+static int cgislot_acquire(const struct cgiconcurrency *rule, const char *script) {
+  int slot, waitslot;
+  time_t waitstart;
+  if (rule == NULL) return(-1);
+  slot = cgislot_take(rule->running, rule->maxrunning);
+  if (slot >= 0) return(slot);
+  /* all slots are busy, try to get into the wait queue */
+  waitslot = cgislot_take(rule->waiting, rule->maxwaiting);
+  if (waitslot < 0) {
+    syslog(LOG_WARNING, "WARNING: '%s' is busy (%d running, wait queue full)", script, rule->maxrunning);
+    return(-2);
+  }
+  waitstart = time(NULL);
+  for (;;) {
+    usleep(20000);
+    slot = cgislot_take(rule->running, rule->maxrunning);
+    if (slot >= 0) break;
+    if (time(NULL) - waitstart >= rule->queuetimeout) {
+      syslog(LOG_WARNING, "WARNING: '%s' is busy (no slot freed up within %ds)", script, rule->queuetimeout);
+      break;
+    }
+  }
+  rule->waiting[waitslot] = 0;
+  if (slot < 0) return(-2);
+  return(slot);
+}
+
+
+/* releases a running slot obtained through cgislot_acquire() */
+static void cgislot_release(const struct cgiconcurrency *rule, int slot) {
+  if ((rule == NULL) || (slot < 0)) return;
+  rule->running[slot] = 0;
+}
+
+
+/* returns the administrator contact given in Gopher+ attributes */
+static const char *gopherplusadmin(const struct MotsognirConfig *config) {
+  if (config->gopherplusadmin != NULL) return(config->gopherplusadmin);
+  return("Server administrator");
+}
+
+
+/* sends a Gopher+ error (1 = item is not available) */
+static void sendgopherpluserror(int sock, const struct MotsognirConfig *config, const char *msg) {
+  char linebuff[1024];
+  sendline(sock, "--1");
+  snprintf(linebuff, sizeof(linebuff), "1 %s", gopherplusadmin(config));
+  sendline(sock, linebuff);
+  snprintf(linebuff, sizeof(linebuff), "%s", msg);
+  sendline(sock, linebuff);
+  sendline(sock, ".");
+}
+
+
+/* sends the header of the answer to a Gopher+ '+' request (nothing for other
+ * requests), once the item is resolved: menus and text documents end with a
+ * period, anything else ends when the connection is closed */
+static void sendgopherplusheader(int sock, int gopherplus, char type) {
+  if (gopherplus != '+') return;
+  switch (type) {
+    case '0':
+    case '1':
+    case '2':
+    case '6':
+    case '7':
+      sendline(sock, "+-1");
+      break;
+    default:
+      sendline(sock, "+-2");
+      break;
+  }
+}
+
+
+/* executes a CGI/PHP application with a set of env variables describing the
+ * gopher environment. if gopherplus is '+' (and gophermapflag is not set),
+ * the output is preceded by a Gopher+ header. returns the amount of data
+ * returned by the CGI/PHP app */
+static long execCgi(int sock, const char *localfile, char **srvsideparams, const struct MotsognirConfig *config, const char *version, const char *scriptname, const char *remoteclientaddr, const char *launcher, int gophermapflag, int gopherplus, struct arena_t *arena) {
+  char tmpstring[4096];
+  const char *cmd;
+  long res;
+  char *emptyarr[2] = { NULL, NULL };
+  long datacount = 0;
+  struct cgiproc proc;
+  const struct cgiconcurrency *concurrencyrule;
+  int slot;
+  /* if the script is subject to a concurrency limit, wait for a free slot */
+  concurrencyrule = cgiconcurrency_find(localfile, config);
+  slot = cgislot_acquire(concurrencyrule, localfile);
+  if (slot == -2) {
+    if ((gophermapflag == 0) && (gopherplus == '+')) {
+      sendgopherpluserror(sock, config, "Server busy, please try again later");
+      return(1);
+    }
+    sendline(sock, "3Server busy, please try again later\tfake\tfake\t0");
+    sendline(sock, "iThe server is too busy to process this request right now.\tfake\tfake\t0");
+    if (gophermapflag == 0) sendline(sock, ".");
+    return(1);
+  }
+  /* if srvsideparams is NULL, replace it temporarily by an empty array */
+  if (srvsideparams == NULL) srvsideparams = emptyarr;
+  if ((srvsideparams[0] != NULL) || (srvsideparams[1] != NULL)) {
+    syslog(LOG_INFO, "running server-side app '%s' with queries '%s' + '%s'", localfile, srvsideparams[0], srvsideparams[1]);
+  } else {
+    syslog(LOG_INFO, "running server-side app '%s'", localfile);
+  }
+  setcgienv(srvsideparams, config, version, scriptname, remoteclientaddr);
   /* execute the script */
   if (launcher == NULL) {
     cmd = localfile;
@@ -1130,57 +1831,220 @@ static long execCgi(int sock, const char *localfile, char **srvsideparams, const
     cmd = tmpstring;
     snprintf(tmpstring, sizeof(tmpstring), "%s %s", launcher, localfile);
   }
-  cgifd = popen(cmd, "r");
-  if (cgifd == NULL) {
+  if (spawncgi(&proc, cmd, localfile, config) != 0) {
     syslog(LOG_WARNING, "ERROR: failed to run the server-side app '%s'", localfile);
+    cgislot_release(concurrencyrule, slot);
     return(0);
   }
   /* read from the CGI application, and send to the socket */
   if (gophermapflag != 0) {
-    /* here I process dynamic gophermaps by reading a single line and passing it through explodegophermapline() */
-    int linelen;
-    char itemtype;
-    char itemdesc[1024];
-    char itemselector[1024];
-    char itemserver[1024];
-    long itemport;
-    char *urldir = getdirpart(scriptname);
-    res = 0;
+    /* here I process dynamic gophermaps by assembling single lines and passing them through explodegophermapline() */
+    char linebuff[4096];
+    int linelen = 0, aborted = 0;
+    size_t pos;
+    char *urldir = getdirpart(arena, scriptname);
     for (;;) {
-      linelen = sockreadline(fileno(cgifd), tmpstring, sizeof(tmpstring), NULL);
-      if (linelen < 0) break;
-      if ((linelen > 0) && (tmpstring[0] == '#')) continue; /* skip comments */
-      datacount += linelen;
-      /* */
-      if (explodegophermapline(tmpstring, &itemtype, itemdesc, itemselector, itemserver, &itemport) != 0) {
-        syslog(LOG_WARNING, "ERROR: dynamic gophermap processing aborted due to failure to interpret its output as being a gophermap line (%s)", localfile);
-        break;
+      res = readcgi(&proc, tmpstring, sizeof(tmpstring), config);
+      if (res < 0) break;
+      /* res == 0 means EOF: flush the last line, if not terminated by a LF */
+      for (pos = 0; (aborted == 0) && ((assembleline(tmpstring, res, &pos, linebuff, &linelen, sizeof(linebuff)) != 0) || ((res == 0) && (linelen > 0))); linelen = 0) {
+        if ((linelen > 0) && (linebuff[0] == '#')) continue; /* skip comments */
+        datacount += linelen;
+        if (senddynamicgophermapline(sock, linebuff, urldir, config) != 0) {
+          syslog(LOG_WARNING, "ERROR: dynamic gophermap processing aborted due to failure to interpret its output as being a gophermap line (%s)", localfile);
+          aborted = 1;
+        }
       }
-      /* build the result line and send it over the wire */
-      buildgophermapline(tmpstring, sizeof(tmpstring), itemtype, itemdesc, itemselector, itemserver, itemport, urldir, config);
-      sendline(sock, tmpstring);
+      if ((res == 0) || (aborted != 0)) break;
     }
-    free(urldir);
   } else {
     for (;;) {
-      res = fread(tmpstring, 1, sizeof(tmpstring), cgifd);
+      res = readcgi(&proc, tmpstring, sizeof(tmpstring), config);
       if (res <= 0) break;
+      if (datacount == 0) sendgopherplusheader(sock, gopherplus, '9'); /* the output of scripts is not period-terminated */
       datacount += res;
-      send(sock, tmpstring, res, 0);
+      accesslog_addbytes(send(sock, tmpstring, res, 0));
     }
   }
   /* close the pipe */
-  res = pclose(cgifd);
-  if (res == -1) {
-    syslog(LOG_WARNING, "WARNING: call to server-side app '%s' failed (%s)", localfile, strerror(errno));
-  } else if (WEXITSTATUS(res) != 0) {
-    syslog(LOG_WARNING, "WARNING: server-side app '%s' terminated with a non-zero exit code (%d)", localfile, WEXITSTATUS(res));
-  }
+  reapcgi(&proc, config);
+  cgislot_release(concurrencyrule, slot);
   return(datacount);
 }
 
 
-static void outputgophermap(int sock, const struct MotsognirConfig *config, const char *localfile, const char *gophermapfile, const char *directorytolist, const char *remoteclientaddr, char **srvsideparams) {
+/* state of a sub-gophermap script */
+#define SUBGMAP_PENDING 0
+#define SUBGMAP_RUNNING 1
+#define SUBGMAP_DONE    2
+#define SUBGMAP_TIMEOUT 3
+#define SUBGMAP_FAILED  4
+#define SUBGMAP_BUSY    5  /* no CgiConcurrency slot could be obtained */
+
+struct subgmap {
+  char *script;          /* resolved path to the script */
+  const char *launcher;  /* interpreter to use, or NULL */
+  int state;
+  const struct cgiconcurrency *rule; /* CgiConcurrency rule, if any */
+  int slot;              /* running slot held in the rule */
+  struct cgiproc proc;
+  char *output;          /* everything the script wrote so far */
+  size_t outputlen;
+  size_t outputsize;
+};
+
+struct gophermapline {
+  char *text;
+  int subgmap;           /* index of the sub-gophermap script, or -1 */
+};
+
+
+/* starts a sub-gophermap script, once it obtained a slot from its
+ * CgiConcurrency rule (if any). if no slot is free while other scripts are
+ * still running, the script is left pending until one of them is done.
+ * otherwise it waits in the rule's queue. returns 0 if the script started, 1
+ * if it is left pending, -1 on failure */
+static int subgmap_start(struct subgmap *item, int running, const struct MotsognirConfig *config) {
+  char cmd[4096];
+  item->rule = cgiconcurrency_find(item->script, config);
+  if ((item->rule != NULL) && (running > 0)) {
+    item->slot = cgislot_take(item->rule->running, item->rule->maxrunning);
+    if (item->slot < 0) return(1);
+  } else {
+    item->slot = cgislot_acquire(item->rule, item->script);
+    if (item->slot == -2) {
+      item->state = SUBGMAP_BUSY;
+      return(-1);
+    }
+  }
+  if (item->launcher == NULL) {
+    snprintf(cmd, sizeof(cmd), "%s", item->script);
+  } else {
+    snprintf(cmd, sizeof(cmd), "%s %s", item->launcher, item->script);
+  }
+  syslog(LOG_INFO, "running server-side app '%s'", item->script);
+  if (spawncgi(&(item->proc), cmd, item->script, config) != 0) {
+    syslog(LOG_WARNING, "ERROR: failed to run the server-side app '%s'", item->script);
+    cgislot_release(item->rule, item->slot);
+    item->rule = NULL;
+    item->state = SUBGMAP_FAILED;
+    return(-1);
+  }
+  item->state = SUBGMAP_RUNNING;
+  return(0);
+}
+
+
+/* collects the exit status of a sub-gophermap script, killing it first if it
+ * is being stopped for exceeding a limit (reason != NULL), and releases its
+ * CgiConcurrency slot */
+static void subgmap_finish(struct subgmap *item, int newstate, const char *reason, const struct MotsognirConfig *config) {
+  if (reason != NULL) killcgi(&(item->proc), reason);
+  reapcgi(&(item->proc), config);
+  cgislot_release(item->rule, item->slot);
+  item->rule = NULL;
+  item->state = newstate;
+}
+
+
+/* runs sub-gophermap scripts (at most maxparallel at the same time), buffering
+ * their output, until the script 'waitfor' is done */
+static void subgmap_pump(struct subgmap *items, int itemscount, int waitfor, const struct MotsognirConfig *config) {
+  struct pollfd fds[64];
+  int fdsitem[64];
+  int x, fdscount, running, res;
+  long len;
+
+  while ((items[waitfor].state == SUBGMAP_PENDING) || (items[waitfor].state == SUBGMAP_RUNNING)) {
+    /* start pending scripts, in gophermap order, as long as there is room */
+    running = 0;
+    for (x = 0; x < itemscount; x++) if (items[x].state == SUBGMAP_RUNNING) running++;
+    for (x = 0; (x < itemscount) && (running < config->subgophermapsmaxparallel); x++) {
+      if (items[x].state != SUBGMAP_PENDING) continue;
+      res = subgmap_start(&(items[x]), running, config);
+      if (res > 0) break; /* wait for a CgiConcurrency slot */
+      if (res == 0) running++;
+    }
+    /* kill scripts that run for too long */
+    fdscount = 0;
+    for (x = 0; x < itemscount; x++) {
+      if (items[x].state != SUBGMAP_RUNNING) continue;
+      if ((config->subgophermapstimeout > 0) && (time(NULL) - items[x].proc.starttime >= config->subgophermapstimeout)) {
+        subgmap_finish(&(items[x]), SUBGMAP_TIMEOUT, "sub-gophermap time", config);
+        continue;
+      }
+      if ((config->cgitimeout > 0) && (time(NULL) - items[x].proc.starttime >= config->cgitimeout)) {
+        subgmap_finish(&(items[x]), SUBGMAP_TIMEOUT, "wall-clock time", config);
+        continue;
+      }
+      if (fdscount == sizeof(fds) / sizeof(fds[0])) continue;
+      fds[fdscount].fd = items[x].proc.fd;
+      fds[fdscount].events = POLLIN;
+      fdsitem[fdscount] = x;
+      fdscount++;
+    }
+    if (fdscount == 0) continue;
+    /* wait for some data to come (wake up every second to check timeouts) */
+    if (poll(fds, fdscount, 1000) < 0) {
+      if (errno == EINTR) continue;
+      syslog(LOG_WARNING, "ERROR: poll() failed while running sub-gophermaps (%s)", strerror(errno));
+      for (x = 0; x < itemscount; x++) if (items[x].state == SUBGMAP_RUNNING) subgmap_finish(&(items[x]), SUBGMAP_FAILED, "poll() failure", config);
+      break;
+    }
+    for (x = 0; x < fdscount; x++) {
+      struct subgmap *item = &(items[fdsitem[x]]);
+      if (fds[x].revents == 0) continue;
+      /* make sure there is some room in the output buffer */
+      if (item->outputsize - item->outputlen < 4096) {
+        char *newbuff = realloc(item->output, item->outputsize + 65536);
+        if (newbuff == NULL) {
+          syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+          subgmap_finish(item, SUBGMAP_FAILED, "memory", config);
+          continue;
+        }
+        item->output = newbuff;
+        item->outputsize += 65536;
+      }
+      len = read(item->proc.fd, item->output + item->outputlen, item->outputsize - item->outputlen);
+      if (len > 0) {
+        item->outputlen += cgiaccountoutput(&(item->proc), len, config);
+        if (item->proc.killreason != NULL) subgmap_finish(item, SUBGMAP_DONE, NULL, config); /* went past the output limit */
+      } else if ((len == 0) || ((errno != EINTR) && (errno != EAGAIN))) {
+        subgmap_finish(item, SUBGMAP_DONE, NULL, config);
+      }
+    }
+  }
+}
+
+
+/* sends the buffered output of a sub-gophermap script, processing it line by
+ * line exactly like the output of a dynamic gophermap */
+static void subgmap_flush(int sock, struct subgmap *item, const char *urldir, const struct MotsognirConfig *config) {
+  char linebuff[4096];
+  size_t pos = 0;
+  int linelen = 0;
+
+  if (item->state == SUBGMAP_TIMEOUT) {
+    sendline(sock, "iError: this section took too long to generate\tfake\tfake\t0");
+    return;
+  }
+  if (item->state == SUBGMAP_BUSY) {
+    sendline(sock, "3Server busy, please try again later\tfake\tfake\t0");
+    return;
+  }
+
+  while ((assembleline(item->output, item->outputlen, &pos, linebuff, &linelen, sizeof(linebuff)) != 0) || (linelen > 0)) {
+    linelen = 0;
+    if (linebuff[0] == '#') continue; /* skip comments */
+    if (senddynamicgophermapline(sock, linebuff, urldir, config) != 0) {
+      syslog(LOG_WARNING, "ERROR: dynamic gophermap processing aborted due to failure to interpret its output as being a gophermap line (%s)", item->script);
+      break;
+    }
+  }
+}
+
+
+static void outputgophermap(int sock, const struct MotsognirConfig *config, const char *localfile, const char *gophermapfile, const char *directorytolist, const char *remoteclientaddr, char **srvsideparams, struct arena_t *arena) {
   FILE *gophermapfd;
   char linebuff[4096];
   char itemtype;
@@ -1188,13 +2052,18 @@ static void outputgophermap(int sock, const struct MotsognirConfig *config, cons
   char itemselector[1024];
   char itemserver[64];
   long itemport;
+  struct gophermapline *lines = NULL;
+  int lineslen = 0;
+  struct subgmap *subgmaps = NULL;
+  int subgmapscount = 0, running, res, x;
+  char *urldir = NULL, *resolved;
 
   /* first check if the gophermap is of dynamic type (cgi or php), and if so, execute it */
   if ((config->cgisupport != 0) && (stringendswith(gophermapfile, ".cgi") != 0)) { /* is it a CGI file? */
-    execCgi(sock, gophermapfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, NULL, 1);
+    execCgi(sock, gophermapfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, NULL, 1, 0, arena);
     return;
   } else if ((config->phpsupport != 0) && (stringendswith(gophermapfile, ".php") != 0)) { /* is it a PHP file? */
-    execCgi(sock, gophermapfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, "php", 1);
+    execCgi(sock, gophermapfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, "php", 1, 0, arena);
     return;
   }
 
@@ -1205,88 +2074,162 @@ static void outputgophermap(int sock, const struct MotsognirConfig *config, cons
   }
   syslog(LOG_INFO, "Response=\"Return gophermap. (%s)", gophermapfile);
 
+  /* load the whole gophermap first, so sub-gophermap scripts can be started
+   * right away and run while the static part of the gophermap is being sent */
   for (;;) {
     if (sockreadline(fileno(gophermapfd), linebuff, 1023, NULL) < 0) break;
     /* skip comments */
     if (linebuff[0] == '#') continue;
+    if ((lineslen % 64) == 0) {
+      struct gophermapline *newlines = realloc(lines, (lineslen + 64) * sizeof(struct gophermapline));
+      if (newlines == NULL) {
+        syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+        break;
+      }
+      lines = newlines;
+    }
+    lines[lineslen].text = arena_strdup(arena, linebuff);
+    lines[lineslen].subgmap = -1;
+    if (lines[lineslen].text == NULL) break;
+    lineslen++;
+    /* sub-gophermap script? */
+    if ((linebuff[0] == '=') && (config->subgophermaps != 0)) {
+      struct subgmap *newsubgmaps;
+      const char *launcher = NULL;
+      if (explodegophermapline(linebuff, &itemtype, itemdesc, itemselector, itemserver, &itemport) != 0) continue;
+      if ((config->phpsupport != 0) && (strcmp(getfileextension(itemdesc), "php") == 0)) {
+        launcher = "php";
+      } else if (config->cgisupport == 0) {
+        continue;
+      }
+      newsubgmaps = realloc(subgmaps, (subgmapscount + 1) * sizeof(struct subgmap));
+      if (newsubgmaps == NULL) continue;
+      subgmaps = newsubgmaps;
+      memset(&(subgmaps[subgmapscount]), 0, sizeof(struct subgmap));
+      resolved = realpath(itemdesc, NULL);
+      if (resolved == NULL) {
+        syslog(LOG_WARNING, "WARNING: Failed to resolve the path to '%s'", itemdesc);
+        continue;
+      }
+      subgmaps[subgmapscount].script = arena_strdup(arena, resolved);
+      free(resolved);
+      if (subgmaps[subgmapscount].script == NULL) continue;
+      subgmaps[subgmapscount].launcher = launcher;
+      subgmaps[subgmapscount].proc.fd = -1;
+      lines[lineslen - 1].subgmap = subgmapscount++;
+    }
+  }
+  fclose(gophermapfd);
+
+  /* start sub-gophermap scripts (as many as allowed to run in parallel) */
+  if (subgmapscount > 0) {
+    char *emptyarr[2] = { NULL, NULL };
+    urldir = getdirpart(arena, directorytolist);
+    setcgienv(emptyarr, config, pVer, directorytolist, remoteclientaddr);
+    for (x = 0, running = 0; (x < subgmapscount) && (running < config->subgophermapsmaxparallel); x++) {
+      res = subgmap_start(&(subgmaps[x]), running, config);
+      if (res > 0) break; /* wait for a CgiConcurrency slot */
+      if (res == 0) running++;
+    }
+  }
+
+  for (x = 0; x < lineslen; x++) {
     /* if it's an instruction to list files, do it, and move to next line */
-    if (strcasecmp(linebuff, "%FILES%") == 0) {
-      outputdircontent(sock, config, localfile, directorytolist, 0);
+    if (strcasecmp(lines[x].text, "%FILES%") == 0) {
+      outputdircontent(sock, config, localfile, directorytolist, 0, 0);
       continue;
-    } else if (strcasecmp(linebuff, "%DIRS%") == 0) {
-      outputdircontent(sock, config, localfile, directorytolist, 1);
+    } else if (strcasecmp(lines[x].text, "%DIRS%") == 0) {
+      outputdircontent(sock, config, localfile, directorytolist, 1, 0);
       continue;
     }
     /* explode the gophermap line into separate items */
-    if (explodegophermapline(linebuff, &itemtype, itemdesc, itemselector, itemserver, &itemport) != 0) {
+    if (explodegophermapline(lines[x].text, &itemtype, itemdesc, itemselector, itemserver, &itemport) != 0) {
       sendline(sock, "3Parsing error\tfake\tfake\t0");
       continue;
     }
-    /* if a sub-gophermap script is provided (and feature is enabled), run it now */
+    /* if a sub-gophermap script is provided (and feature is enabled), wait
+     * for its output and send it now */
     if (itemtype == '=') {
-      if (config->subgophermaps != 0) {
-        char *realscriptname;
-        realscriptname = realpath(itemdesc, NULL);
-        if (realscriptname == NULL) {
-          syslog(LOG_WARNING, "WARNING: Failed to resolve the path to '%s'", itemdesc);
-        } else {
-          if ((config->phpsupport != 0) && (strcmp(getfileextension(itemdesc), "php") == 0)) {
-            execCgi(sock, realscriptname, NULL, config, pVer, directorytolist, remoteclientaddr, "php", 1);
-          } else if (config->cgisupport != 0) {
-            execCgi(sock, realscriptname, NULL, config, pVer, directorytolist, remoteclientaddr, NULL, 1);
-          }
-        }
-        free(realscriptname);
+      if (lines[x].subgmap >= 0) {
+        subgmap_pump(subgmaps, subgmapscount, lines[x].subgmap, config);
+        subgmap_flush(sock, &(subgmaps[lines[x].subgmap]), urldir, config);
       }
       continue;
     }
     /* prepare the final line */
-    buildgophermapline(linebuff, sizeof(linebuff), itemtype, itemdesc, itemselector, itemserver, itemport, directorytolist, config);
+    charset_strfromutf8(config->outputcharset, itemdesc);
+    buildgophermapline(linebuff, sizeof(linebuff), itemtype, itemdesc, itemselector, itemserver, itemport, directorytolist, config->gopherhostname, config->gopherport);
     /* send the final line */
     sendline(sock, linebuff);
   }
-  fclose(gophermapfd);
+
+  /* clean up (scripts that are still running at this point are killed) */
+  for (x = 0; x < subgmapscount; x++) {
+    if (subgmaps[x].state == SUBGMAP_RUNNING) subgmap_finish(&(subgmaps[x]), SUBGMAP_TIMEOUT, "sub-gophermap time", config);
+    free(subgmaps[x].output);
+  }
+  free(subgmaps);
+  free(lines);
+}
+
+
+/* returns the page of a directory listing requested through a 'page=N' URL
+ * query, or 1 if no valid page is requested */
+static long getlistingpage(char **srvsideparams) {
+  long page;
+  if ((srvsideparams == NULL) || (srvsideparams[0] == NULL)) return(1);
+  if (strncmp(srvsideparams[0], "page=", 5) != 0) return(1);
+  page = atol(srvsideparams[0] + 5);
+  if (page < 1) return(1);
+  return(page);
 }
 
 
-static void outputdir(int sock, const struct MotsognirConfig *config, char *localfile, char *directorytolist, const char *remoteclientaddr, char **srvsideparams) {
-  char gophermapfile[5120];
+static void outputdir(int sock, const struct MotsognirConfig *config, char *localfile, char *directorytolist, const char *remoteclientaddr, char **srvsideparams, struct arena_t *arena) {
+  char *gophermapfile;
+  size_t gophermapfile_len;
   syslog(LOG_INFO, "The resource is a directory");
   if (lastcharofstring(localfile) != '/') strcat(localfile, "/");
   if (lastcharofstring(directorytolist) != '/') strcat(directorytolist, "/");
+  gophermapfile_len = strlen(localfile) + sizeof("gophermap.cgi");
+  gophermapfile = arena_alloc(arena, gophermapfile_len);
+  if (gophermapfile == NULL) {
+    syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+    return;
+  }
 
   /* look around for a gophermap */
   for (;;) {
     /* do we have a static gophermap? */
-    snprintf(gophermapfile, sizeof(gophermapfile), "%sgophermap", localfile);
+    snprintf(gophermapfile, gophermapfile_len, "%sgophermap", localfile);
     if (fexist(gophermapfile) != 0) {
-      outputgophermap(sock, config, localfile, gophermapfile, directorytolist, remoteclientaddr, srvsideparams);
+      outputgophermap(sock, config, localfile, gophermapfile, directorytolist, remoteclientaddr, srvsideparams, arena);
       break;
     }
     /* do we have a cgi gophermap? */
     if (config->cgisupport != 0) {
-      snprintf(gophermapfile, sizeof(gophermapfile), "%sgophermap.cgi", localfile);
+      snprintf(gophermapfile, gophermapfile_len, "%sgophermap.cgi", localfile);
       if (fexist(gophermapfile) != 0) {
-        execCgi(sock, gophermapfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, NULL, 1);
+        execCgi(sock, gophermapfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, NULL, 1, 0, arena);
         break;
       }
     }
     /* do we have a PHP gophermap? */
     if (config->phpsupport != 0) {
-      snprintf(gophermapfile, sizeof(gophermapfile), "%sgophermap.php", localfile);
+      snprintf(gophermapfile, gophermapfile_len, "%sgophermap.php", localfile);
       if (fexist(gophermapfile) != 0) {
-        execCgi(sock, gophermapfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, "php", 1);
+        execCgi(sock, gophermapfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, "php", 1, 0, arena);
         break;
       }
     }
     /* is there a default gophermap we could use? */
     if (config->defaultgophermap != NULL) {  /* else use the default gophermap, if any is configured */
-      outputgophermap(sock, config, localfile, config->defaultgophermap, directorytolist, remoteclientaddr, srvsideparams);
+      outputgophermap(sock, config, localfile, config->defaultgophermap, directorytolist, remoteclientaddr, srvsideparams, arena);
       break;
     }
     /* no gophermap found, simply list files & directories */
     syslog(LOG_INFO, "No gophermap found. Listing directory content");
-    outputdircontent(sock, config, localfile, directorytolist, 0);
+    outputdircontent(sock, config, localfile, directorytolist, 0, getlistingpage(srvsideparams));
     break;
   }
 
@@ -1295,29 +2238,73 @@ static void outputdir(int sock, const struct MotsognirConfig *config, char *loca
 }
 
 
-/* Waits for a connection, forks when a client connection arrives, and
- * returns the forked socket. Fills clientipaddrstr and serveripaddrstr with
- * IP addresses (src and dst) */
-static int waitforconn(int gopherport, char *clientipaddrstr, int clientipaddrstr_maxlen, char *serveripaddrstr, int serveripaddrstr_maxlen, struct MotsognirConfig *config) {
-  int sockmaster, sockslave;
+/* creates the local (unix) socket that serves the server status. returns
+ * the socket, or -1 on error */
+static int openstatussocket(const char *path) {
+  struct sockaddr_un addr;
+  int sock;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    syslog(LOG_WARNING, "FATAL ERROR: the StatusSocket path is too long");
+    return(-1);
+  }
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    syslog(LOG_WARNING, "FATAL ERROR: status socket could not be open (%s)", strerror(errno));
+    return(-1);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path); /* a socket left by a previous instance */
+  if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (chmod(path, 0660) != 0) || (listen(sock, 10) != 0)) {
+    syslog(LOG_WARNING, "FATAL ERROR: failed to set up the status socket at '%s' (%s)", path, strerror(errno));
+    close(sock);
+    return(-1);
+  }
+  return(sock);
+}
+
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  /* some systems do not have it, and rely on SO_NOSIGPIPE */
+#endif
+
+/* answers a connection on the status socket with key=value pairs. this is
+ * done by the process that accepts gopher connections, so it must never
+ * block: the report is small enough to fit in the socket buffer, and is
+ * sent without waiting */
+static void servestatussocket(int statussock, const struct MotsognirConfig *config) {
+  char *buff;
+  int sock, len;
+  sock = accept(statussock, NULL, NULL);
+  if (sock < 0) return;
+  buff = statusreport(config, SCOREBOARD_KEYVALUE, "\n", &len);
+  if ((buff != NULL) && (send(sock, buff, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len)) syslog(LOG_WARNING, "WARNING: failed to send the status through the status socket");
+  free(buff);
+  close(sock);
+}
+
+
+/* opens a listening socket on port, as configured (bind address, IPv6).
+ * returns the socket, or -1 on error */
+static int openlistener(int port, const struct MotsognirConfig *config) {
+  int sock;
   int one = 1;  /* this is used by setsockopt() calls on the socket later */
-  socklen_t clilen;
-  struct sockaddr_in6 serv_addr6, cli_addr6; /* for IPv6 and dual sockets */
-  struct sockaddr_in serv_addr, cli_addr;    /* for old IPv4 sockets */
-  pid_t mypid;
+  struct sockaddr_in6 serv_addr6; /* for IPv6 and dual sockets */
+  struct sockaddr_in serv_addr;   /* for old IPv4 sockets */
 
   if (config->disableipv6 == 0) {
-    sockmaster = socket(AF_INET6, SOCK_STREAM, 0);
+    sock = socket(AF_INET6, SOCK_STREAM, 0);
   } else {
-    sockmaster = socket(AF_INET, SOCK_STREAM, 0);
+    sock = socket(AF_INET, SOCK_STREAM, 0);
   }
-  if (sockmaster < 0) {
+  if (sock < 0) {
     syslog(LOG_WARNING, "FATAL ERROR: socket could not be open (%s)", strerror(errno));
-    return(-2);
+    return(-1);
   }
 
   /* I set the socket to be reusable, to avoid having to wait for a longish time when the server is restarted */
-  if (setsockopt(sockmaster, SOL_SOCKET, SO_REUSEADDR, (char *)&one, sizeof(one)) < 0) syslog(LOG_WARNING, "WARNING: failed to set REUSEADDR on main socket");
+  if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&one, sizeof(one)) < 0) syslog(LOG_WARNING, "WARNING: failed to set REUSEADDR on main socket");
 
   /* Initialize socket structure (for both IPv4 and IPv6 variants) */
   memset(&serv_addr, 0, sizeof(serv_addr));
@@ -1330,40 +2317,92 @@ static int waitforconn(int gopherport, char *clientipaddrstr, int clientipaddrst
   } else if (config->disableipv6 != 0) { /* bind on user-specified address - v4 only */
     if (inet_pton(AF_INET, config->bind, &(serv_addr.sin_addr)) != 1) {
       syslog(LOG_WARNING, "FATAL ERROR: failed to parse the IPv4 address bind value. Please check your 'bind' configuration.");
-      return(-2);
+      close(sock);
+      return(-1);
     }
   } else {    /* bind on a user-specfied address only - v6 and dual stack socks */
     if (inet_pton(AF_INET6, config->bind, &(serv_addr6.sin6_addr)) != 1) {
       syslog(LOG_WARNING, "FATAL ERROR: failed to parse the IP address bind value. Please check your 'bind' configuration.");
-      return(-2);
+      close(sock);
+      return(-1);
     }
   }
-  serv_addr.sin_port = htons(gopherport);
-  serv_addr6.sin6_port = htons(gopherport);
+  serv_addr.sin_port = htons(port);
+  serv_addr6.sin6_port = htons(port);
 
   /* Explicitely mark the socket as NOT being IPV6-only. This is needed on systems that have a system-wide sysctl net.inet6.ip6.v6only=1 (by default every *nix besides Linux...) */
   #ifdef IPV6_BINDV6ONLY  /* check if the BINDV6ONLY option exists at all */
   if (config->disableipv6 == 0) {
     int zero = 0;
-    setsockopt(sockmaster, IPPROTO_IPV6, IPV6_BINDV6ONLY, (char *)&zero, (socklen_t)sizeof(zero));
+    setsockopt(sock, IPPROTO_IPV6, IPV6_BINDV6ONLY, (char *)&zero, (socklen_t)sizeof(zero));
   }
   #endif
 
   /* Now bind the host address using a bind() call */
   if (config->disableipv6 == 0) {
-    if (bind(sockmaster, (struct sockaddr *) &serv_addr6, sizeof(serv_addr6)) < 0) {
+    if (bind(sock, (struct sockaddr *) &serv_addr6, sizeof(serv_addr6)) < 0) {
       syslog(LOG_WARNING, "FATAL ERROR: binding failed (%s)", strerror(errno));
-      return(-2);
+      close(sock);
+      return(-1);
     }
   } else {
-    if (bind(sockmaster, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+    if (bind(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
       syslog(LOG_WARNING, "FATAL ERROR: binding failed (%s)", strerror(errno));
-      return(-2);
+      close(sock);
+      return(-1);
     }
   }
 
   /* Start listening for clients */
-  listen(sockmaster, 10);
+  listen(sock, 10);
+  return(sock);
+}
+
+
+/* closes the listening sockets */
+static void closelisteners(int *socks, int sockscount, int socktls) {
+  int x;
+  for (x = 0; x < sockscount; x++) close(socks[x]);
+  if (socktls >= 0) close(socktls);
+}
+
+
+/* Waits for a connection, forks when a client connection arrives, and
+ * returns the forked socket. Fills clientipaddrstr and serveripaddrstr with
+ * IP addresses (src and dst), and accepted with the CLOCK_MONOTONIC time the
+ * connection was accepted */
+static int waitforconn(int gopherport, char *clientipaddrstr, int clientipaddrstr_maxlen, char *serveripaddrstr, int serveripaddrstr_maxlen, struct timespec *accepted, struct MotsognirConfig *config) {
+  int socks[VHOSTS_MAX + 1], sockscount = 0, sockslave, socktls = -1, sockready = -1;
+  int x, y, first = 0, localport = 0;
+  struct pollfd pfd[VHOSTS_MAX + 3];
+  socklen_t clilen;
+  struct sockaddr_in6 serv_addr6, cli_addr6; /* for IPv6 and dual sockets */
+  struct sockaddr_in serv_addr, cli_addr;    /* for old IPv4 sockets */
+  pid_t mypid;
+  int statussock = -1;
+
+  /* one listener per port: the main one, and the ones of vhosts */
+  socks[sockscount++] = openlistener(gopherport, config);
+  if (socks[0] < 0) return(-2);
+  for (x = 0; x < config->vhostscount; x++) {
+    for (y = 0; (y < x) && (config->vhosts[y].port != config->vhosts[x].port); y++);
+    if ((y < x) || (config->vhosts[x].port == gopherport)) continue; /* already listening there */
+    socks[sockscount] = openlistener(config->vhosts[x].port, config);
+    if (socks[sockscount] < 0) return(-2);
+    sockscount++;
+  }
+
+  /* the TLS listener, if any, is set up the same way */
+  if (config->tls != NULL) {
+    socktls = openlistener(config->tlsport, config);
+    if (socktls < 0) return(-2);
+  }
+
+  /* the status socket is set up now, before any chroot() or privileges drop */
+  if (config->statussocket != NULL) {
+    statussock = openstatussocket(config->statussocket);
+    if (statussock < 0) return(-2);
+  }
 
   /* Ignore SIGCHLD - this way I don't have to worry about my children becoming little zombies */
   signal(SIGCHLD, SIG_IGN);
@@ -1371,17 +2410,17 @@ static int waitforconn(int gopherport, char *clientipaddrstr, int clientipaddrst
   /* I don't want to get notified about SIGHUP */
   signal(SIGHUP, SIG_IGN);
 
-  syslog(LOG_INFO, "motsognir v" pVer " process started");
+  syslog(LOG_NOTICE, "motsognir v" pVer " process started");
 
   /* fork off */
   mypid = fork();
   if (mypid == 0) { /* I'm the child, do nothing */
     /* nothing to do - just continue */
   } else if (mypid > 0) { /* I'm the parent - quit now */
-    close(sockmaster);
+    closelisteners(socks, sockscount, socktls);
     return(-1);
   } else {  /* error condition */
-    close(sockmaster);
+    closelisteners(socks, sockscount, socktls);
     syslog(LOG_WARNING, "Failed to dameonize the motsognir process (%s)", strerror(errno));
     return(-2);
   }
@@ -1426,25 +2465,60 @@ static int waitforconn(int gopherport, char *clientipaddrstr, int clientipaddrst
   }
 
   for (;;) {
+    /* the access and slow logs are written out by this process, in batches:
+     * wake up at least every second to do so, even if no connection comes.
+     * the status socket is served by this process as well, and so are the
+     * TLS listener and the listeners of vhosts */
+    sockready = socks[0];
+    if ((config->accesslog != NULL) || (config->slowlog != NULL) || (statussock >= 0) || (socktls >= 0) || (sockscount > 1)) {
+      int pollres;
+      for (x = 0; x < sockscount; x++) pfd[x].fd = socks[x];
+      pfd[sockscount].fd = socktls;      /* poll() ignores negative descriptors */
+      pfd[sockscount + 1].fd = statussock;
+      for (x = 0; x < sockscount + 2; x++) {
+        pfd[x].events = POLLIN;
+        pfd[x].revents = 0;
+      }
+      pollres = poll(pfd, sockscount + 2, ((config->accesslog != NULL) || (config->slowlog != NULL)) ? 1000 : -1);
+      accesslog_flush(config->accesslog);
+      accesslog_flush(config->slowlog);
+      if (pfd[sockscount + 1].revents & POLLIN) servestatussocket(statussock, config);
+      if (pollres <= 0) continue;
+      /* pick a ready listener, starting after the last one served, so a busy
+       * port cannot starve the others */
+      sockready = -1;
+      for (x = 0; x <= sockscount; x++) {
+        y = (first + x) % (sockscount + 1);
+        if (pfd[y].revents & POLLIN) {
+          sockready = pfd[y].fd;
+          first = y + 1;
+          break;
+        }
+      }
+      if (sockready < 0) continue;
+    }
     /* Accept actual connection from the client - here process will go to sleep mode, waiting for incoming connections */
     if (config->disableipv6 == 0) {
       clilen = sizeof(cli_addr6);
-      sockslave = accept(sockmaster, (struct sockaddr *)&cli_addr6, &clilen);
+      sockslave = accept(sockready, (struct sockaddr *)&cli_addr6, &clilen);
     } else {
       clilen = sizeof(cli_addr);
-      sockslave = accept(sockmaster, (struct sockaddr *)&cli_addr, &clilen);
+      sockslave = accept(sockready, (struct sockaddr *)&cli_addr, &clilen);
     }
     if (sockslave < 0) {
       syslog(LOG_WARNING, "FATAL ERROR: accepting connection failed (%s)", strerror(errno));
-      close(sockmaster);
+      closelisteners(socks, sockscount, socktls);
       return(-2);
     }
+    /* latencies are measured from here, before fork() and TLS handshakes */
+    clock_gettime(CLOCK_MONOTONIC, accepted);
 
     /* fork out, close the master socket and return the client socket */
     mypid = fork();
     if (mypid == 0) { /* I'm the child */
       static char logprefix[128];
-      close(sockmaster);
+      closelisteners(socks, sockscount, socktls);
+      if (statussock >= 0) close(statussock);
       /* read client's IP address */
       if (config->disableipv6 == 0) {
         if (inet_ntop(cli_addr6.sin6_family, &cli_addr6.sin6_addr, clientipaddrstr, clientipaddrstr_maxlen) == NULL) {
@@ -1463,12 +2537,16 @@ static int waitforconn(int gopherport, char *clientipaddrstr, int clientipaddrst
         if ((getsockname(sockslave, (struct sockaddr *) &serv_addr6, &clilen) < 0) || (inet_ntop(serv_addr6.sin6_family, &serv_addr6.sin6_addr, serveripaddrstr, serveripaddrstr_maxlen) == NULL)) {
           syslog(LOG_WARNING, "Failed to fetch server's IP address: %s", strerror(errno));
           snprintf(serveripaddrstr, serveripaddrstr_maxlen, "UNKNOWN");
+        } else {
+          localport = ntohs(serv_addr6.sin6_port);
         }
       } else {
         clilen = sizeof(serv_addr);
         if ((getsockname(sockslave, (struct sockaddr *) &serv_addr, &clilen) < 0) || (inet_ntop(serv_addr.sin_family, &serv_addr.sin_addr, serveripaddrstr, serveripaddrstr_maxlen) == NULL)) {
           syslog(LOG_WARNING, "Failed to fetch server's IPv4 address: %s", strerror(errno));
           snprintf(serveripaddrstr, serveripaddrstr_maxlen, "UNKNOWN");
+        } else {
+          localport = ntohs(serv_addr.sin_port);
         }
       }
       /* convert IPv4 "IPV6MAPPED" addresses to "normal" IPv4 strings, if needed */
@@ -1478,10 +2556,19 @@ static int waitforconn(int gopherport, char *clientipaddrstr, int clientipaddrst
       snprintf(logprefix, sizeof(logprefix), "motsognir [%s]", clientipaddrstr);
       openlog(logprefix, LOG_PID, LOG_DAEMON); /* set up the logging to log with PID and peer's IP address */
       syslog(LOG_INFO, "new connection to %s", serveripaddrstr);
+      /* serve the vhost the connection was made to, if any (the TLS listener
+       * mirrors the main port) */
+      selectvhost(config, serveripaddrstr, (sockready == socktls) ? config->gopherport : localport);
       /* if no gopher hostname was set, use the server's address */
       if (config->gopherhostname == NULL) config->gopherhostname = strdup(serveripaddrstr);
       /* Restore the default SIGCHLD handler - we need this because we might call CGI scripts via popen() later, and need to know their exit status */
       signal(SIGCHLD, SIG_DFL);
+      /* connections accepted on the TLS listener are served through the
+       * TLS session, and the menus sent over it point to the TLS port */
+      if (sockready == socktls) {
+        sockslave = tls_accept(config->tls, sockslave);
+        config->gopherport = config->tlsport;
+      }
       return(sockslave);
     } else if (mypid > 0) { /* I'm the parent */
       /* just close child's socket to avoid messing with it */
@@ -1489,7 +2576,7 @@ static int waitforconn(int gopherport, char *clientipaddrstr, int clientipaddrst
     } else { /* error condition */
       syslog(LOG_WARNING, "FATAL ERROR: fork() failed!");
       close(sockslave);
-      close(sockmaster);
+      closelisteners(socks, sockscount, socktls);
       return(-2);
     }
   }
@@ -1497,71 +2584,167 @@ static int waitforconn(int gopherport, char *clientipaddrstr, int clientipaddrst
 
 
 /* sends the content of a txt file to a socket, and escapes '.' lines, if present */
-static void sendtxtfiletosock(int sock, const char *filename) {
-  FILE *fd;
-  char *linebuff;
-  int linebuff_len = 1024 * 1024;
-  /* allocate a big buffer to read file's lines (1M) */
-  linebuff = malloc(linebuff_len);
-  if (linebuff == NULL) {
-    syslog(LOG_WARNING, "ERROR: Out of memory while trying to allocate buffer for file");
-    return;
-  }
-  fd = fopen(filename, "rb");
-  if (fd == NULL) { /* file could not be opened */
+static void sendtxtfiletosock(int sock, const char *filename, int charset) {
+  int fd;
+  long sent;
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) { /* file could not be opened */
     syslog(LOG_WARNING, "ERROR: File '%s' could not be opened", filename);
-    free(linebuff);
+    accesslog_setstatus("error");
     return;
   }
-  for (;;) {
-    if (sockreadline(fileno(fd), linebuff, linebuff_len - 1, NULL) < 0) break;
-    if ((linebuff[0] == '.') && (linebuff[1] == 0)) snprintf(linebuff, linebuff_len, ". "); /* if the line is a single dot, escape it */
-    sendline(sock, linebuff);
+  sent = txtstream_sendcharset(sock, fd, charset);
+  if (sent < 0) accesslog_setstatus("aborted");
+  close(fd);
+}
+
+
+/* sends len bytes of a file, starting at offset. returns 0 on success */
+static int sendfilerange(int sock, int fd, off_t offset, off_t len) {
+#ifdef __linux__
+  /* let the kernel move data from the page cache to the socket */
+  while (len > 0) {
+    ssize_t res = sendfile(sock, fd, &offset, (len > 0x40000000) ? 0x40000000 : len);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      if ((errno == EINVAL) || (errno == ENOSYS)) break; /* not supported for this file, use pread() */
+      return(-1);
+    }
+    if (res == 0) return(-1); /* file shrunk in the meantime */
+    accesslog_addbytes(res);
+    len -= res;
   }
-  fclose(fd);
-  free(linebuff);
+  if (len == 0) return(0);
+#endif
+  {
+    unsigned char *buff;
+    off_t buff_len = iobuf_size();
+    buff = iobuf_get();
+    if (buff == NULL) {
+      syslog(LOG_WARNING, "ERROR: Out of memory while trying to allocate buffer for file");
+      return(-1);
+    }
+    while (len > 0) {
+      ssize_t bytesread, pos, res;
+      bytesread = pread(fd, buff, (len > buff_len) ? buff_len : len, offset);
+      if (bytesread < 0) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      if (bytesread == 0) break; /* file shrunk in the meantime */
+      for (pos = 0; pos < bytesread; pos += res) {
+        res = send(sock, buff + pos, bytesread - pos, 0);
+        if (res < 0) {
+          if (errno == EINTR) {
+            res = 0;
+            continue;
+          }
+          iobuf_put(buff);
+          return(-1);
+        }
+        accesslog_addbytes(res);
+      }
+      offset += bytesread;
+      len -= bytesread;
+    }
+    iobuf_put(buff);
+  }
+  return((len == 0) ? 0 : -1);
 }
 
 
-static void sendbinfiletosock(int sock, const char *filename) {
-  FILE *fd;
-  unsigned char *buff;
-  size_t bytesread;
-  int buff_len = 1024 * 1024;  /* allocate a big buffer to read file's content (1M) */
-  buff = malloc(buff_len);
-  if (buff == NULL) {
-    syslog(LOG_WARNING, "ERROR: Out of memory while trying to allocate buffer for file");
-    return;
+/* parses a decimal file offset, and moves *s past it. returns -1 on overflow */
+static int parseoffset(const char **s, off_t *v) {
+  const off_t offmax = (((off_t)1 << (sizeof(off_t) * 8 - 2)) - 1) * 2 + 1;
+  int d;
+  for (*v = 0; (**s >= '0') && (**s <= '9'); (*s)++) {
+    d = **s - '0';
+    if (*v > (offmax - d) / 10) return(-1);
+    *v = *v * 10 + d;
   }
-  fd = fopen(filename, "rb");
-  if (fd == NULL) { /* file could not be opened */
+  return(0);
+}
+
+
+/* Parses a 'range=OFFSET-END' server-side parameter (END being the offset of
+ * the last byte to send, or the end of the file if omitted). Returns 0 if
+ * there is no range, 1 if a range was found, and -1 if it is malformed. */
+static int getrange(char **srvsideparams, off_t *first, off_t *last) {
+  const char *s = NULL;
+  int x;
+  /* the range may come as an URL query or as a search (tab) parameter */
+  for (x = 0; x < 2; x++) {
+    if ((srvsideparams == NULL) || (srvsideparams[x] == NULL)) continue;
+    if (strncmp(srvsideparams[x], "range=", 6) == 0) s = srvsideparams[x] + 6;
+  }
+  if (s == NULL) return(0);
+  if ((*s < '0') || (*s > '9') || (parseoffset(&s, first) != 0)) return(-1);
+  if (*s++ != '-') return(-1);
+  *last = -1;
+  if (*s == 0) return(1);
+  if (parseoffset(&s, last) != 0) return(-1);
+  if ((*s != 0) || (*last < *first)) return(-1);
+  return(1);
+}
+
+
+/* Sends a binary file, or only a range of it if the request asks for one
+ * (and RangeRequests is enabled) */
+static void sendbinfiletosock(int sock, const char *filename, const struct MotsognirConfig *config, char **srvsideparams) {
+  struct stat st;
+  off_t first = 0, last = -1;
+  int fd, range = 0;
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) { /* file could not be opened */
     syslog(LOG_WARNING, "ERROR: File '%s' could not be opened", filename);
-    free(buff);
+    accesslog_setstatus("error");
     return;
   }
-  for (;;) {
-    bytesread = fread(buff, 1, buff_len, fd);
-    if (bytesread <= 0) break; /* end of file (I guess) */
-    send(sock, buff, bytesread, 0);
+  if (fstat(fd, &st) != 0) {
+    syslog(LOG_WARNING, "ERROR: fstat() failed on '%s' (%s)", filename, strerror(errno));
+    accesslog_setstatus("error");
+    close(fd);
+    return;
   }
-  free(buff);
-  fclose(fd);
+  if (config->rangerequests != 0) range = getrange(srvsideparams, &first, &last);
+  if (range != 0) {
+    if ((last < 0) || (last >= st.st_size)) last = st.st_size - 1;
+    if ((range < 0) || (first >= st.st_size)) {
+      syslog(LOG_INFO, "Invalid range requested for '%s' (file size: %ld)", filename, (long)st.st_size);
+      sendline(sock, "3Invalid range\tfake\tfake\t0");
+      sendline(sock, ".");
+      accesslog_settype('3');
+      accesslog_setstatus("badrange");
+      close(fd);
+      return;
+    }
+    syslog(LOG_INFO, "Sending range %ld-%ld of '%s'", (long)first, (long)last, filename);
+    accesslog_setstatus("partial");
+  } else {
+    last = st.st_size - 1;
+  }
+  if (sendfilerange(sock, fd, first, last - first + 1) != 0) {
+    syslog(LOG_INFO, "Transfer of '%s' interrupted", filename);
+    accesslog_setstatus("aborted");
+  }
+  close(fd);
 }
 
 
-/* Looks at a requests to detect whether it might be HTTP. Returns 0 if no HTTP detected, non-zero otherwise. */
-static int requestlookslikehttp(const char *req) {
-  if ((req[0] == 'G') && (req[1] == 'E') && (req[2] == 'T') && (req[3] == ' ') && (req[4] == '/')) { /* starts by 'GET /'... */
-    if (strstr(req, " HTTP/") != NULL) return(1); /* contains ' HTTP/' -> it is a HTTP request */
-  }
-  return(0);
+/* returns non-zero if a request starts like a HTTP request line: a method
+ * ('GET', 'POST', ...) followed by a space */
+static int requeststartslikehttp(const char *req) {
+  int i;
+  for (i = 0; (req[i] >= 'A') && (req[i] <= 'Z'); i++);
+  return((i > 0) && (i <= 15) && (req[i] == ' '));
 }
 
 
-/* Looks at a requests to detect whether it is a gopher+ requets for the root directory.
- * Returns 0 if not, non-zero otherwise. */
-static int requestlookslikegopherplus(const char *req) {
-  if ((req[0] == '\t') && (req[1] == '$') && (req[2] == 0)) return(1);
+/* Looks at a requests to detect whether it might be HTTP. Returns 0 if no HTTP detected, non-zero otherwise. */
+static int requestlookslikehttp(const char *req) {
+  /* starts by a method ('GET', 'POST', ...) followed by a space... */
+  if (requeststartslikehttp(req) == 0) return(0);
+  if (strstr(req, " HTTP/") != NULL) return(1); /* ...and contains ' HTTP/' -> it is a HTTP request */
   return(0);
 }
 
@@ -1583,38 +2766,6 @@ static int checkforevasion(const char *gopherroot, char **pubdirlist, const char
 }
 
 
-/* performs various security checks on a gopher request. Returns NULL if all is ok, or a pointer to an error string otherwise. */
-static char *gophersecuritycheck(const char *GophRequest) {
-  int x;
-  if (strlen(GophRequest) > 512) return("The gopher request is longer than 512 bytes. RFC 1436 states that the selector shouldn't be longer than 256 bytes.");
-  if (strstr(GophRequest, "\t\t") != NULL) return("Client's request contains two TAB characters, one after the other. It shouldn't ever happen.");
-  if (lastcharofstring(GophRequest) == '\t') return("Client's request ends by a TAB character. There's no situation where that should happen.");
-  /* check that the request contains valid text (possibly encoded as UTF-8) */
-  for (x = 0; GophRequest[x] != 0; x++) {
-    /* look for control chars */
-    if ((GophRequest[x] > 0) && (GophRequest[x] < 32)) return("A control char (ASCII 1..31) has been found in the request. There's no reason for such char to be present there.");
-    /* is it a low-ASCII char? */
-    if ((GophRequest[x] & bx10000000) == 0) continue;
-    /* it must be an UTF-8 sequence (or some invalid stuff) - check how many chars would be expected */
-    if ((GophRequest[x] & bx11100000) == bx11000000) { /* two bytes sequence */
-      if ((GophRequest[x+1] & bx11000000) == bx10000000) {
-        x += 1;
-        continue;
-      }
-    } else if ((GophRequest[x] & bx11110000) == bx11100000) { /* three bytes sequence */
-      if (((GophRequest[x+1] & bx11000000) == bx10000000) && ((GophRequest[x+2] & bx11000000) == bx10000000)) {
-        x += 2;
-        continue;
-      }
-    }
-    /* if I'm here, it means that the UTF-8 sequence was unrecognized */
-    return("Detected an invalid UTF-8 sequence.");
-  }
-  /* Alles klar, proceed! */
-  return(NULL);
-}
-
-
 /* checks whether the given element is a directory. Returns 0 if not, non-zero otherwise. */
 static int is_it_a_directory(const char *localfile) {
   DIR* dir;
@@ -1665,15 +2816,14 @@ static int islocalfileagophermap(const char *file) {
 
 
 /* extracts the directory part from a full file/path string, and switch to given path */
-static int changedir(const char *s) {
+static int changedir(struct arena_t *arena, const char *s) {
   int res = 0;
   char *curdir;
-  curdir = getdirpart(s);
+  curdir = getdirpart(arena, s);
   if ((curdir == NULL) || (chdir(curdir) == -1)) {
     syslog(LOG_WARNING, "WARNING: failed to switch current directory to %s (%s), original resource: %s", curdir, strerror(errno), s);
     res = -1;
   }
-  free(curdir);
   return(res);
 }
 
@@ -1685,233 +2835,922 @@ static void drainsock(int sock) {
 }
 
 
-int main(int argc, char **argv) {
-  char *securitycheckresult;
-  char directorytolist[4096];
-  char localfile[4096];
-  char rootdir[4096];
-  char remoteclientaddr[64];
-  char localserveraddr[64];
-  char **srvsideparams;
-  char gophertype;
-  char *configfile = CONFIGFILE;
-  int sock;
-  struct MotsognirConfig config;
-  time_t StartTime;
+#define GOPHERPLUS_MAXMENU (16 * 1024 * 1024)  /* max size of the menus described by Gopher+ directory attributes */
+
+/* passes the lines of Gopher+ attribute blocks to a sendbuff */
+static void gopherplusemit(void *ctx, const char *line) {
+  sendbuff_line((struct sendbuff *)ctx, line);
+}
+
+
+
+/* fills the attributes of the local resource whose (decoded) selector is
+ * path, straight from the file system. abstract must be at least
+ * GOPHERPLUS_MAXABSTRACT + 1 bytes long. returns -1 if the resource is not
+ * available */
+static int gopherplusstat(const struct MotsognirConfig *config, const char *path, struct gopherplus_item *item, char *abstract) {
+  char localfile[4096], rootdir[4096];
+  struct stat st;
+  char *name;
+  int len;
+  if (gophersecuritycheck(path) != NULL) return(-1);
+  BuildLocalFileAndRootDir(localfile, sizeof(localfile), rootdir, sizeof(rootdir), config, path);
+  RemoveDoubleChar(localfile, '/');
+  if ((checkforevasion(rootdir, config->pubdirlist, localfile) != 0) || (stat(localfile, &st) != 0)) return(-1);
+  item->hasattrs = 1;
+  item->isdir = S_ISDIR(st.st_mode);
+  item->type = (item->isdir != 0) ? '1' : DetectGopherTypeSniff(localfile, config, 0);
+  item->size = st.st_size;
+  item->mtime = st.st_mtime;
+  item->abstract = NULL;
+  /* the abstract is in the '.abstract' directory of the parent directory */
+  len = strlen(localfile);
+  while ((len > 1) && (localfile[len - 1] == '/')) localfile[--len] = 0;
+  name = strrchr(localfile, '/');
+  if ((name != NULL) && (name != localfile)) {
+    *name++ = 0;
+    if (gopherplus_readabstract(localfile, name, abstract, GOPHERPLUS_MAXABSTRACT + 1) >= 0) item->abstract = abstract;
+  }
+  return(0);
+}
+
+
+/* answers a Gopher+ item attributes request ('!') */
+static void outputgopherplusitem(int sock, const struct MotsognirConfig *config, const char *directorytolist, const char *attrs) {
+  struct gopherplus_item item;
+  struct sendbuff sb;
+  char name[1024], selector[4096], abstract[GOPHERPLUS_MAXABSTRACT + 1];
+  const char *p;
+  int len;
 
-  if (argc > 1) {
-    int x;
-    for (x = 1; x < argc; x++) {
-      if (strcmp(argv[x], "--config") == 0) {
-        x++;
-        if (x < argc) configfile = argv[x];
-      } else { /* unknown command line */
-        about(pVer, pDate, HOMEPAGE);
-        return(1);
-      }
-    }
+  memset(&item, 0, sizeof(item));
+  if (gopherplusstat(config, directorytolist, &item, abstract) != 0) {
+    accesslog_setstatus("notfound");
+    sendgopherpluserror(sock, config, "The selected resource doesn't exist!");
+    return;
   }
+  /* the name of the item is the last component of its path */
+  len = strlen(directorytolist);
+  while ((len > 1) && (directorytolist[len - 1] == '/')) len--;
+  for (p = directorytolist + len; (p > directorytolist) && (p[-1] != '/'); p--);
+  snprintf(name, sizeof(name), "%.*s", (int)(directorytolist + len - p), p);
+  if (name[0] == 0) snprintf(name, sizeof(name), "%s", config->gopherhostname); /* the root */
+  percencode(directorytolist, selector, sizeof(selector));
+  item.name = name;
+  item.selector = selector;
+  item.host = config->gopherhostname;
+  item.port = config->gopherport;
+  item.plus = 1;
+
+  sendbuff_init(&sb, sock);
+  sendbuff_line(&sb, "+-1");
+  gopherplus_block(&item, gopherplusadmin(config), attrs, gopherplusemit, &sb);
+  sendbuff_line(&sb, ".");
+  sendbuff_close(&sb);
+}
 
-  /* load motsognir's configuration from file */
-  if (loadconfig(&config, configfile) != 0) {
-    puts("ERROR: A configuration error has been detected. Check the logs for details.");
-    return(9);
-  }
 
-  sock = waitforconn(config.gopherport, remoteclientaddr, sizeof(remoteclientaddr), localserveraddr, sizeof(localserveraddr), &config);
-  if (sock == -1) return(0);
-  if (sock < 0) {
-    puts("ERROR: a fatal error occured. check the logs for details.");
-    return(2);
-  }
+/* answers a Gopher+ directory attributes request ('$'). the menu of the
+ * directory is built as usual, by a child process (it may come from a
+ * gophermap, or from a script), then every item it lists gets its attribute
+ * block. items from the directory itself are found through its index (only
+ * their size and date are looked up), other local items are looked up one by
+ * one */
+static void outputgopherplusdir(int sock, const struct MotsognirConfig *config, char *localfile, char *directorytolist, const char *remoteclientaddr, char **srvsideparams, struct arena_t *arena, const char *attrs) {
+  static struct http_buff menu;
+  struct gopherplus_dir *dir;
+  struct gopherplus_item item;
+  struct selparse_t sel;
+  struct sendbuff sb;
+  char buff[16384], indexfile[4096 + sizeof(DIRINDEX_FILENAME)], abstract[GOPHERPLUS_MAXABSTRACT + 1];
+  char linebuff[2048], desc[1024], selector[1024], host[64], path[1024];
+  char *line, *eol, *name;
+  char type;
+  long n, port, dirlen;
+  int sv[2], overflow = 0;
+  pid_t pid;
 
-  StartTime = time(NULL);
+  if (lastcharofstring(localfile) != '/') strcat(localfile, "/");
+  if (lastcharofstring(directorytolist) != '/') strcat(directorytolist, "/");
 
-  if (sockreadline(sock, directorytolist, sizeof(directorytolist), &StartTime) < 0) {
-    syslog(LOG_WARNING, "Error during selector receiving phase. Connection aborted.");
+  /* build the menu */
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+    syslog(LOG_WARNING, "ERROR: socketpair() failed (%s)", strerror(errno));
+    accesslog_setstatus("error");
+    sendgopherpluserror(sock, config, "Internal error");
+    return;
+  }
+  fcntl(sv[1], F_SETFD, FD_CLOEXEC); /* scripts run to build the menu must not keep it open */
+  pid = fork();
+  if (pid == 0) {
+    close(sv[0]);
     close(sock);
-    return(0);
+    outputdir(sv[1], config, localfile, directorytolist, remoteclientaddr, srvsideparams, arena);
+    _exit(0);
+  }
+  close(sv[1]);
+  if (pid < 0) {
+    syslog(LOG_WARNING, "ERROR: fork() failed (%s)", strerror(errno));
+    close(sv[0]);
+    accesslog_setstatus("error");
+    sendgopherpluserror(sock, config, "Internal error");
+    return;
+  }
+  menu.len = 0;
+  for (;;) {
+    n = read(sv[0], buff, sizeof(buff));
+    if ((n < 0) && (errno == EINTR)) continue;
+    if (n <= 0) break;
+    if (http_append(&menu, buff, n, GOPHERPLUS_MAXMENU) != 0) {
+      kill(pid, SIGKILL);
+      overflow = 1;
+      break;
+    }
   }
-  syslog(LOG_INFO, "Query='%s'", directorytolist);
-  if (directorytolist[0] == 0) {   /* Empty request means "gimme the root listing" */
-    directorytolist[0] = '/';
-    directorytolist[1] = 0;
+  close(sv[0]);
+  waitpid(pid, NULL, 0);
+  if (overflow != 0) {
+    syslog(LOG_WARNING, "ERROR: the menu of '%s' is too large for Gopher+ attributes", localfile);
+    accesslog_setstatus("error");
+    sendgopherpluserror(sock, config, "Internal error");
+    return;
   }
 
-  /* if a plugin is registered, see if it catches this request */
-  if ((config.plugin != NULL) && ((config.pluginfilter == NULL) || (regexec(config.pluginfilter, directorytolist, 0, NULL, 0) == 0))) {
-    long res;
-    char *params[2] = {NULL, NULL};
-    params[0] = directorytolist;
-    if (stringendswith(config.plugin, ".php") != 0) { /* is it a PHP file? */
-      res = execCgi(sock, config.plugin, params, &config, pVer, "", remoteclientaddr, "php", 0);
-    } else {
-      res = execCgi(sock, config.plugin, params, &config, pVer, "", remoteclientaddr, NULL, 0);
-    }
-    /* if the plugin returned anything, then stop here */
-    if (res > 0) {
-      syslog(LOG_INFO, "Query handled by plugin (%s)", config.plugin);
-      drainsock(sock);  /* read whatever request the peer sent us, to drain the socket before closing it (otherwise the tcp stack would trigger a ugly RST) */
-      close(sock);
-      return(0);
+  /* load the attributes of the directory's entries */
+  dir = gopherplus_opendir(localfile, (getdirindexfile(indexfile, sizeof(indexfile), config, directorytolist) == 0) ? indexfile : NULL, config->extmap, config->outputcharset);
+  if (dir == NULL) {
+    syslog(LOG_WARNING, "WARNING: failed to load the attributes of '%s' (%s)", localfile, strerror(errno));
+  } else {
+    syslog(LOG_INFO, "Gopher+ attributes of '%s' loaded from %s", localfile, (gopherplus_isindexed(dir) != 0) ? "its index" : "the directory itself");
+  }
+  dirlen = strlen(directorytolist);
+
+  sendbuff_init(&sb, sock);
+  sendbuff_line(&sb, "+-1");
+  for (line = menu.data; line < menu.data + menu.len; line = eol + 1) {
+    eol = memchr(line, '\n', menu.data + menu.len - line);
+    if (eol == NULL) eol = menu.data + menu.len;
+    n = eol - line;
+    if ((n > 0) && (line[n - 1] == '\r')) n--;
+    if (n >= (long)sizeof(linebuff)) continue;
+    memcpy(linebuff, line, n);
+    linebuff[n] = 0;
+    if (strcmp(linebuff, ".") == 0) break;
+    if ((explodegophermapline(linebuff, &type, desc, selector, host, &port) != 0) || (host[0] == 0)) continue;
+    if ((type == 'i') || (type == '3')) continue; /* not items */
+    memset(&item, 0, sizeof(item));
+    item.type = type;
+    item.name = desc;
+    item.selector = selector;
+    item.host = host;
+    item.port = port;
+    /* local items get their attributes */
+    if ((strcasecmp(host, config->gopherhostname) == 0) && (port == config->gopherport)) {
+      item.plus = 1;
+      snprintf(linebuff, sizeof(linebuff), "%s", selector);
+      if ((selparse(&sel, linebuff, path, config->securldelim) == 0) && (sel.urlquery == NULL) && (sel.searchquery == NULL)) {
+        n = strlen(path);
+        if ((n > 1) && (path[n - 1] == '/')) path[--n] = 0;
+        name = NULL;
+        if ((dir != NULL) && (n > dirlen) && (strncmp(path, directorytolist, dirlen) == 0) && (strchr(path + dirlen, '/') == NULL)) name = path + dirlen;
+        if ((name == NULL) || (gopherplus_getattrs(dir, name, &item) != 0)) gopherplusstat(config, path, &item, abstract);
+      }
+      item.type = type; /* the menu has the last word on types */
     }
-    /* otherwise (plugin returned 0 data), let's handle the request ourselves */
+    gopherplus_block(&item, gopherplusadmin(config), attrs, gopherplusemit, &sb);
   }
+  sendbuff_line(&sb, ".");
+  sendbuff_close(&sb);
+  gopherplus_closedir(dir);
+}
 
-  /* detect 'GET' HTTP requests that would somehow made their way to us, and return a polite error message */
-  if (requestlookslikehttp(directorytolist) != 0) {
-    sendbackhttperror(sock, &config);
-    drainsock(sock);  /* read whatever request the peer sent us, to drain the socket before closing it (otherwise the tcp stack would trigger a ugly RST) */
-    close(sock);
-    return(0);
+
+/* serves a gopher request, given its (raw) selector, and closes sock */
+static void serveselector(int sock, char *rawselector, struct MotsognirConfig *config, const char *remoteclientaddr, struct arena_t *arena) {
+  const char *securitycheckresult;
+  char *directorytolist, *localfile, *rootdir;
+  size_t rootdir_len, localfile_len;
+  char *srvsideparams[2];
+  char gopherplusattrs[64];
+  struct selparse_t sel;
+  char gophertype;
+  int gopherplus;
+
+  /* Gopher+ requests carry an extra field ('+', '!' or '$'): it is cut off,
+   * and the selector is served as usual - or its attributes are. the answer
+   * to a '+' request starts with a Gopher+ header, sent once the item is
+   * resolved (see sendgopherplusheader()), and errors are Gopher+ errors */
+  gopherplus = gopherplus_parse(rawselector, gopherplusattrs, sizeof(gopherplusattrs));
+
+  /* if plugins are registered, see if one of them catches this request - the
+   * routing table is walked in order, and a plugin that returns no data passes
+   * the request to the next matching rule */
+  if (config->router != NULL) {
+    int rule;
+    for (rule = router_match(config->router, rawselector, 0); rule >= 0; rule = router_match(config->router, rawselector, rule + 1)) {
+      long res;
+      char *params[2] = {NULL, NULL};
+      const char *plugin = router_gethandler(config->router, rule);
+      params[0] = rawselector;
+      if (stringendswith(plugin, ".php") != 0) { /* is it a PHP file? */
+        res = execCgi(sock, plugin, params, config, pVer, "", remoteclientaddr, "php", 0, gopherplus, arena);
+      } else {
+        res = execCgi(sock, plugin, params, config, pVer, "", remoteclientaddr, NULL, 0, gopherplus, arena);
+      }
+      /* if the plugin returned anything, then stop here */
+      if (res > 0) {
+        syslog(LOG_INFO, "Query handled by plugin (%s)", plugin);
+        scoreboard_setclass(SCOREBOARD_PLUGIN);
+        drainsock(sock);  /* read whatever request the peer sent us, to drain the socket before closing it (otherwise the tcp stack would trigger a ugly RST) */
+        close(sock);
+        return;
+      }
+    }
+    /* otherwise (no plugin returned any data), let's handle the request ourselves */
   }
 
-  /* detect gopher+ requests for the root resource, as forged by the UMN gopher
-   * client. this needs to be handled because of a bug in the gopher client,
-   * which makes it output an error instead of fallbacking to standard gopher */
-  if (requestlookslikegopherplus(directorytolist) != 0) {
-    sendbackgopherplushack(sock, &config);
+  /* detect 'GET' HTTP requests that would somehow made their way to us, and return a polite error message */
+  if (requestlookslikehttp(rawselector) != 0) {
+    accesslog_setstatus("http");
+    scoreboard_setclass(SCOREBOARD_HTTP);
+    sendbackhttperror(sock, config);
     drainsock(sock);  /* read whatever request the peer sent us, to drain the socket before closing it (otherwise the tcp stack would trigger a ugly RST) */
     close(sock);
-    return(0);
+    return;
   }
 
   /* detect requests for foreign URLs and return a simple html redirecting page */
-  if ((directorytolist[0] == 'U') && (directorytolist[1] == 'R') && (directorytolist[2] == 'L') && (directorytolist[3] == ':')) {
-    exturlredirector(sock, directorytolist);
+  if ((rawselector[0] == 'U') && (rawselector[1] == 'R') && (rawselector[2] == 'L') && (rawselector[3] == ':')) {
+    accesslog_settype('h');
+    sendgopherplusheader(sock, gopherplus, 'h');
+    exturlredirector(sock, rawselector);
     close(sock);
-    return(0);
+    return;
   }
 
-  /* a request should start with a / (if not, prepend it with one) */
-  if (directorytolist[0] != '/') {
-    memmove(directorytolist+1, directorytolist, strlen(directorytolist)+1); /* first move the whole thing by one position to the right */
-    directorytolist[0] = '/';
+  /* separate server side params from the 'real' query, and decode the latter
+   * (QUERY_STRING must NOT be decoded in any way). the path is also given a
+   * leading '/' and cleaned from double slashes on the way. paths are sized
+   * after the selector, with room for the trailing '/' of directories */
+  directorytolist = arena_alloc(arena, strlen(rawselector) + 3);
+  if (directorytolist == NULL) {
+    syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+    accesslog_setstatus("error");
+    return;
   }
-
-  /* separate server side params from the 'real' query */
-  srvsideparams = explode_serverside_params_from_query(directorytolist, &config);
-
-  /* Decode percent-encoded data - note that this must be done AFTER we separated server side params, because QUERY_STRING must NOT be decoded in any way */
-  if (percdecode(directorytolist) != 0) {
+  if (selparse(&sel, rawselector, directorytolist, config->securldelim) != 0) {
+    if (sel.flags & SELPARSE_NULPERCENT) {
+      syslog(LOG_WARNING, "ERROR: detected a dangerous percent encoding (%%00)");
+    } else {
+      syslog(LOG_WARNING, "ERROR: detected invalid percent encoding");
+    }
     syslog(LOG_WARNING, "Percent decoding on request failed. Query aborted.");
-    return(0);
+    accesslog_setstatus("badrequest");
+    return;
   }
+  srvsideparams[0] = sel.urlquery;
+  srvsideparams[1] = sel.searchquery;
+  syslog(LOG_INFO, "Got following server-side parameters: %s | %s", srvsideparams[0], srvsideparams[1]);
 
   /* Once we decoded the request, check that it doesn't contain any nasty stuff */
   securitycheckresult = gophersecuritycheck(directorytolist);
   if (securitycheckresult != NULL) {
-    syslog(LOG_INFO, "The gopher security module has detected a suspect condition. The query won't be processed. Reason: %s", securitycheckresult);
+    syslog(LOG_WARNING, "The gopher security module has detected a suspect condition. The query won't be processed. Reason: %s", securitycheckresult);
+    accesslog_setstatus("badrequest");
+    scoreboard_setclass(SCOREBOARD_EVASION);
     close(sock);
-    return(0);
+    return;
+  }
+  accesslog_phase(ACCESSLOG_PARSED);
+
+  /* the server status is available to allowed clients only */
+  if ((config->statusselector != NULL) && (strcmp(directorytolist, config->statusselector) == 0)) {
+    accesslog_phase(ACCESSLOG_RESOLVED);
+    sendgopherplusheader(sock, gopherplus, '0');
+    outputstatus(sock, config, remoteclientaddr, srvsideparams[0]);
+    close(sock);
+    return;
+  }
+
+  /* search requests are answered from the search index */
+  if ((config->searchselector != NULL) && (strcmp(directorytolist, config->searchselector) == 0)) {
+    accesslog_settype('7');
+    scoreboard_setclass(SCOREBOARD_SEARCH);
+    accesslog_phase(ACCESSLOG_RESOLVED);
+    sendgopherplusheader(sock, gopherplus, '7');
+    outputsearch(sock, config, srvsideparams[1]);
+    sendline(sock, ".");
+    close(sock);
+    return;
   }
 
   /* build the localfile path, and the root directory (the latter is necessary for further evasion checks */
-  BuildLocalFileAndRootDir(localfile, sizeof(localfile), rootdir, sizeof(rootdir), &config, directorytolist);
+  rootdir_len = strlen(config->gopherroot) + 1;
+  if ((config->userdir != NULL) && (strlen(config->userdir) + 128 > rootdir_len)) rootdir_len = strlen(config->userdir) + 128;
+  localfile_len = rootdir_len + strlen(directorytolist) + 1;
+  rootdir = arena_alloc(arena, rootdir_len);
+  localfile = arena_alloc(arena, localfile_len);
+  if ((rootdir == NULL) || (localfile == NULL)) {
+    syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+    accesslog_setstatus("error");
+    close(sock);
+    return;
+  }
+  BuildLocalFileAndRootDir(localfile, localfile_len, rootdir, rootdir_len, config, directorytolist);
 
-  /* Remove double occurences of slashes in paths */
-  RemoveDoubleChar(directorytolist, '/');
+  /* Remove double occurences of slashes in the local path */
   RemoveDoubleChar(localfile, '/');
 
   syslog(LOG_INFO, "Requested resource: %s / Local resource: %s", directorytolist, localfile);
 
-  if (checkforevasion(rootdir, config.pubdirlist, localfile) != 0) {
-    syslog(LOG_INFO, "Evasion attempt. Forbidden!");
-    sendline(sock, "iForbidden!\tfake\tfake\t0");
-    sendline(sock, ".");
+  if (checkforevasion(rootdir, config->pubdirlist, localfile) != 0) {
+    syslog(LOG_WARNING, "Evasion attempt. Forbidden!");
+    scoreboard_setclass(SCOREBOARD_EVASION);
+    accesslog_settype('3');
+    accesslog_setstatus("forbidden");
+    if (gopherplus != 0) {
+      sendgopherpluserror(sock, config, "Forbidden!");
+    } else {
+      sendline(sock, "iForbidden!\tfake\tfake\t0");
+      sendline(sock, ".");
+    }
     close(sock);
-    return(0);
+    return;
   }
+  accesslog_phase(ACCESSLOG_EVASION);
 
   if (is_it_a_directory(localfile) != 0) {
     if (chdir(localfile) != 0) syslog(LOG_WARNING, "WARNING: failed to switch to directory '%s'", localfile);
-    outputdir(sock, &config, localfile, directorytolist, remoteclientaddr, srvsideparams);
+    accesslog_settype('1');
+    scoreboard_setclass(SCOREBOARD_MENU);
+    accesslog_phase(ACCESSLOG_RESOLVED);
+    if (gopherplus == '!') {
+      outputgopherplusitem(sock, config, directorytolist, gopherplusattrs);
+    } else if (gopherplus == '$') {
+      outputgopherplusdir(sock, config, localfile, directorytolist, remoteclientaddr, srvsideparams, arena, gopherplusattrs);
+    } else {
+      sendgopherplusheader(sock, gopherplus, '1');
+      outputdir(sock, config, localfile, directorytolist, remoteclientaddr, srvsideparams, arena);
+    }
     close(sock);
-    return(0);
+    return;
   }
 
   /* if NOT a directory... */
 
   /* switch the current working directory to where the destination resource is */
-  if (changedir(localfile) != 0) {
-    syslog(LOG_INFO, "ERROR: changedir() failure for '%s'", localfile);
-    sendline(sock, "iForbidden!\tfake\tfake\t0");
-    sendline(sock, ".");
+  if (changedir(arena, localfile) != 0) {
+    syslog(LOG_WARNING, "ERROR: changedir() failure for '%s'", localfile);
+    accesslog_settype('3');
+    accesslog_setstatus("forbidden");
+    if (gopherplus != 0) {
+      sendgopherpluserror(sock, config, "Forbidden!");
+    } else {
+      sendline(sock, "iForbidden!\tfake\tfake\t0");
+      sendline(sock, ".");
+    }
     close(sock);
-    return(0);
+    return;
   }
 
-  if ((strcmp(directorytolist, "/caps.txt") == 0) && (config.capssupport != 0)) {  /* If asking for /caps.txt, return it. */
+  if ((strcmp(directorytolist, "/caps.txt") == 0) && (config->capssupport != 0)) {  /* If asking for /caps.txt, return it. */
     syslog(LOG_INFO, "Returned caps.txt data");
-    printcapstxt(sock, &config, pVer);
+    accesslog_settype('0');
+    sendgopherplusheader(sock, gopherplus, '0');
+    printcapstxt(sock, config, pVer);
     sendline(sock, ".");
     close(sock);
-    return(0);
+    return;
   }
 
   /* the query is requesting a file - does it exist at all?
      if client asks for a gophermap, we fake a 'not found' message as well */
   if ((fexist(localfile) == 0) || (islocalfileagophermap(localfile) != 0)) {
     syslog(LOG_INFO, "FileExists check: the file doesn't exists");
+    accesslog_settype('3');
+    accesslog_setstatus("notfound");
+    if (gopherplus != 0) {
+      sendgopherpluserror(sock, config, "The selected resource doesn't exist!");
+      close(sock);
+      return;
+    }
     sendline(sock, "3The selected resource doesn't exist!\tfake\tfake\t0");
     sendline(sock, "iThe selected resource cannot be located.\tfake\tfake\t0");
     sendline(sock, ".");
     close(sock);
-    return(0);
+    return;
   }
 
   /* in 'paranoid' mode, only allow access to files that are world-readable */
-  if (config.paranoidmode != 0) {
+  if (config->paranoidmode != 0) {
     struct stat statbuf;
     if (stat(localfile, &statbuf) != 0) {
       /* error while reading attributes */
-      syslog(LOG_INFO, "stat() failed: %s", strerror(errno));
-      sendline(sock, "3Internal error\tfake\tfake\t0");
-      sendline(sock, "iInternal error\tfake\tfake\t0");
-      sendline(sock, ".");
+      syslog(LOG_WARNING, "stat() failed: %s", strerror(errno));
+      accesslog_settype('3');
+      accesslog_setstatus("error");
+      if (gopherplus != 0) {
+        sendgopherpluserror(sock, config, "Internal error");
+      } else {
+        sendline(sock, "3Internal error\tfake\tfake\t0");
+        sendline(sock, "iInternal error\tfake\tfake\t0");
+        sendline(sock, ".");
+      }
       close(sock);
-      return(0);
+      return;
     } else if ((statbuf.st_mode & S_IROTH) != S_IROTH) {
       /* not world-readable */
       syslog(LOG_INFO, "Paranoid mode check failed: file is not world-readable");
-      sendline(sock, "3Permission denied\tfake\tfake\t0");
-      sendline(sock, "iPermission denied\tfake\tfake\t0");
-      sendline(sock, ".");
+      accesslog_settype('3');
+      accesslog_setstatus("forbidden");
+      if (gopherplus != 0) {
+        sendgopherpluserror(sock, config, "Permission denied");
+      } else {
+        sendline(sock, "3Permission denied\tfake\tfake\t0");
+        sendline(sock, "iPermission denied\tfake\tfake\t0");
+        sendline(sock, ".");
+      }
       close(sock);
-      return(0);
+      return;
     }
   }
 
+  /* Gopher+ attributes of a file */
+  if (gopherplus == '!') {
+    accesslog_settype(DetectGopherTypeSniff(localfile, config, 0));
+    accesslog_phase(ACCESSLOG_RESOLVED);
+    outputgopherplusitem(sock, config, directorytolist, gopherplusattrs);
+    close(sock);
+    return;
+  }
+  if (gopherplus == '$') {
+    accesslog_settype('3');
+    accesslog_setstatus("notfound");
+    sendgopherpluserror(sock, config, "The selected resource is not a directory.");
+    close(sock);
+    return;
+  }
+
   /* if the query is pointing to a CGI file, and CGI support is enabled - execute the query */
-  if ((strcmp(getfileextension(localfile), "cgi") == 0) && (config.cgisupport != 0)) {
-    execCgi(sock, localfile, srvsideparams, &config, pVer, directorytolist, remoteclientaddr, NULL, 0);
+  if ((strcmp(getfileextension(localfile), "cgi") == 0) && (config->cgisupport != 0)) {
+    scoreboard_setclass(SCOREBOARD_CGI);
+    accesslog_phase(ACCESSLOG_RESOLVED);
+    execCgi(sock, localfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, NULL, 0, gopherplus, arena);
     close(sock);
-    return(0);
+    return;
   }
 
   /* if the query is pointing to a PHP file, and PHP support is enabled - execute the query */
-  if ((strcmp(getfileextension(localfile), "php") == 0) && (config.phpsupport != 0)) {
-    execCgi(sock, localfile, srvsideparams, &config, pVer, directorytolist, remoteclientaddr, "php", 0);
+  if ((strcmp(getfileextension(localfile), "php") == 0) && (config->phpsupport != 0)) {
+    scoreboard_setclass(SCOREBOARD_CGI);
+    accesslog_phase(ACCESSLOG_RESOLVED);
+    execCgi(sock, localfile, srvsideparams, config, pVer, directorytolist, remoteclientaddr, "php", 0, gopherplus, arena);
     close(sock);
-    return(0);
+    return;
   }
 
   /* we want a normal file's content */
   syslog(LOG_INFO, "Returning file '%s'", localfile);
-  gophertype = DetectGopherType(localfile, config.extmap);
+  gophertype = DetectGopherTypeSniff(localfile, config, 1);
+  accesslog_settype(gophertype);
+  accesslog_phase(ACCESSLOG_RESOLVED);
+  sendgopherplusheader(sock, gopherplus, gophertype);
   switch (gophertype) {
     case '0':
     case '2':
     case '6':
-      sendtxtfiletosock(sock, localfile);
+      scoreboard_setclass(SCOREBOARD_TEXT);
+      sendtxtfiletosock(sock, localfile, (config->outputcharsettext != 0) ? config->outputcharset : CHARSET_UTF8);
       sendline(sock, ".");
       break;
     default:
-      sendbinfiletosock(sock, localfile);
+      scoreboard_setclass(SCOREBOARD_BINARY);
+      sendbinfiletosock(sock, localfile, config, srvsideparams);
       break;
   }
 
   close(sock);
+}
+
+
+#ifndef MSG_MORE
+#define MSG_MORE 0  /* only a hint that more data follows */
+#endif
+
+#define HTTP_MAXREQUESTS 1000                /* max amount of requests served over a single HTTP connection */
+#define HTTP_MAXDYNAMIC (16 * 1024 * 1024)  /* max size of dynamic answers (menus, scripts) in HTTP gateway mode */
+
+/* sends a whole buffer to an HTTP client. returns 0 on success */
+static int httpsend(int sock, const char *buff, long len, int flags) {
+  long pos = 0, res;
+  while (pos < len) {
+    res = send(sock, buff + pos, len - pos, flags | MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      return(-1);
+    }
+    accesslog_addbytes(res);
+    pos += res;
+  }
+  return(0);
+}
+
+
+/* sends the status line and headers of an HTTP answer. contenttype is NULL
+ * if the answer has no body, lastmodified is 0 if unknown. more is set if
+ * the body is sent right after, so both may leave in the same packets */
+static int httpsendhead(int sock, int status, const char *contenttype, long contentlength, time_t lastmodified, int keepalive, int more, const struct MotsognirConfig *config) {
+  char head[1024], date[32];
+  int len;
+  http_date(date, time(NULL));
+  len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nServer: Motsognir/%s\r\nDate: %s\r\n", status, http_reason(status), pVer, date);
+  if (lastmodified != 0) {
+    http_date(date, lastmodified);
+    len += snprintf(head + len, sizeof(head) - len, "Last-Modified: %s\r\n", date);
+  }
+  if (contenttype != NULL) {
+    /* the charset of text files is the one announced in caps.txt, if any */
+    if ((strncmp(contenttype, "text/", 5) == 0) && (config->capsserverdefaultencoding != NULL)) {
+      len += snprintf(head + len, sizeof(head) - len, "Content-Type: %s; charset=%.64s\r\n", contenttype, config->capsserverdefaultencoding);
+    } else {
+      len += snprintf(head + len, sizeof(head) - len, "Content-Type: %s\r\n", contenttype);
+    }
+  }
+  if (status != 304) len += snprintf(head + len, sizeof(head) - len, "Content-Length: %ld\r\n", contentlength);
+  if (status == 405) len += snprintf(head + len, sizeof(head) - len, "Allow: GET, HEAD\r\n");
+  len += snprintf(head + len, sizeof(head) - len, "Connection: %s\r\n\r\n", (keepalive != 0) ? "keep-alive" : "close");
+  return(httpsend(sock, head, len, (more != 0) ? MSG_MORE : 0));
+}
+
+
+/* sends an HTTP error page */
+static int httpsenderror(int sock, int status, int keepalive, int headonly, const struct MotsognirConfig *config) {
+  char body[512];
+  int len;
+  len = snprintf(body, sizeof(body), "<!DOCTYPE html>\n<html>\n<head><title>%d %s</title></head>\n<body><h1>%d %s</h1></body>\n</html>\n", status, http_reason(status), status, http_reason(status));
+  if (httpsendhead(sock, status, "text/html", len, 0, keepalive, !headonly, config) != 0) return(-1);
+  if (headonly != 0) return(0);
+  return(httpsend(sock, body, len, 0));
+}
+
+
+/* checks whether a selector points to a plain file, that the gopher
+ * pipeline would send as is: the HTTP gateway serves these by itself. if so,
+ * returns 0 and fills localfile */
+static int httpstaticfile(char *localfile, long localfile_len, const char *rawselector, const struct MotsognirConfig *config) {
+  char selcopy[4096 - 2], directorytolist[4096], rootdir[4096];
+  struct selparse_t sel;
+  struct stat st;
+  /* any selector may be caught by a plugin */
+  if ((config->router != NULL) && (router_match(config->router, rawselector, 0) >= 0)) return(-1);
+  if (strlen(rawselector) >= sizeof(selcopy)) return(-1);
+  strcpy(selcopy, rawselector);
+  if ((selparse(&sel, selcopy, directorytolist, config->securldelim) != 0) || (gophersecuritycheck(directorytolist) != NULL)) return(-1);
+  if ((config->statusselector != NULL) && (strcmp(directorytolist, config->statusselector) == 0)) return(-1);
+  if ((config->searchselector != NULL) && (strcmp(directorytolist, config->searchselector) == 0)) return(-1);
+  if ((strcmp(directorytolist, "/caps.txt") == 0) && (config->capssupport != 0)) return(-1);
+  BuildLocalFileAndRootDir(localfile, localfile_len, rootdir, sizeof(rootdir), config, directorytolist);
+  RemoveDoubleChar(localfile, '/');
+  if (checkforevasion(rootdir, config->pubdirlist, localfile) != 0) return(-1);
+  if ((stat(localfile, &st) != 0) || (!S_ISREG(st.st_mode)) || (islocalfileagophermap(localfile) != 0)) return(-1);
+  if ((strcmp(getfileextension(localfile), "cgi") == 0) && (config->cgisupport != 0)) return(-1);
+  if ((strcmp(getfileextension(localfile), "php") == 0) && (config->phpsupport != 0)) return(-1);
+  if ((config->paranoidmode != 0) && ((st.st_mode & S_IROTH) != S_IROTH)) return(-1);
+  return(0);
+}
+
+
+/* answers an HTTP request for a plain file: sent with sendfile(), and
+ * subject to conditional GET. returns 0 on success */
+static int httpservefile(int sock, const struct http_request *req, const char *localfile, int keepalive, const struct MotsognirConfig *config) {
+  struct stat st;
+  int fd, res, headonly;
+  char gophertype;
+  headonly = (strcmp(req->method, "HEAD") == 0);
+  fd = open(localfile, O_RDONLY);
+  if ((fd < 0) || (fstat(fd, &st) != 0)) {
+    syslog(LOG_WARNING, "ERROR: File '%s' could not be opened", localfile);
+    if (fd >= 0) close(fd);
+    accesslog_setstatus("error");
+    return(httpsenderror(sock, 500, keepalive, headonly, config));
+  }
+  gophertype = DetectGopherTypeSniff(localfile, config, 1);
+  accesslog_settype(gophertype);
+  scoreboard_setclass(((gophertype == '0') || (gophertype == '2') || (gophertype == '6')) ? SCOREBOARD_TEXT : SCOREBOARD_BINARY);
+  accesslog_phase(ACCESSLOG_RESOLVED);
+  if ((req->ifmodifiedsince != 0) && (st.st_mtime <= req->ifmodifiedsince)) {
+    close(fd);
+    return(httpsendhead(sock, 304, NULL, 0, st.st_mtime, keepalive, 0, config));
+  }
+  res = httpsendhead(sock, 200, http_contenttype(getfileextension(localfile), gophertype), st.st_size, st.st_mtime, keepalive, !headonly, config);
+  if ((res == 0) && (headonly == 0)) res = sendfilerange(sock, fd, 0, st.st_size);
+  if (res != 0) accesslog_setstatus("aborted");
+  close(fd);
+  return(res);
+}
+
+
+/* answers an HTTP request through the gopher pipeline, run by a child
+ * process into a local socket. its answer is then translated: menus are
+ * rendered as HTML, text documents lose their gopher escaping. returns 0
+ * on success */
+static int httpservedynamic(int sock, const struct http_request *req, char *rawselector, int keepalive, struct MotsognirConfig *config, const char *remoteclientaddr, struct arena_t *arena) {
+  static struct http_buff answer, page;
+  char buff[16384];
+  struct {
+    char type;
+    int reqclass;
+    int status;  /* see accesslog_getstatusid() */
+  } result;
+  int sv[2], meta[2], overflow = 0, headonly, status, res;
+  long n;
+  pid_t pid;
+  const char *contenttype;
+  struct http_buff *body = &answer;
+
+  headonly = (strcmp(req->method, "HEAD") == 0);
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+    syslog(LOG_WARNING, "ERROR: socketpair() failed (%s)", strerror(errno));
+    accesslog_setstatus("error");
+    return(httpsenderror(sock, 500, keepalive, headonly, config));
+  }
+  if (pipe(meta) != 0) {
+    syslog(LOG_WARNING, "ERROR: pipe() failed (%s)", strerror(errno));
+    close(sv[0]);
+    close(sv[1]);
+    accesslog_setstatus("error");
+    return(httpsenderror(sock, 500, keepalive, headonly, config));
+  }
+  /* scripts run by the pipeline must not keep the local socket open */
+  fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+  fcntl(meta[1], F_SETFD, FD_CLOEXEC);
+
+  pid = fork();
+  if (pid == 0) { /* child: serves the request, then tells how it went */
+    close(sv[0]);
+    close(meta[0]);
+    close(sock);
+    serveselector(sv[1], rawselector, config, remoteclientaddr, arena);
+    result.type = accesslog_gettype();
+    result.reqclass = scoreboard_getclass();
+    result.status = accesslog_getstatusid();
+    if (write(meta[1], &result, sizeof(result)) != sizeof(result)) _exit(1);
+    _exit(0);
+  }
+  close(sv[1]);
+  close(meta[1]);
+  if (pid < 0) {
+    syslog(LOG_WARNING, "ERROR: fork() failed (%s)", strerror(errno));
+    close(sv[0]);
+    close(meta[0]);
+    accesslog_setstatus("error");
+    return(httpsenderror(sock, 500, keepalive, headonly, config));
+  }
+
+  /* collect the whole answer */
+  answer.len = 0;
+  for (;;) {
+    n = read(sv[0], buff, sizeof(buff));
+    if ((n < 0) && (errno == EINTR)) continue;
+    if (n <= 0) break;
+    if (http_append(&answer, buff, n, HTTP_MAXDYNAMIC) != 0) {
+      syslog(LOG_WARNING, "ERROR: the answer to '%s' is too large for the HTTP gateway", rawselector);
+      kill(pid, SIGKILL);
+      overflow = 1;
+      break;
+    }
+  }
+  n = read(meta[0], &result, sizeof(result));
+  close(sv[0]);
+  close(meta[0]);
+  waitpid(pid, NULL, 0);
+  accesslog_phase(ACCESSLOG_RESOLVED);
+  if ((overflow != 0) || (n != sizeof(result))) {
+    accesslog_setstatus("error");
+    return(httpsenderror(sock, 502, keepalive, headonly, config));
+  }
+  accesslog_settype(result.type);
+  accesslog_setstatusid(result.status);
+  scoreboard_setclass(result.reqclass);
+  status = http_statusof(accesslog_getstatus());
+  if ((answer.len == 0) && (status != 200)) return(httpsenderror(sock, status, keepalive, headonly, config));
+
+  /* translate the answer, after its gopher type (guessed for scripts) */
+  if ((result.type == '1') || (result.type == '7') || (result.type == '3') || ((result.type == '-') && (http_lookslikemenu(answer.data, answer.len) != 0))) {
+    page.len = 0;
+    if (http_menutohtml(&page, answer.data, answer.len, req->target, config->gopherhostname, config->gopherport, HTTP_MAXDYNAMIC) != 0) {
+      accesslog_setstatus("error");
+      return(httpsenderror(sock, 502, keepalive, headonly, config));
+    }
+    body = &page;
+    contenttype = "text/html";
+  } else {
+    char type = result.type;
+    if ((type == '-') && (answer.len > 0)) type = sniff_buffer((unsigned char *)answer.data, (answer.len < SNIFF_LEN) ? answer.len : SNIFF_LEN);
+    if (type == '0') answer.len = http_untext(answer.data, answer.len);
+    contenttype = http_contenttype(NULL, type);
+  }
+  res = httpsendhead(sock, status, contenttype, body->len, 0, keepalive, !headonly, config);
+  if ((res == 0) && (headonly == 0)) res = httpsend(sock, body->data, body->len, 0);
+  if (res != 0) accesslog_setstatus("aborted");
+  return(res);
+}
+
+
+/* reads an HTTP request head into buff, that holds len bytes already (the
+ * start of the head, or pipelined requests), waiting up to timeout seconds.
+ * returns the length of the head, 0 if the connection was closed or timed
+ * out, or -1 if the head is too large */
+static int httpreadhead(int sock, char *buff, int *len, int timeout) {
+  struct pollfd pfd;
+  int headlen, res;
+  for (;;) {
+    headlen = http_headlen(buff, *len);
+    if (headlen > 0) return(headlen);
+    if (*len >= HTTP_MAXHEAD) return(-1);
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    res = poll(&pfd, 1, timeout * 1000);
+    if ((res < 0) && (errno == EINTR)) continue;
+    if (res <= 0) return(0);
+    res = recv(sock, buff + *len, HTTP_MAXHEAD - *len, 0);
+    if ((res < 0) && (errno == EINTR)) continue;
+    if (res <= 0) return(0);
+    *len += res;
+  }
+}
+
+
+/* serves an HTTP client, in HTTP gateway mode: requests are read from the
+ * connection, and answered in order, for as long as the client keeps it open
+ * (within the keep-alive timeout). firstline is the request line of the
+ * first request, read already */
+static void httpgateway(int sock, const char *firstline, struct MotsognirConfig *config, const char *remoteclientaddr, struct arena_t *arena) {
+  static char buff[HTTP_MAXHEAD];
+  char rawselector[4096 - 2]; /* leaves room in directorytolist for a leading and a trailing '/' */
+  char localfile[4096];
+  struct http_request req;
+  int len, headlen, requests, status, keepalive, res;
+
+  /* web pages are rendered in UTF-8, whatever the charset of gopher menus */
+  config->outputcharset = CHARSET_UTF8;
+  len = snprintf(buff, sizeof(buff), "%s\r\n", firstline);
+  for (requests = 0;; requests++) {
+    headlen = httpreadhead(sock, buff, &len, (requests == 0) ? 10 : config->httpkeepalive);
+    if (headlen == 0) break;
+    /* every request gets its own access log record (the first one's has
+     * been started already, when the connection was accepted), the next
+     * ones being timed since their head was received */
+    if (requests > 0) {
+      accesslog_begin(config->accesslog, config->slowlog, config->slowlogthreshold, remoteclientaddr, NULL);
+      scoreboard_beginrequest();
+    }
+    accesslog_phase(ACCESSLOG_SELECTOR);
+
+    keepalive = 0;
+    if (headlen < 0) {
+      status = 431;
+    } else {
+      status = http_parserequest(&req, buff, headlen);
+      len -= headlen;
+      memmove(buff, buff + headlen, len);
+    }
+    if (status == 0) {
+      syslog(LOG_INFO, "HTTP request: %s %s", req.method, req.target);
+      accesslog_setselector(req.target);
+      scoreboard_setselector(req.target);
+      /* request bodies are not read: the connection is closed after such
+       * requests instead */
+      keepalive = ((req.keepalive != 0) && (req.contentlength == 0) && (config->httpkeepalive > 0) && (requests + 1 < HTTP_MAXREQUESTS));
+      if ((strcmp(req.method, "GET") != 0) && (strcmp(req.method, "HEAD") != 0)) {
+        status = 405;
+      } else if (http_toselector(rawselector, sizeof(rawselector), req.target) != 0) {
+        status = 414;
+      } else if (rawselector[0] != '/') {
+        status = 400;
+      }
+    }
+
+    if (status != 0) {
+      accesslog_setstatus("badrequest");
+      scoreboard_setclass(SCOREBOARD_HTTP);
+      res = httpsenderror(sock, status, keepalive, 0, config);
+    } else {
+      accesslog_phase(ACCESSLOG_PARSED);
+      if (httpstaticfile(localfile, sizeof(localfile), rawselector, config) == 0) {
+        res = httpservefile(sock, &req, localfile, keepalive, config);
+      } else {
+        res = httpservedynamic(sock, &req, rawselector, keepalive, config, remoteclientaddr, arena);
+      }
+    }
+
+    scoreboard_endrequest();
+    accesslog_end();
+    if ((res != 0) || (keepalive == 0)) break;
+  }
+}
+
+
+int main(int argc, char **argv) {
+  char rawselector[4096 - 2]; /* leaves room in directorytolist for a leading and a trailing '/' */
+  char remoteclientaddr[64];
+  char localserveraddr[64];
+  char *configfile = CONFIGFILE;
+  int sock;
+  struct MotsognirConfig config;
+  struct arena_t *arena;
+  struct timespec accepted;
+  time_t StartTime;
+  int selectorlen;
+
+  if (argc > 1) {
+    int x;
+    for (x = 1; x < argc; x++) {
+      if (strcmp(argv[x], "--config") == 0) {
+        x++;
+        if (x < argc) configfile = argv[x];
+      } else { /* unknown command line */
+        about(pVer, pDate, HOMEPAGE);
+        return(1);
+      }
+    }
+  }
+
+  /* load motsognir's configuration from file */
+  if (loadconfig(&config, configfile) != 0) {
+    puts("ERROR: A configuration error has been detected. Check the logs for details.");
+    return(9);
+  }
+
+  /* informational messages are debug chatter, emitted in verbose mode only
+   * (requests are recorded by the access log, if any) */
+  if (config.verbosemode == 0) setlogmask(LOG_UPTO(LOG_NOTICE));
+
+  sock = waitforconn(config.gopherport, remoteclientaddr, sizeof(remoteclientaddr), localserveraddr, sizeof(localserveraddr), &accepted, &config);
+  if (sock == -1) return(0);
+  if (sock < 0) {
+    puts("ERROR: a fatal error occured. check the logs for details.");
+    return(2);
+  }
+
+  /* from here on, this process serves a single request: all its temporary
+   * allocations come from an arena that is never freed explicitly (it goes
+   * away with the process), and I/O buffers are sized after the socket */
+  arena = arena_new();
+  if (arena == NULL) {
+    syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+    close(sock);
+    return(0);
+  }
+  iobuf_init(sock);
+
+  /* the access log record is queued, and the scoreboard updated, whenever
+   * this process exits */
+  accesslog_begin(config.accesslog, config.slowlog, config.slowlogthreshold, remoteclientaddr, &accepted);
+  scoreboard_begin(config.scoreboard, remoteclientaddr);
+  atexit(accesslog_end);
+  atexit(scoreboard_end);
+
+  StartTime = time(NULL);
+
+  selectorlen = sockreadline(sock, rawselector, sizeof(rawselector), &StartTime);
+  if (selectorlen < 0) {
+    syslog(LOG_WARNING, "Error during selector receiving phase. Connection aborted.");
+    accesslog_setstatus("aborted");
+    close(sock);
+    return(0);
+  }
+  accesslog_phase(ACCESSLOG_SELECTOR);
+  syslog(LOG_INFO, "Query='%s'", rawselector);
+  accesslog_setselector(rawselector);
+  scoreboard_setselector(rawselector);
+
+  /* a HTTP request line too long for rawselector lost its ' HTTP/' part:
+   * the HTTP gateway answers it with an error rather than as a selector */
+  if ((config.httpgateway != 0) && (selectorlen >= (int)sizeof(rawselector)) && (requeststartslikehttp(rawselector) != 0)) {
+    syslog(LOG_INFO, "HTTP request line too long");
+    accesslog_setstatus("badrequest");
+    scoreboard_setclass(SCOREBOARD_HTTP);
+    httpsenderror(sock, 414, 0, 0, &config);
+    drainsock(sock);
+    close(sock);
+    return(0);
+  }
+  if (rawselector[0] == 0) {   /* Empty request means "gimme the root listing" */
+    rawselector[0] = '/';
+    rawselector[1] = 0;
+  }
+
+  /* HTTP clients are served by the HTTP gateway, if enabled */
+  if ((config.httpgateway != 0) && (requestlookslikehttp(rawselector) != 0)) {
+    httpgateway(sock, rawselector, &config, remoteclientaddr, arena);
+    drainsock(sock);  /* read whatever request the peer sent us, to drain the socket before closing it (otherwise the tcp stack would trigger a ugly RST) */
+    close(sock);
+    return(0);
+  }
+
+  serveselector(sock, rawselector, &config, remoteclientaddr, arena);
   syslog(LOG_INFO, "connection closed. duration: %lus", (unsigned long)(time(NULL) - StartTime));
   return(0);
 }
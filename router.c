@@ -0,0 +1,351 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides an ordered (pattern -> handler) routing table for plugins.
+ *
+ * Every rule is a POSIX extended regex, but running a list of regexes on every
+ * incoming selector gets expensive fast. That's why literal prefixes ('^/abc')
+ * and literal suffixes ('\.cgi$') are extracted from patterns when rules are
+ * added: prefixes go into a trie, so a single walk over the selector yields
+ * the handful of rules that could possibly match. Rules that are entirely
+ * literal (like '^/search$' or '^/guestbook/') never run any regex at all.
+ */
+
+#include <regex.h>   /* regcomp(), regexec()... */
+#include <stdlib.h>  /* malloc(), calloc(), free() */
+#include <string.h>  /* strlen(), memcmp()... */
+
+#include "router.h"  /* include self for control */
+
+/* longest literal prefix kept in the trie (longer prefixes are truncated,
+ * the regex takes care of checking the rest) */
+#define ROUTER_MAXPREFIX 64
+
+/* kind of test that needs to be performed once the trie selected a rule */
+#define ROUTER_KIND_REGEX  0  /* prefix and suffix are just prefilters */
+#define ROUTER_KIND_PREFIX 1  /* '^lit' - the trie walk is enough */
+#define ROUTER_KIND_EXACT  2  /* '^lit$' - selector must be exactly lit */
+#define ROUTER_KIND_SUFFIX 3  /* 'lit$' - checking the suffix is enough */
+#define ROUTER_KIND_SUBSTR 4  /* 'lit' - selector must contain lit */
+
+struct router_rule {
+  char *handler;
+  char *literal;     /* the substring for ROUTER_KIND_SUBSTR rules */
+  char *suffix;
+  int suffixlen;
+  int prefixlen;
+  int kind;
+  int hasregex;
+  regex_t regex;
+};
+
+struct router_trienode {
+  struct router_trienode *firstchild;
+  struct router_trienode *nextsibling;
+  int *rules;        /* ids of rules whose prefix ends here, sorted */
+  int rulescount;
+  unsigned char key;
+};
+
+struct router_t {
+  struct router_rule *rules;
+  int rulescount;
+  struct router_trienode root;  /* rules without any prefix are attached to the root */
+};
+
+
+/* returns non-zero if ch is a special char in a POSIX extended regex */
+static int isregexmeta(char ch) {
+  if (ch == 0) return(1);
+  if (strchr(".[]()*+?{}|^$\\", ch) != NULL) return(1);
+  return(0);
+}
+
+
+/* extracts the literal string that starts at *pattern, and stores it into
+ * 'out'. *pattern is updated to point to the first non-literal char. returns
+ * the length of the extracted literal. */
+static int parseliteral(const char **pattern, char *out, int outmax) {
+  const char *p = *pattern;
+  int len = 0;
+  for (;;) {
+    char ch;
+    const char *next;
+    if ((p[0] == '\\') && (p[1] != 0) && (isregexmeta(p[1]) != 0)) {
+      ch = p[1];  /* escaped special char (like '\.') is a literal */
+      next = p + 2;
+    } else if (isregexmeta(p[0]) == 0) {
+      ch = p[0];
+      next = p + 1;
+    } else {
+      break;
+    }
+    /* a literal followed by a quantifier is not guaranteed to be there, the
+     * only exception being 'a+' (at least one 'a', but the rest is unknown) */
+    if ((*next == '*') || (*next == '?') || (*next == '{')) break;
+    if ((*next == '+') && (next[1] != 0) && (strchr("*?{+", next[1]) != NULL)) break; /* 'a+*' and such */
+    if (len == outmax) break;
+    out[len++] = ch;
+    p = next;
+    if (*next == '+') break;
+  }
+  out[len] = 0;
+  *pattern = p;
+  return(len);
+}
+
+
+/* returns the amount of backslashes right before position pos of pattern */
+static int backslashesbefore(const char *pattern, int pos) {
+  int i;
+  for (i = pos - 1; (i >= 0) && (pattern[i] == '\\'); i--);
+  return(pos - 1 - i);
+}
+
+
+/* computes the literal suffix of a '$'-anchored pattern (returns its length,
+ * or 0 if none could be extracted). escaped special chars (like '\.') are
+ * literals. startpos is set to the position, in the pattern, where the
+ * suffix starts. */
+static int parsesuffix(const char *pattern, char *out, int *startpos) {
+  int plen = strlen(pattern);
+  int i, len = 0, x;
+  char ch;
+  *startpos = -1;
+  if ((plen == 0) || (pattern[plen - 1] != '$')) return(0);
+  /* make sure the final '$' is not escaped */
+  if ((backslashesbefore(pattern, plen - 1) & 1) != 0) return(0);
+  /* walk backward over chars that are literals for sure (the suffix is
+   * stored reversed, then put back in order) */
+  for (i = plen - 2; i >= 0; i--) {
+    int escaped = backslashesbefore(pattern, i) & 1;
+    if (isregexmeta(pattern[i]) != 0) {
+      if (escaped == 0) break;
+      out[len++] = pattern[i];  /* '\.' and such */
+      i--;
+    } else {
+      if (escaped != 0) break;  /* something like '\b' */
+      out[len++] = pattern[i];
+    }
+  }
+  for (x = 0; x < len / 2; x++) {
+    ch = out[x];
+    out[x] = out[len - 1 - x];
+    out[len - 1 - x] = ch;
+  }
+  out[len] = 0;
+  *startpos = i + 1;
+  return(len);
+}
+
+
+/* returns the child of a trie node that matches key, creates it if asked to */
+static struct router_trienode *trie_getchild(struct router_trienode *node, unsigned char key, int create) {
+  struct router_trienode *child;
+  for (child = node->firstchild; child != NULL; child = child->nextsibling) {
+    if (child->key == key) return(child);
+  }
+  if (create == 0) return(NULL);
+  child = calloc(1, sizeof(struct router_trienode));
+  if (child == NULL) return(NULL);
+  child->key = key;
+  child->nextsibling = node->firstchild;
+  node->firstchild = child;
+  return(child);
+}
+
+
+static void trie_free(struct router_trienode *node) {
+  struct router_trienode *child, *nextchild;
+  for (child = node->firstchild; child != NULL; child = nextchild) {
+    nextchild = child->nextsibling;
+    trie_free(child);
+    free(child);
+  }
+  free(node->rules);
+}
+
+
+struct router_t *router_new(void) {
+  return(calloc(1, sizeof(struct router_t)));
+}
+
+
+int router_add(struct router_t *obj, const char *pattern, const char *handler) {
+  struct router_rule *rule, *newlist;
+  struct router_trienode *node;
+  char prefix[ROUTER_MAXPREFIX + 1];
+  char suffix[1024];
+  const char *rest;
+  int *newids, x, suffixstart;
+  int hasalternation = (strchr(pattern, '|') != NULL);
+
+  if (strlen(pattern) >= sizeof(suffix)) return(-1);
+  newlist = realloc(obj->rules, (obj->rulescount + 1) * sizeof(struct router_rule));
+  if (newlist == NULL) return(-1);
+  obj->rules = newlist;
+  rule = &(obj->rules[obj->rulescount]);
+  memset(rule, 0, sizeof(*rule));
+
+  /* compile the regex first, this validates the pattern at the same time (an
+   * empty pattern is not a valid regex everywhere, but it means 'match all') */
+  if (pattern[0] != 0) {
+    if (regcomp(&(rule->regex), pattern, REG_EXTENDED | REG_NOSUB) != 0) return(-1);
+    rule->hasregex = 1;
+  }
+  rule->kind = ROUTER_KIND_REGEX;
+
+  /* alternations ('a|b') make prefixes and suffixes meaningless */
+  prefix[0] = 0;
+  suffix[0] = 0;
+  if (hasalternation == 0) {
+    /* extract the literal prefix, if the pattern is anchored to the start */
+    if (pattern[0] == '^') {
+      rest = pattern + 1;
+      rule->prefixlen = parseliteral(&rest, prefix, ROUTER_MAXPREFIX);
+      if (rest[0] == 0) {
+        rule->kind = ROUTER_KIND_PREFIX;
+      } else if ((rest[0] == '$') && (rest[1] == 0)) {
+        rule->kind = ROUTER_KIND_EXACT;
+      }
+    } else {
+      rest = pattern;
+      parseliteral(&rest, suffix, sizeof(suffix) - 1);
+      if (rest[0] == 0) {
+        rule->kind = ROUTER_KIND_SUBSTR;
+        rule->literal = strdup(suffix);
+        if (rule->literal == NULL) goto failed;
+      }
+    }
+    /* extract the literal suffix, if the pattern is anchored to the end */
+    if (rule->kind == ROUTER_KIND_REGEX) {
+      rule->suffixlen = parsesuffix(pattern, suffix, &suffixstart);
+      if ((rule->suffixlen > 0) && (suffixstart == 0)) rule->kind = ROUTER_KIND_SUFFIX;
+      if (rule->suffixlen > 0) {
+        rule->suffix = strdup(suffix);
+        if (rule->suffix == NULL) goto failed;
+      }
+    }
+  }
+
+  /* literal rules do not need their regex anymore */
+  if ((rule->kind != ROUTER_KIND_REGEX) && (rule->hasregex != 0)) {
+    regfree(&(rule->regex));
+    rule->hasregex = 0;
+  }
+
+  rule->handler = strdup(handler);
+  if (rule->handler == NULL) goto failed;
+
+  /* attach the rule to the trie node of its prefix */
+  node = &(obj->root);
+  for (x = 0; x < rule->prefixlen; x++) {
+    node = trie_getchild(node, (unsigned char)prefix[x], 1);
+    if (node == NULL) goto failed;
+  }
+  newids = realloc(node->rules, (node->rulescount + 1) * sizeof(int));
+  if (newids == NULL) goto failed;
+  node->rules = newids;
+  node->rules[node->rulescount++] = obj->rulescount; /* ids only grow, so the list stays sorted */
+
+  obj->rulescount += 1;
+  return(0);
+
+  failed:
+  if (rule->hasregex != 0) regfree(&(rule->regex));
+  free(rule->literal);
+  free(rule->suffix);
+  free(rule->handler);
+  return(-1);
+}
+
+
+/* checks whether a rule (that already passed the prefix prefilter) matches */
+static int rule_matches(const struct router_rule *rule, const char *selector, int selectorlen) {
+  switch (rule->kind) {
+    case ROUTER_KIND_PREFIX:
+      return(1);
+    case ROUTER_KIND_EXACT:
+      return(selectorlen == rule->prefixlen);
+    case ROUTER_KIND_SUBSTR:
+      return(strstr(selector, rule->literal) != NULL);
+  }
+  /* regex and suffix rules: check the literal suffix first */
+  if (rule->suffixlen > 0) {
+    if (selectorlen < rule->suffixlen) return(0);
+    if (memcmp(selector + selectorlen - rule->suffixlen, rule->suffix, rule->suffixlen) != 0) return(0);
+  }
+  if (rule->kind == ROUTER_KIND_SUFFIX) return(1);
+  return(regexec(&(rule->regex), selector, 0, NULL, 0) == 0);
+}
+
+
+int router_match(const struct router_t *obj, const char *selector, int firstrule) {
+  const struct router_trienode *path[ROUTER_MAXPREFIX + 1];
+  int pathpos[ROUTER_MAXPREFIX + 1];
+  const struct router_trienode *node;
+  int pathlen = 0, selectorlen, x, cursor, best, bestpath;
+
+  if (obj == NULL) return(-1);
+  selectorlen = strlen(selector);
+
+  /* walk the trie along the selector, remembering nodes that hold rules */
+  node = &(obj->root);
+  for (x = 0;; x++) {
+    if (node->rulescount > 0) {
+      path[pathlen] = node;
+      pathpos[pathlen] = 0;
+      pathlen++;
+    }
+    if ((x == selectorlen) || (x == ROUTER_MAXPREFIX)) break;
+    node = trie_getchild((struct router_trienode *)node, (unsigned char)selector[x], 0);
+    if (node == NULL) break;
+  }
+
+  /* candidates must be tested in the order rules were declared, so merge the
+   * (sorted) rule lists of all collected nodes */
+  for (cursor = firstrule;;) {
+    best = -1;
+    bestpath = -1;
+    for (x = 0; x < pathlen; x++) {
+      while ((pathpos[x] < path[x]->rulescount) && (path[x]->rules[pathpos[x]] < cursor)) pathpos[x]++;
+      if (pathpos[x] == path[x]->rulescount) continue;
+      if ((best < 0) || (path[x]->rules[pathpos[x]] < best)) {
+        best = path[x]->rules[pathpos[x]];
+        bestpath = x;
+      }
+    }
+    if (best < 0) return(-1);
+    if (rule_matches(&(obj->rules[best]), selector, selectorlen) != 0) return(best);
+    pathpos[bestpath]++;
+    cursor = best + 1;
+  }
+}
+
+
+const char *router_gethandler(const struct router_t *obj, int rule) {
+  if ((obj == NULL) || (rule < 0) || (rule >= obj->rulescount)) return(NULL);
+  return(obj->rules[rule].handler);
+}
+
+
+int router_count(const struct router_t *obj) {
+  if (obj == NULL) return(0);
+  return(obj->rulescount);
+}
+
+
+void router_free(struct router_t *obj) {
+  int x;
+  if (obj == NULL) return;
+  for (x = 0; x < obj->rulescount; x++) {
+    if (obj->rules[x].hasregex != 0) regfree(&(obj->rules[x].regex));
+    free(obj->rules[x].literal);
+    free(obj->rules[x].suffix);
+    free(obj->rules[x].handler);
+  }
+  free(obj->rules);
+  trie_free(&(obj->root));
+  free(obj);
+}
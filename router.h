@@ -0,0 +1,34 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides an ordered (pattern -> handler) routing table for plugins
+ */
+
+#ifndef router_h_sentinel
+#define router_h_sentinel
+
+struct router_t;
+
+/* allocates a new, empty routing table. returns NULL on out of memory */
+struct router_t *router_new(void);
+
+/* appends a rule at the end of the routing table. pattern is a POSIX extended
+ * regex (an empty pattern matches everything). returns 0 on success, non-zero
+ * if the pattern is invalid or memory ran out */
+int router_add(struct router_t *obj, const char *pattern, const char *handler);
+
+/* looks for the first rule (starting at rule id 'firstrule') that matches the
+ * selector. returns the rule's id, or -1 if no rule matches */
+int router_match(const struct router_t *obj, const char *selector, int firstrule);
+
+/* returns the handler associated with a rule id */
+const char *router_gethandler(const struct router_t *obj, int rule);
+
+/* returns the amount of rules present in the routing table */
+int router_count(const struct router_t *obj);
+
+/* frees the memory allocated to a routing table */
+void router_free(struct router_t *obj);
+
+#endif
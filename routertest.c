@@ -0,0 +1,202 @@
+/*
+ * Test & benchmark application for the plugin router.
+ *
+ * Builds a routing table of N rules and compares the trie-prefiltered router
+ * against the naive approach of running regexec() on every rule, one after
+ * another, until one matches.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "router.h"
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+/* generates the pattern of rule number n, alternating between the typical
+ * shapes of plugin filters */
+static void genpattern(char *buff, int bufflen, int n) {
+  switch (n % 5) {
+    case 0:
+      snprintf(buff, bufflen, "^/app%d/", n);
+      break;
+    case 1:
+      snprintf(buff, bufflen, "^/search%d$", n);
+      break;
+    case 2:
+      snprintf(buff, bufflen, "^/svc%d/[a-z]+\\.cgi$", n);
+      break;
+    case 3:
+      snprintf(buff, bufflen, "\\.ext%d$", n);
+      break;
+    default:
+      snprintf(buff, bufflen, "^/(legacy|old)%d/", n);
+      break;
+  }
+}
+
+
+/* generates a selector: most of them do not match any rule at all (like
+ * real traffic), some match rules spread over the table */
+static void genselector(char *buff, int bufflen, int n, int rulescount) {
+  int rule = (n * 7919) % rulescount;
+  switch (n % 8) {
+    case 0:
+      snprintf(buff, bufflen, "/app%d/some/thing", rule - (rule % 5));
+      break;
+    case 1:
+      snprintf(buff, bufflen, "/svc%d/query.cgi", rule - (rule % 5) + 2);
+      break;
+    case 2:
+      snprintf(buff, bufflen, "/files/archive/doc%d.ext%d", n, rule - (rule % 5) + 3);
+      break;
+    case 3: /* '\.' must match a dot only */
+      snprintf(buff, bufflen, "/files/archive/doc%d_ext%d", n, rule - (rule % 5) + 3);
+      break;
+    default:
+      snprintf(buff, bufflen, "/files/archive/doc%d.txt", n);
+      break;
+  }
+}
+
+
+/* patterns whose literal suffix holds escaped special chars, and selectors
+ * to check them against */
+static const char *escpatterns[] = {"\\.cgi$", "^/a\\.cgi$", "\\\\.cgi$", "\\\\\\.cgi$", "a\\$$", "\\(x\\)$", "[.]cgi$", "x\\.+$", NULL};
+static const char *escselectors[] = {"/a.cgi", "/a_cgi", "/a\\.cgi", "/a\\_cgi", "a$", "a", "(x)", "x", "x.", "x..", NULL};
+
+
+/* checks that patterns with escaped special chars route the way regexec()
+ * matches them. returns the amount of failures */
+static int checkescapes(void) {
+  struct router_t *router;
+  regex_t regex;
+  int x, y, r1, r2, errors = 0;
+  for (x = 0; escpatterns[x] != NULL; x++) {
+    router = router_new();
+    if ((router == NULL) || (router_add(router, escpatterns[x], "handler") != 0) || (regcomp(&regex, escpatterns[x], REG_EXTENDED | REG_NOSUB) != 0)) {
+      printf("  FAILED: rule '%s' rejected\n", escpatterns[x]);
+      errors++;
+      continue;
+    }
+    for (y = 0; escselectors[y] != NULL; y++) {
+      r1 = router_match(router, escselectors[y], 0);
+      r2 = (regexec(&regex, escselectors[y], 0, NULL, 0) == 0) ? 0 : -1;
+      if (r1 != r2) {
+        printf("  FAILED: '%s' -> '%s' router=%d regexec=%d\n", escpatterns[x], escselectors[y], r1, r2);
+        errors++;
+      }
+    }
+    regfree(&regex);
+    router_free(router);
+  }
+  return(errors);
+}
+
+
+int main(int argc, char **argv) {
+  struct router_t *router;
+  regex_t *regexes;
+  char pattern[128];
+  char **selectors;
+  int rulescount = 200, selectorscount = 10000, iterations = 20;
+  int x, y, i, mismatches = 0;
+  volatile long checksum = 0;
+  double t0, t_router, t_regex;
+
+  if (argc > 1) rulescount = atoi(argv[1]);
+  if (argc > 2) iterations = atoi(argv[2]);
+  if ((rulescount < 1) || (iterations < 1)) {
+    puts("routertest is a simple tool to test and benchmark motsognir's plugin router.");
+    puts("usage: routertest [rules] [iterations]");
+    return(1);
+  }
+
+  printf("build a routing table of %d rules...\n", rulescount);
+  router = router_new();
+  regexes = calloc(rulescount, sizeof(regex_t));
+  selectors = calloc(selectorscount, sizeof(char *));
+  if ((router == NULL) || (regexes == NULL) || (selectors == NULL)) {
+    puts("out of memory");
+    return(1);
+  }
+  for (x = 0; x < rulescount; x++) {
+    genpattern(pattern, sizeof(pattern), x);
+    if ((router_add(router, pattern, "handler") != 0) || (regcomp(&(regexes[x]), pattern, REG_EXTENDED | REG_NOSUB) != 0)) {
+      printf("failed to add rule '%s'\n", pattern);
+      return(1);
+    }
+  }
+  for (x = 0; x < selectorscount; x++) {
+    genselector(pattern, sizeof(pattern), x, rulescount);
+    selectors[x] = strdup(pattern);
+  }
+
+  puts("check escaped special chars in literals...");
+  mismatches = checkescapes();
+  if (mismatches != 0) {
+    printf("%d errors found!\n", mismatches);
+    return(1);
+  }
+
+  puts("check that both engines agree...");
+  for (x = 0; x < selectorscount; x++) {
+    int r1 = router_match(router, selectors[x], 0);
+    int r2 = -1;
+    for (y = 0; y < rulescount; y++) {
+      if (regexec(&(regexes[y]), selectors[x], 0, NULL, 0) == 0) {
+        r2 = y;
+        break;
+      }
+    }
+    if (r1 != r2) {
+      if (mismatches++ < 10) printf("  MISMATCH: '%s' -> router=%d regexec=%d\n", selectors[x], r1, r2);
+    }
+  }
+  if (mismatches != 0) {
+    printf("%d mismatches found!\n", mismatches);
+    return(1);
+  }
+
+  printf("benchmark %d x %d selectors...\n", iterations, selectorscount);
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    for (x = 0; x < selectorscount; x++) checksum += router_match(router, selectors[x], 0);
+  }
+  t_router = now() - t0;
+
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    for (x = 0; x < selectorscount; x++) {
+      for (y = 0; y < rulescount; y++) {
+        if (regexec(&(regexes[y]), selectors[x], 0, NULL, 0) == 0) break;
+      }
+      checksum += y;
+    }
+  }
+  t_regex = now() - t0;
+
+  printf("  router:  %12.0f selectors/s\n", (double)iterations * selectorscount / t_router);
+  printf("  regexec: %12.0f selectors/s\n", (double)iterations * selectorscount / t_regex);
+  printf("  speedup: %.1fx\n", t_regex / t_router);
+
+  for (x = 0; x < rulescount; x++) regfree(&(regexes[x]));
+  for (x = 0; x < selectorscount; x++) free(selectors[x]);
+  free(regexes);
+  free(selectors);
+  router_free(router);
+  return(0);
+}
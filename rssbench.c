@@ -0,0 +1,178 @@
+/*
+ * Memory benchmark for motsognir: measures how much memory every connection
+ * costs.
+ *
+ * Opens many connections to a running server, all requesting the same
+ * selector, and reads only the first bytes of every answer. Each serving
+ * process then blocks as soon as its socket buffers are full, at the peak of
+ * its work, which leaves time to look at the memory usage of all of them
+ * (children of the given motsognir pid) through /proc, on Linux.
+ *
+ * For meaningful results, pick selectors whose answers do not fit in socket
+ * buffers (big text or binary files, huge directories...).
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define MAXCONNS 4096
+
+struct meminfo {
+  long hwm;      /* peak resident set size (VmHWM), in KiB */
+  long rss;      /* resident set size (VmRSS), in KiB */
+  long priv;     /* private (not shared with other processes) memory, in KiB */
+};
+
+
+/* reads the value (in KiB) of a 'key: value kB' line of a /proc file */
+static long readprocvalue(const char *file, const char *key) {
+  char linebuff[256];
+  size_t keylen = strlen(key);
+  long res = -1;
+  FILE *fd;
+  fd = fopen(file, "rb");
+  if (fd == NULL) return(-1);
+  while (fgets(linebuff, sizeof(linebuff), fd) != NULL) {
+    if ((strncmp(linebuff, key, keylen) == 0) && (linebuff[keylen] == ':')) {
+      res = atol(linebuff + keylen + 1);
+      break;
+    }
+  }
+  fclose(fd);
+  return(res);
+}
+
+
+/* returns the parent pid of a process, or -1 on error */
+static long getppidof(long pid) {
+  char file[64];
+  snprintf(file, sizeof(file), "/proc/%ld/status", pid);
+  return(readprocvalue(file, "PPid"));
+}
+
+
+/* collects memory stats of all children of ppid. returns their amount */
+static int collectchildren(long ppid, struct meminfo *infos, int maxinfos) {
+  struct dirent *ent;
+  DIR *dir;
+  int count = 0;
+  dir = opendir("/proc");
+  if (dir == NULL) return(0);
+  while (((ent = readdir(dir)) != NULL) && (count < maxinfos)) {
+    char file[64];
+    long pid = atol(ent->d_name), privclean, privdirty;
+    if ((pid <= 0) || (getppidof(pid) != ppid)) continue;
+    snprintf(file, sizeof(file), "/proc/%ld/status", pid);
+    infos[count].hwm = readprocvalue(file, "VmHWM");
+    infos[count].rss = readprocvalue(file, "VmRSS");
+    snprintf(file, sizeof(file), "/proc/%ld/smaps_rollup", pid);
+    privclean = readprocvalue(file, "Private_Clean");
+    privdirty = readprocvalue(file, "Private_Dirty");
+    infos[count].priv = ((privclean < 0) || (privdirty < 0)) ? -1 : privclean + privdirty;
+    if (infos[count].hwm >= 0) count++;
+  }
+  closedir(dir);
+  return(count);
+}
+
+
+static int connectto(const char *host, int port) {
+  struct sockaddr_in addr;
+  int sock;
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0) return(-1);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if ((inet_pton(AF_INET, host, &(addr.sin_addr)) != 1) || (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+    close(sock);
+    return(-1);
+  }
+  return(sock);
+}
+
+
+static void help(void) {
+  puts("rssbench measures the memory used by every connection of a running motsognir server (Linux only).");
+  puts("");
+  puts("usage: rssbench [-n connections] [-h host] [-p port] pid selector");
+  puts("");
+  puts("  pid            pid of the motsognir process accepting connections");
+  puts("  -n connections amount of simultaneous connections (default: 100)");
+  puts("  -h host        IPv4 address of the server (default: 127.0.0.1)");
+  puts("  -p port        port of the server (default: 70)");
+}
+
+
+int main(int argc, char **argv) {
+  static int socks[MAXCONNS];
+  static struct meminfo infos[MAXCONNS];
+  const char *host = "127.0.0.1", *selector;
+  char buff[512];
+  long pid, sumhwm = 0, sumrss = 0, sumpriv = 0, maxhwm = 0, maxpriv = 0;
+  int conns = 100, port = 70, x, count, opened = 0;
+
+  for (x = 1; x < argc; x++) {
+    if ((strcmp(argv[x], "-n") == 0) && (x + 1 < argc)) {
+      conns = atoi(argv[++x]);
+    } else if ((strcmp(argv[x], "-h") == 0) && (x + 1 < argc)) {
+      host = argv[++x];
+    } else if ((strcmp(argv[x], "-p") == 0) && (x + 1 < argc)) {
+      port = atoi(argv[++x]);
+    } else {
+      break;
+    }
+  }
+  if ((x + 2 != argc) || (conns < 1) || (conns > MAXCONNS)) {
+    help();
+    return(1);
+  }
+  pid = atol(argv[x]);
+  selector = argv[x + 1];
+
+  /* open all connections, and read only the start of every answer */
+  for (x = 0; x < conns; x++) {
+    socks[x] = connectto(host, port);
+    if (socks[x] < 0) {
+      printf("connection #%d failed: %s\n", x + 1, strerror(errno));
+      break;
+    }
+    opened++;
+    snprintf(buff, sizeof(buff), "%s\r\n", selector);
+    if (send(socks[x], buff, strlen(buff), 0) < 0) break;
+  }
+  for (x = 0; x < opened; x++) {
+    if (recv(socks[x], buff, sizeof(buff), 0) < 0) printf("connection #%d: recv() failed\n", x + 1);
+  }
+  sleep(1); /* let servers fill their socket buffers */
+
+  count = collectchildren(pid, infos, MAXCONNS);
+  for (x = 0; x < count; x++) {
+    sumhwm += infos[x].hwm;
+    sumrss += infos[x].rss;
+    sumpriv += infos[x].priv;
+    if (infos[x].hwm > maxhwm) maxhwm = infos[x].hwm;
+    if (infos[x].priv > maxpriv) maxpriv = infos[x].priv;
+  }
+  printf("%d connections, %d serving processes still alive\n", opened, count);
+  if (count > 0) {
+    printf("  peak RSS:       %8ld KiB avg, %8ld KiB max\n", sumhwm / count, maxhwm);
+    printf("  current RSS:    %8ld KiB avg\n", sumrss / count);
+    printf("  private memory: %8ld KiB avg, %8ld KiB max (%ld KiB for all connections)\n", sumpriv / count, maxpriv, sumpriv);
+  }
+
+  for (x = 0; x < opened; x++) close(socks[x]);
+  return((count > 0) ? 0 : 1);
+}
@@ -0,0 +1,354 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a scoreboard of server activity, shared by all motsognir processes.
+ *
+ * The scoreboard lives in anonymous memory mapped with MAP_SHARED before the
+ * first fork, so every process serving a request updates the same counters
+ * (with atomic additions, no locking). Every process also claims a slot for
+ * the time of its request, holding its client address and selector, so the
+ * report can tell what the server is busy with right now. Slots of processes
+ * that died without releasing them are detected with kill(pid, 0).
+ *
+ * The time every request takes to reach each of its phases (see accesslog.h)
+ * is aggregated into histograms, one per class of request and per phase.
+ * Histograms are log-linear, like HDR histograms: values below 32 us are
+ * counted exactly, and every power of two above is split into 16 buckets, so
+ * percentiles are reported with about 6% precision, from 1 us to an hour.
+ */
+
+#include <errno.h>
+#include <signal.h>      /* kill() */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>       /* snprintf() */
+#include <string.h>      /* memset() */
+#include <time.h>
+#include <unistd.h>      /* getpid() */
+#include <sys/mman.h>    /* mmap() */
+#include <sys/resource.h> /* getrusage() */
+#include <sys/types.h>
+
+#include "accesslog.h"   /* accesslog_getbytes(), accesslog_failed() */
+#include "scoreboard.h"  /* include self for control */
+
+#define SCOREBOARD_SLOTS 256
+#define SCOREBOARD_LISTMAX 64  /* max amount of active requests in reports */
+#define REPORT_LINEMAX 128     /* longest line of a report, but active requests */
+
+#define HIST_SUBBITS 4
+#define HIST_SUB (1 << HIST_SUBBITS)
+#define HIST_BUCKETS (2 * HIST_SUB + (32 - HIST_SUBBITS - 1) * HIST_SUB)  /* covers 32-bit values */
+
+struct sbslot {
+  volatile pid_t pid;  /* 0 if the slot is free */
+  int32_t reserved;
+  int64_t started;     /* monotonic time, in ms */
+  char client[48];
+  char selector[112];
+};
+
+struct scoreboard_t {
+  int64_t started;     /* wall clock time */
+  volatile int32_t active;
+  int32_t reserved;
+  volatile uint64_t connections;
+  volatile uint64_t totalrequests; /* more than connections with HTTP keep-alive */
+  volatile uint64_t bytes;
+  volatile uint64_t errors;
+  volatile uint64_t cpuuser;   /* CPU time of completed requests, in us */
+  volatile uint64_t cpusystem;
+  volatile uint64_t requests[SCOREBOARD_CLASSES];
+  struct sbslot slots[SCOREBOARD_SLOTS];
+  volatile uint32_t latency[SCOREBOARD_CLASSES][ACCESSLOG_PHASES][HIST_BUCKETS];  /* in us */
+};
+
+static const char *classnames[SCOREBOARD_CLASSES] = {"other", "menu", "text", "binary", "search", "cgi", "plugin", "http", "evasion"};
+
+/* the connection served by the current process, and its current request */
+static struct {
+  struct scoreboard_t *sb;
+  struct sbslot *slot;
+  pid_t pid;
+  int inrequest;  /* non-zero while a request is going on */
+  int reqclass;
+  long cpuuser;   /* CPU time used before the request began, in us */
+  long cpusystem;
+} cur;
+
+
+/* returns the CPU time used by this process and by the children it waited
+ * for (CGI scripts), in us */
+static void cputime(long *user, long *system) {
+  struct rusage ru;
+  *user = 0;
+  *system = 0;
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+    *user += ru.ru_utime.tv_sec * 1000000L + ru.ru_utime.tv_usec;
+    *system += ru.ru_stime.tv_sec * 1000000L + ru.ru_stime.tv_usec;
+  }
+  if (getrusage(RUSAGE_CHILDREN, &ru) == 0) {
+    *user += ru.ru_utime.tv_sec * 1000000L + ru.ru_utime.tv_usec;
+    *system += ru.ru_stime.tv_sec * 1000000L + ru.ru_stime.tv_usec;
+  }
+}
+
+
+static int64_t monotonicms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+
+/* returns the histogram bucket of a value */
+static int bucketof(uint32_t v) {
+  int e;
+  if (v < 2 * HIST_SUB) return(v);
+  for (e = HIST_SUBBITS + 2; (e < 32) && ((v >> e) != 0); e++); /* e = amount of significant bits */
+  return(2 * HIST_SUB + (e - HIST_SUBBITS - 2) * HIST_SUB + (int)(v >> (e - HIST_SUBBITS - 1)) - HIST_SUB);
+}
+
+
+/* returns the highest value counted in a bucket */
+static unsigned long bucketmax(int idx) {
+  int e;
+  if (idx < 2 * HIST_SUB) return(idx);
+  idx -= 2 * HIST_SUB;
+  e = idx / HIST_SUB + HIST_SUBBITS + 2;
+  return((((unsigned long)(idx % HIST_SUB + HIST_SUB + 1)) << (e - HIST_SUBBITS - 1)) - 1);
+}
+
+
+/* computes a few percentiles of a histogram (p50, p90, p99 and max, in
+ * this order). returns the amount of values in the histogram */
+static unsigned long percentiles(const volatile uint32_t *hist, unsigned long *res) {
+  static const double quantiles[4] = {0.50, 0.90, 0.99, 1.0};
+  uint32_t copy[HIST_BUCKETS];
+  unsigned long total = 0, cumul = 0;
+  int x, q = 0;
+  for (x = 0; x < HIST_BUCKETS; x++) {
+    copy[x] = hist[x];
+    total += copy[x];
+  }
+  for (x = 0; x < 4; x++) res[x] = 0;
+  if (total == 0) return(0);
+  for (x = 0; (x < HIST_BUCKETS) && (q < 4); x++) {
+    cumul += copy[x];
+    while ((q < 4) && (cumul > 0) && (cumul >= quantiles[q] * total)) res[q++] = bucketmax(x);
+  }
+  return(total);
+}
+
+
+/* returns non-zero if a slot is held by a live process */
+static int slotalive(const struct sbslot *slot) {
+  pid_t pid = slot->pid;
+  if (pid == 0) return(0);
+  return((kill(pid, 0) == 0) || (errno == EPERM));
+}
+
+
+struct scoreboard_t *scoreboard_open(void) {
+  struct scoreboard_t *sb;
+  sb = mmap(NULL, sizeof(struct scoreboard_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+  if (sb == MAP_FAILED) return(NULL);
+  memset(sb, 0, sizeof(struct scoreboard_t));
+  sb->started = time(NULL);
+  return(sb);
+}
+
+
+void scoreboard_begin(struct scoreboard_t *sb, const char *client) {
+  int x;
+  if (sb == NULL) return;
+  cur.sb = sb;
+  cur.pid = getpid();
+  cur.inrequest = 1;
+  cur.reqclass = SCOREBOARD_OTHER;
+  cputime(&(cur.cpuuser), &(cur.cpusystem));
+  __sync_fetch_and_add(&(sb->connections), 1);
+  __sync_fetch_and_add(&(sb->active), 1);
+  /* claim a free slot, or one left behind by a dead process (if all are
+   * busy, this request is simply not listed) */
+  for (x = 0; x < SCOREBOARD_SLOTS; x++) {
+    pid_t owner = sb->slots[x].pid;
+    if ((owner != 0) && (slotalive(&(sb->slots[x])) != 0)) continue;
+    if (__sync_bool_compare_and_swap(&(sb->slots[x].pid), owner, cur.pid) == 0) continue;
+    cur.slot = &(sb->slots[x]);
+    cur.slot->started = monotonicms();
+    snprintf(cur.slot->client, sizeof(cur.slot->client), "%s", client);
+    cur.slot->selector[0] = 0;
+    break;
+  }
+}
+
+
+void scoreboard_beginrequest(void) {
+  if ((cur.sb == NULL) || (cur.pid != getpid()) || (cur.inrequest != 0)) return;
+  cur.inrequest = 1;
+  cur.reqclass = SCOREBOARD_OTHER;
+  cputime(&(cur.cpuuser), &(cur.cpusystem));
+  if (cur.slot != NULL) {
+    cur.slot->started = monotonicms();
+    cur.slot->selector[0] = 0;
+  }
+}
+
+
+void scoreboard_setselector(const char *selector) {
+  int x;
+  if (cur.slot == NULL) return;
+  /* control chars are replaced, so reports stay one line per request */
+  for (x = 0; (selector[x] != 0) && (x < (int)sizeof(cur.slot->selector) - 1); x++) {
+    cur.slot->selector[x] = ((unsigned char)selector[x] < 0x20) ? '?' : selector[x];
+  }
+  cur.slot->selector[x] = 0;
+}
+
+
+void scoreboard_setclass(int reqclass) {
+  if ((reqclass >= 0) && (reqclass < SCOREBOARD_CLASSES)) cur.reqclass = reqclass;
+}
+
+
+int scoreboard_getclass(void) {
+  return(cur.reqclass);
+}
+
+
+void scoreboard_endrequest(void) {
+  struct scoreboard_t *sb = cur.sb;
+  long user, system;
+  int x;
+  if ((sb == NULL) || (cur.pid != getpid()) || (cur.inrequest == 0)) return;
+  cur.inrequest = 0;
+  __sync_fetch_and_add(&(sb->totalrequests), 1);
+  __sync_fetch_and_add(&(sb->requests[cur.reqclass]), 1);
+  __sync_fetch_and_add(&(sb->bytes), accesslog_getbytes());
+  if (accesslog_failed() != 0) __sync_fetch_and_add(&(sb->errors), 1);
+  for (x = 0; x < ACCESSLOG_PHASES; x++) {
+    long us = accesslog_getphase(x);
+    if (us < 0) continue;
+    if (us > 0xFFFFFFFFL) us = 0xFFFFFFFFL;
+    __sync_fetch_and_add(&(sb->latency[cur.reqclass][x][bucketof(us)]), 1);
+  }
+  /* CPU time of this process, and of the CGI scripts it waited for, since
+   * the request began (a process may serve several requests in a row) */
+  cputime(&user, &system);
+  __sync_fetch_and_add(&(sb->cpuuser), user - cur.cpuuser);
+  __sync_fetch_and_add(&(sb->cpusystem), system - cur.cpusystem);
+}
+
+
+void scoreboard_end(void) {
+  struct scoreboard_t *sb = cur.sb;
+  if ((sb == NULL) || (cur.pid != getpid())) return;
+  scoreboard_endrequest();
+  cur.sb = NULL;
+  __sync_fetch_and_sub(&(sb->active), 1);
+  if (cur.slot != NULL) cur.slot->pid = 0;
+}
+
+
+/* appends a formatted string to buff (of buffsize bytes, holding len bytes
+ * already). returns the new length, or -1 if the string does not fit (or if
+ * len is -1 already, so calls can be chained) */
+static int append(char *buff, int len, int buffsize, const char *fmt, ...) {
+  va_list args;
+  int res;
+  if ((len < 0) || (len >= buffsize)) return(-1);
+  va_start(args, fmt);
+  res = vsnprintf(buff + len, buffsize - len, fmt, args);
+  va_end(args);
+  if ((res < 0) || (res >= buffsize - len)) {
+    buff[len] = 0;
+    return(-1);
+  }
+  return(len + res);
+}
+
+
+int scoreboard_reportsize(const struct scoreboard_t *sb, int format) {
+  int x, y, hists = 0, lines;
+  unsigned long p[4];
+  for (x = 0; x < SCOREBOARD_CLASSES; x++) {
+    for (y = 0; y < ACCESSLOG_PHASES; y++) {
+      if (percentiles(sb->latency[x][y], p) != 0) hists++;
+    }
+  }
+  if (format == SCOREBOARD_KEYVALUE) {
+    lines = 8 + SCOREBOARD_CLASSES + hists * 5;
+    return(lines * REPORT_LINEMAX + 1);
+  }
+  lines = 10 + SCOREBOARD_CLASSES * 2 + hists + 1;
+  return(lines * REPORT_LINEMAX + SCOREBOARD_LISTMAX * (int)(sizeof(sb->slots[0].client) + sizeof(sb->slots[0].selector) + REPORT_LINEMAX) + 1);
+}
+
+
+int scoreboard_report(const struct scoreboard_t *sb, char *buff, int buffsize, int format, const char *eol) {
+  long uptime = time(NULL) - sb->started;
+  int64_t now = monotonicms();
+  unsigned long p[4], count;
+  int len = 0, x, y, listed = 0;
+
+  if (buffsize <= 0) return(-1);
+  buff[0] = 0;
+  if (format == SCOREBOARD_KEYVALUE) {
+    len = append(buff, len, buffsize, "uptime=%ld%s", uptime, eol);
+    len = append(buff, len, buffsize, "active=%d%s", (int)sb->active, eol);
+    len = append(buff, len, buffsize, "connections=%lu%s", (unsigned long)sb->connections, eol);
+    len = append(buff, len, buffsize, "requests=%lu%s", (unsigned long)sb->totalrequests, eol);
+    len = append(buff, len, buffsize, "bytes=%lu%s", (unsigned long)sb->bytes, eol);
+    len = append(buff, len, buffsize, "errors=%lu%s", (unsigned long)sb->errors, eol);
+    len = append(buff, len, buffsize, "cpu.user=%lu%s", (unsigned long)sb->cpuuser, eol);
+    len = append(buff, len, buffsize, "cpu.system=%lu%s", (unsigned long)sb->cpusystem, eol);
+    for (x = 0; x < SCOREBOARD_CLASSES; x++) len = append(buff, len, buffsize, "requests.%s=%lu%s", classnames[x], (unsigned long)sb->requests[x], eol);
+    /* latencies, in us since connections were accepted */
+    for (x = 0; x < SCOREBOARD_CLASSES; x++) {
+      for (y = 0; y < ACCESSLOG_PHASES; y++) {
+        count = percentiles(sb->latency[x][y], p);
+        if (count == 0) continue;
+        len = append(buff, len, buffsize, "latency.%s.%s.count=%lu%s", classnames[x], accesslog_phasename(y), count, eol);
+        len = append(buff, len, buffsize, "latency.%s.%s.p50=%lu%s", classnames[x], accesslog_phasename(y), p[0], eol);
+        len = append(buff, len, buffsize, "latency.%s.%s.p90=%lu%s", classnames[x], accesslog_phasename(y), p[1], eol);
+        len = append(buff, len, buffsize, "latency.%s.%s.p99=%lu%s", classnames[x], accesslog_phasename(y), p[2], eol);
+        len = append(buff, len, buffsize, "latency.%s.%s.max=%lu%s", classnames[x], accesslog_phasename(y), p[3], eol);
+      }
+    }
+  } else {
+    len = append(buff, len, buffsize, "Uptime:             %ldd %02ld:%02ld:%02ld%s", uptime / 86400, (uptime / 3600) % 24, (uptime / 60) % 60, uptime % 60, eol);
+    len = append(buff, len, buffsize, "Active connections: %d%s", (int)sb->active, eol);
+    len = append(buff, len, buffsize, "Total connections:  %lu%s", (unsigned long)sb->connections, eol);
+    len = append(buff, len, buffsize, "Total requests:     %lu%s", (unsigned long)sb->totalrequests, eol);
+    len = append(buff, len, buffsize, "Bytes sent:         %lu (%.1f MiB)%s", (unsigned long)sb->bytes, sb->bytes / 1048576.0, eol);
+    len = append(buff, len, buffsize, "Errors:             %lu%s", (unsigned long)sb->errors, eol);
+    len = append(buff, len, buffsize, "CPU time:           %.3fs user, %.3fs system%s", sb->cpuuser / 1000000.0, sb->cpusystem / 1000000.0, eol);
+    len = append(buff, len, buffsize, "%sRequests by class:%s", eol, eol);
+    for (x = 0; x < SCOREBOARD_CLASSES; x++) len = append(buff, len, buffsize, "  %-10s %lu%s", classnames[x], (unsigned long)sb->requests[x], eol);
+    len = append(buff, len, buffsize, "%sLatencies (ms since accept: p50 / p90 / p99 / max):%s", eol, eol);
+    for (x = 0; x < SCOREBOARD_CLASSES; x++) {
+      if (sb->requests[x] == 0) continue;
+      len = append(buff, len, buffsize, "  %s%s", classnames[x], eol);
+      for (y = 0; y < ACCESSLOG_PHASES; y++) {
+        count = percentiles(sb->latency[x][y], p);
+        if (count == 0) continue;
+        len = append(buff, len, buffsize, "    %-10s %9.3f / %9.3f / %9.3f / %9.3f  (%lu)%s", accesslog_phasename(y), p[0] / 1000.0, p[1] / 1000.0, p[2] / 1000.0, p[3] / 1000.0, count, eol);
+      }
+    }
+    len = append(buff, len, buffsize, "%sActive requests:%s", eol, eol);
+    len = append(buff, len, buffsize, "  %-7s %9s  %-40s %s%s", "pid", "seconds", "client", "selector", eol);
+    for (x = 0; (x < SCOREBOARD_SLOTS) && (listed < SCOREBOARD_LISTMAX); x++) {
+      struct sbslot slot;
+      if (slotalive(&(sb->slots[x])) == 0) continue;
+      /* work on a copy, the slot may change at any time */
+      memcpy(&slot, (const void *)&(sb->slots[x]), sizeof(slot));
+      slot.client[sizeof(slot.client) - 1] = 0;
+      slot.selector[sizeof(slot.selector) - 1] = 0;
+      len = append(buff, len, buffsize, "  %-7ld %9.1f  %-40s %s%s", (long)slot.pid, (now - slot.started) / 1000.0, slot.client, slot.selector, eol);
+      listed++;
+    }
+  }
+  return(len);
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a scoreboard of server activity, shared by all motsognir processes
+ */
+
+#ifndef scoreboard_h_sentinel
+#define scoreboard_h_sentinel
+
+/* classes of requests */
+#define SCOREBOARD_OTHER   0
+#define SCOREBOARD_MENU    1  /* directory listings and gophermaps */
+#define SCOREBOARD_TEXT    2
+#define SCOREBOARD_BINARY  3
+#define SCOREBOARD_SEARCH  4
+#define SCOREBOARD_CGI     5
+#define SCOREBOARD_PLUGIN  6
+#define SCOREBOARD_HTTP    7  /* HTTP requests, rejected (or malformed, in HTTP gateway mode) */
+#define SCOREBOARD_EVASION 8  /* requests blocked for escaping the gopher root */
+#define SCOREBOARD_CLASSES 9
+
+/* report formats */
+#define SCOREBOARD_TEXTREPORT 0  /* for humans */
+#define SCOREBOARD_KEYVALUE   1  /* one key=value pair per line */
+
+struct scoreboard_t;
+
+/* allocates a scoreboard in memory shared with all the processes forked
+ * afterwards. returns NULL on error */
+struct scoreboard_t *scoreboard_open(void);
+
+/* the functions below account the request served by the current process.
+ * all of them do nothing if sb is NULL */
+
+/* registers a new connection, from the given client address, and begins
+ * its first request */
+void scoreboard_begin(struct scoreboard_t *sb, const char *client);
+
+/* begins another request on the connection registered with
+ * scoreboard_begin(), once the previous one was completed with
+ * scoreboard_endrequest() (HTTP keep-alive) */
+void scoreboard_beginrequest(void);
+
+/* sets the selector of the current request */
+void scoreboard_setselector(const char *selector);
+
+/* sets the class of the current request (SCOREBOARD_OTHER by default) */
+void scoreboard_setclass(int reqclass);
+
+/* returns the class of the current request */
+int scoreboard_getclass(void);
+
+/* completes the accounting of the current request: bytes sent and the
+ * request's status are taken from the access log record (see accesslog.h),
+ * CPU time (of the process and of the CGI scripts it waited for, since the
+ * request began) from getrusage(). does nothing if no request is going on */
+void scoreboard_endrequest(void);
+
+/* completes the current request, if any, and the connection. only the
+ * first call, made by the process that called scoreboard_begin(), does
+ * anything, so this can be set up with atexit() */
+void scoreboard_end(void);
+
+/* returns the size of a buffer large enough for a report in the given
+ * format, as of now: it grows with the amount of latency histograms that
+ * hold values */
+int scoreboard_reportsize(const struct scoreboard_t *sb, int format);
+
+/* writes a report of the scoreboard into buff, lines being terminated by
+ * eol (of up to 2 chars). returns the length of the report, or -1 if buff is
+ * too small for it (histograms may fill up between scoreboard_reportsize()
+ * and this call) */
+int scoreboard_report(const struct scoreboard_t *sb, char *buff, int buffsize, int format, const char *eol);
+
+#endif
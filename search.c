@@ -0,0 +1,796 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a full-text search engine over a gopher root.
+ *
+ * Searchable documents are text files and the items of gophermaps. The index
+ * is a single file, meant to be mapped in memory, that holds a table of
+ * documents and a sorted table of terms, each term pointing to its postings
+ * list: (docid, term frequency) pairs, docids being delta-encoded, all as
+ * variable-length integers. Results are ranked with BM25.
+ *
+ * When an index is rebuilt, text files and gophermaps whose size and mtime
+ * did not change are not read again: their documents and postings are taken
+ * over from the previous index.
+ *
+ * File layout (host byte order, it is a local cache):
+ *   header: char magic[8], u32 doccount, u32 termcount, u32 docsoffset,
+ *           u32 termsoffset, u64 totallen (sum of the length of all docs)
+ *   docs:   u64 srcmtime, u64 srcsize, u32 source, u32 desc, u32 selector,
+ *           u32 server, u32 port, u32 len (in terms), u32 type, u32 reserved
+ *   terms:  u32 term, u32 postings, u32 df
+ *   then strings (NUL-terminated) and postings, pointed by the above offsets
+ */
+
+#include <errno.h>
+#include <fcntl.h>       /* open() */
+#include <math.h>        /* log() */
+#include <stdint.h>
+#include <stdio.h>       /* fopen(), fgets(), rename() */
+#include <stdlib.h>      /* malloc(), realloc(), qsort(), free() */
+#include <string.h>
+#include <unistd.h>      /* read(), write(), close(), unlink(), getpid() */
+#include <sys/mman.h>    /* mmap() */
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "dirlist.h"
+#include "search.h"      /* include self for control */
+
+#define SEARCH_MAGIC "MOTSSRC1"
+#define HEADERLEN 32
+#define DOCLEN 48
+#define TERMLEN 12
+#define MAXTOKEN 32               /* longer words are cut */
+#define MAXQUERYTERMS 16
+#define MAXFILEREAD (1024 * 1024) /* only the beginning of huge files is indexed */
+
+/* BM25 parameters */
+#define BM25_K1 1.2
+#define BM25_B  0.75
+
+struct search_t {
+  const unsigned char *map;
+  size_t maplen;
+  uint32_t doccount;
+  uint32_t termcount;
+  uint32_t docsoffset;
+  uint32_t termsoffset;
+  double avglen;
+};
+
+struct sdoc {
+  char type;
+  char *desc;
+  char *selector;
+  char *server;
+  char *source;
+  long port;
+  uint64_t srcmtime;
+  uint64_t srcsize;
+  uint32_t len;
+};
+
+struct sterm {
+  char *str;
+  uint32_t *post;   /* (docid, tf) pairs */
+  uint32_t count;   /* amount of pairs */
+  uint32_t alloc;
+  uint32_t lastdoc;
+};
+
+struct builder {
+  const char *root;
+  const struct extmap_t *extmap;
+  struct sdoc *docs;
+  long doccount;
+  long docalloc;
+  struct sterm *terms;      /* hash table */
+  unsigned long termalloc;  /* always a power of 2 */
+  unsigned long termcount;
+  uint64_t totallen;
+  const struct search_t *old;
+  int32_t *oldsources;      /* hash table: first docid of every old source */
+  unsigned long oldsourcesalloc;
+  uint32_t *oldmap;         /* old docid -> new docid + 1 (0 if dropped) */
+  struct search_stats *stats;
+  int failed;
+};
+
+struct buff {
+  unsigned char *data;
+  size_t len;
+  size_t alloc;
+};
+
+
+static unsigned long hashstr(const char *s, size_t len) {
+  unsigned long h = 2166136261u;
+  size_t x;
+  for (x = 0; x < len; x++) {
+    h ^= (unsigned char)s[x];
+    h *= 16777619u;
+  }
+  return(h);
+}
+
+
+static uint32_t rd32(const unsigned char *p) {
+  uint32_t r;
+  memcpy(&r, p, 4);
+  return(r);
+}
+
+
+static uint64_t rd64(const unsigned char *p) {
+  uint64_t r;
+  memcpy(&r, p, 8);
+  return(r);
+}
+
+
+/* returns a string stored in the index (or an empty string if the offset is invalid) */
+static const char *rdstr(const struct search_t *obj, uint32_t offset) {
+  if (offset >= obj->maplen) return("");
+  return((const char *)obj->map + offset);
+}
+
+
+static int isword(unsigned char c) {
+  if ((c >= 'a') && (c <= 'z')) return(1);
+  if ((c >= 'A') && (c <= 'Z')) return(1);
+  if ((c >= '0') && (c <= '9')) return(1);
+  if (c >= 0x80) return(1);  /* UTF-8 sequences are kept as-is */
+  return(0);
+}
+
+
+/* splits text into lower-cased terms of at least 2 bytes, and calls
+ * callback() for each of them. returns the amount of terms found. */
+static uint32_t tokenize(const char *text, size_t len, void (*callback)(void *, const char *, int), void *arg) {
+  char tok[MAXTOKEN];
+  int toklen = 0;
+  uint32_t count = 0;
+  size_t x;
+  for (x = 0; x <= len; x++) {
+    unsigned char c = (x < len) ? text[x] : ' ';
+    if (isword(c) != 0) {
+      if ((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+      if (toklen < MAXTOKEN) tok[toklen++] = c;
+      continue;
+    }
+    if (toklen >= 2) {
+      callback(arg, tok, toklen);
+      count++;
+    }
+    toklen = 0;
+  }
+  return(count);
+}
+
+
+/*** index building ***/
+
+/* looks up a term in the builder's hash table, inserting it if needed.
+ * returns NULL on out of memory */
+static struct sterm *getterm(struct builder *b, const char *tok, int len) {
+  unsigned long h;
+  struct sterm *t;
+  /* keep the hash table at most half full */
+  if ((b->termcount + 1) * 2 > b->termalloc) {
+    struct sterm *newterms;
+    unsigned long newalloc = (b->termalloc == 0) ? 4096 : b->termalloc * 2, x;
+    newterms = calloc(newalloc, sizeof(struct sterm));
+    if (newterms == NULL) return(NULL);
+    for (x = 0; x < b->termalloc; x++) {
+      if (b->terms[x].str == NULL) continue;
+      h = hashstr(b->terms[x].str, strlen(b->terms[x].str)) & (newalloc - 1);
+      while (newterms[h].str != NULL) h = (h + 1) & (newalloc - 1);
+      newterms[h] = b->terms[x];
+    }
+    free(b->terms);
+    b->terms = newterms;
+    b->termalloc = newalloc;
+  }
+  h = hashstr(tok, len) & (b->termalloc - 1);
+  for (;;) {
+    t = &(b->terms[h]);
+    if (t->str == NULL) break;
+    if ((strncmp(t->str, tok, len) == 0) && (t->str[len] == 0)) return(t);
+    h = (h + 1) & (b->termalloc - 1);
+  }
+  t->str = malloc(len + 1);
+  if (t->str == NULL) return(NULL);
+  memcpy(t->str, tok, len);
+  t->str[len] = 0;
+  b->termcount++;
+  return(t);
+}
+
+
+static int addposting(struct sterm *t, uint32_t docid, uint32_t tf) {
+  if (t->count == t->alloc) {
+    uint32_t *newpost;
+    uint32_t newalloc = t->alloc * 2 + 4;
+    newpost = realloc(t->post, newalloc * 2 * sizeof(uint32_t));
+    if (newpost == NULL) return(-1);
+    t->post = newpost;
+    t->alloc = newalloc;
+  }
+  t->post[t->count * 2] = docid;
+  t->post[t->count * 2 + 1] = tf;
+  t->count++;
+  t->lastdoc = docid;
+  return(0);
+}
+
+
+/* tokenize() callback: accounts a term for the last document */
+static void indexterm(void *arg, const char *tok, int len) {
+  struct builder *b = arg;
+  uint32_t docid = b->doccount - 1;
+  struct sterm *t;
+  t = getterm(b, tok, len);
+  if (t == NULL) {
+    b->failed = 1;
+    return;
+  }
+  if ((t->count > 0) && (t->lastdoc == docid)) {
+    t->post[(t->count - 1) * 2 + 1]++;
+  } else if (addposting(t, docid, 1) != 0) {
+    b->failed = 1;
+  }
+}
+
+
+/* appends a new document. returns NULL on out of memory */
+static struct sdoc *adddoc(struct builder *b, char type, const char *desc, const char *selector, const char *server, long port, const char *source, const struct stat *st) {
+  struct sdoc *d;
+  if (b->doccount == b->docalloc) {
+    struct sdoc *newdocs;
+    long newalloc = b->docalloc * 2 + 256;
+    newdocs = realloc(b->docs, newalloc * sizeof(struct sdoc));
+    if (newdocs == NULL) return(NULL);
+    b->docs = newdocs;
+    b->docalloc = newalloc;
+  }
+  d = &(b->docs[b->doccount]);
+  memset(d, 0, sizeof(struct sdoc));
+  d->type = type;
+  d->desc = strdup(desc);
+  d->selector = strdup(selector);
+  d->server = strdup(server);
+  d->source = strdup(source);
+  d->port = port;
+  d->srcmtime = st->st_mtime;
+  d->srcsize = st->st_size;
+  b->doccount++;
+  if ((d->desc == NULL) || (d->selector == NULL) || (d->server == NULL) || (d->source == NULL)) return(NULL);
+  return(d);
+}
+
+
+/* takes over the documents of a source from the previous index, if it did
+ * not change since. returns non-zero if it did. */
+static int reusesource(struct builder *b, const char *source, const struct stat *st) {
+  const struct search_t *old = b->old;
+  unsigned long h;
+  int32_t docid;
+  if (b->oldsources == NULL) return(0);
+  h = hashstr(source, strlen(source)) & (b->oldsourcesalloc - 1);
+  for (;;) {
+    docid = b->oldsources[h];
+    if (docid < 0) return(0);
+    if (strcmp(rdstr(old, rd32(old->map + old->docsoffset + docid * DOCLEN + 16)), source) == 0) break;
+    h = (h + 1) & (b->oldsourcesalloc - 1);
+  }
+  /* documents of a source are stored one after another */
+  for (; (uint32_t)docid < old->doccount; docid++) {
+    const unsigned char *rec = old->map + old->docsoffset + docid * DOCLEN;
+    struct sdoc *d;
+    if (strcmp(rdstr(old, rd32(rec + 16)), source) != 0) break;
+    if ((rd64(rec) != (uint64_t)st->st_mtime) || (rd64(rec + 8) != (uint64_t)st->st_size)) return(0);
+    d = adddoc(b, rd32(rec + 40), rdstr(old, rd32(rec + 20)), rdstr(old, rd32(rec + 24)), rdstr(old, rd32(rec + 28)), rd32(rec + 32), source, st);
+    if (d == NULL) {
+      b->failed = 1;
+      return(1);
+    }
+    d->len = rd32(rec + 36);
+    b->totallen += d->len;
+    b->oldmap[docid] = b->doccount;
+  }
+  if (b->stats != NULL) b->stats->reused++;
+  return(1);
+}
+
+
+static void indextextfile(struct builder *b, const char *path, const char *source, const struct stat *st) {
+  struct sdoc *d;
+  char *content;
+  long len;
+  int fd;
+  d = adddoc(b, '0', source + 1, source, "", 0, source, st);
+  if (d == NULL) {
+    b->failed = 1;
+    return;
+  }
+  /* the file's path is searchable, too */
+  d->len = tokenize(source, strlen(source), indexterm, b);
+  fd = open(path, O_RDONLY);
+  content = malloc(MAXFILEREAD);
+  if ((fd >= 0) && (content != NULL)) {
+    len = read(fd, content, MAXFILEREAD);
+    if (len > 0) d->len += tokenize(content, len, indexterm, b);
+  }
+  free(content);
+  if (fd >= 0) close(fd);
+  b->totallen += d->len;
+}
+
+
+/* splits a gophermap line in place. returns non-zero if the line is not a link */
+static int splitgophermapline(char *line, char **fields) {
+  int x, f = 1;
+  fields[0] = line + 1;
+  for (x = 1; x < 4; x++) fields[x] = "";
+  for (; *line != 0; line++) {
+    if (*line != '\t') continue;
+    *line = 0;
+    if (f == 4) break;
+    fields[f++] = line + 1;
+  }
+  if (f < 2) return(-1);  /* no selector at all */
+  return(0);
+}
+
+
+static void indexgophermap(struct builder *b, const char *path, const char *source, const struct stat *st) {
+  char line[4096];
+  char *fields[4];
+  FILE *fd;
+  fd = fopen(path, "rb");
+  if (fd == NULL) return;
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    struct sdoc *d;
+    char type = line[0];
+    line[strcspn(line, "\r\n")] = 0;
+    if ((type == 0) || (type == '#') || (type == '=') || (type == 'i') || (type == '3') || (type == '%')) continue;
+    if (splitgophermapline(line, fields) != 0) continue;
+    if (fields[0][0] == 0) continue;
+    d = adddoc(b, type, fields[0], fields[1], fields[2], atol(fields[3]), source, st);
+    if (d == NULL) {
+      b->failed = 1;
+      break;
+    }
+    d->len = tokenize(fields[0], strlen(fields[0]), indexterm, b);
+    b->totallen += d->len;
+  }
+  fclose(fd);
+}
+
+
+static int walkfilter(const char *name) {
+  return(name[0] != '.');
+}
+
+
+/* walks a directory (relpath starts and ends with a '/') */
+static void walk(struct builder *b, const char *relpath) {
+  struct dirlist_t *dirlist;
+  char path[4096], source[4096];
+  int x;
+  snprintf(path, sizeof(path), "%s%s", b->root, relpath);
+  dirlist = dirlist_load(path, walkfilter);
+  if (dirlist == NULL) return;
+  for (x = 0; (x < dirlist_count(dirlist)) && (b->failed == 0); x++) {
+    const char *name = dirlist_name(dirlist, x);
+    const char *ext;
+    struct stat st;
+    snprintf(source, sizeof(source), "%s%s", relpath, name);
+    if (dirlist_isdir(dirlist, x) != 0) {
+      strncat(source, "/", sizeof(source) - strlen(source) - 1);
+      walk(b, source);
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s%s", b->root, source);
+    if ((stat(path, &st) != 0) || (!S_ISREG(st.st_mode))) continue;
+    if (strcmp(name, "gophermap") == 0) {
+      if (b->stats != NULL) b->stats->sources++;
+      if (reusesource(b, source, &st) == 0) indexgophermap(b, path, source, &st);
+      continue;
+    }
+    ext = strrchr(name, '.');
+    if (extmap_lookup(b->extmap, (ext != NULL) ? ext + 1 : "") != '0') continue;
+    if (b->stats != NULL) b->stats->sources++;
+    if (reusesource(b, source, &st) == 0) indextextfile(b, path, source, &st);
+  }
+  dirlist_free(dirlist);
+}
+
+
+/* moves the postings of reused documents from the old index to the new one */
+static void transferpostings(struct builder *b) {
+  const struct search_t *old = b->old;
+  uint32_t x, y;
+  for (x = 0; (x < old->termcount) && (b->failed == 0); x++) {
+    const unsigned char *rec = old->map + old->termsoffset + x * TERMLEN;
+    const char *str = rdstr(old, rd32(rec));
+    const unsigned char *p = old->map + rd32(rec + 4);
+    const unsigned char *end = old->map + old->maplen;
+    uint32_t df = rd32(rec + 8), docid = 0;
+    struct sterm *t = NULL;
+    for (y = 0; y < df; y++) {
+      uint32_t delta = 0, tf = 0;
+      int shift;
+      for (shift = 0; (p < end) && (shift < 32); shift += 7) {
+        delta |= (uint32_t)(*p & 127) << shift;
+        if ((*(p++) & 128) == 0) break;
+      }
+      for (shift = 0; (p < end) && (shift < 32); shift += 7) {
+        tf |= (uint32_t)(*p & 127) << shift;
+        if ((*(p++) & 128) == 0) break;
+      }
+      docid += delta;
+      if ((docid >= old->doccount) || (b->oldmap[docid] == 0)) continue;
+      if (t == NULL) t = getterm(b, str, strlen(str));
+      if ((t == NULL) || (addposting(t, b->oldmap[docid] - 1, tf) != 0)) {
+        b->failed = 1;
+        break;
+      }
+    }
+  }
+}
+
+
+static int buff_append(struct buff *bf, const void *data, size_t len) {
+  if (bf->len + len > bf->alloc) {
+    unsigned char *newdata;
+    size_t newalloc = bf->alloc * 2 + len + 65536;
+    newdata = realloc(bf->data, newalloc);
+    if (newdata == NULL) return(-1);
+    bf->data = newdata;
+    bf->alloc = newalloc;
+  }
+  memcpy(bf->data + bf->len, data, len);
+  bf->len += len;
+  return(0);
+}
+
+
+/* appends a string, and returns its offset in the file */
+static uint32_t buff_str(struct buff *bf, size_t base, const char *s, int *failed) {
+  uint32_t res = base + bf->len;
+  if (buff_append(bf, s, strlen(s) + 1) != 0) *failed = 1;
+  return(res);
+}
+
+
+static int buff_varint(struct buff *bf, uint32_t v) {
+  unsigned char tmp[5];
+  int len = 0;
+  do {
+    tmp[len] = v & 127;
+    v >>= 7;
+    if (v != 0) tmp[len] |= 128;
+    len++;
+  } while (v != 0);
+  return(buff_append(bf, tmp, len));
+}
+
+
+static int termcmp(const void *a, const void *b) {
+  return(strcmp((*(const struct sterm * const *)a)->str, (*(const struct sterm * const *)b)->str));
+}
+
+
+static int postcmp(const void *a, const void *b) {
+  uint32_t da = ((const uint32_t *)a)[0], db = ((const uint32_t *)b)[0];
+  if (da < db) return(-1);
+  return(da > db);
+}
+
+
+static int writeindex(struct builder *b, const char *indexfile) {
+  struct buff head = {NULL, 0, 0}, blob = {NULL, 0, 0};
+  struct sterm **sorted;
+  char tmpfile[4096];
+  size_t blobbase;
+  unsigned long x, y;
+  uint32_t u32;
+  int failed = 0, fd;
+
+  sorted = malloc((b->termcount + 1) * sizeof(struct sterm *));
+  if (sorted == NULL) return(-1);
+  for (x = 0, y = 0; x < b->termalloc; x++) {
+    if (b->terms[x].str != NULL) sorted[y++] = &(b->terms[x]);
+  }
+  qsort(sorted, b->termcount, sizeof(struct sterm *), termcmp);
+
+  /* the blob (strings and postings) comes right after the fixed-size tables */
+  blobbase = HEADERLEN + b->doccount * DOCLEN + b->termcount * TERMLEN;
+  failed |= buff_append(&head, SEARCH_MAGIC, 8);
+  u32 = b->doccount;
+  failed |= buff_append(&head, &u32, 4);
+  u32 = b->termcount;
+  failed |= buff_append(&head, &u32, 4);
+  u32 = HEADERLEN;
+  failed |= buff_append(&head, &u32, 4);
+  u32 = HEADERLEN + b->doccount * DOCLEN;
+  failed |= buff_append(&head, &u32, 4);
+  failed |= buff_append(&head, &(b->totallen), 8);
+
+  for (x = 0; (long)x < b->doccount; x++) {
+    const struct sdoc *d = &(b->docs[x]);
+    uint32_t rec[8];
+    failed |= buff_append(&head, &(d->srcmtime), 8);
+    failed |= buff_append(&head, &(d->srcsize), 8);
+    rec[0] = buff_str(&blob, blobbase, d->source, &failed);
+    rec[1] = buff_str(&blob, blobbase, d->desc, &failed);
+    rec[2] = buff_str(&blob, blobbase, d->selector, &failed);
+    rec[3] = buff_str(&blob, blobbase, d->server, &failed);
+    rec[4] = d->port;
+    rec[5] = d->len;
+    rec[6] = (unsigned char)d->type;
+    rec[7] = 0;
+    failed |= buff_append(&head, rec, sizeof(rec));
+  }
+
+  for (x = 0; x < b->termcount; x++) {
+    struct sterm *t = sorted[x];
+    uint32_t rec[3], prev = 0;
+    rec[0] = buff_str(&blob, blobbase, t->str, &failed);
+    rec[1] = blobbase + blob.len;
+    rec[2] = t->count;
+    qsort(t->post, t->count, 2 * sizeof(uint32_t), postcmp);
+    for (y = 0; y < t->count; y++) {
+      failed |= buff_varint(&blob, t->post[y * 2] - prev);
+      failed |= buff_varint(&blob, t->post[y * 2 + 1]);
+      prev = t->post[y * 2];
+    }
+    failed |= buff_append(&head, rec, sizeof(rec));
+  }
+  free(sorted);
+  if ((failed == 0) && (blobbase + blob.len > 0xFFFFFFFFu)) failed = 1; /* offsets are 32 bits */
+
+  /* write the index to a temporary file first, then move it in place */
+  if (failed == 0) {
+    snprintf(tmpfile, sizeof(tmpfile), "%s.%ld.tmp", indexfile, (long)getpid());
+    fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      failed = 1;
+    } else {
+      if ((write(fd, head.data, head.len) != (ssize_t)head.len) || (write(fd, blob.data, blob.len) != (ssize_t)blob.len)) failed = 1;
+      close(fd);
+      if ((failed != 0) || (rename(tmpfile, indexfile) != 0)) {
+        failed = 1;
+        unlink(tmpfile);
+      }
+    }
+  }
+  free(head.data);
+  free(blob.data);
+  return(failed);
+}
+
+
+int search_build(const char *root, const char *indexfile, const struct extmap_t *extmap, struct search_stats *stats) {
+  struct builder b;
+  char rootbuff[4096];
+  unsigned long x;
+  int res;
+
+  memset(&b, 0, sizeof(b));
+  /* the root is used without any trailing '/' */
+  snprintf(rootbuff, sizeof(rootbuff), "%s", root);
+  while ((rootbuff[0] != 0) && (rootbuff[strlen(rootbuff) - 1] == '/')) rootbuff[strlen(rootbuff) - 1] = 0;
+  b.root = rootbuff;
+  b.extmap = extmap;
+  b.stats = stats;
+  if (stats != NULL) memset(stats, 0, sizeof(struct search_stats));
+
+  /* load the previous index, if any, and hash its sources */
+  b.old = search_open(indexfile);
+  if ((b.old != NULL) && (b.old->doccount > 0)) {
+    uint32_t docid;
+    b.oldmap = calloc(b.old->doccount, sizeof(uint32_t));
+    for (b.oldsourcesalloc = 1024; b.oldsourcesalloc < b.old->doccount * 2; b.oldsourcesalloc *= 2);
+    b.oldsources = malloc(b.oldsourcesalloc * sizeof(int32_t));
+    if ((b.oldmap == NULL) || (b.oldsources == NULL)) {
+      free(b.oldsources);
+      b.oldsources = NULL;
+    } else {
+      const char *prevsource = NULL;
+      memset(b.oldsources, 0xFF, b.oldsourcesalloc * sizeof(int32_t));
+      for (docid = 0; docid < b.old->doccount; docid++) {
+        const char *source = rdstr(b.old, rd32(b.old->map + b.old->docsoffset + docid * DOCLEN + 16));
+        unsigned long h;
+        if ((prevsource != NULL) && (strcmp(prevsource, source) == 0)) continue;
+        prevsource = source;
+        h = hashstr(source, strlen(source)) & (b.oldsourcesalloc - 1);
+        while (b.oldsources[h] >= 0) h = (h + 1) & (b.oldsourcesalloc - 1);
+        b.oldsources[h] = docid;
+      }
+    }
+  }
+
+  walk(&b, "/");
+  if ((b.failed == 0) && (b.oldsources != NULL)) transferpostings(&b);
+
+  res = b.failed;
+  if (res == 0) res = writeindex(&b, indexfile);
+  if (stats != NULL) {
+    stats->docs = b.doccount;
+    stats->terms = b.termcount;
+  }
+
+  /* clean up */
+  for (x = 0; (long)x < b.doccount; x++) {
+    free(b.docs[x].desc);
+    free(b.docs[x].selector);
+    free(b.docs[x].server);
+    free(b.docs[x].source);
+  }
+  free(b.docs);
+  for (x = 0; x < b.termalloc; x++) {
+    free(b.terms[x].str);
+    free(b.terms[x].post);
+  }
+  free(b.terms);
+  free(b.oldsources);
+  free(b.oldmap);
+  if (b.old != NULL) search_close((struct search_t *)b.old);
+  return(res);
+}
+
+
+/*** searching ***/
+
+struct search_t *search_open(const char *indexfile) {
+  struct search_t *obj;
+  struct stat st;
+  void *map;
+  int fd;
+  fd = open(indexfile, O_RDONLY);
+  if (fd < 0) return(NULL);
+  if ((fstat(fd, &st) != 0) || (st.st_size < HEADERLEN)) {
+    close(fd);
+    return(NULL);
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return(NULL);
+  obj = malloc(sizeof(struct search_t));
+  if (obj == NULL) {
+    munmap(map, st.st_size);
+    return(NULL);
+  }
+  obj->map = map;
+  obj->maplen = st.st_size;
+  obj->doccount = rd32(obj->map + 8);
+  obj->termcount = rd32(obj->map + 12);
+  obj->docsoffset = rd32(obj->map + 16);
+  obj->termsoffset = rd32(obj->map + 20);
+  obj->avglen = 1;
+  if (obj->doccount > 0) obj->avglen = (double)rd64(obj->map + 24) / obj->doccount;
+  if (obj->avglen <= 0) obj->avglen = 1;
+  /* validate the header */
+  if ((memcmp(map, SEARCH_MAGIC, 8) != 0)
+   || ((uint64_t)obj->docsoffset + (uint64_t)obj->doccount * DOCLEN > obj->maplen)
+   || ((uint64_t)obj->termsoffset + (uint64_t)obj->termcount * TERMLEN > obj->maplen)) {
+    search_close(obj);
+    return(NULL);
+  }
+  return(obj);
+}
+
+
+struct queryterms {
+  char terms[MAXQUERYTERMS][MAXTOKEN + 1];
+  int count;
+};
+
+
+/* tokenize() callback: collects distinct query terms */
+static void queryterm(void *arg, const char *tok, int len) {
+  struct queryterms *q = arg;
+  int x;
+  if (q->count == MAXQUERYTERMS) return;
+  for (x = 0; x < q->count; x++) {
+    if ((strncmp(q->terms[x], tok, len) == 0) && (q->terms[x][len] == 0)) return;
+  }
+  memcpy(q->terms[q->count], tok, len);
+  q->terms[q->count][len] = 0;
+  q->count++;
+}
+
+
+/* returns the index of a term in the terms table, or -1 if not found */
+static long findterm(const struct search_t *obj, const char *term) {
+  long lo = 0, hi = (long)obj->termcount - 1;
+  while (lo <= hi) {
+    long mid = (lo + hi) / 2;
+    int cmp = strcmp(rdstr(obj, rd32(obj->map + obj->termsoffset + mid * TERMLEN)), term);
+    if (cmp == 0) return(mid);
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return(-1);
+}
+
+
+int search_query(const struct search_t *obj, const char *query, struct search_result *results, int maxresults) {
+  struct queryterms q;
+  float *scores;
+  uint32_t x, y;
+  int t, count = 0;
+
+  if ((maxresults < 1) || (obj->doccount == 0)) return(0);
+  q.count = 0;
+  tokenize(query, strlen(query), queryterm, &q);
+  if (q.count == 0) return(0);
+  scores = calloc(obj->doccount, sizeof(float));
+  if (scores == NULL) return(0);
+
+  /* BM25 scoring */
+  for (t = 0; t < q.count; t++) {
+    long termid = findterm(obj, q.terms[t]);
+    const unsigned char *rec, *p, *end = obj->map + obj->maplen;
+    uint32_t df, docid = 0;
+    double idf;
+    if (termid < 0) continue;
+    rec = obj->map + obj->termsoffset + termid * TERMLEN;
+    p = obj->map + rd32(rec + 4);
+    df = rd32(rec + 8);
+    idf = log(1.0 + (obj->doccount - df + 0.5) / (df + 0.5));
+    for (y = 0; (y < df) && (p < end); y++) {
+      uint32_t delta = 0, tf = 0, doclen;
+      int shift;
+      for (shift = 0; (p < end) && (shift < 32); shift += 7) {
+        delta |= (uint32_t)(*p & 127) << shift;
+        if ((*(p++) & 128) == 0) break;
+      }
+      for (shift = 0; (p < end) && (shift < 32); shift += 7) {
+        tf |= (uint32_t)(*p & 127) << shift;
+        if ((*(p++) & 128) == 0) break;
+      }
+      docid += delta;
+      if (docid >= obj->doccount) break;
+      doclen = rd32(obj->map + obj->docsoffset + docid * DOCLEN + 36);
+      scores[docid] += idf * (tf * (BM25_K1 + 1)) / (tf + BM25_K1 * (1 - BM25_B + BM25_B * doclen / obj->avglen));
+    }
+  }
+
+  /* keep the best results, sorted by decreasing score */
+  for (x = 0; x < obj->doccount; x++) {
+    int pos;
+    if (scores[x] <= 0) continue;
+    if ((count == maxresults) && (scores[x] <= results[count - 1].score)) continue;
+    pos = (count < maxresults) ? count++ : count - 1;
+    for (; (pos > 0) && (results[pos - 1].score < scores[x]); pos--) results[pos] = results[pos - 1];
+    results[pos].score = scores[x];
+    results[pos].docid = x;  /* details are filled below */
+  }
+  free(scores);
+
+  for (t = 0; t < count; t++) {
+    const unsigned char *rec = obj->map + obj->docsoffset + results[t].docid * DOCLEN;
+    results[t].source = rdstr(obj, rd32(rec + 16));
+    results[t].desc = rdstr(obj, rd32(rec + 20));
+    results[t].selector = rdstr(obj, rd32(rec + 24));
+    results[t].server = rdstr(obj, rd32(rec + 28));
+    results[t].port = rd32(rec + 32);
+    results[t].type = rd32(rec + 40);
+  }
+  return(count);
+}
+
+
+void search_close(struct search_t *obj) {
+  if (obj == NULL) return;
+  munmap((void *)obj->map, obj->maplen);
+  free(obj);
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a full-text search engine over a gopher root
+ */
+
+#ifndef search_h_sentinel
+#define search_h_sentinel
+
+#include "extmap.h"
+
+struct search_t;
+
+struct search_result {
+  char type;
+  const char *desc;
+  const char *selector;
+  const char *server;
+  long port;
+  const char *source;  /* local path (relative to the gopher root) of the
+                          text file or gophermap the result comes from */
+  unsigned long docid; /* position of the document in the index */
+  double score;
+};
+
+struct search_stats {
+  long sources;       /* text files and gophermaps found */
+  long reused;        /* sources that did not change since last indexing */
+  long docs;          /* searchable documents (files and gophermap items) */
+  long terms;         /* distinct terms */
+};
+
+/* builds the search index of the gopher root (text files, as recognized by
+ * extmap, and the items of gophermaps) and writes it to indexfile. if
+ * indexfile already exists, sources that did not change since are not read
+ * again. stats may be NULL. returns 0 on success, non-zero otherwise */
+int search_build(const char *root, const char *indexfile, const struct extmap_t *extmap, struct search_stats *stats);
+
+/* maps a search index in memory. returns NULL on error */
+struct search_t *search_open(const char *indexfile);
+
+/* runs a query, and fills results with up to maxresults documents, best
+ * first. returns the amount of results */
+int search_query(const struct search_t *obj, const char *query, struct search_result *results, int maxresults);
+
+/* unmaps a search index */
+void search_close(struct search_t *obj);
+
+#endif
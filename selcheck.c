@@ -0,0 +1,228 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a single-pass validation kernel for gopher selectors.
+ *
+ * All checks (length, control chars, TAB sequences and UTF-8 validity) are
+ * performed while walking the selector once. On x86 the selector is loaded
+ * by aligned blocks of 16 (SSE2) or 32 (AVX2) bytes, and each block is turned
+ * into a few bit masks (NUL, control chars, TABs, non-ASCII). Pure ASCII
+ * blocks are then validated with a couple of bit operations, and only blocks
+ * that contain non-ASCII bytes go through the UTF-8 state machine. Aligned
+ * loads never cross a page boundary, hence reading the few bytes that follow
+ * the NUL terminator is harmless.
+ */
+
+#include <stddef.h>      /* size_t */
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SELCHECK_X86
+#include <immintrin.h>
+#endif
+
+#include "selcheck.h"    /* include self for control */
+
+/* UTF-8 decoder states (RFC 3629) */
+#define U8_OK       0  /* not inside of a sequence */
+#define U8_NEED1    1  /* one continuation byte expected */
+#define U8_NEED2    2  /* two continuation bytes expected */
+#define U8_NEED3    3  /* three continuation bytes expected */
+#define U8_E0       4  /* after E0: A0..BF expected (no overlong) */
+#define U8_ED       5  /* after ED: 80..9F expected (no surrogates) */
+#define U8_F0       6  /* after F0: 90..BF expected (no overlong) */
+#define U8_F4       7  /* after F4: 80..8F expected (max U+10FFFF) */
+#define U8_BAD      8
+
+struct scanstate {
+  int flags;
+  int len;
+  int utf8;
+  int prevtab;
+};
+
+
+static int utf8step(int state, unsigned char c) {
+  switch (state) {
+    case U8_OK:
+      if (c < 0x80) return(U8_OK);
+      if ((c >= 0xC2) && (c <= 0xDF)) return(U8_NEED1);
+      if (c == 0xE0) return(U8_E0);
+      if (c == 0xED) return(U8_ED);
+      if ((c >= 0xE1) && (c <= 0xEF)) return(U8_NEED2);
+      if (c == 0xF0) return(U8_F0);
+      if (c == 0xF4) return(U8_F4);
+      if ((c >= 0xF1) && (c <= 0xF3)) return(U8_NEED3);
+      return(U8_BAD);
+    case U8_NEED1:
+    case U8_NEED2:
+    case U8_NEED3:
+      if ((c & 0xC0) == 0x80) return(state - 1);
+      return(U8_BAD);
+    case U8_E0:
+      if ((c >= 0xA0) && (c <= 0xBF)) return(U8_NEED1);
+      return(U8_BAD);
+    case U8_ED:
+      if ((c >= 0x80) && (c <= 0x9F)) return(U8_NEED1);
+      return(U8_BAD);
+    case U8_F0:
+      if ((c >= 0x90) && (c <= 0xBF)) return(U8_NEED2);
+      return(U8_BAD);
+    case U8_F4:
+      if ((c >= 0x80) && (c <= 0x8F)) return(U8_NEED2);
+      return(U8_BAD);
+  }
+  return(U8_BAD);
+}
+
+
+/* computes the final result once the whole selector has been scanned */
+static int scanresult(const struct scanstate *st) {
+  int res = st->flags;
+  if (st->len > SELCHECK_MAXLEN) return(SELCHECK_TOOLONG);
+  if (st->prevtab != 0) res |= SELCHECK_TRAILINGTAB;
+  if (st->utf8 != U8_OK) res |= SELCHECK_BADUTF8;
+  return(res);
+}
+
+
+int selcheck_scan_scalar(const char *s) {
+  struct scanstate st;
+  const unsigned char *p = (const unsigned char *)s;
+  st.flags = 0;
+  st.utf8 = U8_OK;
+  st.prevtab = 0;
+  for (st.len = 0; p[st.len] != 0; st.len++) {
+    unsigned char c = p[st.len];
+    if (st.len == SELCHECK_MAXLEN) return(SELCHECK_TOOLONG);
+    if (c == '\t') {
+      if (st.prevtab != 0) st.flags |= SELCHECK_DOUBLETAB;
+      st.prevtab = 1;
+    } else {
+      st.prevtab = 0;
+    }
+    if ((c > 0) && (c < 32)) st.flags |= SELCHECK_CTRLCHAR;
+    if ((c >= 0x80) || (st.utf8 != U8_OK)) st.utf8 = utf8step(st.utf8, c);
+  }
+  return(scanresult(&st));
+}
+
+
+#ifdef SELCHECK_X86
+
+/* processes one block of w bytes (w <= 32), described by its bit masks (bit
+ * n stands for byte n). returns non-zero once the end of the selector (or of
+ * the allowed length) has been reached. */
+static int scanmasks(struct scanstate *st, const unsigned char *blk, int w, unsigned int zero, unsigned int ctrl, unsigned int tab, unsigned int high) {
+  unsigned int valid = 0xFFFFFFFFu;
+  int end = w, x;
+  if (zero != 0) {
+    end = __builtin_ctz(zero);
+    valid = (1u << end) - 1;
+  } else if (w < 32) {
+    valid = (1u << w) - 1;
+  }
+  ctrl &= valid;
+  tab &= valid;
+  high &= valid;
+  st->len += end;
+  if (st->len > SELCHECK_MAXLEN) return(1);
+  if (ctrl != 0) st->flags |= SELCHECK_CTRLCHAR;
+  if (((tab & (tab >> 1)) != 0) || ((st->prevtab != 0) && ((tab & 1) != 0))) st->flags |= SELCHECK_DOUBLETAB;
+  if (end > 0) st->prevtab = (tab >> (end - 1)) & 1;
+  /* non-ASCII bytes (or a sequence started in a previous block) */
+  if ((high != 0) || (st->utf8 != U8_OK)) {
+    x = 0;
+    if (st->utf8 == U8_OK) x = __builtin_ctz(high);
+    for (; x < end; x++) st->utf8 = utf8step(st->utf8, blk[x]);
+  }
+  return(zero != 0);
+}
+
+
+int selcheck_scan_sse2(const char *s) {
+  struct scanstate st;
+  const unsigned char *blk;
+  int skip;
+  const __m128i nul = _mm_setzero_si128();
+  const __m128i space = _mm_set1_epi8(32);
+  const __m128i tabs = _mm_set1_epi8('\t');
+  st.flags = 0;
+  st.len = 0;
+  st.utf8 = U8_OK;
+  st.prevtab = 0;
+  blk = (const unsigned char *)((size_t)s & ~(size_t)15);
+  skip = (const unsigned char *)s - blk;
+  for (;;) {
+    __m128i v = _mm_load_si128((const __m128i *)blk);
+    unsigned int zero = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nul));
+    unsigned int ctrl = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, nul), _mm_cmplt_epi8(v, space)));
+    unsigned int tab = _mm_movemask_epi8(_mm_cmpeq_epi8(v, tabs));
+    unsigned int high = _mm_movemask_epi8(v);
+    if (scanmasks(&st, blk + skip, 16 - skip, zero >> skip, ctrl >> skip, tab >> skip, high >> skip) != 0) break;
+    blk += 16;
+    skip = 0;
+  }
+  return(scanresult(&st));
+}
+
+
+__attribute__((target("avx2"))) static int scan_avx2(const char *s) {
+  struct scanstate st;
+  const unsigned char *blk;
+  int skip;
+  const __m256i nul = _mm256_setzero_si256();
+  const __m256i space = _mm256_set1_epi8(32);
+  const __m256i tabs = _mm256_set1_epi8('\t');
+  st.flags = 0;
+  st.len = 0;
+  st.utf8 = U8_OK;
+  st.prevtab = 0;
+  blk = (const unsigned char *)((size_t)s & ~(size_t)31);
+  skip = (const unsigned char *)s - blk;
+  for (;;) {
+    __m256i v = _mm256_load_si256((const __m256i *)blk);
+    unsigned int zero = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nul));
+    unsigned int ctrl = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(v, nul), _mm256_cmpgt_epi8(space, v)));
+    unsigned int tab = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, tabs));
+    unsigned int high = _mm256_movemask_epi8(v);
+    if (scanmasks(&st, blk + skip, 32 - skip, zero >> skip, ctrl >> skip, tab >> skip, high >> skip) != 0) break;
+    blk += 32;
+    skip = 0;
+  }
+  return(scanresult(&st));
+}
+
+
+int selcheck_scan_avx2(const char *s) {
+  if (__builtin_cpu_supports("avx2") == 0) return(-1);
+  return(scan_avx2(s));
+}
+
+
+int selcheck_scan(const char *s) {
+  static int hasavx2 = -1;
+  if (hasavx2 < 0) hasavx2 = (__builtin_cpu_supports("avx2") != 0);
+  if (hasavx2 != 0) return(scan_avx2(s));
+  return(selcheck_scan_sse2(s));
+}
+
+#else
+
+int selcheck_scan_sse2(const char *s) {
+  (void)s;
+  return(-1);
+}
+
+
+int selcheck_scan_avx2(const char *s) {
+  (void)s;
+  return(-1);
+}
+
+
+int selcheck_scan(const char *s) {
+  return(selcheck_scan_scalar(s));
+}
+
+#endif
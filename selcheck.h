@@ -0,0 +1,33 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a single-pass validation kernel for gopher selectors
+ */
+
+#ifndef selcheck_h_sentinel
+#define selcheck_h_sentinel
+
+/* longest selector that is accepted (in bytes) */
+#define SELCHECK_MAXLEN 512
+
+/* flags returned by the selcheck_scan*() functions */
+#define SELCHECK_TOOLONG     1   /* selector longer than SELCHECK_MAXLEN */
+#define SELCHECK_DOUBLETAB   2   /* two TABs in a row */
+#define SELCHECK_TRAILINGTAB 4   /* last char is a TAB */
+#define SELCHECK_CTRLCHAR    8   /* a char in the 1..31 range */
+#define SELCHECK_BADUTF8    16   /* invalid, overlong or truncated UTF-8 */
+
+/* scans a NUL-terminated selector in a single pass and returns a combination
+ * of SELCHECK_* flags (0 if the selector is clean). the scan stops as soon as
+ * the selector is known to be too long, in which case SELCHECK_TOOLONG is
+ * returned alone. uses the fastest implementation the CPU supports. */
+int selcheck_scan(const char *s);
+
+/* the individual implementations, exposed for testing. the SIMD versions are
+ * only available on x86 and return -1 if the CPU does not support them. */
+int selcheck_scan_scalar(const char *s);
+int selcheck_scan_sse2(const char *s);
+int selcheck_scan_avx2(const char *s);
+
+#endif
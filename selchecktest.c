@@ -0,0 +1,201 @@
+/*
+ * Test & benchmark application for the selector validation kernel.
+ *
+ * Feeds random selectors to all available implementations of the kernel and
+ * checks that they agree, then compares their speed with the legacy,
+ * multi-pass gophersecuritycheck() logic.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "selcheck.h"
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+/* the legacy checks (as motsognir performed them up to v1.0.11) */
+static int legacy_scan(const char *s) {
+  int x;
+  if (strlen(s) > 512) return(SELCHECK_TOOLONG);
+  if (strstr(s, "\t\t") != NULL) return(SELCHECK_DOUBLETAB);
+  if ((s[0] != 0) && (s[strlen(s) - 1] == '\t')) return(SELCHECK_TRAILINGTAB);
+  for (x = 0; s[x] != 0; x++) {
+    if ((s[x] > 0) && (s[x] < 32)) return(SELCHECK_CTRLCHAR);
+    if ((s[x] & 0x80) == 0) continue;
+    if ((s[x] & 0xE0) == 0xC0) {
+      if ((s[x+1] & 0xC0) == 0x80) {
+        x += 1;
+        continue;
+      }
+    } else if ((s[x] & 0xF0) == 0xE0) {
+      if (((s[x+1] & 0xC0) == 0x80) && ((s[x+2] & 0xC0) == 0x80)) {
+        x += 2;
+        continue;
+      }
+    }
+    return(SELCHECK_BADUTF8);
+  }
+  return(0);
+}
+
+
+/* picks a random byte, biased towards the ones that matter to the kernel */
+static unsigned char randbyte(void) {
+  static const unsigned char special[] = {'\t', '\t', 1, 31, 32, 127, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC1, 0xC2, 0xDF, 0xE0, 0xE1, 0xED, 0xEF, 0xF0, 0xF1, 0xF4, 0xF5, 0xFF};
+  switch (rand() % 4) {
+    case 0:
+      return(special[rand() % sizeof(special)]);
+    case 1:
+      return(0x80 + (rand() % 0x40)); /* continuation byte */
+    default:
+      return(33 + (rand() % 94));
+  }
+}
+
+
+/* generates a random selector of len bytes */
+static void randselector(char *s, int len) {
+  int x;
+  for (x = 0; x < len; x++) s[x] = randbyte();
+  s[len] = 0;
+  /* most of the time, keep things mostly valid so the interesting paths are hit */
+  if (rand() % 2) {
+    for (x = 0; x < len; x++) {
+      if (((unsigned char)s[x] >= 0x80) && (rand() % 4 != 0)) s[x] = 'a';
+      if ((s[x] == '\t') && (rand() % 4 != 0)) s[x] = 'b';
+    }
+  }
+}
+
+
+static int checkvector(const char *s, int expected) {
+  int r = selcheck_scan(s);
+  if (r != expected) {
+    printf("  FAILED: vector '%s' -> %d (expected %d)\n", s, r, expected);
+    return(1);
+  }
+  return(0);
+}
+
+
+int main(int argc, char **argv) {
+  static char buff[1024 + 64];
+  char **selectors;
+  int selectorscount = 1000, iterations = 2000, fuzzcount = 2000000;
+  int x, i, len, r1, r2, r3, errors = 0;
+  volatile long checksum = 0;
+  double t0, t_legacy, t_scalar, t_sse2, t_avx2 = 0;
+
+  if (argc > 1) fuzzcount = atoi(argv[1]);
+  if (argc > 2) iterations = atoi(argv[2]);
+  if ((fuzzcount < 0) || (iterations < 1)) {
+    puts("selchecktest is a simple tool to test and benchmark motsognir's selector validation kernel.");
+    puts("usage: selchecktest [fuzz_iterations] [bench_iterations]");
+    return(1);
+  }
+
+  puts("check known vectors...");
+  errors += checkvector("/some/dir/file.txt", 0);
+  errors += checkvector("/f\xC3\xA9te/\xE2\x82\xAC/\xF0\x9F\x98\x80.txt", 0);  /* 2, 3 and 4 bytes */
+  errors += checkvector("/\xF4\x8F\xBF\xBF", 0);                               /* U+10FFFF */
+  errors += checkvector("/\xC0\xAF", SELCHECK_BADUTF8);                        /* overlong '/' */
+  errors += checkvector("/\xE0\x80\xAF", SELCHECK_BADUTF8);                    /* overlong '/' */
+  errors += checkvector("/\xF0\x80\x80\xAF", SELCHECK_BADUTF8);                /* overlong '/' */
+  errors += checkvector("/\xED\xA0\x80", SELCHECK_BADUTF8);                    /* surrogate */
+  errors += checkvector("/\xF4\x90\x80\x80", SELCHECK_BADUTF8);                /* > U+10FFFF */
+  errors += checkvector("/\xF0\x9F\x98", SELCHECK_BADUTF8);                    /* truncated */
+  errors += checkvector("/a\t\tb", SELCHECK_DOUBLETAB | SELCHECK_CTRLCHAR);
+  errors += checkvector("/a\tb\t", SELCHECK_TRAILINGTAB | SELCHECK_CTRLCHAR);
+  errors += checkvector("/a\rb", SELCHECK_CTRLCHAR);
+  memset(buff, 'a', 513);
+  buff[513] = 0;
+  errors += checkvector(buff, SELCHECK_TOOLONG);
+  buff[512] = 0;
+  errors += checkvector(buff, 0);
+
+  printf("fuzz %d random selectors...\n", fuzzcount);
+  for (i = 0; i < fuzzcount; i++) {
+    char *s = buff + (rand() % 64);  /* random alignment */
+    len = rand() % 600;
+    if (rand() % 2) len %= 40;
+    randselector(s, len);
+    r1 = selcheck_scan_scalar(s);
+    r2 = selcheck_scan_sse2(s);
+    r3 = selcheck_scan_avx2(s);
+    if (((r2 >= 0) && (r2 != r1)) || ((r3 >= 0) && (r3 != r1)) || (selcheck_scan(s) != r1)) {
+      if (errors++ < 10) printf("  MISMATCH: len=%d scalar=%d sse2=%d avx2=%d\n", len, r1, r2, r3);
+    }
+  }
+  if (errors != 0) {
+    printf("%d errors found!\n", errors);
+    return(1);
+  }
+
+  selectors = calloc(selectorscount, sizeof(char *));
+  if (selectors == NULL) {
+    puts("out of memory");
+    return(1);
+  }
+  for (x = 0; x < selectorscount; x++) {
+    switch (x % 4) {
+      case 0:
+        snprintf(buff, sizeof(buff), "/archive/%d/documents/readme.txt", x);
+        break;
+      case 1:
+        snprintf(buff, sizeof(buff), "/users/phlog/2019-%02d-%02d-f\xC3\xA9te-%d.txt", x % 12, x % 28, x);
+        break;
+      case 2:
+        snprintf(buff, sizeof(buff), "/software/mirror/%d/some/rather/deep/path/of/directories/package-%d.tar.gz", x, x);
+        break;
+      default:
+        snprintf(buff, sizeof(buff), "/%d", x);
+        break;
+    }
+    selectors[x] = strdup(buff);
+  }
+
+  printf("benchmark %d x %d selectors...\n", iterations, selectorscount);
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    for (x = 0; x < selectorscount; x++) checksum += legacy_scan(selectors[x]);
+  }
+  t_legacy = now() - t0;
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    for (x = 0; x < selectorscount; x++) checksum += selcheck_scan_scalar(selectors[x]);
+  }
+  t_scalar = now() - t0;
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    for (x = 0; x < selectorscount; x++) checksum += selcheck_scan_sse2(selectors[x]);
+  }
+  t_sse2 = now() - t0;
+  if (selcheck_scan_avx2("") >= 0) {
+    t0 = now();
+    for (i = 0; i < iterations; i++) {
+      for (x = 0; x < selectorscount; x++) checksum += selcheck_scan_avx2(selectors[x]);
+    }
+    t_avx2 = now() - t0;
+  }
+
+  printf("  legacy:  %12.0f selectors/s\n", (double)iterations * selectorscount / t_legacy);
+  printf("  scalar:  %12.0f selectors/s\n", (double)iterations * selectorscount / t_scalar);
+  if (selcheck_scan_sse2("") >= 0) printf("  sse2:    %12.0f selectors/s\n", (double)iterations * selectorscount / t_sse2);
+  if (t_avx2 > 0) printf("  avx2:    %12.0f selectors/s\n", (double)iterations * selectorscount / t_avx2);
+
+  for (x = 0; x < selectorscount; x++) free(selectors[x]);
+  free(selectors);
+  return(0);
+}
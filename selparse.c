@@ -0,0 +1,89 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a single-pass parser for gopher selectors.
+ *
+ * A selector is made of a path, optionally followed by a URL query (after a
+ * '?') and by a search query (after a TAB). The path is percent-decoded and
+ * its slashes are collapsed while being copied, so the whole selector is
+ * walked exactly once.
+ */
+
+#include <stddef.h>      /* NULL */
+
+#include "selparse.h"    /* include self for control */
+
+
+/* Decodes a single hex character (0..F) and returns its value. Returns -1 if
+ * the character is invalid. */
+static int hex2int(char ch) {
+  if ((ch >= '0') && (ch <= '9')) return(ch - '0');
+  if ((ch >= 'A') && (ch <= 'F')) return(ch - 'A' + 10);
+  if ((ch >= 'a') && (ch <= 'f')) return(ch - 'a' + 10);
+  return(-1);
+}
+
+
+int selparse(struct selparse_t *res, char *selector, char *pathbuff, char urldelim) {
+  char *s = selector, *p = pathbuff;
+  int hi, lo;
+  char ch;
+
+  res->path = pathbuff;
+  res->urlquery = NULL;
+  res->searchquery = NULL;
+  res->flags = 0;
+
+  /* a path always starts with a '/' */
+  *p++ = '/';
+
+  /* path: everything up to the first '?', urldelim or TAB */
+  for (; (*s != 0) && (*s != '?') && (*s != '\t') && ((*s != urldelim) || (urldelim == 0)); s++) {
+    ch = *s;
+    if (ch == '+') {
+      ch = ' ';
+    } else if (ch == '%') {
+      if ((s[1] == 0) || (s[2] == 0)) {
+        res->flags |= SELPARSE_BADPERCENT;
+        break;
+      }
+      if ((s[1] == '0') && (s[2] == '0')) { /* NUL chars shall never be decoded */
+        res->flags |= SELPARSE_NULPERCENT;
+        break;
+      }
+      hi = hex2int(s[1]);
+      lo = hex2int(s[2]);
+      if ((hi < 0) || (lo < 0)) {
+        res->flags |= SELPARSE_BADPERCENT;
+        break;
+      }
+      ch = (hi << 4) | lo;
+      s += 2;
+    }
+    if ((ch == '/') && (p[-1] == '/')) continue; /* collapse '//' sequences */
+    *p++ = ch;
+  }
+  *p = 0;
+  if (res->flags & (SELPARSE_BADPERCENT | SELPARSE_NULPERCENT)) return(-1);
+
+  /* URL query: everything up to the first TAB */
+  if ((*s != 0) && (*s != '\t')) {
+    *s++ = 0;
+    res->urlquery = s;
+    res->flags |= SELPARSE_URLQUERY;
+    while ((*s != 0) && (*s != '\t')) s++;
+  }
+
+  /* search query: everything up to the next TAB (gopher+ data, if any, is
+   * ignored) */
+  if (*s == '\t') {
+    *s++ = 0;
+    res->searchquery = s;
+    res->flags |= SELPARSE_SEARCHQUERY;
+    while ((*s != 0) && (*s != '\t')) s++;
+    *s = 0;
+  }
+
+  return(0);
+}
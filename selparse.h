@@ -0,0 +1,33 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a single-pass parser for gopher selectors
+ */
+
+#ifndef selparse_h_sentinel
+#define selparse_h_sentinel
+
+/* flags set by selparse() */
+#define SELPARSE_URLQUERY    1  /* a URL query ('?...') was present */
+#define SELPARSE_SEARCHQUERY 2  /* a search query (TAB...) was present */
+#define SELPARSE_BADPERCENT  4  /* truncated or invalid percent encoding */
+#define SELPARSE_NULPERCENT  8  /* percent encoding of a NUL char (%00) */
+
+struct selparse_t {
+  char *path;         /* percent-decoded path, always starting with a '/' and
+                         without any '//' sequence */
+  char *urlquery;     /* raw (not decoded) URL query, or NULL */
+  char *searchquery;  /* raw search query, or NULL */
+  int flags;          /* SELPARSE_* flags */
+};
+
+/* parses selector in a single pass, without allocating any memory. the path
+ * is written to pathbuff, which must be at least one byte longer than the
+ * selector. the URL and search queries are left in selector (terminated in
+ * place), and res points to them. urldelim is an alternative char that also
+ * starts a URL query (0 if none). returns 0 on success, non-zero if the
+ * percent encoding of the path is invalid (see res->flags for details). */
+int selparse(struct selparse_t *res, char *selector, char *pathbuff, char urldelim);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ * Test & benchmark application for the selector parser.
+ *
+ * Compares the single-pass parser against the legacy pipeline (prepend a '/',
+ * split queries, percent-decode, then remove double slashes), both for
+ * correctness and for speed.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "selparse.h"
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+static int legacy_hex2int(char ch) {
+  if ((ch >= '0') && (ch <= '9')) return(ch - '0');
+  if ((ch >= 'A') && (ch <= 'F')) return(ch - 'A' + 10);
+  if ((ch >= 'a') && (ch <= 'f')) return(ch - 'a' + 10);
+  return(-1);
+}
+
+
+/* the legacy percent decoder (as motsognir used it up to v1.0.11) */
+static int legacy_percdecode(char *string) {
+  int x, y, firstnibble, secondnibble;
+  y = 0;
+  for (x = 0; string[x] != 0; x++) {
+    if (string[x] != '%') {
+      string[y++] = (string[x] == '+') ? ' ' : string[x];
+      continue;
+    }
+    if ((string[x + 1] == 0) || (string[x + 2] == 0)) return(-1);
+    if ((string[x + 1] == '0') && (string[x + 2] == '0')) return(-1);
+    firstnibble = legacy_hex2int(string[++x]);
+    secondnibble = legacy_hex2int(string[++x]);
+    if ((firstnibble < 0) || (secondnibble < 0)) return(-1);
+    string[y++] = (firstnibble << 4) | secondnibble;
+  }
+  string[y] = 0;
+  return(0);
+}
+
+
+/* the legacy query splitter (as motsognir used it up to v1.0.11) */
+static void legacy_explode(char *directorytolist, char **res) {
+  char *ptr, *tabposition = NULL, *queposition = NULL;
+  res[0] = NULL;
+  res[1] = NULL;
+  for (ptr = directorytolist; *ptr != 0; ptr++) {
+    if ((*ptr == '?') && (queposition == NULL)) queposition = ptr;
+    if ((*ptr == '\t') && (tabposition == NULL)) {
+      tabposition = ptr;
+      break;
+    }
+  }
+  if (tabposition != NULL) {
+    for (ptr = tabposition + 1; *ptr != 0; ptr++) {
+      if (*ptr == '\t') {
+        *ptr = 0;
+        break;
+      }
+    }
+    res[1] = strdup(tabposition + 1);
+    *tabposition = 0;
+  }
+  if (queposition != NULL) {
+    res[0] = strdup(queposition + 1);
+    *queposition = 0;
+  }
+}
+
+
+/* the legacy double slashes remover (as motsognir used it up to v1.0.11) */
+static void legacy_removedoublechar(char *string, char ch) {
+  char chstr[3] = {0, 0, 0};
+  char *occur;
+  chstr[0] = ch;
+  chstr[1] = ch;
+  for (;;) {
+    occur = strstr(string, chstr);
+    if (occur == NULL) break;
+    while (*occur != 0) {
+      *occur = occur[1];
+      occur += 1;
+    }
+  }
+}
+
+
+/* runs the whole legacy pipeline on selector (modified in place) */
+static int legacy_parse(char *selector, char **res) {
+  if (selector[0] != '/') {
+    memmove(selector + 1, selector, strlen(selector) + 1);
+    selector[0] = '/';
+  }
+  legacy_explode(selector, res);
+  if (legacy_percdecode(selector) != 0) return(-1);
+  legacy_removedoublechar(selector, '/');
+  return(0);
+}
+
+
+static int strequal(const char *s1, const char *s2) {
+  if ((s1 == NULL) || (s2 == NULL)) return(s1 == s2);
+  return(strcmp(s1, s2) == 0);
+}
+
+
+/* generates a random selector, made mostly of chars that matter to the parser */
+static void randselector(char *s, int len) {
+  static const char charset[] = "////??\t\t%%%%++0aF2f9zZ.~";
+  int x;
+  for (x = 0; x < len; x++) s[x] = charset[rand() % (sizeof(charset) - 1)];
+  s[len] = 0;
+}
+
+
+int main(int argc, char **argv) {
+  static char buff1[4096 + 2], buff2[4096 + 2], pathbuff[4096 + 2];
+  static const char *samples[] = {
+    "/archive/documents/readme.txt",
+    "/phlog/2019/f%C3%A9te+de+la+musique.txt",
+    "/cgi-bin/search.cgi?lang=en&page=2\tgopher server",
+    "/software//mirror//linux//debian//pool//main//m//motsognir//motsognir_1.0.11.tar.gz",
+    NULL};
+  char *legacyres[2];
+  struct selparse_t sel;
+  int x, i, r1, r2, iterations = 200000, fuzzcount = 1000000, errors = 0, slashes;
+  volatile long checksum = 0;
+  double t0, t_legacy, t_selparse;
+
+  if (argc > 1) fuzzcount = atoi(argv[1]);
+  if (argc > 2) iterations = atoi(argv[2]);
+  if ((fuzzcount < 0) || (iterations < 1)) {
+    puts("selparsetest is a simple tool to test and benchmark motsognir's selector parser.");
+    puts("usage: selparsetest [fuzz_iterations] [bench_iterations]");
+    return(1);
+  }
+
+  printf("check that both parsers agree on %d random selectors...\n", fuzzcount);
+  for (i = 0; i < fuzzcount; i++) {
+    randselector(buff1, rand() % 64);
+    strcpy(buff2, buff1);
+    r1 = legacy_parse(buff1, legacyres);
+    r2 = selparse(&sel, buff2, pathbuff, 0);
+    if ((r1 != 0) != (r2 != 0)) {
+      errors++;
+    } else if ((r1 == 0) && ((strcmp(buff1, sel.path) != 0) || !strequal(legacyres[0], sel.urlquery) || !strequal(legacyres[1], sel.searchquery))) {
+      errors++;
+    }
+    free(legacyres[0]);
+    free(legacyres[1]);
+  }
+  if (errors != 0) {
+    printf("%d mismatches found!\n", errors);
+    return(1);
+  }
+
+  printf("benchmark %d iterations of typical selectors...\n", iterations);
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    for (x = 0; samples[x] != NULL; x++) {
+      strcpy(buff1, samples[x]);
+      checksum += legacy_parse(buff1, legacyres);
+      free(legacyres[0]);
+      free(legacyres[1]);
+    }
+  }
+  t_legacy = now() - t0;
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    for (x = 0; samples[x] != NULL; x++) {
+      strcpy(buff1, samples[x]);
+      checksum += selparse(&sel, buff1, pathbuff, 0);
+    }
+  }
+  t_selparse = now() - t0;
+  printf("  legacy:   %12.0f selectors/s\n", (double)iterations * x / t_legacy);
+  printf("  selparse: %12.0f selectors/s\n", (double)iterations * x / t_selparse);
+
+  for (slashes = 256; slashes <= 4096; slashes *= 4) {
+    iterations = 1000;
+    printf("benchmark %d iterations of a selector with %d slashes...\n", iterations, slashes - 1);
+    memset(buff2, '/', slashes - 1);
+    buff2[slashes - 1] = 0;
+    t0 = now();
+    for (i = 0; i < iterations; i++) {
+      strcpy(buff1, buff2);
+      checksum += legacy_parse(buff1, legacyres);
+    }
+    t_legacy = now() - t0;
+    t0 = now();
+    for (i = 0; i < iterations; i++) {
+      strcpy(buff1, buff2);
+      checksum += selparse(&sel, buff1, pathbuff, 0);
+    }
+    t_selparse = now() - t0;
+    printf("  legacy:   %12.0f selectors/s\n", (double)iterations / t_legacy);
+    printf("  selparse: %12.0f selectors/s\n", (double)iterations / t_selparse);
+  }
+  return(0);
+}
@@ -0,0 +1,270 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides gopher type detection based on the content of files, and a cache
+ * of the verdicts shared by all motsognir processes.
+ *
+ * Files are recognized by their magic numbers (images, sounds, PDF), or
+ * classified as text or binary by a simple heuristic (no NUL byte, very few
+ * control chars, mostly valid UTF-8), HTML being text that starts with an
+ * html tag.
+ *
+ * The cache is a 4-way set-associative table, mapped in memory with
+ * MAP_SHARED so all processes see each other's verdicts. Entries are written
+ * without any locking: each of them carries a checksum, and torn entries
+ * (two processes writing the same slot at once) simply do not validate.
+ *
+ * Cache file layout (host byte order, it is a local cache):
+ *   header:  char magic[8], u32 entries, u32 reserved
+ *   entries: u64 dev, u64 ino, i64 mtime (in ns), u32 type, u32 check
+ */
+
+#include <fcntl.h>       /* open() */
+#include <stdint.h>
+#include <string.h>      /* memcmp(), memset() */
+#include <stdlib.h>      /* malloc(), free() */
+#include <unistd.h>      /* pread(), ftruncate(), close() */
+#include <sys/mman.h>    /* mmap() */
+#include <sys/types.h>
+
+#include "sniff.h"       /* include self for control */
+
+#define SNIFFCACHE_MAGIC "MOTSSNF1"
+#define SNIFFCACHE_ENTRIES 65536  /* 2 MiB */
+#define SNIFFCACHE_WAYS 4
+
+struct sniffentry {
+  uint64_t dev;
+  uint64_t ino;
+  int64_t mtime;
+  uint32_t type;
+  uint32_t check;  /* 0 if the entry is empty */
+};
+
+struct sniffcache_t {
+  unsigned char *map;
+  size_t maplen;
+  volatile struct sniffentry *entries;
+  uint32_t setmask;
+};
+
+
+/* returns non-zero if buff starts with the len bytes of magic */
+static int startswith(const unsigned char *buff, int bufflen, const char *magic, int len) {
+  if (bufflen < len) return(0);
+  return(memcmp(buff, magic, len) == 0);
+}
+
+
+/* returns non-zero if buff starts with an html tag (after some whitespaces) */
+static int lookslikehtml(const unsigned char *buff, int len) {
+  static const char *tags[] = {"<!doctype html", "<html", "<head", NULL};
+  int x, y;
+  for (x = 0; (x < len) && ((buff[x] == ' ') || (buff[x] == '\t') || (buff[x] == '\r') || (buff[x] == '\n')); x++);
+  for (y = 0; tags[y] != NULL; y++) {
+    int taglen = strlen(tags[y]), z;
+    if (len - x < taglen) continue;
+    for (z = 0; z < taglen; z++) {
+      unsigned char c = buff[x + z];
+      if ((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+      if (c != (unsigned char)tags[y][z]) break;
+    }
+    if (z == taglen) return(1);
+  }
+  return(0);
+}
+
+
+/* returns non-zero if buff looks like text: no NUL byte, less than 1% of
+ * control chars, and either valid UTF-8 or only a few high bytes (some
+ * legacy 8-bit encoding) */
+static int looksliketext(const unsigned char *buff, int len, int truncated) {
+  int x, ctrl = 0, high = 0, badutf8 = 0, follow;
+  for (x = 0; x < len; x++) {
+    unsigned char c = buff[x];
+    if (c == 0) return(0);
+    if (c < 0x80) {
+      if (((c < 0x20) && (c != '\t') && (c != '\n') && (c != '\r') && (c != '\f') && (c != '\v') && (c != 0x1B)) || (c == 0x7F)) ctrl++;
+      continue;
+    }
+    high++;
+    /* validate the UTF-8 sequence */
+    if ((c >= 0xC2) && (c <= 0xDF)) {
+      follow = 1;
+    } else if ((c >= 0xE0) && (c <= 0xEF)) {
+      follow = 2;
+    } else if ((c >= 0xF0) && (c <= 0xF4)) {
+      follow = 3;
+    } else {
+      badutf8++;
+      continue;
+    }
+    if (x + follow >= len) { /* sequence cut by the end of the buffer */
+      if (truncated == 0) badutf8++;
+      break;
+    }
+    for (; follow > 0; follow--) {
+      if ((buff[x + 1] & 0xC0) != 0x80) {
+        badutf8++;
+        break;
+      }
+      x++;
+    }
+  }
+  if (ctrl * 100 > len) return(0);
+  if ((badutf8 > 0) && (high * 10 > len * 3)) return(0);
+  return(1);
+}
+
+
+char sniff_buffer(const unsigned char *buff, int len) {
+  /* images */
+  if (startswith(buff, len, "GIF87a", 6) || startswith(buff, len, "GIF89a", 6)) return('g');
+  if (startswith(buff, len, "\x89PNG\r\n\x1A\n", 8)) return('I');
+  if (startswith(buff, len, "\xFF\xD8\xFF", 3)) return('I');
+  if (startswith(buff, len, "II*\0", 4) || startswith(buff, len, "MM\0*", 4)) return('I');
+  if (startswith(buff, len, "RIFF", 4) && (len >= 12) && (memcmp(buff + 8, "WEBP", 4) == 0)) return('I');
+  if (startswith(buff, len, "BM", 2) && (len >= 26) && (memcmp(buff + 6, "\0\0\0\0", 4) == 0)) return('I');
+  if (startswith(buff, len, "\0\0\1\0", 4) && (len >= 6) && (buff[4] | buff[5])) return('I'); /* ico */
+  /* documents */
+  if (startswith(buff, len, "%PDF-", 5)) return('P');
+  /* sounds */
+  if (startswith(buff, len, "ID3", 3) || startswith(buff, len, "OggS", 4) || startswith(buff, len, "fLaC", 4) || startswith(buff, len, "MThd", 4)) return('s');
+  if (startswith(buff, len, "RIFF", 4) && (len >= 12) && (memcmp(buff + 8, "WAVE", 4) == 0)) return('s');
+  if (startswith(buff, len, "FORM", 4) && (len >= 12) && ((memcmp(buff + 8, "AIFF", 4) == 0) || (memcmp(buff + 8, "AIFC", 4) == 0))) return('s');
+  if ((len >= 4) && (buff[0] == 0xFF) && ((buff[1] & 0xE0) == 0xE0) && ((buff[2] & 0xF0) != 0xF0)) return('s'); /* mpeg/aac frame */
+  /* text, possibly html (an UTF-8 BOM is skipped) */
+  if (startswith(buff, len, "\xEF\xBB\xBF", 3)) {
+    buff += 3;
+    len -= 3;
+  }
+  if (looksliketext(buff, len, len >= SNIFF_LEN - 3) != 0) {
+    if (lookslikehtml(buff, len) != 0) return('h');
+    return('0');
+  }
+  return('9');
+}
+
+
+char sniff_fd(int fd) {
+  unsigned char buff[SNIFF_LEN];
+  ssize_t len;
+  len = pread(fd, buff, sizeof(buff), 0);
+  if (len < 0) return(0);
+  return(sniff_buffer(buff, len));
+}
+
+
+/*** verdict cache ***/
+
+static uint64_t mtimekey(const struct stat *st) {
+  return((uint64_t)st->st_mtime * 1000000000u + st->st_mtim.tv_nsec);
+}
+
+
+static uint32_t checksum(uint64_t dev, uint64_t ino, uint64_t mtime, uint32_t type) {
+  uint64_t h = dev * UINT64_C(0x9E3779B97F4A7C15);
+  h = (h ^ ino) * UINT64_C(0xC2B2AE3D27D4EB4F);
+  h = (h ^ mtime) * UINT64_C(0x165667B19E3779F9);
+  h = (h ^ type) * UINT64_C(0x9E3779B97F4A7C15);
+  h ^= h >> 32;
+  return((uint32_t)h | 1);  /* never 0, which marks empty entries */
+}
+
+
+/* returns the first entry of the set a file belongs to */
+static volatile struct sniffentry *getset(const struct sniffcache_t *obj, const struct stat *st) {
+  uint64_t h = ((uint64_t)st->st_dev * UINT64_C(0x9E3779B97F4A7C15)) ^ ((uint64_t)st->st_ino * UINT64_C(0xC2B2AE3D27D4EB4F));
+  h ^= h >> 29;
+  return(obj->entries + (h & obj->setmask) * SNIFFCACHE_WAYS);
+}
+
+
+struct sniffcache_t *sniffcache_open(const char *file) {
+  struct sniffcache_t *obj;
+  size_t maplen = 16 + SNIFFCACHE_ENTRIES * sizeof(struct sniffentry);
+  void *map;
+  uint32_t entries = SNIFFCACHE_ENTRIES;
+  obj = calloc(1, sizeof(struct sniffcache_t));
+  if (obj == NULL) return(NULL);
+  if (file == NULL) {
+    map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+  } else {
+    struct stat st;
+    int fd = open(file, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+      free(obj);
+      return(NULL);
+    }
+    /* the file must be of the right size before being mapped */
+    if ((fstat(fd, &st) != 0) || (((size_t)st.st_size != maplen) && (ftruncate(fd, maplen) != 0))) {
+      close(fd);
+      free(obj);
+      return(NULL);
+    }
+    map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+  if (map == MAP_FAILED) {
+    free(obj);
+    return(NULL);
+  }
+  obj->map = map;
+  obj->maplen = maplen;
+  obj->entries = (volatile struct sniffentry *)(obj->map + 16);
+  obj->setmask = SNIFFCACHE_ENTRIES / SNIFFCACHE_WAYS - 1;
+  /* (re)initialize the cache if it is new, or not of a known format */
+  if ((memcmp(obj->map, SNIFFCACHE_MAGIC, 8) != 0) || (memcmp(obj->map + 8, &entries, 4) != 0)) {
+    memset(obj->map, 0, maplen);
+    memcpy(obj->map + 8, &entries, 4);
+    memcpy(obj->map, SNIFFCACHE_MAGIC, 8);
+  }
+  return(obj);
+}
+
+
+char sniffcache_get(const struct sniffcache_t *obj, const struct stat *st) {
+  volatile struct sniffentry *set;
+  uint64_t mtime = mtimekey(st);
+  int x;
+  if (obj == NULL) return(0);
+  set = getset(obj, st);
+  for (x = 0; x < SNIFFCACHE_WAYS; x++) {
+    struct sniffentry e;
+    e.dev = set[x].dev;
+    e.ino = set[x].ino;
+    e.mtime = set[x].mtime;
+    e.type = set[x].type;
+    e.check = set[x].check;
+    if ((e.dev != (uint64_t)st->st_dev) || (e.ino != (uint64_t)st->st_ino) || ((uint64_t)e.mtime != mtime)) continue;
+    if (e.check != checksum(e.dev, e.ino, e.mtime, e.type)) continue; /* torn entry */
+    return(e.type);
+  }
+  return(0);
+}
+
+
+void sniffcache_put(struct sniffcache_t *obj, const struct stat *st, char type) {
+  volatile struct sniffentry *set, *e;
+  uint64_t mtime = mtimekey(st);
+  int x;
+  if (obj == NULL) return;
+  set = getset(obj, st);
+  /* reuse the entry of the same file (older mtime), or an empty one, or
+   * evict some pseudo-random one */
+  e = &(set[(mtime ^ (mtime >> 17)) % SNIFFCACHE_WAYS]);
+  for (x = 0; x < SNIFFCACHE_WAYS; x++) {
+    if ((set[x].dev == (uint64_t)st->st_dev) && (set[x].ino == (uint64_t)st->st_ino)) {
+      e = &(set[x]);
+      break;
+    }
+    if (set[x].check == 0) e = &(set[x]);
+  }
+  e->check = 0;
+  e->dev = st->st_dev;
+  e->ino = st->st_ino;
+  e->mtime = mtime;
+  e->type = (unsigned char)type;
+  e->check = checksum(st->st_dev, st->st_ino, mtime, (unsigned char)type);
+}
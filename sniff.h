@@ -0,0 +1,40 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides gopher type detection based on the content of files, and a cache
+ * of the verdicts shared by all motsognir processes
+ */
+
+#ifndef sniff_h_sentinel
+#define sniff_h_sentinel
+
+#include <sys/stat.h>
+
+/* amount of bytes looked at, at the start of files */
+#define SNIFF_LEN 512
+
+struct sniffcache_t;
+
+/* classifies the first bytes of a file as one of the '0' (text), 'g' (GIF),
+ * 'I' (image), 's' (sound), 'P' (PDF), 'h' (HTML) or '9' (binary) gopher
+ * types */
+char sniff_buffer(const unsigned char *buff, int len);
+
+/* reads the start of an open file and classifies it. returns 0 on error */
+char sniff_fd(int fd);
+
+/* opens (or creates) a verdict cache file and maps it in memory, shared with
+ * all the processes forked afterwards. if file is NULL, the cache is held in
+ * anonymous shared memory and lost when motsognir exits. returns NULL on
+ * error */
+struct sniffcache_t *sniffcache_open(const char *file);
+
+/* returns the cached verdict for a file, or 0 if there is none (verdicts are
+ * keyed by device, inode and mtime, so a modified file is never matched) */
+char sniffcache_get(const struct sniffcache_t *obj, const struct stat *st);
+
+/* stores the verdict for a file */
+void sniffcache_put(struct sniffcache_t *obj, const struct stat *st, char type);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * Test & benchmark application for content sniffing.
+ *
+ * Checks the gopher types guessed from known magic numbers, the split
+ * between text (ASCII, UTF-8, legacy 8-bit, HTML) and binary data, then the
+ * verdict cache: hits, misses once a file's mtime changes, persistence of a
+ * cache file and sharing between processes. Finally measures how long it
+ * takes to sniff a file, compared with a cache lookup.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "sniff.h"
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+struct sniffknown {
+  const char *data;
+  int len;
+  char type;
+};
+
+#define KNOWN(data, type) {data, sizeof(data) - 1, type}
+
+static struct sniffknown knowns[] = {
+  KNOWN("GIF89a\x01\x00\x01\x00", 'g'),
+  KNOWN("GIF87a\x01\x00\x01\x00", 'g'),
+  KNOWN("\x89PNG\r\n\x1A\n\0\0\0\x0DIHDR", 'I'),
+  KNOWN("\xFF\xD8\xFF\xE0\0\x10JFIF", 'I'),
+  KNOWN("II*\0\x08\0\0\0", 'I'),
+  KNOWN("RIFF\x24\0\0\0WEBPVP8 ", 'I'),
+  KNOWN("%PDF-1.4\n%\xE2\xE3\xCF\xD3\n", 'P'),
+  KNOWN("ID3\x03\0\0\0\0\0\0", 's'),
+  KNOWN("OggS\0\x02\0\0", 's'),
+  KNOWN("fLaC\0\0\0\x22", 's'),
+  KNOWN("RIFF\x24\0\0\0WAVEfmt ", 's'),
+  KNOWN("FORM\0\0\0\x24" "AIFFCOMM", 's'),
+  KNOWN("RIFF\x24\0\0\0AVI LIST", '9'),    /* neither WEBP nor WAVE */
+  KNOWN("Hello, gopherspace!\r\nSecond line.\r\n", '0'),
+  KNOWN("Caf\xC3\xA9 cr\xC3\xA8me br\xC3\xBBl\xC3\xA9" "e\n", '0'),  /* UTF-8 */
+  KNOWN("d\xE9j\xE0 vu, a bit of latin-1 text in there\n", '0'),   /* a few high bytes */
+  KNOWN("\xEF\xBB\xBFtext after a BOM\n", '0'),
+  KNOWN("\x1B[1mANSI art\x1B[0m\n", '0'),
+  KNOWN("  \n<!DOCTYPE html>\n<html><body>hi</body></html>\n", 'h'),
+  KNOWN("<HTML><HEAD><TITLE>x</TITLE></HEAD></HTML>", 'h'),
+  KNOWN("\xEF\xBB\xBF<html>\n", 'h'),
+  KNOWN("text\0with a NUL byte", '9'),
+  KNOWN("\x7F" "ELF\x02\x01\x01\0\0\0\0\0", '9'),
+  KNOWN("\xC0\xC1\xF5\xFE\xE9\xE8\xE0\xF9\xFF\xFA", '9'),           /* mostly invalid high bytes */
+  KNOWN("\x01\x02\x03\x04 control chars", '9'),
+  KNOWN("", '0'),
+  {NULL, 0, 0}
+};
+
+
+/* writes len bytes of data to file, and returns its status in st. returns
+ * 0 on success */
+static int writefile(const char *file, const void *data, int len, struct stat *st) {
+  int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) return(-1);
+  if (write(fd, data, len) != len) {
+    close(fd);
+    return(-1);
+  }
+  close(fd);
+  return(stat(file, st));
+}
+
+
+int main(int argc, char **argv) {
+  unsigned char buff[SNIFF_LEN];
+  char file[64], cachefile[64];
+  struct sniffcache_t *cache;
+  struct stat st, st2;
+  struct timespec times[2];
+  int x, fd, status, errors = 0;
+  long iterations = 200000, i, hits = 0;
+  double t0, t_sniff, t_cache;
+  pid_t pid;
+
+  if (argc > 1) iterations = atol(argv[1]);
+  if (iterations < 1) {
+    puts("snifftest is a simple tool to test and benchmark motsognir's content sniffing.");
+    puts("usage: snifftest [iterations]");
+    return(1);
+  }
+
+  puts("check known magic numbers and contents...");
+  for (x = 0; knowns[x].data != NULL; x++) {
+    char type = sniff_buffer((const unsigned char *)knowns[x].data, knowns[x].len);
+    if (type != knowns[x].type) {
+      printf("  FAILED: test #%d sniffed as '%c' instead of '%c'\n", x, type, knowns[x].type);
+      errors++;
+    }
+  }
+
+  puts("check UTF-8 sequences cut by the end of the sniffed block...");
+  memset(buff, 'a', sizeof(buff));
+  buff[SNIFF_LEN - 2] = 0xE2; /* a 3 bytes sequence, of which 2 fit */
+  buff[SNIFF_LEN - 1] = 0x82;
+  if (sniff_buffer(buff, SNIFF_LEN) != '0') {
+    puts("  FAILED: text cut in the middle of a sequence");
+    errors++;
+  }
+  for (x = 0; x < (int)sizeof(buff); x++) buff[x] = (x % 2) ? 0xE9 : 'a'; /* invalid UTF-8, half of it */
+  if (sniff_buffer(buff, SNIFF_LEN) != '9') {
+    puts("  FAILED: mostly high bytes taken for text");
+    errors++;
+  }
+
+  puts("check sniffing of files...");
+  snprintf(file, sizeof(file), "/tmp/snifftest-%ld.dat", (long)getpid());
+  snprintf(cachefile, sizeof(cachefile), "/tmp/snifftest-%ld.cache", (long)getpid());
+  if (writefile(file, "GIF89a\x01\x00\x01\x00", 10, &st) != 0) {
+    puts("failed to create a temporary file");
+    return(1);
+  }
+  fd = open(file, O_RDONLY);
+  if ((fd < 0) || (sniff_fd(fd) != 'g')) {
+    puts("  FAILED: sniff_fd()");
+    errors++;
+  }
+  if (fd >= 0) close(fd);
+
+  puts("check the verdict cache...");
+  cache = sniffcache_open(cachefile);
+  if (cache == NULL) {
+    puts("failed to open the cache file");
+    unlink(file);
+    return(1);
+  }
+  if (sniffcache_get(cache, &st) != 0) {
+    puts("  FAILED: hit in an empty cache");
+    errors++;
+  }
+  sniffcache_put(cache, &st, 'g');
+  if (sniffcache_get(cache, &st) != 'g') {
+    puts("  FAILED: no hit after a put");
+    errors++;
+  }
+  /* the file changes: same inode, another mtime */
+  times[0] = st.st_atim;
+  times[1] = st.st_mtim;
+  times[1].tv_sec += 10;
+  if ((writefile(file, "%PDF-1.4\n", 9, &st2) != 0) || (utimensat(AT_FDCWD, file, times, 0) != 0) || (stat(file, &st2) != 0)) {
+    puts("failed to modify the temporary file");
+    errors++;
+  } else if (st2.st_ino != st.st_ino) {
+    puts("  skipped: the file got a new inode");
+  } else {
+    if (sniffcache_get(cache, &st2) != 0) {
+      puts("  FAILED: hit after the file's mtime changed");
+      errors++;
+    }
+    sniffcache_put(cache, &st2, 'P');
+    if ((sniffcache_get(cache, &st2) != 'P') || (sniffcache_get(cache, &st) != 0)) {
+      puts("  FAILED: the verdict was not replaced");
+      errors++;
+    }
+  }
+  /* verdicts are shared with processes forked afterwards */
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    sniffcache_put(cache, &st, 'I');
+    _exit(0);
+  }
+  if ((pid < 0) || (waitpid(pid, &status, 0) != pid) || (sniffcache_get(cache, &st) != 'I')) {
+    puts("  FAILED: verdict of a child process not seen by its parent");
+    errors++;
+  }
+  /* and they survive in the cache file */
+  cache = sniffcache_open(cachefile);
+  if ((cache == NULL) || (sniffcache_get(cache, &st) != 'I')) {
+    puts("  FAILED: verdict not kept in the cache file");
+    errors++;
+  }
+  /* a file of some other format is reinitialized */
+  fd = open(cachefile, O_WRONLY);
+  if ((fd < 0) || (write(fd, "GARBAGE!", 8) != 8)) errors++;
+  if (fd >= 0) close(fd);
+  cache = sniffcache_open(cachefile);
+  if ((cache == NULL) || (sniffcache_get(cache, &st) != 0)) {
+    puts("  FAILED: cache file of an unknown format not reinitialized");
+    errors++;
+  }
+
+  if (errors != 0) {
+    unlink(file);
+    unlink(cachefile);
+    printf("%d errors found!\n", errors);
+    return(1);
+  }
+
+  /* a text file, that has to be read through */
+  memset(buff, 'a', sizeof(buff));
+  for (x = 0; x < (int)sizeof(buff); x += 64) buff[x] = '\n';
+  writefile(file, buff, sizeof(buff), &st);
+  sniffcache_put(cache, &st, '0');
+  printf("benchmark %ld x sniffing of a %d bytes text file...\n", iterations, SNIFF_LEN);
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    fd = open(file, O_RDONLY);
+    if (sniff_fd(fd) == '0') hits++;
+    close(fd);
+  }
+  t_sniff = now() - t0;
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    if ((stat(file, &st) == 0) && (sniffcache_get(cache, &st) == '0')) hits++;
+  }
+  t_cache = now() - t0;
+  printf("  sniffed:   %8.1f ns/file\n", t_sniff * 1000000000.0 / iterations);
+  printf("  cache hit: %8.1f ns/file\n", t_cache * 1000000000.0 / iterations);
+  printf("  speedup: %.1fx\n", t_sniff / t_cache);
+  unlink(file);
+  unlink(cachefile);
+  if (hits != iterations * 2) {
+    puts("  FAILED: some files were not recognized as text");
+    return(1);
+  }
+  return(0);
+}
@@ -0,0 +1,311 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the TLS listener: handshakes, session resumption and hand-over of
+ * the encryption to the kernel (kTLS) where available.
+ *
+ * Every connection is served by its own process, so a server-side session
+ * cache would go away with the process that filled it. Sessions are resumed
+ * through stateless session tickets instead: OpenSSL encrypts them with keys
+ * it generates along with the TLS context, and the context is set up by the
+ * process that accepts connections, before it forks any child. All children
+ * share the keys, hence any of them can resume a session started by another
+ * one (tickets become invalid whenever motsognir is restarted).
+ *
+ * Once the handshake is done, OpenSSL is asked to pass the session keys to
+ * the kernel (kTLS). If the kernel takes over both directions, the socket
+ * behaves like a plain TCP one from then on: the request is served through
+ * it as usual, and sendfile() stays zero-copy. OpenSSL keeps working on top
+ * of kTLS (the kernel frames and encrypts whatever it writes), which is how
+ * the session gets closed with a close_notify alert once the request is
+ * served. Otherwise (no kTLS in the kernel or in OpenSSL, or a cipher it
+ * does not handle), the process forks: the child serves the request through
+ * a local socket, and the parent relays data between that socket and the
+ * TLS session.
+ */
+
+#include <stdlib.h>      /* calloc(), free() */
+
+#include "tls.h"         /* include self for control */
+
+#ifdef WITH_TLS
+
+#include <errno.h>
+#include <fcntl.h>       /* fcntl() */
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>       /* snprintf() */
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>      /* fork(), read(), close() */
+#include <sys/socket.h>
+#include <sys/time.h>    /* struct timeval */
+#include <sys/wait.h>    /* waitpid() */
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#define TLS_HANDSHAKETIMEOUT 10  /* seconds */
+#define TLS_RELAYTIMEOUT 120     /* seconds without any progress after which the relay gives up */
+
+struct tls_t {
+  SSL_CTX *ctx;
+};
+
+/* the session offloaded to the kernel, closed when the process exits */
+static struct {
+  SSL *ssl;
+  int sock;   /* a descriptor of its own, kept open until the close_notify */
+  pid_t pid;
+} ktls;
+
+
+/* logs the last OpenSSL error (or errno, if OpenSSL has none), after a
+ * message */
+static void logsslerror(int priority, const char *msg) {
+  char errbuff[256];
+  unsigned long err;
+  err = ERR_get_error();
+  if (err != 0) {
+    ERR_error_string_n(err, errbuff, sizeof(errbuff));
+  } else {
+    const char *reason = "unexpected data or end of stream";
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      reason = "timeout";
+    } else if (errno != 0) {
+      reason = strerror(errno);
+    }
+    snprintf(errbuff, sizeof(errbuff), "%s", reason);
+  }
+  syslog(priority, "%s (%s)", msg, errbuff);
+}
+
+
+struct tls_t *tls_open(const char *certfile, const char *keyfile) {
+  struct tls_t *tls;
+  tls = calloc(1, sizeof(struct tls_t));
+  if (tls == NULL) {
+    syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+    return(NULL);
+  }
+  tls->ctx = SSL_CTX_new(TLS_server_method());
+  if (tls->ctx == NULL) {
+    logsslerror(LOG_ERR, "ERROR: failed to set up the TLS context");
+    free(tls);
+    return(NULL);
+  }
+  SSL_CTX_set_min_proto_version(tls->ctx, TLS1_2_VERSION);
+  if (SSL_CTX_use_certificate_chain_file(tls->ctx, certfile) != 1) {
+    logsslerror(LOG_ERR, "ERROR: failed to load the TLS certificate");
+    SSL_CTX_free(tls->ctx);
+    free(tls);
+    return(NULL);
+  }
+  if ((SSL_CTX_use_PrivateKey_file(tls->ctx, keyfile, SSL_FILETYPE_PEM) != 1) || (SSL_CTX_check_private_key(tls->ctx) != 1)) {
+    logsslerror(LOG_ERR, "ERROR: failed to load the TLS private key");
+    SSL_CTX_free(tls->ctx);
+    free(tls);
+    return(NULL);
+  }
+  /* a session cache would not outlive the process that serves the
+   * connection: resumption relies on session tickets only */
+  SSL_CTX_set_session_cache_mode(tls->ctx, SSL_SESS_CACHE_OFF);
+  SSL_CTX_set_session_id_context(tls->ctx, (const unsigned char *)"motsognir", 9);
+  SSL_CTX_set_options(tls->ctx, SSL_OP_NO_RENEGOTIATION);
+  SSL_CTX_set_mode(tls->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_ENABLE_KTLS
+  SSL_CTX_set_options(tls->ctx, SSL_OP_ENABLE_KTLS);
+#endif
+  return(tls);
+}
+
+
+/* sets the send and receive timeouts of a socket (0 = none) */
+static void setsocktimeout(int sock, int seconds) {
+  struct timeval tv;
+  tv.tv_sec = seconds;
+  tv.tv_usec = 0;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+
+/* returns non-zero if the kernel handles the encryption of both directions
+ * of the session, with nothing left in OpenSSL's own buffers */
+static int kernelhandover(SSL *ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+  if ((BIO_get_ktls_send(SSL_get_wbio(ssl))) && (BIO_get_ktls_recv(SSL_get_rbio(ssl))) && (SSL_has_pending(ssl) == 0)) return(1);
+#else
+  (void)ssl;
+#endif
+  return(0);
+}
+
+
+/* sends a close_notify over the session offloaded to the kernel, and closes
+ * its connection */
+static void ktls_end(void) {
+  if ((ktls.ssl == NULL) || (ktls.pid != getpid())) return;
+  signal(SIGPIPE, SIG_IGN); /* the client may be gone already */
+  SSL_shutdown(ktls.ssl);
+  SSL_free(ktls.ssl);
+  ktls.ssl = NULL;
+  close(ktls.sock);
+}
+
+
+/* relays data between the TLS session on sock and the local socket, until
+ * the local side is done (or the client goes away). both sockets must be
+ * non-blocking. data sent by the client that the local side does not read
+ * fast enough is dropped: past the selector, gopher clients have nothing
+ * more to say */
+static void relay(SSL *ssl, int sock, int local) {
+  static char outbuff[16384], inbuff[16384];
+  int outlen = 0, outpos = 0, clientdone = 0, localdone = 0;
+  int n, err;
+  struct pollfd pfd[2];
+
+  for (;;) {
+    /* client -> local */
+    while (clientdone == 0) {
+      n = SSL_read(ssl, inbuff, sizeof(inbuff));
+      if (n > 0) {
+        if (send(local, inbuff, n, MSG_NOSIGNAL) < 0) clientdone = 1;
+        continue;
+      }
+      err = SSL_get_error(ssl, n);
+      if ((err == SSL_ERROR_WANT_READ) || (err == SSL_ERROR_WANT_WRITE)) break;
+      clientdone = 1; /* close_notify, or the connection is gone */
+      shutdown(local, SHUT_WR);
+    }
+    /* local -> client */
+    for (;;) {
+      if (outpos == outlen) {
+        if (localdone != 0) break;
+        n = read(local, outbuff, sizeof(outbuff));
+        if (n > 0) {
+          outlen = n;
+          outpos = 0;
+        } else {
+          if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))) localdone = 1;
+          break;
+        }
+      }
+      n = SSL_write(ssl, outbuff + outpos, outlen - outpos);
+      if (n > 0) {
+        outpos += n;
+        continue;
+      }
+      err = SSL_get_error(ssl, n);
+      if ((err == SSL_ERROR_WANT_READ) || (err == SSL_ERROR_WANT_WRITE)) break;
+      return; /* the client is gone */
+    }
+    if ((localdone != 0) && (outpos == outlen)) break;
+    /* wait for something to do */
+    pfd[0].fd = sock;
+    pfd[0].events = 0;
+    if (clientdone == 0) pfd[0].events |= POLLIN;
+    if (outpos < outlen) pfd[0].events |= POLLOUT;
+    pfd[0].revents = 0;
+    pfd[1].fd = ((outpos < outlen) || (localdone != 0)) ? -1 : local;
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    n = poll(pfd, 2, TLS_RELAYTIMEOUT * 1000);
+    if ((n < 0) && (errno == EINTR)) continue;
+    if (n <= 0) return;
+  }
+}
+
+
+int tls_accept(struct tls_t *tls, int sock) {
+  SSL *ssl;
+  int sv[2];
+  pid_t pid;
+
+  ssl = SSL_new(tls->ctx);
+  if ((ssl == NULL) || (SSL_set_fd(ssl, sock) != 1)) {
+    logsslerror(LOG_WARNING, "ERROR: failed to set up the TLS session");
+    return(-1);
+  }
+  setsocktimeout(sock, TLS_HANDSHAKETIMEOUT);
+  errno = 0;
+  if (SSL_accept(ssl) != 1) {
+    logsslerror(LOG_WARNING, "TLS handshake failed");
+    return(-1);
+  }
+  setsocktimeout(sock, 0);
+  if (kernelhandover(ssl)) {
+    int servesock = dup(sock);
+    if (servesock < 0) {
+      syslog(LOG_WARNING, "ERROR: dup() failed (%s)", strerror(errno));
+      SSL_free(ssl);
+      return(-1);
+    }
+    syslog(LOG_INFO, "%s session %s, encryption offloaded to the kernel", SSL_get_version(ssl), SSL_session_reused(ssl) ? "resumed" : "established");
+    /* the request is served through a duplicate of the socket: the
+     * connection stays open when it gets closed, until the close_notify is
+     * sent at exit. server-side apps must not inherit the SSL's own one */
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    ktls.ssl = ssl;
+    ktls.sock = sock;
+    ktls.pid = getpid();
+    atexit(ktls_end);
+    return(servesock);
+  }
+  syslog(LOG_INFO, "%s session %s, relayed", SSL_get_version(ssl), SSL_session_reused(ssl) ? "resumed" : "established");
+
+  /* no kernel offload: serve the request through a local socket */
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+    syslog(LOG_WARNING, "ERROR: socketpair() failed (%s)", strerror(errno));
+    SSL_free(ssl);
+    return(-1);
+  }
+  pid = fork();
+  if (pid == 0) { /* child: serves the request */
+    close(sv[1]);
+    close(sock);
+    return(sv[0]);
+  }
+  close(sv[0]);
+  if (pid < 0) {
+    syslog(LOG_WARNING, "ERROR: fork() failed (%s)", strerror(errno));
+    close(sv[1]);
+    SSL_free(ssl);
+    return(-1);
+  }
+  /* parent: relays until the child is done, then leaves */
+  signal(SIGPIPE, SIG_IGN);
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+  fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+  relay(ssl, sock, sv[1]);
+  /* the answer is complete (or the relay gave up): tell the client, no need
+   * to wait for its own close_notify */
+  SSL_shutdown(ssl);
+  SSL_free(ssl);
+  close(sv[1]);
+  close(sock);
+  waitpid(pid, NULL, 0);
+  _exit(0);
+}
+
+#else /* no TLS support compiled in */
+
+#include <syslog.h>
+
+
+struct tls_t *tls_open(const char *certfile, const char *keyfile) {
+  (void)certfile;
+  (void)keyfile;
+  syslog(LOG_ERR, "ERROR: this motsognir build has no TLS support (it must be compiled with WITH_TLS defined, and linked against OpenSSL)");
+  return(NULL);
+}
+
+
+int tls_accept(struct tls_t *tls, int sock) {
+  (void)tls;
+  (void)sock;
+  return(-1);
+}
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the TLS listener: handshakes, session resumption and hand-over of
+ * the encryption to the kernel (kTLS) where available. TLS support requires
+ * OpenSSL, and is compiled in only if WITH_TLS is defined
+ */
+
+#ifndef tls_h_sentinel
+#define tls_h_sentinel
+
+struct tls_t;
+
+/* loads the certificate chain and private key (both PEM files), and sets up
+ * the TLS context. this must be done before forking: session tickets are
+ * encrypted with keys generated here, so any process forked afterwards is
+ * able to resume a session started by another one. errors are logged.
+ * returns NULL on error */
+struct tls_t *tls_open(const char *certfile, const char *keyfile);
+
+/* performs the TLS handshake on a freshly accepted connection, and returns
+ * the socket the request shall be served through: either a duplicate of
+ * sock, if the kernel took over the encryption (then send(), writev() and
+ * sendfile() work on it as they do on plain connections, and the session is
+ * closed when the process exits), or a local socket otherwise, relayed to
+ * the client by a helper process. returns -1 on error */
+int tls_accept(struct tls_t *tls, int sock);
+
+#endif
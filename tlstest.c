@@ -0,0 +1,331 @@
+/*
+ * Test & benchmark application for the TLS listener.
+ *
+ * Generates a self-signed certificate, then serves a file over TLS the way
+ * motsognir does (tls_accept() in a process forked for every connection) and
+ * fetches it with an OpenSSL client: the bytes received must be those of the
+ * file, the session must end with a close_notify alert, and a second
+ * connection must resume the session of the first one. Then compares the
+ * time it takes to set up full and resumed sessions, and measures the
+ * transfer rate.
+ *
+ * TLS support is optional: unless compiled with WITH_TLS defined, this test
+ * does nothing.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef WITH_TLS
+
+#include <errno.h>
+#include <fcntl.h>   /* open() */
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "tls.h"
+
+#define FILELEN (1024 * 1024)
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+/* generates a self-signed certificate for 'localhost', and writes it to
+ * certfile, along with its private key to keyfile. returns 0 on success,
+ * non-zero otherwise */
+static int mkcert(const char *certfile, const char *keyfile) {
+  EVP_PKEY_CTX *kctx;
+  EVP_PKEY *pkey = NULL;
+  X509 *x509;
+  X509_NAME *name;
+  FILE *fd;
+  int res = -1;
+
+  kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+  if ((kctx == NULL) || (EVP_PKEY_keygen_init(kctx) <= 0) || (EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, 2048) <= 0) || (EVP_PKEY_keygen(kctx, &pkey) <= 0)) {
+    EVP_PKEY_CTX_free(kctx);
+    return(-1);
+  }
+  EVP_PKEY_CTX_free(kctx);
+  x509 = X509_new();
+  if (x509 == NULL) goto done;
+  X509_set_version(x509, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x509), -3600);
+  X509_gmtime_adj(X509_getm_notAfter(x509), 86400);
+  X509_set_pubkey(x509, pkey);
+  name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+  if (X509_sign(x509, pkey, EVP_sha256()) == 0) goto done;
+  fd = fopen(certfile, "wb");
+  if (fd == NULL) goto done;
+  res = (PEM_write_X509(fd, x509) == 1) ? 0 : -1;
+  fclose(fd);
+  if (res != 0) goto done;
+  fd = fopen(keyfile, "wb");
+  res = -1;
+  if (fd == NULL) goto done;
+  res = (PEM_write_PrivateKey(fd, pkey, NULL, NULL, 0, NULL, NULL) == 1) ? 0 : -1;
+  fclose(fd);
+  done:
+  X509_free(x509);
+  EVP_PKEY_free(pkey);
+  return(res);
+}
+
+
+/* accepts connections forever, and serves each of them through tls_accept()
+ * in a process of its own: the client's request line is read, then the
+ * content of filename is sent back */
+static void serve(struct tls_t *tls, int listener, const char *filename) {
+  char buff[16384];
+  int sock, fd, n;
+  pid_t pid;
+  for (;;) {
+    sock = accept(listener, NULL, NULL);
+    if (sock < 0) continue;
+    pid = fork();
+    if (pid > 0) {
+      close(sock);
+      waitpid(pid, NULL, 0);
+      continue;
+    }
+    if (pid < 0) _exit(1);
+    close(listener);
+    sock = tls_accept(tls, sock);
+    if (sock < 0) _exit(1);
+    /* read the request line */
+    do {
+      n = recv(sock, buff, 1, 0);
+    } while ((n == 1) && (buff[0] != '\n'));
+    fd = open(filename, O_RDONLY);
+    while ((fd >= 0) && ((n = read(fd, buff, sizeof(buff))) > 0)) {
+      if (send(sock, buff, n, MSG_NOSIGNAL) != n) break;
+    }
+    close(sock);
+    exit(0);  /* not _exit(): the session is closed at exit */
+  }
+}
+
+
+/* fetches the file served on port, resuming session if not NULL. the
+ * content is written into buff (of FILELEN bytes). returns the amount of
+ * bytes received, or -1 on error. *reused is set if the session has been
+ * resumed, *closenotify if the server ended it properly. the session is
+ * returned through *newsession, if not NULL */
+static long fetch(SSL_CTX *ctx, int port, SSL_SESSION *session, SSL_SESSION **newsession, unsigned char *buff, int *reused, int *closenotify) {
+  struct sockaddr_in addr;
+  SSL *ssl;
+  int sock, n;
+  long len = 0;
+
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((sock < 0) || (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+    if (sock >= 0) close(sock);
+    return(-1);
+  }
+  ssl = SSL_new(ctx);
+  SSL_set_fd(ssl, sock);
+  SSL_set_tlsext_host_name(ssl, "localhost");
+  if (session != NULL) SSL_set_session(ssl, session);
+  if ((SSL_connect(ssl) != 1) || (SSL_write(ssl, "/file\r\n", 7) != 7)) {
+    ERR_print_errors_fp(stdout);
+    SSL_free(ssl);
+    close(sock);
+    return(-1);
+  }
+  for (;;) {
+    n = SSL_read(ssl, buff + len, (len < FILELEN) ? FILELEN - len : 1);
+    if (n <= 0) break;
+    len += n;
+    if (len > FILELEN) break;
+  }
+  *closenotify = (SSL_get_error(ssl, n) == SSL_ERROR_ZERO_RETURN);
+  *reused = SSL_session_reused(ssl);
+  if (newsession != NULL) *newsession = SSL_get1_session(ssl); /* TLS 1.3 tickets come along with data */
+  SSL_shutdown(ssl);
+  SSL_free(ssl);
+  close(sock);
+  return(len);
+}
+
+
+int main(int argc, char **argv) {
+  char dir[] = "/tmp/tlstestXXXXXX", certfile[64], keyfile[64], filename[64];
+  unsigned char *content, *buff;
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  struct tls_t *tls;
+  SSL_CTX *ctx;
+  SSL_SESSION *session = NULL, *session2 = NULL;
+  int listener, port, x, iterations = 50, errors = 0, reused, closenotify;
+  long len;
+  double t0, t_full, t_resumed;
+  pid_t server;
+  FILE *fd;
+
+  if (argc > 1) iterations = atoi(argv[1]);
+  if (iterations < 1) {
+    puts("tlstest is a simple tool to test and benchmark motsognir's TLS listener.");
+    puts("usage: tlstest [iterations]");
+    return(1);
+  }
+  alarm(300); /* do not hang forever if something goes wrong */
+
+  if (mkdtemp(dir) == NULL) {
+    puts("failed to create a temporary directory");
+    return(1);
+  }
+  snprintf(certfile, sizeof(certfile), "%s/cert.pem", dir);
+  snprintf(keyfile, sizeof(keyfile), "%s/key.pem", dir);
+  snprintf(filename, sizeof(filename), "%s/file", dir);
+  content = malloc(FILELEN);
+  buff = malloc(FILELEN + 1);
+  if ((content == NULL) || (buff == NULL)) {
+    puts("out of memory");
+    return(1);
+  }
+  for (x = 0; x < FILELEN; x++) content[x] = rand();
+  fd = fopen(filename, "wb");
+  if ((fd == NULL) || (fwrite(content, 1, FILELEN, fd) != FILELEN)) {
+    puts("failed to write the test file");
+    return(1);
+  }
+  fclose(fd);
+
+  puts("check a self-signed certificate is loaded...");
+  if (mkcert(certfile, keyfile) != 0) {
+    puts("  FAILED: could not generate the certificate");
+    return(1);
+  }
+  tls = tls_open(certfile, keyfile);
+  if (tls == NULL) {
+    puts("  FAILED: tls_open()");
+    return(1);
+  }
+
+  /* the server runs in a process of its own, forked after tls_open() as
+   * motsognir does */
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((listener < 0) || (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(listener, 16) != 0) || (getsockname(listener, (struct sockaddr *)&addr, &addrlen) != 0)) {
+    printf("failed to set up a listening socket (%s)\n", strerror(errno));
+    return(1);
+  }
+  port = ntohs(addr.sin_port);
+  fflush(stdout); /* server processes exit() through stdio */
+  server = fork();
+  if (server == 0) serve(tls, listener, filename);
+  close(listener);
+
+  ctx = SSL_CTX_new(TLS_client_method());
+  if ((ctx == NULL) || (SSL_CTX_load_verify_locations(ctx, certfile, NULL) != 1)) {
+    puts("failed to set up the TLS client");
+    kill(server, SIGTERM);
+    return(1);
+  }
+  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+
+  puts("check a file is fetched over TLS...");
+  len = fetch(ctx, port, NULL, &session, buff, &reused, &closenotify);
+  if ((len != FILELEN) || (memcmp(buff, content, FILELEN) != 0)) {
+    printf("  FAILED: got %ld bytes instead of %d, or a different content\n", len, FILELEN);
+    errors++;
+  }
+  if (closenotify == 0) {
+    puts("  FAILED: the session did not end with a close_notify");
+    errors++;
+  }
+  if (reused != 0) {
+    puts("  FAILED: a session has been resumed out of the blue");
+    errors++;
+  }
+
+  puts("check the session is resumed by another server process...");
+  len = fetch(ctx, port, session, &session2, buff, &reused, &closenotify);
+  if ((len != FILELEN) || (memcmp(buff, content, FILELEN) != 0)) {
+    printf("  FAILED: got %ld bytes over the resumed session\n", len);
+    errors++;
+  }
+  if (reused == 0) {
+    puts("  FAILED: the session has not been resumed");
+    errors++;
+  }
+  if (closenotify == 0) {
+    puts("  FAILED: the resumed session did not end with a close_notify");
+    errors++;
+  }
+
+  if (errors != 0) {
+    kill(server, SIGTERM);
+    printf("%d errors found!\n", errors);
+    return(1);
+  }
+
+  printf("benchmark %d x full sessions vs resumed sessions (%d KiB each)...\n", iterations, FILELEN / 1024);
+  t0 = now();
+  for (x = 0; x < iterations; x++) {
+    if (fetch(ctx, port, NULL, NULL, buff, &reused, &closenotify) != FILELEN) errors++;
+  }
+  t_full = now() - t0;
+  t0 = now();
+  for (x = 0; x < iterations; x++) {
+    if ((fetch(ctx, port, session2, NULL, buff, &reused, &closenotify) != FILELEN) || (reused == 0)) errors++;
+  }
+  t_resumed = now() - t0;
+  printf("  full:    %6.2f ms/session  %8.1f MiB/s\n", t_full * 1000.0 / iterations, (double)iterations * FILELEN / t_full / 1048576.0);
+  printf("  resumed: %6.2f ms/session  %8.1f MiB/s\n", t_resumed * 1000.0 / iterations, (double)iterations * FILELEN / t_resumed / 1048576.0);
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  SSL_SESSION_free(session);
+  SSL_SESSION_free(session2);
+  SSL_CTX_free(ctx);
+  unlink(certfile);
+  unlink(keyfile);
+  unlink(filename);
+  rmdir(dir);
+  free(content);
+  free(buff);
+  if (errors != 0) {
+    printf("  FAILED: %d sessions went wrong\n", errors);
+    return(1);
+  }
+  return(0);
+}
+
+#else /* no TLS support compiled in */
+
+int main(void) {
+  puts("tlstest: no TLS support compiled in (see the Makefile), skipped.");
+  return(0);
+}
+
+#endif
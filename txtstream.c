@@ -0,0 +1,181 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a block-based engine for streaming text files to gopher clients.
+ *
+ * Text files used to be read one byte per read() call, and sent one line per
+ * writev() call. Here the file is read by large blocks instead, and every
+ * block is scanned with memchr() for line terminators and for the few bytes
+ * that need special care (CR and NUL). Spans of plain text are copied in bulk
+ * to a large output buffer, that is sent only once full.
+ *
+ * Both buffers are taken from the pool of I/O buffers (see arena.c), so they
+ * are sized after the socket's send buffer. Blocks that must be converted to
+ * another charset are converted in place, right after being read; a UTF-8
+ * sequence cut by the end of a block is carried over to the next one.
+ */
+
+#include <errno.h>
+#include <string.h>      /* memchr(), memcpy() */
+#include <unistd.h>      /* read() */
+#include <sys/socket.h>  /* send() */
+#include <sys/types.h>
+
+#include "accesslog.h"   /* accesslog_addbytes() */
+#include "arena.h"       /* iobuf_get(), iobuf_put() */
+#include "charset.h"     /* charset_fromutf8() */
+#include "txtstream.h"   /* include self for control */
+
+struct txtstream {
+  int sock;
+  char *out;
+  long outlen;
+  long outsize;
+  long sent;
+  int failed;
+  long linelen;    /* bytes of the current line sent so far */
+  int linepending; /* set once any byte of the current line has been read */
+  int linecut;     /* the rest of the current line must be discarded */
+  char firstchar;  /* first char of the current line */
+};
+
+
+/* sends the content of the output buffer */
+static void flushout(struct txtstream *ts) {
+  long pos = 0, res;
+  while ((pos < ts->outlen) && (ts->failed == 0)) {
+    res = send(ts->sock, ts->out + pos, ts->outlen - pos, 0);
+    if (res < 0) {
+      if (errno == EINTR) continue;
+      ts->failed = 1;
+      break;
+    }
+    pos += res;
+  }
+  ts->sent += pos;
+  ts->outlen = 0;
+  accesslog_addbytes(pos);  /* as it goes, so the first byte gets timed */
+}
+
+
+static void putout(struct txtstream *ts, const char *data, long len) {
+  while (len > 0) {
+    long chunk = ts->outsize - ts->outlen;
+    if (chunk > len) chunk = len;
+    memcpy(ts->out + ts->outlen, data, chunk);
+    ts->outlen += chunk;
+    data += chunk;
+    len -= chunk;
+    if (ts->outlen == ts->outsize) flushout(ts);
+  }
+}
+
+
+/* appends a span of line content (without any LF) to the current line */
+static void putspan(struct txtstream *ts, const char *data, long len) {
+  const char *special;
+  long x;
+  if (len == 0) return;
+  ts->linepending = 1;
+  if (ts->linecut != 0) return;
+  /* fast path: no CR nor NUL inside the span */
+  special = memchr(data, '\r', len);
+  if ((special == NULL) && (memchr(data, 0, len) == NULL)) {
+    if (len > TXTSTREAM_MAXLINE - ts->linelen) {
+      len = TXTSTREAM_MAXLINE - ts->linelen;
+      ts->linecut = 1;
+    }
+    if (ts->linelen == 0) ts->firstchar = data[0];
+    putout(ts, data, len);
+    ts->linelen += len;
+    return;
+  }
+  /* slow path: byte by byte */
+  for (x = 0; (x < len) && (ts->linecut == 0); x++) {
+    if (data[x] == '\r') continue;
+    if ((data[x] == 0) || (ts->linelen == TXTSTREAM_MAXLINE)) {
+      ts->linecut = 1;
+      break;
+    }
+    if (ts->linelen == 0) ts->firstchar = data[x];
+    putout(ts, data + x, 1);
+    ts->linelen += 1;
+  }
+}
+
+
+/* terminates the current line */
+static void endline(struct txtstream *ts) {
+  if ((ts->linelen == 1) && (ts->firstchar == '.')) {
+    putout(ts, " \r\n", 3); /* a line with a single dot must be escaped */
+  } else {
+    putout(ts, "\r\n", 2);
+  }
+  ts->linelen = 0;
+  ts->linepending = 0;
+  ts->linecut = 0;
+}
+
+
+long txtstream_send(int sock, int fd) {
+  return(txtstream_sendcharset(sock, fd, CHARSET_UTF8));
+}
+
+
+long txtstream_sendcharset(int sock, int fd, int charset) {
+  struct txtstream ts;
+  char *in;
+  const char *p, *end, *lf;
+  long len, used = 0, carry = 0, insize = iobuf_size();
+
+  memset(&ts, 0, sizeof(ts));
+  ts.sock = sock;
+  ts.outsize = iobuf_size();
+  in = iobuf_get();
+  ts.out = iobuf_get();
+  if ((in == NULL) || (ts.out == NULL)) {
+    iobuf_put(in);
+    iobuf_put(ts.out);
+    return(-1);
+  }
+
+  while (ts.failed == 0) {
+    len = read(fd, in + carry, insize - carry);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      ts.failed = 1;
+      break;
+    }
+    if ((len == 0) && (carry == 0)) break;
+    if (charset != CHARSET_UTF8) {
+      if (len == 0) { /* the file ends with a cut sequence */
+        len = charset_fromutf8(charset, in, carry, NULL);
+        carry = 0;
+      } else {
+        len += carry;
+        carry = len;
+        len = charset_fromutf8(charset, in, len, &used);
+        carry -= used;
+      }
+    }
+    end = in + len;
+    for (p = in; p < end; p = lf + 1) {
+      lf = memchr(p, '\n', end - p);
+      if (lf == NULL) {
+        putspan(&ts, p, end - p);
+        break;
+      }
+      putspan(&ts, p, lf - p);
+      endline(&ts);
+    }
+    if (carry > 0) memmove(in, in + used, carry);
+  }
+  /* the last line might not be terminated by a LF */
+  if ((ts.failed == 0) && (ts.linepending != 0)) endline(&ts);
+  if (ts.failed == 0) flushout(&ts);
+  iobuf_put(in);
+  iobuf_put(ts.out);
+  if (ts.failed != 0) return(-1);
+  return(ts.sent);
+}
@@ -0,0 +1,26 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides a block-based engine for streaming text files to gopher clients
+ */
+
+#ifndef txtstream_h_sentinel
+#define txtstream_h_sentinel
+
+/* longest line (in bytes) that gets transmitted - anything beyond is cut */
+#define TXTSTREAM_MAXLINE (1024 * 1024 - 2)
+
+/* streams the content of fd to sock as gopher text: lines are terminated by
+ * CRLF, CR chars are dropped, lines are cut at the first NUL char or after
+ * TXTSTREAM_MAXLINE bytes, and lines made of a single dot are escaped. the
+ * final '.' terminator is NOT sent. bytes are accounted in the access log
+ * (see accesslog.h) as they get sent. returns the amount of bytes sent, or
+ * -1 on error. */
+long txtstream_send(int sock, int fd);
+
+/* same as txtstream_send(), but the text is converted from UTF-8 to charset
+ * on the way (see charset.h) */
+long txtstream_sendcharset(int sock, int fd, int charset);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Test & benchmark application for the text streamer.
+ *
+ * Streams text files through a socket pair, once with the block-based engine
+ * and once with the legacy approach (one read() per byte and one writev() per
+ * line), checks that both outputs are identical and compares throughputs.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "txtstream.h"
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+/* the legacy line reader (as motsognir used it up to v1.0.11) */
+static int legacy_readline(int fd, char *buf, int n) {
+  int numRead, totRead = 0, gotatleastonebyte = 0;
+  char ch;
+  for (;;) {
+    numRead = read(fd, &ch, 1);
+    if (numRead == -1) {
+      if (errno == EINTR) continue;
+      return(-1);
+    } else if (numRead == 0) {
+      if (gotatleastonebyte == 0) totRead = -1;
+      break;
+    } else {
+      gotatleastonebyte = 1;
+      if (ch == '\r') continue;
+      if (ch == '\n') break;
+      if (totRead < n - 1) {
+        totRead++;
+        *buf++ = ch;
+      }
+    }
+  }
+  if (totRead >= 0) *buf = 0;
+  return(totRead);
+}
+
+
+/* the legacy text streamer (as motsognir used it up to v1.0.11) */
+static long legacy_send(int sock, int fd) {
+  char *linebuff;
+  int linebuff_len = 1024 * 1024;
+  struct iovec iov[2];
+  linebuff = malloc(linebuff_len);
+  if (linebuff == NULL) return(-1);
+  for (;;) {
+    if (legacy_readline(fd, linebuff, linebuff_len - 1) < 0) break;
+    if ((linebuff[0] == '.') && (linebuff[1] == 0)) snprintf(linebuff, linebuff_len, ". ");
+    iov[0].iov_base = linebuff;
+    iov[0].iov_len = strlen(linebuff);
+    iov[1].iov_base = "\r\n";
+    iov[1].iov_len = 2;
+    writev(sock, iov, 2);
+  }
+  free(linebuff);
+  return(0);
+}
+
+
+/* streams file through a socket pair with the given engine. the received
+ * data is written to outfile (or discarded if outfile is NULL). returns the
+ * time it took, in seconds, or a negative value on error. */
+static double streamfile(long (*engine)(int, int), const char *file, const char *outfile) {
+  int sv[2], fd, outfd = -1, status;
+  pid_t pid;
+  double t0;
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return(-1);
+  pid = fork();
+  if (pid < 0) return(-1);
+  if (pid == 0) { /* the child receives data */
+    static char buff[256 * 1024];
+    long len;
+    close(sv[0]);
+    if (outfile != NULL) outfd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    while ((len = read(sv[1], buff, sizeof(buff))) != 0) {
+      if (len < 0) {
+        if (errno == EINTR) continue;
+        _exit(1);
+      }
+      if ((outfd >= 0) && (write(outfd, buff, len) != len)) _exit(1);
+    }
+    if (outfd >= 0) close(outfd);
+    _exit(0);
+  }
+  close(sv[1]);
+  fd = open(file, O_RDONLY);
+  if (fd < 0) return(-1);
+  t0 = now();
+  engine(sv[0], fd);
+  close(sv[0]);
+  waitpid(pid, &status, 0);
+  t0 = now() - t0;
+  close(fd);
+  if ((WIFEXITED(status) == 0) || (WEXITSTATUS(status) != 0)) return(-1);
+  return(t0);
+}
+
+
+/* returns 0 if both files have the same content */
+static int cmpfiles(const char *f1, const char *f2) {
+  FILE *fd1, *fd2;
+  int c1, c2, res = 1;
+  fd1 = fopen(f1, "rb");
+  fd2 = fopen(f2, "rb");
+  if ((fd1 != NULL) && (fd2 != NULL)) {
+    do {
+      c1 = fgetc(fd1);
+      c2 = fgetc(fd2);
+    } while ((c1 == c2) && (c1 != EOF));
+    if (c1 == c2) res = 0;
+  }
+  if (fd1 != NULL) fclose(fd1);
+  if (fd2 != NULL) fclose(fd2);
+  return(res);
+}
+
+
+/* writes a test file with all the special cases the streamer must handle:
+ * lone dots, CRLF and lone CR, NUL bytes, overlong lines, empty lines and a
+ * last line without any LF terminator */
+static int gentricky(const char *file) {
+  FILE *fd;
+  long x;
+  fd = fopen(file, "wb");
+  if (fd == NULL) return(-1);
+  fputs(".\n..\n. \n.\r\n\r.\r\n\n\r\n\r\rabc\r\rdef\n", fd);
+  fwrite(".\0abc\n", 1, 6, fd);
+  fwrite("\0\n", 1, 2, fd);
+  fwrite("hello\0world\r\n", 1, 13, fd);
+  for (x = 0; x < 3 * 1024 * 1024; x++) fputc('a' + (x % 26), fd);
+  fputc('\n', fd);
+  for (x = 0; x < TXTSTREAM_MAXLINE; x++) fputc((x % 1000 == 999) ? '\r' : 'x', fd);
+  fputs("yz\n", fd);
+  fwrite(".\r\0\n", 1, 4, fd);
+  fputs(".", fd);
+  fclose(fd);
+  return(0);
+}
+
+
+/* writes a test file of roughly size bytes of ordinary text lines */
+static int gentext(const char *file, long size) {
+  FILE *fd;
+  long written = 0;
+  int x = 0;
+  fd = fopen(file, "wb");
+  if (fd == NULL) return(-1);
+  while (written < size) {
+    x++;
+    if (x % 50 == 0) {
+      written += fprintf(fd, ".\n");
+    } else {
+      written += fprintf(fd, "Line %d of a rather ordinary text document, with some words in it.%s\n", x, (x % 3 == 0) ? "\r" : "");
+    }
+  }
+  fclose(fd);
+  return(0);
+}
+
+
+int main(int argc, char **argv) {
+  char tmpdir[] = "/tmp/txtstreamtest-XXXXXX";
+  char fin[64], fout1[64], fout2[64];
+  long size = 64;
+  int i, iterations = 5, res = 0;
+  double t, t_block = 0, t_legacy = 0;
+
+  if (argc > 1) size = atol(argv[1]);
+  if (argc > 2) iterations = atoi(argv[2]);
+  if ((size < 1) || (iterations < 1)) {
+    puts("txtstreamtest is a simple tool to test and benchmark motsognir's text streamer.");
+    puts("usage: txtstreamtest [size_in_MiB] [iterations]");
+    return(1);
+  }
+  if (mkdtemp(tmpdir) == NULL) {
+    puts("failed to create a temporary directory");
+    return(1);
+  }
+  snprintf(fin, sizeof(fin), "%s/in", tmpdir);
+  snprintf(fout1, sizeof(fout1), "%s/out1", tmpdir);
+  snprintf(fout2, sizeof(fout2), "%s/out2", tmpdir);
+
+  puts("check that both engines agree on corner cases...");
+  if ((gentricky(fin) != 0) || (streamfile(txtstream_send, fin, fout1) < 0) || (streamfile(legacy_send, fin, fout2) < 0) || (cmpfiles(fout1, fout2) != 0)) {
+    puts("  MISMATCH!");
+    res = 1;
+    goto CLEANUP;
+  }
+
+  printf("check that both engines agree on a %ld MiB text file...\n", size);
+  if ((gentext(fin, size * 1024 * 1024) != 0) || (streamfile(txtstream_send, fin, fout1) < 0) || (streamfile(legacy_send, fin, fout2) < 0) || (cmpfiles(fout1, fout2) != 0)) {
+    puts("  MISMATCH!");
+    res = 1;
+    goto CLEANUP;
+  }
+
+  printf("benchmark %d x %ld MiB...\n", iterations, size);
+  for (i = 0; i < iterations; i++) {
+    t = streamfile(txtstream_send, fin, NULL);
+    if (t < 0) res = 1;
+    t_block += t;
+    t = streamfile(legacy_send, fin, NULL);
+    if (t < 0) res = 1;
+    t_legacy += t;
+  }
+  printf("  block:   %10.1f MiB/s\n", (double)iterations * size / t_block);
+  printf("  legacy:  %10.1f MiB/s\n", (double)iterations * size / t_legacy);
+  printf("  speedup: %.1fx\n", t_legacy / t_block);
+
+  CLEANUP:
+  unlink(fin);
+  unlink(fout1);
+  unlink(fout2);
+  rmdir(tmpdir);
+  return(res);
+}
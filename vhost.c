@@ -0,0 +1,97 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the [vhost] sections of the configuration, and the selection of
+ * the vhost that serves a connection. It is kept apart from motsognir.c so
+ * it can be tested (see vhosttest)
+ */
+
+#include <arpa/inet.h>   /* inet_pton(), inet_ntop() */
+#include <netinet/in.h>  /* struct in6_addr */
+#include <stdlib.h>      /* realloc(), free() */
+#include <string.h>
+#include <strings.h>     /* strcasecmp() */
+#include <syslog.h>
+
+#include "conffile.h"    /* conffile_explodelist() */
+#include "vhost.h"       /* include self for control */
+
+
+int vhost_add(struct vhost **vhosts, int *vhostscount) {
+  struct vhost *newlist;
+  if (*vhostscount >= VHOSTS_MAX) {
+    syslog(LOG_ERR, "ERROR: Too many [vhost] sections (at most %d are allowed)", VHOSTS_MAX);
+    return(-1);
+  }
+  newlist = realloc(*vhosts, (*vhostscount + 1) * sizeof(struct vhost));
+  if (newlist == NULL) {
+    syslog(LOG_ERR, "ERROR: OUT OF MEMORY ON LINE #%d", __LINE__);
+    return(-1);
+  }
+  *vhosts = newlist;
+  memset(&(newlist[*vhostscount]), 0, sizeof(struct vhost));
+  *vhostscount += 1;
+  return(*vhostscount - 1);
+}
+
+
+int vhost_directive(struct vhost *vhost, const char *token, char *value) {
+  if (strcasecmp(token, "Bind") == 0) {
+    vhost->bind = strdup(value);
+  } else if (strcasecmp(token, "GopherPort") == 0) {
+    vhost->port = atoi(value);
+  } else if (strcasecmp(token, "GopherHostname") == 0) {
+    vhost->gopherhostname = strdup(value);
+  } else if (strcasecmp(token, "GopherRoot") == 0) {
+    vhost->gopherroot = strdup(value);
+  } else if (strcasecmp(token, "PubDirList") == 0) {
+    vhost->pubdirlist = conffile_explodelist(value, ":");
+  } else if (strcasecmp(token, "UserDir") == 0) {
+    vhost->userdir = strdup(value);
+  } else if (strcasecmp(token, "ExtMapFile") == 0) {
+    vhost->extmapfile = strdup(value);
+  } else if (strcasecmp(token, "DirIndexPath") == 0) {
+    vhost->dirindexpath = strdup(value);
+  } else if (strcasecmp(token, "SearchIndex") == 0) {
+    vhost->searchindex = strdup(value);
+  } else if (strcasecmp(token, "OutputCharset") == 0) {
+    vhost->outputcharsetname = strdup(value);
+  } else {
+    return(-1);
+  }
+  return(0);
+}
+
+
+int vhost_normalizebind(struct vhost *vhost) {
+  unsigned char addr[sizeof(struct in6_addr)];
+  char normalized[INET6_ADDRSTRLEN];
+  if (vhost->bind == NULL) return(0);
+  if (inet_pton(AF_INET, vhost->bind, addr) == 1) {
+    inet_ntop(AF_INET, addr, normalized, sizeof(normalized));
+  } else if (inet_pton(AF_INET6, vhost->bind, addr) == 1) {
+    inet_ntop(AF_INET6, addr, normalized, sizeof(normalized));
+  } else {
+    return(-1);
+  }
+  free(vhost->bind);
+  /* addresses of connections are logged without the IPv4-mapped prefix */
+  vhost->bind = strdup((strncasecmp(normalized, "::ffff:", 7) == 0) && (strchr(normalized, '.') != NULL) ? normalized + 7 : normalized);
+  return(0);
+}
+
+
+struct vhost *vhost_select(struct vhost *vhosts, int vhostscount, const char *localaddr, int localport) {
+  struct vhost *vh = NULL;
+  int x;
+  for (x = 0; x < vhostscount; x++) {
+    if (vhosts[x].port != localport) continue;
+    if (vhosts[x].bind == NULL) {
+      if (vh == NULL) vh = &(vhosts[x]);
+    } else if (strcmp(vhosts[x].bind, localaddr) == 0) {
+      return(&(vhosts[x]));
+    }
+  }
+  return(vh);
+}
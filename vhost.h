@@ -0,0 +1,53 @@
+/*
+ * This file is part of the Motsognir gopher server
+ * Copyright (C) 2008-2019 Mateusz Viste
+ *
+ * Provides the [vhost] sections of the configuration, and the selection of
+ * the vhost that serves a connection
+ */
+
+#ifndef vhost_h_sentinel
+#define vhost_h_sentinel
+
+struct extmap_t;
+
+/* maximum amount of [vhost] sections */
+#define VHOSTS_MAX 64
+
+/* a virtual host, as declared by a [vhost] section: connections accepted on
+ * its local address (any, if bind is NULL) and port are served with its own
+ * settings. settings it does not declare are inherited at load time. */
+struct vhost {
+  char *bind;            /* normalized local address, or NULL for any */
+  int port;
+  char *gopherhostname;
+  char *gopherroot;
+  char **pubdirlist;
+  char *userdir;
+  char *extmapfile;
+  struct extmap_t *extmap;
+  char *dirindexpath;
+  char *searchindex;
+  char *outputcharsetname;
+  int outputcharset;
+};
+
+/* appends a new, empty vhost to the vhosts list. returns its index, or -1 on
+ * error (too many vhosts, or out of memory) */
+int vhost_add(struct vhost **vhosts, int *vhostscount);
+
+/* applies a directive found in a [vhost] section. returns -1 if the
+ * directive cannot be set per vhost */
+int vhost_directive(struct vhost *vhost, const char *token, char *value);
+
+/* normalizes the Bind address of a vhost, so it can be compared as a string
+ * with the local address of connections. returns -1 if the address is
+ * invalid */
+int vhost_normalizebind(struct vhost *vhost);
+
+/* returns the vhost that matches the local address and port of a
+ * connection: a vhost bound to the very address first, or else one bound to
+ * any address. returns NULL if none matches */
+struct vhost *vhost_select(struct vhost *vhosts, int vhostscount, const char *localaddr, int localport);
+
+#endif
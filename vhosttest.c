@@ -0,0 +1,236 @@
+/*
+ * Test & benchmark application for the configuration file parser and the
+ * selection of vhosts.
+ *
+ * Parses a sample configuration with [vhost] sections (and comments, CRLF
+ * line endings, commented out directives...) the way loadconfig() does,
+ * checks the resulting vhosts, the normalization of their addresses and the
+ * vhost picked for various local addresses and ports, then measures how long
+ * it takes to select a vhost among VHOSTS_MAX of them.
+ *
+ * This file is part of the Motsognir gopher server.
+ * Copyright (C) 2008-2019 Mateusz Viste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>  /* strcasecmp() */
+#include <time.h>
+
+#include "conffile.h"
+#include "vhost.h"
+
+
+/* returns a monotonic timestamp, in seconds */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+
+static const char *sampleconf =
+  "# main configuration\n"
+  "GopherPort=7070\n"
+  "GopherHostname=main.example.org   # trailing comment\n"
+  "#GopherRoot=/srv/commented-out/\n"
+  "CapsSupport=\n"
+  "line without any equal sign\n"
+  "\n"
+  "[vhost]\n"
+  "#GopherPort=17071\n"
+  "# GopherPort = 17072\n"
+  "  Bind = 127.0.0.1 \n"
+  "GopherHostname=a.example.org\r\n"
+  "PubDirList=/pub:/files\n"
+  "\n"
+  "[VHOST]\r\n"
+  "Bind=::FFFF:127.0.0.2\n"
+  "GopherHostname=b.example.org\n"
+  "\n"
+  "[vhost]\n"
+  "GopherPort=7071\n"
+  "GopherHostname=c.example.org\n"
+  "\n"
+  "[vhost]\n"
+  "Bind=2001:DB8:0:0::1\n"
+  "GopherHostname=d.example.org\n"
+  "GopherRoot=/srv/d/";
+
+
+/* parses a configuration the way loadconfig() does. returns 0 on success,
+ * non-zero otherwise */
+static int parseconf(FILE *fd, struct vhost **vhosts, int *vhostscount, int *mainport) {
+  char token[64], value[1024];
+  int res, vhost = -1;
+  *vhosts = NULL;
+  *vhostscount = 0;
+  for (;;) {
+    res = conffile_next(fd, token, sizeof(token), value, sizeof(value));
+    if (res == CONFFILE_EOF) break;
+    if (res == CONFFILE_SECTION) {
+      if (strcasecmp(token, "[vhost]") != 0) {
+        printf("  FAILED: unexpected section '%s'\n", token);
+        return(-1);
+      }
+      vhost = vhost_add(vhosts, vhostscount);
+      if (vhost < 0) return(-1);
+      continue;
+    }
+    if (vhost >= 0) {
+      if (vhost_directive(&((*vhosts)[vhost]), token, value) != 0) {
+        printf("  FAILED: '%s' rejected in a [vhost] section\n", token);
+        return(-1);
+      }
+    } else if (strcasecmp(token, "GopherPort") == 0) {
+      *mainport = atoi(value);
+    } else if ((strcasecmp(token, "GopherHostname") == 0) && (strcmp(value, "main.example.org") != 0)) {
+      printf("  FAILED: GopherHostname is '%s'\n", value);
+      return(-1);
+    } else if (strcasecmp(token, "GopherHostname") != 0) {
+      printf("  FAILED: unexpected directive '%s' = '%s'\n", token, value);
+      return(-1);
+    }
+  }
+  return(0);
+}
+
+
+/* checks that the vhost selected for localaddr:localport is the one serving
+ * hostname (or none, if hostname is NULL). returns the amount of failures */
+static int checkselect(struct vhost *vhosts, int vhostscount, const char *localaddr, int localport, const char *hostname) {
+  struct vhost *vh = vhost_select(vhosts, vhostscount, localaddr, localport);
+  const char *got = (vh == NULL) ? NULL : vh->gopherhostname;
+  if ((got == hostname) || ((got != NULL) && (hostname != NULL) && (strcmp(got, hostname) == 0))) return(0);
+  printf("  FAILED: %s:%d selects %s instead of %s\n", localaddr, localport, (got != NULL) ? got : "none", (hostname != NULL) ? hostname : "none");
+  return(1);
+}
+
+
+int main(int argc, char **argv) {
+  struct vhost *vhosts, bench[VHOSTS_MAX];
+  char addr[VHOSTS_MAX][32];
+  int vhostscount, x, mainport = 0, errors = 0;
+  long iterations = 2000000, i, found = 0;
+  double t0, t;
+  FILE *fd;
+
+  if (argc > 1) iterations = atol(argv[1]);
+  if (iterations < 1) {
+    puts("vhosttest is a simple tool to test and benchmark motsognir's configuration parser and vhost selection.");
+    puts("usage: vhosttest [iterations]");
+    return(1);
+  }
+
+  puts("check the configuration parser...");
+  fd = tmpfile();
+  if (fd == NULL) {
+    puts("failed to create a temporary file");
+    return(1);
+  }
+  fputs(sampleconf, fd);
+  rewind(fd);
+  if (parseconf(fd, &vhosts, &vhostscount, &mainport) != 0) {
+    puts("1 errors found!");
+    return(1);
+  }
+  fclose(fd);
+  if (mainport != 7070) {
+    printf("  FAILED: GopherPort is %d\n", mainport);
+    errors++;
+  }
+  if (vhostscount != 4) {
+    printf("  FAILED: %d vhosts found instead of 4\n", vhostscount);
+    printf("%d errors found!\n", errors + 1);
+    return(1);
+  }
+  if ((vhosts[0].port != 0) || (vhosts[0].bind == NULL) || (strcmp(vhosts[0].bind, "127.0.0.1") != 0)) {
+    puts("  FAILED: vhost #1 (commented out GopherPort, or Bind)");
+    errors++;
+  }
+  if ((vhosts[0].pubdirlist == NULL) || (vhosts[0].pubdirlist[0] == NULL) || (strcmp(vhosts[0].pubdirlist[0], "/pub") != 0) || (vhosts[0].pubdirlist[1] == NULL) || (strcmp(vhosts[0].pubdirlist[1], "/files") != 0) || (vhosts[0].pubdirlist[2] != NULL)) {
+    puts("  FAILED: vhost #1 PubDirList");
+    errors++;
+  }
+  if ((vhosts[1].gopherhostname == NULL) || (strcmp(vhosts[1].gopherhostname, "b.example.org") != 0)) {
+    puts("  FAILED: vhost #2 (CRLF section header)");
+    errors++;
+  }
+  if ((vhosts[2].port != 7071) || (vhosts[2].bind != NULL)) {
+    puts("  FAILED: vhost #3");
+    errors++;
+  }
+  if ((vhosts[3].gopherroot == NULL) || (strcmp(vhosts[3].gopherroot, "/srv/d/") != 0)) {
+    puts("  FAILED: vhost #4 (directive at the very end of the file)");
+    errors++;
+  }
+  if (vhost_directive(&(vhosts[0]), "RunAsUser", "nobody") == 0) {
+    puts("  FAILED: RunAsUser accepted in a [vhost] section");
+    errors++;
+  }
+
+  puts("check the normalization of Bind addresses...");
+  for (x = 0; x < vhostscount; x++) {
+    if (vhosts[x].port == 0) vhosts[x].port = mainport; /* inherited, as resolvevhosts() does */
+    if (vhost_normalizebind(&(vhosts[x])) != 0) {
+      printf("  FAILED: vhost #%d Bind address rejected\n", x + 1);
+      errors++;
+    }
+  }
+  if ((vhosts[1].bind == NULL) || (strcmp(vhosts[1].bind, "127.0.0.2") != 0)) {
+    printf("  FAILED: IPv4-mapped address normalized to '%s'\n", (vhosts[1].bind != NULL) ? vhosts[1].bind : "NULL");
+    errors++;
+  }
+  if ((vhosts[3].bind == NULL) || (strcmp(vhosts[3].bind, "2001:db8::1") != 0)) {
+    printf("  FAILED: IPv6 address normalized to '%s'\n", (vhosts[3].bind != NULL) ? vhosts[3].bind : "NULL");
+    errors++;
+  }
+  bench[0].bind = strdup("example.org");
+  if (vhost_normalizebind(&(bench[0])) == 0) {
+    puts("  FAILED: host name accepted as a Bind address");
+    errors++;
+  }
+  free(bench[0].bind);
+
+  puts("check the selection of vhosts...");
+  errors += checkselect(vhosts, vhostscount, "127.0.0.1", 7070, "a.example.org");
+  errors += checkselect(vhosts, vhostscount, "127.0.0.2", 7070, "b.example.org");
+  errors += checkselect(vhosts, vhostscount, "2001:db8::1", 7070, "d.example.org");
+  errors += checkselect(vhosts, vhostscount, "127.0.0.3", 7070, NULL);
+  errors += checkselect(vhosts, vhostscount, "127.0.0.1", 7071, "c.example.org");
+  errors += checkselect(vhosts, vhostscount, "127.0.0.1", 7072, NULL);
+  /* a vhost bound to the very address wins over one bound to any address,
+   * whatever their order */
+  vhosts[0].port = 7071;
+  errors += checkselect(vhosts, vhostscount, "127.0.0.1", 7071, "a.example.org");
+  errors += checkselect(vhosts, vhostscount, "127.0.0.9", 7071, "c.example.org");
+  vhosts[2].port = 7070;
+  errors += checkselect(vhosts, vhostscount, "127.0.0.1", 7070, "c.example.org");
+  errors += checkselect(vhosts, vhostscount, "127.0.0.2", 7070, "b.example.org");
+
+  if (errors != 0) {
+    printf("%d errors found!\n", errors);
+    return(1);
+  }
+
+  /* VHOSTS_MAX vhosts on the same port, each bound to its own address */
+  memset(bench, 0, sizeof(bench));
+  for (x = 0; x < VHOSTS_MAX; x++) {
+    sprintf(addr[x], "192.0.2.%d", x + 1);
+    bench[x].bind = addr[x];
+    bench[x].port = 70;
+  }
+  printf("benchmark %ld x vhost selection among %d vhosts...\n", iterations, VHOSTS_MAX);
+  t0 = now();
+  for (i = 0; i < iterations; i++) {
+    if (vhost_select(bench, VHOSTS_MAX, addr[i % VHOSTS_MAX], 70) != NULL) found++;
+  }
+  t = now() - t0;
+  printf("  %.1f ns/selection\n", t * 1000000000.0 / iterations);
+  if (found != iterations) {
+    puts("  FAILED: some selections did not find their vhost");
+    return(1);
+  }
+  return(0);
+}